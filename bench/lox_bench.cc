@@ -0,0 +1,201 @@
+// Times each stage of the pipeline separately on the workloads in this
+// directory, plus scanning and parsing throughput on large synthetic inputs.
+//
+//   ./lox_bench --benchmark_filter=Interpret/fib
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../src/scanner/scanner.h"
+#include "../src/scanner/source.h"
+#include "../src/treewalk/closure_compiler.h"
+#include "../src/treewalk/interpreter.h"
+#include "../src/treewalk/jit.h"
+#include "../src/treewalk/optimizer.h"
+#include "../src/treewalk/parser.h"
+#include "../src/treewalk/resolver.h"
+#include "../src/treewalk/runtime_error.h"
+#include "../src/utils/error.h"
+#include "../src/vm/vm.h"
+
+namespace {
+
+const char* const kWorkloads[] = {
+    "binary_trees", "closures",   "fib",           "instantiation", "loops",
+    "method_call",  "properties", "string_concat", "zoo",
+};
+
+std::unique_ptr<SourceBuffer> load(const std::string& name) {
+  std::string path = std::string{LOX_BENCH_DIR} + "/" + name + ".lox";
+  std::unique_ptr<SourceBuffer> source = SourceBuffer::fromFile(path);
+  if (source == nullptr) {
+    std::cerr << "Failed to open " << path << "\n";
+    std::exit(74);
+  }
+  return source;
+}
+
+// Declarations, classes, calls, strings and comments in roughly the
+// proportions of hand-written code. Every copy declares new names so the
+// whole input also resolves.
+std::string synthetic(int copies) {
+  std::ostringstream out;
+  for (int i = 0; i < copies; ++i) {
+    out << "// Copy " << i << " of the synthetic input.\n"
+        << "class Shape" << i << " {\n"
+        << "  init(width, height) {\n"
+        << "    this.width = width;\n"
+        << "    this.height = height;\n"
+        << "  }\n"
+        << "  area() { return this.width * this.height; }\n"
+        << "}\n"
+        << "fun describe" << i << "(shape, label) {\n"
+        << "  var area = shape.area();\n"
+        << "  if (area >= 100 and label != nil) {\n"
+        << "    return label + \" is large\";\n"
+        << "  }\n"
+        << "  return \"small\";\n"
+        << "}\n"
+        << "var result" << i << " = describe" << i << "(Shape" << i
+        << "(12.5, " << i << "), \"shape " << i << "\");\n";
+  }
+  return out.str();
+}
+
+std::vector<StmtPtr> parse(std::string_view source) {
+  std::vector<StmtPtr> statements = Parser{source}.parse();
+  Resolver{}.resolve(statements);
+  Optimizer{true}.optimize(statements);
+  return statements;
+}
+
+// Discards what the workloads print.
+class Silence {
+ public:
+  Silence() : saved_{std::cout.rdbuf(sink_.rdbuf())} {}
+  ~Silence() { std::cout.rdbuf(saved_); }
+
+ private:
+  std::ostringstream sink_;
+  std::streambuf* saved_;
+};
+
+void scan(benchmark::State& state, std::string_view source,
+          Simd simd = Scanner::bestSimd()) {
+  for (auto _ : state) {
+    std::vector<Token> tokens = Scanner{source, simd}.scanTokens();
+    benchmark::DoNotOptimize(tokens.data());
+  }
+  state.SetBytesProcessed(state.iterations() * source.size());
+}
+
+// The parser pulls tokens from the scanner as it goes, so this includes
+// scanning; BM_Scan times that alone.
+void parseSource(benchmark::State& state, std::string_view source) {
+  for (auto _ : state) {
+    std::vector<StmtPtr> statements = Parser{source}.parse();
+    benchmark::DoNotOptimize(statements.data());
+  }
+  state.SetBytesProcessed(state.iterations() * source.size());
+  if (hadError) state.SkipWithError("syntax error");
+}
+
+void BM_Scan(benchmark::State& state, const std::string& name) {
+  std::unique_ptr<SourceBuffer> source = load(name);
+  scan(state, source->text());
+}
+
+void BM_Parse(benchmark::State& state, const std::string& name) {
+  std::unique_ptr<SourceBuffer> source = load(name);
+  parseSource(state, source->text());
+}
+
+// How BM_Interpret runs the tree.
+enum class Engine { WALK, CLOSURES, JIT };
+
+// A fresh interpreter and tree per run, so caches and globals start cold
+// every time; only interpret() is timed, compiling included.
+void BM_Interpret(benchmark::State& state, const std::string& name,
+                  Engine engine) {
+  std::unique_ptr<SourceBuffer> source = load(name);
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<StmtPtr> statements = parse(source->text());
+    auto interpreter = std::make_unique<Interpreter>();
+    std::unique_ptr<ClosureCompiler> closures;
+    std::unique_ptr<Jit> jit;
+    if (engine == Engine::CLOSURES) {
+      closures = std::make_unique<ClosureCompiler>();
+      interpreter->setClosureCompiler(closures.get());
+    } else if (engine == Engine::JIT) {
+      jit = std::make_unique<Jit>(*interpreter);
+      interpreter->setJit(jit.get());
+    }
+    state.ResumeTiming();
+
+    Silence silence;
+    interpreter->interpret(statements);
+  }
+  if (hadError || hadRuntimeError) state.SkipWithError("lox error");
+}
+
+// The VM compiles as part of interpret(), so compilation is included.
+void BM_VM(benchmark::State& state, const std::string& name) {
+  std::unique_ptr<SourceBuffer> source = load(name);
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<StmtPtr> statements = Parser{source->text()}.parse();
+    Optimizer{true}.optimize(statements);
+    auto machine = std::make_unique<vm::VM>();
+    state.ResumeTiming();
+
+    Silence silence;
+    machine->interpret(statements);
+  }
+  if (hadError || hadRuntimeError) state.SkipWithError("lox error");
+}
+
+// The second argument picks the instructions: 0 scalar, 1 SSE2, 2 AVX2.
+void BM_ScanSynthetic(benchmark::State& state) {
+  std::string source = synthetic(static_cast<int>(state.range(0)));
+  scan(state, source, static_cast<Simd>(state.range(1)));
+}
+
+void BM_ParseSynthetic(benchmark::State& state) {
+  std::string source = synthetic(static_cast<int>(state.range(0)));
+  parseSource(state, source);
+}
+
+BENCHMARK(BM_ScanSynthetic)
+    ->ArgsProduct({benchmark::CreateRange(64, 32768, 8), {0, 1, 2}});
+BENCHMARK(BM_ParseSynthetic)->RangeMultiplier(8)->Range(64, 32768);
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  for (const char* workload : kWorkloads) {
+    std::string name = workload;
+    benchmark::RegisterBenchmark(("Scan/" + name).c_str(), BM_Scan, name);
+    benchmark::RegisterBenchmark(("Parse/" + name).c_str(), BM_Parse, name);
+    benchmark::RegisterBenchmark(("Interpret/" + name).c_str(), BM_Interpret,
+                                 name, Engine::WALK)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("Closures/" + name).c_str(), BM_Interpret,
+                                 name, Engine::CLOSURES)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("JIT/" + name).c_str(), BM_Interpret, name,
+                                 Engine::JIT)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("VM/" + name).c_str(), BM_VM, name)
+        ->Unit(benchmark::kMillisecond);
+  }
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+}
@@ -4,47 +4,111 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
-#include "scanner/scanner.h"
+#include "scanner/source.h"
 #include "token/token.h"
+#include "treewalk/actors.h"
+#include "treewalk/closure_compiler.h"
+#include "treewalk/image_cache.h"
 #include "treewalk/interpreter.h"
-#include "treewalk/parser.h"
+#include "treewalk/jit.h"
+#include "treewalk/module_loader.h"
+#include "treewalk/optimizer.h"
+#include "treewalk/profiler.h"
+#include "treewalk/resolver.h"
 #include "treewalk/runtime_error.h"
+#include "utils/ast_printer.h"
 #include "utils/error.h"
+#include "vm/vm.h"
 
-std::string readFile(std::string path) {
-  std::ifstream file{path.data(),
-                     std::ios::in | std::ios::binary | std::ios::ate};
-  if (!file) {
+// `-` reads the script from stdin, which is mapped like any file when it is
+// redirected from one.
+std::unique_ptr<SourceBuffer> readFile(std::string path) {
+  std::unique_ptr<SourceBuffer> source =
+      SourceBuffer::fromFile(path == "-" ? "/dev/stdin" : path);
+  if (source == nullptr) {
     std::cerr << "Failed to open file " << path << ": " << std::strerror(errno)
               << "\n";
     std::exit(74);
   }
-  std::string contents;
-  contents.resize(file.tellg());
-  file.seekg(0, std::ios::beg);
-  file.read(contents.data(), contents.size());
-  return contents;
+  return source;
 }
 
 Interpreter interpreter{};
+std::unique_ptr<vm::VM> bytecodeVM;
+// Functions refer back into the tree that declared them and tokens point into
+// the source text, so the loader keeps every program and module loaded so far
+// alive for the REPL's lifetime. Each one is resolved and optimized on the
+// thread that parsed it.
+ModuleLoader loader{[](Module& module) {
+  // The bytecode compiler resolves variables itself.
+  if (bytecodeVM == nullptr) {
+    Resolver resolver{};
+    resolver.resolve(module.statements);
+    if (resolver.hadError()) return false;
+  }
+  // REPL lines and imported modules share their globals with other code.
+  bool wholeProgram = !module.path.empty() && module.importedBy == nullptr;
+  Optimizer{wholeProgram}.optimize(module.statements);
+  return true;
+}};
+// Defines spawn, send, receive and self in `interpreter`.
+Actors actors{interpreter};
+// Set by --cache, which stores images in `cacheDirectory`.
+std::unique_ptr<ImageCache> imageCache;
+std::string cacheDirectory;
+// Print the optimized tree of each program instead of running it.
+bool dumpAst = false;
+// Set by --profile; the report goes to stderr at exit, the JSON dump to
+// `profilePath` if one was given.
+std::unique_ptr<Profiler> profiler;
+std::string profilePath;
+// Set by --jit.
+std::unique_ptr<Jit> jit;
+// Set by --closures, which speeds up programs that spend their time in
+// loops and repeated calls; short scripts gain nothing (see ClosureCompiler).
+std::unique_ptr<ClosureCompiler> closures;
 
-void run(std::string source) {
-  Scanner scanner{source};
-  std::vector<Token> tokens = scanner.scanTokens();
+void reportProfile() {
+  profiler->report(std::cerr);
+  if (profilePath.empty()) return;
+  std::ofstream out{profilePath};
+  profiler->writeJson(out);
+  if (!out) {
+    std::cerr << "Failed to write profile " << profilePath << ": "
+              << std::strerror(errno) << "\n";
+  }
+}
 
-  Parser parser{tokens};
-  auto statements = parser.parse();
+// `path` is empty for REPL lines, which later input can still refer to.
+void run(std::unique_ptr<SourceBuffer> source, const std::string& path) {
+  auto& statements = loader.load(std::move(source), path).statements;
 
-  // Stop if there was a syntax error.
+  // Stop if there was an error, here or in an imported module.
   if (hadError) return;
 
+  if (dumpAst) {
+    AstPrinter printer;
+    for (const auto& statement : statements) {
+      std::cout << printer.print(*statement) << "\n";
+    }
+    return;
+  }
+
+  if (bytecodeVM != nullptr) {
+    bytecodeVM->interpret(statements);
+    return;
+  }
+
   interpreter.interpret(statements);
 }
 
 void runFile(std::string path) {
-  std::string contents = readFile(path);
-  run(contents);
+  run(readFile(path), path);
+  // The program is done when the last actor is, or waits for a message no
+  // other actor is left to send.
+  actors.join();
 
   // Indicate an error in the exit code.
   if (hadError) std::exit(65);
@@ -56,17 +120,69 @@ void runPrompt() {
     std::cout << "> ";
     std::string line;
     if (!std::getline(std::cin, line)) break;
-    run(line);
+    run(std::make_unique<SourceBuffer>(std::move(line)), "");
     hadError = false;
   }
+  actors.join();
+}
+
+void usage() {
+  std::cout << "Usage ./lox [--vm] [--dump-ast] [--gc-growth=<factor>] "
+               "[--profile[=<json file>]] [--jit] [--closures] "
+               "[--cache[=<directory>]] [script | -] \n";
+  std::exit(64);
 }
 
 int main(int argc, char* argv[]) {
-  if (argc > 2) {
-    std::cout << "Usage ./lox [script] \n";
-    std::exit(64);
-  } else if (argc == 2) {
-    runFile(argv[1]);
+  int arg = 1;
+  for (; arg < argc && std::strncmp(argv[arg], "--", 2) == 0; ++arg) {
+    const char* option = argv[arg];
+    if (std::strcmp(option, "--vm") == 0) {
+      bytecodeVM = std::make_unique<vm::VM>();
+    } else if (std::strcmp(option, "--dump-ast") == 0) {
+      dumpAst = true;
+    } else if (std::strncmp(option, "--gc-growth=", 12) == 0) {
+      double factor = std::atof(option + 12);
+      if (factor <= 1) usage();
+      interpreter.heap().setGrowthFactor(factor);
+    } else if (std::strcmp(option, "--profile") == 0 ||
+               std::strncmp(option, "--profile=", 10) == 0) {
+      if (option[9] == '=') profilePath = option + 10;
+      profiler = std::make_unique<Profiler>(interpreter.heap());
+    } else if (std::strcmp(option, "--jit") == 0) {
+      jit = std::make_unique<Jit>(interpreter);
+    } else if (std::strcmp(option, "--closures") == 0) {
+      closures = std::make_unique<ClosureCompiler>();
+    } else if (std::strcmp(option, "--cache") == 0 ||
+               std::strncmp(option, "--cache=", 8) == 0) {
+      cacheDirectory =
+          option[7] == '=' ? option + 8 : ImageCache::defaultDirectory();
+    } else {
+      usage();
+    }
+  }
+  // Only the tree-walker is instrumented or compiled.
+  if ((profiler != nullptr || jit != nullptr || closures != nullptr) &&
+      bytecodeVM != nullptr) {
+    usage();
+  }
+  interpreter.setJit(jit.get());
+  interpreter.setClosureCompiler(closures.get());
+  if (!cacheDirectory.empty()) {
+    // Trees for the bytecode compiler are not resolved.
+    imageCache = std::make_unique<ImageCache>(std::move(cacheDirectory),
+                                              bytecodeVM != nullptr);
+    loader.setImageCache(imageCache.get());
+  }
+  if (profiler != nullptr) {
+    interpreter.setProfiler(profiler.get());
+    // Runs on every exit path, including the error exits of runFile().
+    std::atexit(reportProfile);
+  }
+  if (argc - arg > 1) {
+    usage();
+  } else if (argc - arg == 1) {
+    runFile(argv[arg]);
   } else {
     runPrompt();
   }
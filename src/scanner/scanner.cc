@@ -1,14 +1,318 @@
 #include "scanner.h"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string_view>
 #include <vector>
 
-std::vector<Token> Scanner::scanTokens() {
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LOX_SCAN_X86 1
+#endif
+
+// Comments and strings can run long, so they are scanned by whichever of
+// these kernels the CPU supports (though AVX2 has measured no faster than
+// SSE2). Each returns the end of the run starting at `p`, which is `end` if
+// the run reaches it.
+struct ScanKernels {
+  // The rest of a comment, up to the newline.
+  const char* (*lineEnd)(const char* p, const char* end);
+  // The rest of a string, up to the closing quote, counting the newlines in
+  // it.
+  const char* (*stringEnd)(const char* p, const char* end, size_t& lines);
+};
+
+namespace {
+
+// What each byte can start or continue, looked up rather than compared.
+enum CharClass : uint8_t { kDigit = 1, kAlpha = 2 };
+
+constexpr std::array<uint8_t, 256> classify() {
+  std::array<uint8_t, 256> classes{};
+  for (int c = '0'; c <= '9'; ++c) classes[c] = kDigit;
+  for (int c = 'a'; c <= 'z'; ++c) classes[c] = kAlpha;
+  for (int c = 'A'; c <= 'Z'; ++c) classes[c] = kAlpha;
+  classes['_'] = kAlpha;
+  return classes;
+}
+
+constexpr std::array<uint8_t, 256> kCharClasses = classify();
+
+constexpr bool is(char c, uint8_t classes) {
+  return kCharClasses[static_cast<unsigned char>(c)] & classes;
+}
+
+constexpr bool digit(char c) { return is(c, kDigit); }
+constexpr bool alpha(char c) { return is(c, kAlpha); }
+constexpr bool identifierChar(char c) { return is(c, kAlpha | kDigit); }
+
+// The scalar kernels also finish what the vector ones leave: the last few
+// bytes, which are never loaded whole so as not to read past the source.
+const char* scalarBlankEnd(const char* p, const char* end, size_t& lines) {
+  for (; p < end; ++p) {
+    if (*p == '\n') {
+      ++lines;
+    } else if (*p != ' ' && *p != '\r') {
+      break;
+    }
+  }
+  return p;
+}
+
+const char* scalarLineEnd(const char* p, const char* end) {
+  while (p < end && *p != '\n') {
+    ++p;
+  }
+  return p;
+}
+
+const char* scalarStringEnd(const char* p, const char* end, size_t& lines) {
+  for (; p < end && *p != '"'; ++p) {
+    if (*p == '\n') ++lines;
+  }
+  return p;
+}
+
+const char* scalarIdentifierEnd(const char* p, const char* end) {
+  while (p < end && identifierChar(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+const char* scalarDigitsEnd(const char* p, const char* end) {
+  while (p < end && digit(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+constexpr ScanKernels kScalar{scalarLineEnd, scalarStringEnd};
+
+#ifdef LOX_SCAN_X86
+
+// The vector kernels test V::kWidth bytes at a time, each test giving a mask
+// with a bit per byte. V supplies the instructions; vectors don't leave it,
+// so the kernels themselves don't depend on any instruction set.
+
+// Newlines are few, so clearing them one by one beats popcount, which x86-64
+// doesn't have without checking for it either.
+void countLines(uint32_t newlines, size_t& lines) {
+  for (; newlines != 0; newlines &= newlines - 1) {
+    ++lines;
+  }
+}
+
+// Where the first set bit of `stop` is, after counting the newlines before
+// it.
+const char* stopAt(const char* p, uint32_t stop, uint32_t newlines,
+                   size_t& lines) {
+  countLines(newlines & ((stop & -stop) - 1), lines);
+  return p + __builtin_ctz(stop);
+}
+
+template <class V>
+const char* blankEnd(const char* p, const char* end, size_t& lines) {
+  for (; end - p >= V::kWidth; p += V::kWidth) {
+    uint32_t newlines = V::equal(p, '\n');
+    uint32_t blanks = newlines | V::equal(p, ' ') | V::equal(p, '\r');
+    if (blanks != V::kAll) return stopAt(p, ~blanks, newlines, lines);
+    countLines(newlines, lines);
+  }
+  return scalarBlankEnd(p, end, lines);
+}
+
+template <class V>
+const char* lineEnd(const char* p, const char* end) {
+  for (; end - p >= V::kWidth; p += V::kWidth) {
+    uint32_t newlines = V::equal(p, '\n');
+    if (newlines != 0) return p + __builtin_ctz(newlines);
+  }
+  return scalarLineEnd(p, end);
+}
+
+template <class V>
+const char* stringEnd(const char* p, const char* end, size_t& lines) {
+  for (; end - p >= V::kWidth; p += V::kWidth) {
+    uint32_t newlines = V::equal(p, '\n');
+    uint32_t quotes = V::equal(p, '"');
+    if (quotes != 0) return stopAt(p, quotes, newlines, lines);
+    countLines(newlines, lines);
+  }
+  return scalarStringEnd(p, end, lines);
+}
+
+template <class V>
+const char* identifierEnd(const char* p, const char* end) {
+  for (; end - p >= V::kWidth; p += V::kWidth) {
+    uint32_t letters = V::identifier(p);
+    if (letters != V::kAll) return p + __builtin_ctz(~letters);
+  }
+  return scalarIdentifierEnd(p, end);
+}
+
+template <class V>
+const char* digitsEnd(const char* p, const char* end) {
+  for (; end - p >= V::kWidth; p += V::kWidth) {
+    uint32_t digits = V::digits(p);
+    if (digits != V::kAll) return p + __builtin_ctz(~digits);
+  }
+  return scalarDigitsEnd(p, end);
+}
+
+// Bytes from `low` to `high` are the only ones at most `high - low` once
+// `low` is subtracted, compared unsigned. Setting 0x20 turns upper case
+// letters into lower case ones, and nothing else into a letter.
+
+// SSE2 is part of x86-64, so it needs no check.
+struct Sse2 {
+  static constexpr int kWidth = 16;
+  static constexpr uint32_t kAll = 0xffff;
+
+  static uint32_t equal(const char* p, char c) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(load(p), _mm_set1_epi8(c)));
+  }
+  static uint32_t digits(const char* p) {
+    return between(load(p), '0', '9');
+  }
+  static uint32_t identifier(const char* p) {
+    __m128i bytes = load(p);
+    __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+    return between(lower, 'a', 'z') | between(bytes, '0', '9') |
+           _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+  }
+
+ private:
+  static __m128i load(const char* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+  static uint32_t between(__m128i bytes, char low, char high) {
+    __m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8(low));
+    __m128i clamped = _mm_min_epu8(offset, _mm_set1_epi8(high - low));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(clamped, offset));
+  }
+};
+
+constexpr ScanKernels kSse2{lineEnd<Sse2>, stringEnd<Sse2>};
+
+// Only comments and strings use AVX2. It is compiled in whatever the build
+// targets, and only used if the CPU has it.
+struct Avx2 {
+  static constexpr int kWidth = 32;
+  static constexpr uint32_t kAll = 0xffffffff;
+
+  [[gnu::target("avx2")]] static uint32_t equal(const char* p, char c) {
+    return _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(load(p), _mm256_set1_epi8(c)));
+  }
+
+ private:
+  [[gnu::target("avx2")]] static __m256i load(const char* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+};
+
+// The kernels and the instructions above are inlined into these, which
+// makes them AVX2 code.
+namespace avx2 {
+
+[[gnu::target("avx2"), gnu::flatten]] const char* lineEnd(const char* p,
+                                                          const char* end) {
+  return ::lineEnd<Avx2>(p, end);
+}
+[[gnu::target("avx2"), gnu::flatten]] const char* stringEnd(const char* p,
+                                                            const char* end,
+                                                            size_t& lines) {
+  return ::stringEnd<Avx2>(p, end, lines);
+}
+
+}  // namespace avx2
+
+constexpr ScanKernels kAvx2{avx2::lineEnd, avx2::stringEnd};
+
+#endif  // LOX_SCAN_X86
+
+// Identifiers, numbers and runs of whitespace seldom fill even 16 bytes, so
+// calling a kernel for them would cost more than it saves. SSE2 is inlined
+// for them instead, unless the scanner was asked not to use vectors at all.
+
+const char* blankEnd(bool sse2, const char* p, const char* end,
+                     size_t& lines) {
+#ifdef LOX_SCAN_X86
+  if (sse2) return blankEnd<Sse2>(p, end, lines);
+#endif
+  return scalarBlankEnd(p, end, lines);
+}
+
+const char* identifierEnd(bool sse2, const char* p, const char* end) {
+#ifdef LOX_SCAN_X86
+  if (sse2) return identifierEnd<Sse2>(p, end);
+#endif
+  return scalarIdentifierEnd(p, end);
+}
+
+const char* digitsEnd(bool sse2, const char* p, const char* end) {
+#ifdef LOX_SCAN_X86
+  if (sse2) return digitsEnd<Sse2>(p, end);
+#endif
+  return scalarDigitsEnd(p, end);
+}
+
+}  // namespace
+
+Simd Scanner::bestSimd() {
+#ifdef LOX_SCAN_X86
+  static const Simd best =
+      __builtin_cpu_supports("avx2") ? Simd::AVX2 : Simd::SSE2;
+  return best;
+#else
+  return Simd::SCALAR;
+#endif
+}
+
+Scanner::Scanner(std::string_view source, Simd simd)
+    : kernels_{&kScalar}, source_{source} {
+#ifdef LOX_SCAN_X86
+  switch (std::min(simd, bestSimd())) {
+    case Simd::SCALAR:
+      break;
+    case Simd::SSE2:
+      kernels_ = &kSse2;
+      sse2_ = true;
+      break;
+    case Simd::AVX2:
+      kernels_ = &kAvx2;
+      sse2_ = true;
+      break;
+  }
+#else
+  (void)simd;
+#endif
+}
+
+Token Scanner::next() {
   while (!isAtEnd()) {
     start_ = current_;
     scanToken();
+    if (token_.has_value()) {
+      Token token = std::move(*token_);
+      token_.reset();
+      return token;
+    }
   }
-  tokens_.emplace_back(END_OF_FILE, "", nullptr, line_);
-  return tokens_;
+  return Token{END_OF_FILE, "", static_cast<int>(line_)};
+}
+
+std::vector<Token> Scanner::scanTokens() {
+  std::vector<Token> tokens;
+  // Code runs three to four bytes a token, so this rarely grows more than
+  // once.
+  tokens.reserve((source_.size() - current_) / 4);
+  do {
+    tokens.push_back(next());
+  } while (tokens.back().type_ != END_OF_FILE);
+  return tokens;
 }
 
 bool Scanner::isAtEnd() { return current_ >= source_.size(); }
@@ -60,26 +364,24 @@ void Scanner::scanToken() {
       break;
     case '/':
       if (match('/')) {
-        while (peek() != '\n' && !isAtEnd()) {
-          advance();
-        }
+        current_ = kernels_->lineEnd(here(), end()) - source_.data();
       } else {
         addToken(SLASH);
       }
       break;
     case ' ':
     case '\r':
-      break;
     case '\n':
-      ++line_;
+      current_ = blankEnd(sse2_, source_.data() + start_, end(), line_) -
+                 source_.data();
       break;
     case '"':
       string();
       break;
     default:
-      if (isDigit(c)) {
+      if (digit(c)) {
         number();
-      } else if (isAlpha(c)) {
+      } else if (alpha(c)) {
         identifier();
       } else {
         error(line_, "Unexpected character.");
@@ -90,11 +392,9 @@ void Scanner::scanToken() {
 
 char Scanner::advance() { return source_[current_++]; }
 
-void Scanner::addToken(TokenType type) { addToken(type, nullptr); }
-
-void Scanner::addToken(TokenType type, std::any literal) {
-  std::string text{source_.substr(start_, current_ - start_)};
-  tokens_.emplace_back(type, std::move(text), std::move(literal), line_);
+void Scanner::addToken(TokenType type, Symbol symbol) {
+  token_.emplace(type, source_.substr(start_, current_ - start_), line_,
+                 symbol);
 }
 
 bool Scanner::match(char expected) {
@@ -123,54 +423,45 @@ char Scanner::peekNext() {
 }
 
 void Scanner::string() {
-  while (peek() != '"' && !isAtEnd()) {
-    if (peek() == '\n') {
-      ++line_;
-    }
-    advance();
-  }
+  current_ = kernels_->stringEnd(here(), end(), line_) - source_.data();
   if (isAtEnd()) {
     error(line_, "Unterminated string.");
     return;
   }
   advance();
-  std::string value{source_.substr(start_ + 1, current_ - 2 - start_)};
-  addToken(STRING, value);
+  addToken(STRING);
 }
 
-bool Scanner::isDigit(char c) { return c >= '0' && c <= '9'; }
-
-bool Scanner::isAlpha(char c) {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
-}
-
-bool Scanner::isAlphaNumeric(char c) { return isAlpha(c) || isDigit(c); }
-
 void Scanner::number() {
-  while (isDigit(peek())) {
+  current_ = digitsEnd(sse2_, here(), end()) - source_.data();
+  if (peek() == '.' && digit(peekNext())) {
     advance();
+    current_ = digitsEnd(sse2_, here(), end()) - source_.data();
   }
-  if (peek() == '.' && isDigit(peekNext())) {
-    advance();
-  }
-  while (isDigit(peek())) {
-    advance();
-  }
-  addToken(NUMBER,
-           std::stod(std::string{source_.substr(start_, current_ - start_)}));
+  addToken(NUMBER);
 }
 
 void Scanner::identifier() {
-  while (isAlphaNumeric(peek())) {
-    advance();
-  }
-  std::string text = source_.substr(start_, current_ - start_);
-  TokenType type;
-  auto match = keywords.find(text);
-  if (match == keywords.end()) {
-    type = IDENTIFIER;
+  current_ = identifierEnd(sse2_, here(), end()) - source_.data();
+  std::string_view text = source_.substr(start_, current_ - start_);
+  // Keywords are told apart without touching the symbol table, which is
+  // shared and locked.
+  TokenType type = keywordType(text);
+  if (type == IDENTIFIER) {
+    addToken(type, intern(text));
   } else {
-    type = match->second;
+    addToken(type);
+  }
+}
+
+Symbol Scanner::intern(std::string_view name) {
+  // Names such as `shape1` and `shape2` differ at the end.
+  size_t hash = name.size() * 31 + static_cast<unsigned char>(name.front());
+  hash = hash * 31 + static_cast<unsigned char>(name.back());
+  if (name.size() > 1) {
+    hash = hash * 31 + static_cast<unsigned char>(name[name.size() - 2]);
   }
-  addToken(type);
+  Interned& entry = interned_[hash % kInterned];
+  if (entry.name != name) entry = {name, symbols().intern(name)};
+  return entry.symbol;
 }
\ No newline at end of file
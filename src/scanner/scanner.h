@@ -1,38 +1,65 @@
 #pragma once
 
-#include <any>
+#include <array>
 #include <cstddef>
-#include <string>
+#include <optional>
+#include <string_view>
 #include <vector>
 
 #include "../token/token.h"
 #include "../utils/error.h"
 
+// The instructions the scanner skips runs of characters with, such as
+// whitespace, comments, strings, identifiers and digits.
+enum class Simd { SCALAR, SSE2, AVX2 };
+
+struct ScanKernels;
+
+// Tokens borrow their lexemes from `source`, which must outlive them (see
+// SourceBuffer).
 class Scanner {
  public:
-  Scanner(std::string source) : source_(source) {}
+  // Asking for instructions the CPU lacks gets the best ones it has.
+  Scanner(std::string_view source, Simd simd = bestSimd());
 
+  // Scans up to the next token and returns it. Past the end of the source,
+  // returns END_OF_FILE however often it is called.
+  Token next();
+  // Every token left, END_OF_FILE included.
   std::vector<Token> scanTokens();
 
+  // The widest instructions this CPU supports.
+  static Simd bestSimd();
+
  private:
   void scanToken();
   char advance();
   bool isAtEnd();
+  const char* here() const { return source_.data() + current_; }
+  const char* end() const { return source_.data() + source_.size(); }
   void identifier();
+  Symbol intern(std::string_view name);
   void number();
   void string();
-  void addToken(TokenType type);
-  void addToken(TokenType type, std::any literal);
+  void addToken(TokenType type, Symbol symbol = kNoSymbol);
   bool match(char expected);
   char peek();
   char peekNext();
-  bool isAlpha(char c);
-  bool isAlphaNumeric(char c);
-  bool isDigit(char c);
 
-  std::string source_;
-  std::vector<Token> tokens_;
+  const ScanKernels* kernels_;
+  bool sse2_{false};
+  std::string_view source_;
+  std::optional<Token> token_;  // set by addToken(), taken by next()
   size_t line_{1};
   size_t start_{0};
   size_t current_{0};
+
+  // The identifiers interned last, by a hash of their lexeme. Most repeat,
+  // and finding them here spares taking the symbol table's lock.
+  struct Interned {
+    std::string_view name;
+    Symbol symbol{kNoSymbol};
+  };
+  static constexpr size_t kInterned = 256;
+  std::array<Interned, kInterned> interned_{};
 };
\ No newline at end of file
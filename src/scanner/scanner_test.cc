@@ -4,9 +4,13 @@
 
 #include <cstring>
 #include <fstream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "source.h"
+
 std::vector<std::string> readExpected(std::string path) {
   std::vector<std::string> lines;
   std::ifstream file(path);
@@ -23,26 +27,20 @@ std::vector<std::string> readExpected(std::string path) {
   return lines;
 }
 
-std::vector<Token> load(std::string path) {
-  std::ifstream file{path.data(),
-                     std::ios::in | std::ios::binary | std::ios::ate};
-  if (!file) {
+std::unique_ptr<SourceBuffer> load(std::string path) {
+  std::unique_ptr<SourceBuffer> source = SourceBuffer::fromFile(path);
+  if (source == nullptr) {
     std::cerr << "Failed to open file " << path << ": " << std::strerror(errno)
               << "\n";
     std::exit(74);
   }
-  std::string contents;
-  contents.resize(file.tellg());
-  file.seekg(0, std::ios::beg);
-  file.read(contents.data(), contents.size());
-  Scanner scanner{contents};
-  std::vector<Token> tokens = scanner.scanTokens();
-  return tokens;
+  return source;
 }
 
 TEST(ScannerTests, Test1) {
   auto expected = readExpected("./test-lexing1.lox.expected");
-  auto tokens = load("./test-lexing1.lox");
+  auto source = load("./test-lexing1.lox");
+  auto tokens = Scanner{source->text()}.scanTokens();
   auto expectedIter = expected.begin();
   for (const Token &token : tokens) {
     ASSERT_EQ(token.toString(), *expectedIter);
@@ -52,10 +50,115 @@ TEST(ScannerTests, Test1) {
 
 TEST(ScannerTests, Test2) {
   auto expected = readExpected("./test-lexing2.lox.expected");
-  auto tokens = load("./test-lexing2.lox");
+  auto source = load("./test-lexing2.lox");
+  auto tokens = Scanner{source->text()}.scanTokens();
   auto expectedIter = expected.begin();
   for (const Token &token : tokens) {
     ASSERT_EQ(token.toString(), *expectedIter);
     ++expectedIter;
   }
 }
+
+TEST(ScannerTests, InternsIdentifiers) {
+  Scanner scanner{"var foo = bar + foo; while"};
+  std::vector<Token> tokens = scanner.scanTokens();
+  ASSERT_EQ(tokens[0].type_, VAR);
+  ASSERT_EQ(tokens[1].type_, IDENTIFIER);
+  ASSERT_EQ(tokens[3].type_, IDENTIFIER);
+  ASSERT_EQ(tokens[5].type_, IDENTIFIER);
+  ASSERT_EQ(tokens[7].type_, WHILE);
+  ASSERT_EQ(tokens[1].symbol_, tokens[5].symbol_);
+  ASSERT_NE(tokens[1].symbol_, tokens[3].symbol_);
+  ASSERT_EQ(symbols().name(tokens[3].symbol_), "bar");
+  ASSERT_EQ(tokens[0].symbol_, kNoSymbol);
+}
+
+TEST(ScannerTests, InternsManyIdentifiers) {
+  // More names than the scanner remembers, so some share a slot there.
+  std::string source;
+  for (int i = 0; i < 1000; ++i) {
+    source += "a" + std::to_string(i) + " b" + std::to_string(i % 7) + " ";
+  }
+  std::vector<Token> tokens = Scanner{source}.scanTokens();
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(symbols().name(tokens[2 * i].symbol_), "a" + std::to_string(i));
+    ASSERT_EQ(tokens[2 * i + 1].symbol_,
+              symbols().intern("b" + std::to_string(i % 7)));
+  }
+}
+
+TEST(ScannerTests, LexemesPointIntoSource) {
+  SourceBuffer source{"var x = 12.5; print \"hi\";"};
+  std::vector<Token> tokens = Scanner{source.text()}.scanTokens();
+  const char* begin = source.text().data();
+  const char* end = begin + source.text().size();
+  for (const Token& token : tokens) {
+    if (token.type_ == END_OF_FILE) continue;
+    ASSERT_GE(token.lexeme_.data(), begin);
+    ASSERT_LE(token.lexeme_.data() + token.lexeme_.size(), end);
+  }
+  ASSERT_EQ(tokens[3].number(), 12.5);
+  ASSERT_EQ(tokens[6].string(), "hi");
+}
+
+// Each token, with the line it is on.
+std::vector<std::string> scan(std::string_view source, Simd simd) {
+  std::vector<std::string> tokens;
+  for (const Token& token : Scanner{source, simd}.scanTokens()) {
+    tokens.push_back(std::to_string(token.line_) + " " + token.toString());
+  }
+  return tokens;
+}
+
+TEST(ScannerTests, VectorKernelsMatchScalar) {
+  // Runs long enough to span whole vectors, and ones that end just inside
+  // or just past one, at every alignment.
+  std::string body =
+      "var an_identifier_that_goes_on_for_quite_a_while_ = 1234567890123456"
+      "78901234567890.5;\n"
+      "  \r\n\n    \n// a comment that is longer than thirty-two bytes "
+      "\"\n"
+      "print \"a string\nover\nlines, with \\ and 42 in it\" + x_1;\n"
+      "Upper_Case_Name_09 != zz;//\n  \n\"\"12.x";
+  std::vector<std::string> cases;
+  for (size_t shift = 0; shift < 40; ++shift) {
+    cases.push_back(std::string(shift, ' ') + body);
+    cases.push_back(body.substr(0, body.size() - shift));
+  }
+  // Left open, strings and comments run to the end.
+  cases.push_back(body + "\"unterminated\nstring that goes on and on");
+  cases.push_back(body + "// no newline after this comment");
+
+  for (const std::string& source : cases) {
+    std::vector<std::string> expected = scan(source, Simd::SCALAR);
+    ASSERT_EQ(scan(source, Simd::SSE2), expected) << source;
+    ASSERT_EQ(scan(source, Simd::AVX2), expected) << source;
+  }
+  hadError = false;
+}
+
+TEST(ScannerTests, KeywordsAreWholeWords) {
+  std::vector<Token> tokens =
+      Scanner{"or for fun import orx fo funny imports _if i IF"}.scanTokens();
+  std::vector<TokenType> types;
+  for (const Token& token : tokens) types.push_back(token.type_);
+  EXPECT_EQ(types, (std::vector<TokenType>{OR, FOR, FUN, IMPORT, IDENTIFIER,
+                                           IDENTIFIER, IDENTIFIER, IDENTIFIER,
+                                           IDENTIFIER, IDENTIFIER, IDENTIFIER,
+                                           END_OF_FILE}));
+  EXPECT_EQ(tokens[0].symbol_, kNoSymbol);
+  EXPECT_NE(tokens[4].symbol_, kNoSymbol);
+}
+
+TEST(ScannerTests, NextScansOneTokenAtATime) {
+  Scanner scanner{"print x; // done\n"};
+  EXPECT_EQ(scanner.next().type_, PRINT);
+  EXPECT_EQ(scanner.next().lexeme_, "x");
+  // The rest, comment and all, is left for later calls.
+  std::vector<Token> rest = scanner.scanTokens();
+  ASSERT_EQ(rest.size(), 2u);
+  EXPECT_EQ(rest[0].type_, SEMICOLON);
+  EXPECT_EQ(rest[1].type_, END_OF_FILE);
+  EXPECT_EQ(rest[1].line_, 2);
+  EXPECT_EQ(scanner.next().type_, END_OF_FILE);
+}
@@ -0,0 +1,53 @@
+#include "source.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+
+std::unique_ptr<SourceBuffer> SourceBuffer::fromFile(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat info;
+  if (::fstat(fd, &info) < 0) {
+    int saved = errno;
+    ::close(fd);
+    errno = saved;
+    return nullptr;
+  }
+  size_t size = static_cast<size_t>(info.st_size);
+  void* mapped = MAP_FAILED;
+  // Empty files can't be mapped, and pipes or other special files have no
+  // meaningful size; both go through a plain read below.
+  if (S_ISREG(info.st_mode) && size > 0) {
+    mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  ::close(fd);
+  if (mapped != MAP_FAILED) {
+    ::madvise(mapped, size, MADV_SEQUENTIAL);
+    return std::unique_ptr<SourceBuffer>{
+        new SourceBuffer{static_cast<const char*>(mapped), size}};
+  }
+
+  std::ifstream file{path, std::ios::in | std::ios::binary};
+  if (!file) return nullptr;
+  std::string contents{std::istreambuf_iterator<char>{file},
+                       std::istreambuf_iterator<char>{}};
+  return std::make_unique<SourceBuffer>(std::move(contents));
+}
+
+SourceBuffer::SourceBuffer(std::string text)
+    : owned_{std::move(text)}, text_{owned_} {}
+
+SourceBuffer::SourceBuffer(const char* mapped, size_t size)
+    : mapped_{const_cast<char*>(mapped)},
+      mappedSize_{size},
+      text_{mapped, size} {}
+
+SourceBuffer::~SourceBuffer() {
+  if (mapped_ != nullptr) ::munmap(mapped_, mappedSize_);
+}
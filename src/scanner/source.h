@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Owns the text of one script. Files are mapped read-only instead of being
+// copied, and tokens, the AST and the runtimes keep string_views into the
+// buffer, so it has to outlive everything built from it.
+class SourceBuffer {
+ public:
+  // Returns nullptr and leaves errno set if the file can't be opened.
+  static std::unique_ptr<SourceBuffer> fromFile(const std::string& path);
+
+  explicit SourceBuffer(std::string text);
+  ~SourceBuffer();
+  SourceBuffer(const SourceBuffer&) = delete;
+  SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+  std::string_view text() const { return text_; }
+
+ private:
+  SourceBuffer(const char* mapped, size_t size);
+
+  std::string owned_;  // REPL lines and files that can't be mapped
+  void* mapped_{nullptr};
+  size_t mappedSize_{0};
+  std::string_view text_;
+};
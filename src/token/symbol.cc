@@ -0,0 +1,55 @@
+#include "symbol.h"
+
+#include <functional>
+
+SymbolTable::SymbolTable() : buckets_(64, kNoSymbol) {}
+
+Symbol SymbolTable::intern(std::string_view name) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  size_t hash = std::hash<std::string_view>{}(name);
+  size_t mask = buckets_.size() - 1;
+  for (size_t index = hash & mask;; index = (index + 1) & mask) {
+    Symbol symbol = buckets_[index];
+    if (symbol == kNoSymbol) {
+      symbol = static_cast<Symbol>(names_.size());
+      names_.emplace_back(name);
+      hashes_.push_back(hash);
+      buckets_[index] = symbol;
+      if (names_.size() * 4 > buckets_.size() * 3) grow();
+      return symbol;
+    }
+    if (hashes_[symbol] == hash && names_[symbol] == name) return symbol;
+  }
+}
+
+const std::string& SymbolTable::name(Symbol symbol) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return names_[symbol];
+}
+
+size_t SymbolTable::hash(Symbol symbol) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return hashes_[symbol];
+}
+
+size_t SymbolTable::size() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return names_.size();
+}
+
+void SymbolTable::grow() {
+  // Rehashing only needs the cached hashes, never the strings themselves.
+  std::vector<Symbol> buckets(buckets_.size() * 2, kNoSymbol);
+  size_t mask = buckets.size() - 1;
+  for (Symbol symbol = 0; symbol < names_.size(); ++symbol) {
+    size_t index = hashes_[symbol] & mask;
+    while (buckets[index] != kNoSymbol) index = (index + 1) & mask;
+    buckets[index] = symbol;
+  }
+  buckets_ = std::move(buckets);
+}
+
+SymbolTable& symbols() {
+  static SymbolTable table;
+  return table;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Identifiers are interned once, at scan time, into dense integer ids. Later
+// phases compare and index by id instead of hashing and comparing strings.
+using Symbol = uint32_t;
+
+inline constexpr Symbol kNoSymbol = UINT32_MAX;
+
+class SymbolTable {
+ public:
+  SymbolTable();
+
+  // Safe to call from several threads at once, as the module loader's
+  // parsers and independent isolates (see Isolate) do.
+  Symbol intern(std::string_view name);
+  // Also safe while other threads intern. Names are only looked up to
+  // report errors, so taking the lock costs nothing that matters.
+  const std::string& name(Symbol symbol) const;
+  size_t hash(Symbol symbol) const;
+  size_t size() const;
+
+ private:
+  void grow();
+
+  std::deque<std::string> names_;  // deque: references stay valid on growth
+  std::vector<size_t> hashes_;
+  std::vector<Symbol> buckets_;  // open addressing, kNoSymbol marks empty
+  mutable std::mutex mutex_;
+};
+
+// The process-wide table shared by the scanner, parser and runtimes. Names
+// are never removed.
+SymbolTable& symbols();
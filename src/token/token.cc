@@ -1,7 +1,16 @@
 #include "token.h"
 
-#include <any>
+#include <charconv>
 #include <string>
+#include <string_view>
+
+double Token::number() const {
+  // The scanner only makes NUMBER tokens of well-formed decimals, so the
+  // result of from_chars needs no checking.
+  double value = 0;
+  std::from_chars(lexeme_.data(), lexeme_.data() + lexeme_.size(), value);
+  return value;
+}
 
 std::string Token::toString() const {
   std::string literal_text;
@@ -10,10 +19,10 @@ std::string Token::toString() const {
       literal_text = lexeme_;
       break;
     case (STRING):
-      literal_text = std::any_cast<std::string>(literal_);
+      literal_text = string();
       break;
     case (NUMBER):
-      literal_text = std::to_string(std::any_cast<double>(literal_));
+      literal_text = std::to_string(number());
       break;
     case (TRUE):
       literal_text = "true";
@@ -24,5 +33,6 @@ std::string Token::toString() const {
     default:
       literal_text = "nil";
   }
-  return strings.at(type_) + " " + lexeme_ + " " + literal_text;
+  return std::string{kTokenNames[type_]} + " " + std::string{lexeme_} + " " +
+         literal_text;
 }
\ No newline at end of file
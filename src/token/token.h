@@ -1,10 +1,16 @@
 #pragma once
 
-#include <any>
-#include <map>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
-enum TokenType {
+#include "symbol.h"
+
+enum TokenType : int {
   // Single-character tokens.
   LEFT_PAREN,   // `(`
   RIGHT_PAREN,  // `)`
@@ -38,6 +44,7 @@ enum TokenType {
   FUN,     // `fun`
   FOR,     // `for`
   IF,      // `if`
+  IMPORT,  // `import`
   NIL,     // `nil`
   OR,      // `or`
   PRINT,   // `print`
@@ -51,69 +58,127 @@ enum TokenType {
   END_OF_FILE  // 文件结束符
 };
 
-const std::map<TokenType, std::string> strings{
-    {LEFT_PAREN, "LEFT_PAREN"},
-    {RIGHT_PAREN, "RIGHT_PAREN"},
-    {LEFT_BRACE, "LEFT_BRACE"},
-    {RIGHT_BRACE, "RIGHT_BRACE"},
-    {COMMA, "COMMA"},
-    {DOT, "DOT"},
-    {MINUS, "MINUS"},
-    {PLUS, "PLUS"},
-    {SEMICOLON, "SEMICOLON"},
-    {SLASH, "SLASH"},
-    {STAR, "STAR"},
-    {BANG, "BANG"},
-    {BANG_EQUAL, "BANG_EQUAL"},
-    {EQUAL, "EQUAL"},
-    {EQUAL_EQUAL, "EQUAL_EQUAL"},
-    {GREATER, "GREATER"},
-    {GREATER_EQUAL, "GREATER_EQUAL"},
-    {LESS, "LESS"},
-    {LESS_EQUAL, "LESS_EQUAL"},
-    {IDENTIFIER, "IDENTIFIER"},
-    {STRING, "STRING"},
-    {NUMBER, "NUMBER"},
-    {AND, "AND"},
-    {CLASS, "CLASS"},
-    {ELSE, "ELSE"},
-    {FALSE, "FALSE"},
-    {FUN, "FUN"},
-    {FOR, "FOR"},
-    {IF, "IF"},
-    {NIL, "NIL"},
-    {OR, "OR"},
-    {PRINT, "PRINT"},
-    {RETURN, "RETURN"},
-    {SUPER, "SUPER"},
-    {THIS, "THIS"},
-    {TRUE, "TRUE"},
-    {VAR, "VAR"},
-    {WHILE, "WHILE"},
-    {END_OF_FILE, "END_OF_FILE"},
+// Indexed by TokenType.
+inline constexpr std::string_view kTokenNames[] = {
+    // Single-character tokens.
+    "LEFT_PAREN", "RIGHT_PAREN", "LEFT_BRACE", "RIGHT_BRACE", "COMMA", "DOT",
+    "MINUS", "PLUS", "SEMICOLON", "SLASH", "STAR",
+    // One or two character tokens.
+    "BANG", "BANG_EQUAL", "EQUAL", "EQUAL_EQUAL", "GREATER", "GREATER_EQUAL",
+    "LESS", "LESS_EQUAL",
+    // Literals.
+    "IDENTIFIER", "STRING", "NUMBER",
+    // Keywords.
+    "AND", "CLASS", "ELSE", "FALSE", "FUN", "FOR", "IF", "IMPORT", "NIL", "OR",
+    "PRINT", "RETURN", "SUPER", "THIS", "TRUE", "VAR", "WHILE",
+
+    "END_OF_FILE",
 };
+static_assert(std::size(kTokenNames) == END_OF_FILE + 1,
+              "kTokenNames is missing a TokenType");
 
-const std::map<std::string, TokenType> keywords{
-    {"and", AND},   {"class", CLASS}, {"else", ELSE},     {"false", FALSE},
-    {"for", FOR},   {"fun", FUN},     {"if", IF},         {"nil", NIL},
-    {"or", OR},     {"print", PRINT}, {"return", RETURN}, {"super", SUPER},
-    {"this", THIS}, {"true", TRUE},   {"var", VAR},       {"while", WHILE},
+struct Keyword {
+  std::string_view text;
+  TokenType type;
 };
 
+inline constexpr Keyword kKeywords[] = {
+    {"and", AND},     {"class", CLASS},   {"else", ELSE},   {"false", FALSE},
+    {"for", FOR},     {"fun", FUN},       {"if", IF},       {"import", IMPORT},
+    {"nil", NIL},     {"or", OR},         {"print", PRINT}, {"return", RETURN},
+    {"super", SUPER}, {"this", THIS},     {"true", TRUE},   {"var", VAR},
+    {"while", WHILE},
+};
+
+// Keywords are looked up in a perfect hash table built at compile time: one
+// hash of the length and the first and last characters, then one compare.
+namespace keyword_table {
+
+inline constexpr size_t kSize = 64;
+inline constexpr size_t kMinLength = 2;
+inline constexpr size_t kMaxLength = 6;
+
+constexpr size_t hash(std::string_view text, uint32_t seed) {
+  uint32_t mixed = (static_cast<unsigned char>(text.front()) << 16 |
+                    static_cast<unsigned char>(text.back()) << 8 |
+                    static_cast<uint32_t>(text.size())) *
+                   seed;
+  return mixed >> 26;  // the top six bits, which are the best mixed
+}
+static_assert(kSize == 1 << 6, "hash() must cover the table");
+
+using Table = std::array<Keyword, kSize>;
+
+// Fills the table for `seed`, or returns false if two keywords collide.
+constexpr bool fill(uint32_t seed, Table& table) {
+  table = {};
+  for (const Keyword& keyword : kKeywords) {
+    Keyword& slot = table[hash(keyword.text, seed)];
+    if (!slot.text.empty()) return false;
+    slot = keyword;
+  }
+  return true;
+}
+
+// The first odd multiplier that sends every keyword to its own slot.
+constexpr uint32_t findSeed() {
+  for (uint32_t seed = 0x9e3779b1;; seed += 2) {
+    Table table{};
+    if (fill(seed, table)) return seed;
+  }
+}
+
+inline constexpr uint32_t kSeed = findSeed();
+
+constexpr Table build() {
+  Table table{};
+  fill(kSeed, table);
+  return table;
+}
+
+inline constexpr Table kTable = build();
+
+}  // namespace keyword_table
+
+// The keyword `text` spells, or IDENTIFIER if it isn't one.
+constexpr TokenType keywordType(std::string_view text) {
+  using namespace keyword_table;
+  if (text.size() < kMinLength || text.size() > kMaxLength) return IDENTIFIER;
+  const Keyword& keyword = kTable[hash(text, kSeed)];
+  return keyword.text == text ? keyword.type : IDENTIFIER;
+}
+
+static_assert(keywordType("while") == WHILE && keywordType("or") == OR &&
+                  keywordType("whale") == IDENTIFIER &&
+                  keywordType("x") == IDENTIFIER,
+              "keywordType() is broken");
+
+// Tokens are small and trivially copyable, since the parser and the tree copy
+// them freely. Literal values are not stored: number() and string() read
+// them off the lexeme when the parser builds the Literal.
 class Token {
  public:
-  Token(TokenType type, std::string lexeme, std::any literal, int line)
-      : type_(type),
-        lexeme_(std::move(lexeme)),
-        literal_(std::move(literal)),
-        line_(line) {}
+  // `lexeme` points into the SourceBuffer being scanned.
+  Token(TokenType type, std::string_view lexeme, int line,
+        Symbol symbol = kNoSymbol)
+      : type_(type), lexeme_(lexeme), line_(line), symbol_(symbol) {}
 
   TokenType getType() { return type_; }
 
+  // The value of a NUMBER token.
+  double number() const;
+  // The text of a STRING token, without the quotes.
+  std::string_view string() const {
+    return lexeme_.substr(1, lexeme_.size() - 2);
+  }
+
   std::string toString() const;
 
   TokenType type_;
-  std::string lexeme_;
-  std::any literal_;
+  std::string_view lexeme_;
   int line_;
-};
\ No newline at end of file
+  Symbol symbol_;  // Interned name of IDENTIFIER tokens.
+};
+
+static_assert(std::is_trivially_copyable_v<Token>,
+              "Tokens are copied around as plain bytes");
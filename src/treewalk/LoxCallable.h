@@ -1,14 +1,29 @@
 #pragma once
 
+#include <string>
 #include <vector>
 
+#include "LoxObject.h"
+#include "value.h"
+
 class Interpreter;
+struct Function;
 
-class LoxCallable {
+class LoxCallable : public LoxObject {
  public:
+  LoxCallable() : LoxObject{ObjectType::CALLABLE} {}
   virtual int arity() = 0;
-  virtual std::any call(Interpreter& interpreter,
-                        std::vector<std::any> arguments) = 0;
+  // `arguments` points at arity() values on the interpreter's argument
+  // stack, which stay there until the call returns. The callee may move
+  // them out.
+  virtual Value call(Interpreter& interpreter, Value* arguments) = 0;
   virtual std::string toString() = 0;
-  virtual ~LoxCallable() = default;
-};
\ No newline at end of file
+
+  // The function whose parameters a call binds, if any. Declarations outlive
+  // every callable made from them, so a call site can remember the one whose
+  // arity it has already checked.
+  const Function* declaration() const { return declaration_; }
+
+ protected:
+  const Function* declaration_{nullptr};
+};
@@ -0,0 +1,50 @@
+#include "LoxClass.h"
+
+#include "LoxFunction.h"
+#include "LoxInstance.h"
+#include "interpreter.h"
+
+LoxClass::LoxClass(std::string name, LoxClass* superclass,
+                   std::unordered_map<Symbol, Value> methods)
+    : name{std::move(name)}, methods{std::move(methods)} {
+  if (superclass != nullptr) {
+    // Existing keys are the subclass's overrides and are kept.
+    this->methods.insert(superclass->methods.begin(),
+                         superclass->methods.end());
+  }
+  findInitializer();
+}
+
+void LoxClass::findInitializer() {
+  initializer = findMethod(symbols().intern("init"));
+  if (initializer != nullptr) declaration_ = initializer->declaration();
+}
+
+int LoxClass::arity() {
+  return initializer == nullptr ? 0 : initializer->arity();
+}
+
+Value LoxClass::call(Interpreter& interpreter, Value* arguments) {
+  Value instance = interpreter.heap().make<LoxInstance>(this);
+  if (initializer != nullptr) {
+    initializer->invoke(interpreter, instance.asInstance(), arguments);
+  }
+  return instance;
+}
+
+LoxFunction* LoxClass::findMethod(Symbol name) const {
+  auto elem = methods.find(name);
+  if (elem == methods.end()) return nullptr;
+  return static_cast<LoxFunction*>(elem->second.asCallable());
+}
+
+void LoxClass::trace(std::vector<LoxObject*>& references) const {
+  for (const auto& [name, method] : methods) {
+    references.push_back(method.asObject());
+  }
+}
+
+void LoxClass::clear() {
+  initializer = nullptr;
+  methods.clear();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../token/symbol.h"
+#include "LoxCallable.h"
+#include "LoxObject.h"
+#include "shape.h"
+#include "value.h"
+
+class LoxFunction;
+
+class LoxClass : public LoxCallable {
+ public:
+  // `methods` maps names to LoxFunctions. The superclass's methods are
+  // copied in up front, so a lookup never walks the class chain.
+  LoxClass(std::string name, LoxClass* superclass,
+           std::unordered_map<Symbol, Value> methods);
+  std::string toString() override { return name; }
+  int arity() override;
+  Value call(Interpreter& interpreter, Value* arguments) override;
+  void trace(std::vector<LoxObject*>& references) const override;
+  void clear() override;
+
+  // nullptr if the class has no such method.
+  LoxFunction* findMethod(Symbol name) const;
+  // The shape of a new instance, with no fields.
+  Shape* rootShape() { return &rootShape_; }
+
+  const std::string name;
+
+ private:
+  friend class Actors;  // Copies classes into another actor's heap.
+
+  // Looks up `init` once the methods are in place.
+  void findInitializer();
+
+  std::unordered_map<Symbol, Value> methods;
+  LoxFunction* initializer{nullptr};
+  Shape rootShape_;
+};
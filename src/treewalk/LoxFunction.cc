@@ -1,29 +1,105 @@
 #include "LoxFunction.h"
 
-#include "LoxReturn.h"
+#include "LoxInstance.h"
 #include "environment.h"
 #include "interpreter.h"
+#include "jit.h"
+#include "profiler.h"
 #include "stmt.h"
 
-LoxFunction::LoxFunction(std::shared_ptr<Function> declaration,
-                         std::shared_ptr<Environment> closure)
-    : declaration{std::move(declaration)}, closure{std::move(closure)} {}
+LoxFunction::LoxFunction(const Function* declaration, Ref<Environment> closure,
+                         bool isInitializer)
+    : closure{std::move(closure)}, isInitializer{isInitializer} {
+  declaration_ = declaration;
+}
 std::string LoxFunction::toString() {
-  return "<fn " + declaration->name.lexeme_ + ">";
+  return "<fn " + std::string{declaration_->name.lexeme_} + ">";
+}
+
+int LoxFunction::arity() { return declaration_->params.size(); }
+
+Value LoxFunction::call(Interpreter& interpreter, Value* arguments) {
+  return call(interpreter, closure, arguments);
+}
+
+Value LoxFunction::bind(Interpreter& interpreter, LoxInstance* instance) {
+  return interpreter.heap().make<LoxFunction>(
+      declaration_, bindThis(interpreter, instance), isInitializer);
 }
 
-int LoxFunction::arity() { return declaration->params.size(); }
+Value LoxFunction::invoke(Interpreter& interpreter, LoxInstance* instance,
+                          Value* arguments) {
+  Ref<Environment> receiver = bindThis(interpreter, instance);
+  Value result = call(interpreter, receiver, arguments);
+  interpreter.heap().recycle(std::move(receiver));
+  return result;
+}
 
-std::any LoxFunction::call(Interpreter& interpreter,
-                           std::vector<std::any> arguments) {
-  auto environment = std::make_shared<Environment>(closure);
-  for (int i = 0; i < declaration->params.size(); ++i) {
-    environment->define(declaration->params[i].lexeme_, arguments[i]);
+Value LoxFunction::call(Interpreter& interpreter,
+                        const Ref<Environment>& closure, Value* arguments) {
+  return finishTailCalls(interpreter, run(interpreter, closure, arguments));
+}
+
+Value LoxFunction::finishTailCalls(Interpreter& interpreter, Value result) {
+  // Each tail call replaces the frame that made it, which has returned by
+  // now, so a chain of them runs at this depth however long it is.
+  Interpreter::TailCall& tail = interpreter.tailCall();
+  while (!tail.callee.isNil()) {
+    Value callee = std::move(tail.callee);
+    auto& function = static_cast<LoxFunction&>(*callee.asCallable());
+    if (tail.receiver.isNil()) {
+      result = function.run(interpreter, function.closure,
+                            tail.arguments.data());
+      continue;
+    }
+    Ref<Environment> receiver =
+        function.bindThis(interpreter, tail.receiver.asInstance());
+    tail.receiver = nullptr;
+    result = function.run(interpreter, receiver, tail.arguments.data());
+    interpreter.heap().recycle(std::move(receiver));
   }
-  try {
-    interpreter.executeBlock(declaration->body, environment);
-  } catch (LoxReturn returnValue) {
-    return returnValue.value;
+  return result;
+}
+
+Value LoxFunction::run(Interpreter& interpreter,
+                       const Ref<Environment>& closure, Value* arguments) {
+  Profiler::Scope profile{interpreter.profiler(), *this};
+  if (Jit* jit = interpreter.jit(); jit != nullptr && !isInitializer) {
+    if (native == nullptr && ++calls == jit->threshold()) {
+      native = jit->compile(*declaration_);
+    }
+    Value result;
+    if (native != nullptr && jit->run(*native, arguments, result)) {
+      return result;
+    }
+  }
+
+  // Parameters are bound by position, in the slots the Resolver assigned.
+  Ref<Environment> environment = interpreter.heap().makeEnvironment(closure);
+  for (int i = 0; i < declaration_->params.size(); ++i) {
+    environment->define(std::move(arguments[i]));
   }
+  Completion completion = interpreter.executeBody(*declaration_, environment);
+  interpreter.heap().recycle(std::move(environment));
+
+  // An initializer always returns `this`, even from an early `return;`.
+  if (isInitializer) return closure->getAt(0, 0);
+  if (completion == Completion::RETURN) return interpreter.takeReturnValue();
   return nullptr;
 }
+
+// Methods see `this` in slot 0 of an environment between the class scope and
+// the method's own, matching the scope the Resolver opens for it.
+Ref<Environment> LoxFunction::bindThis(Interpreter& interpreter,
+                                       LoxInstance* instance) {
+  Ref<Environment> environment = interpreter.heap().makeEnvironment(closure);
+  environment->define(instance);
+  return environment;
+}
+
+void LoxFunction::trace(std::vector<LoxObject*>& references) const {
+  // Copies made by Actors get their closure after they are allocated.
+  if (closure != nullptr) references.push_back(closure.get());
+}
+
+void LoxFunction::clear() { closure = nullptr; }
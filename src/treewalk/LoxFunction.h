@@ -1,24 +1,55 @@
 #pragma once
 
-#include <any>
-#include <memory>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #include "LoxCallable.h"
+#include "LoxObject.h"
+#include "environment.h"
+#include "jit.h"
 
-class Environment;
-class Function;
+struct Function;
+class LoxInstance;
 
 class LoxFunction : public LoxCallable {
  public:
-  LoxFunction(std::shared_ptr<Function> declaration,
-              std::shared_ptr<Environment> closure);
+  // The declaration is owned by the parsed program, which the caller keeps
+  // alive for as long as the interpreter runs.
+  LoxFunction(const Function* declaration, Ref<Environment> closure,
+              bool isInitializer = false);
   std::string toString() override;
   int arity() override;
-  std::any call(Interpreter& interpreter,
-                std::vector<std::any> arguments) override;
+  Value call(Interpreter& interpreter, Value* arguments) override;
+  void trace(std::vector<LoxObject*>& references) const override;
+  void clear() override;
+
+  // The method with `this` bound to `instance`, as a value of its own.
+  Value bind(Interpreter& interpreter, LoxInstance* instance);
+  // Calls the method on `instance` without allocating the bound method that
+  // `bind` returns.
+  Value invoke(Interpreter& interpreter, LoxInstance* instance,
+               Value* arguments);
 
  private:
-  std::shared_ptr<Function> declaration;
-  std::shared_ptr<Environment> closure;
-};
\ No newline at end of file
+  // Runs the call and then the tail calls it leaves behind, one after the
+  // other.
+  Value call(Interpreter& interpreter, const Ref<Environment>& closure,
+             Value* arguments);
+  // Runs the pending tail calls, if any, of a call that returned `result`.
+  static Value finishTailCalls(Interpreter& interpreter, Value result);
+  // Runs the body once, in a new environment enclosed by `closure`.
+  Value run(Interpreter& interpreter, const Ref<Environment>& closure,
+            Value* arguments);
+  Ref<Environment> bindThis(Interpreter& interpreter, LoxInstance* instance);
+
+  friend class Jit;  // Calls compiled functions directly.
+  friend class Interpreter;  // Defers tail calls, see deferCall().
+  friend class Actors;       // Copies functions into another actor's heap.
+
+  Ref<Environment> closure;
+  bool isInitializer;
+  // Counts calls until the Jit compiles the declaration.
+  uint32_t calls{0};
+  const Jit::Code* native{nullptr};
+};
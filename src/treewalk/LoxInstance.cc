@@ -0,0 +1,13 @@
+#include "LoxInstance.h"
+
+void LoxInstance::trace(std::vector<LoxObject*>& references) const {
+  references.push_back(klass.get());
+  for (const Value& field : fields) {
+    if (field.isObject()) references.push_back(field.asObject());
+  }
+}
+
+void LoxInstance::clear() {
+  fields.clear();
+  klass = nullptr;
+}
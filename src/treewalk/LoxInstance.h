@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "LoxClass.h"
+#include "LoxObject.h"
+#include "shape.h"
+#include "value.h"
+
+// Fields are stored densely in the order they were first assigned; `shape`
+// maps their names to indices and is shared by every instance that got the
+// same fields in the same order.
+class LoxInstance : public LoxObject {
+ public:
+  explicit LoxInstance(LoxClass* klass)
+      : LoxObject{ObjectType::INSTANCE},
+        klass{klass},
+        shape{klass->rootShape()} {}
+
+  std::string toString() const { return klass->name + " instance"; }
+  void trace(std::vector<LoxObject*>& references) const override;
+  void clear() override;
+
+  Ref<LoxClass> klass;
+  Shape* shape;
+  std::vector<Value> fields;
+};
+
+inline LoxInstance* Value::asInstance() const {
+  return static_cast<LoxInstance*>(asObject());
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>  // std::move, std::swap
+#include <vector>
+
+enum class ObjectType { STRING, CALLABLE, ENVIRONMENT, INSTANCE };
+
+// Base of every heap-allocated runtime object. Objects are reference counted
+// intrusively by Value and Ref, so the count lives right next to the type
+// tag. Objects that can take part in a reference cycle (environments, the
+// closures stored in them, classes and instances) are allocated by a Heap
+// instead; those are only ever freed by its collector.
+class LoxObject {
+ public:
+  explicit LoxObject(ObjectType type) : type{type} {}
+  LoxObject(const LoxObject&) = delete;
+  LoxObject& operator=(const LoxObject&) = delete;
+  virtual ~LoxObject() = default;
+
+  void retain() { ++refCount_; }
+  void release() {
+    if (--refCount_ == 0 && !traced_) delete this;
+  }
+
+  // Appends every object this one holds a reference to. Only objects that can
+  // reference other objects need to override it.
+  virtual void trace(std::vector<LoxObject*>& references) const {}
+  // Drops every reference this object holds. The collector calls it on all
+  // unreachable objects before freeing any of them, so no destructor ever
+  // touches an object that is already gone.
+  virtual void clear() {}
+
+  const ObjectType type;
+
+ private:
+  friend class Heap;
+  int refCount_{0};
+  bool traced_{false};
+  bool marked_{false};
+  int gcRefs_{0};
+  LoxObject* next_{nullptr};
+};
+
+class LoxString : public LoxObject {
+ public:
+  explicit LoxString(std::string value)
+      : LoxObject{ObjectType::STRING}, value{std::move(value)} {}
+
+  const std::string value;
+};
+
+// Counted pointer for objects that are not held in a Value, such as
+// environments.
+template <class T>
+class Ref {
+ public:
+  Ref() = default;
+  Ref(std::nullptr_t) {}
+  Ref(T* object) : object_{object} {
+    if (object_ != nullptr) object_->retain();
+  }
+  Ref(const Ref& other) : Ref{other.object_} {}
+  Ref(Ref&& other) noexcept : object_{other.object_} {
+    other.object_ = nullptr;
+  }
+  Ref& operator=(Ref other) noexcept {
+    std::swap(object_, other.object_);
+    return *this;
+  }
+  ~Ref() {
+    if (object_ != nullptr) object_->release();
+  }
+
+  T* get() const { return object_; }
+  T* operator->() const { return object_; }
+  T& operator*() const { return *object_; }
+  bool operator==(const Ref& other) const { return object_ == other.object_; }
+  bool operator!=(const Ref& other) const { return object_ != other.object_; }
+  bool operator==(std::nullptr_t) const { return object_ == nullptr; }
+  bool operator!=(std::nullptr_t) const { return object_ != nullptr; }
+
+ private:
+  T* object_{nullptr};
+};
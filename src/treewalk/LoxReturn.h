@@ -1,7 +0,0 @@
-#pragma once
-#include <any>
-
-class LoxReturn {
- public:
-  const std::any value;
-};
@@ -0,0 +1,429 @@
+#include "actors.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <climits>
+#include <optional>
+#include <system_error>
+#include <unordered_map>
+#include <utility>  // std::move
+
+#include "LoxClass.h"
+#include "LoxFunction.h"
+#include "LoxInstance.h"
+#include "environment.h"
+#include "runtime_error.h"
+
+// Strings are copied out of the sender's heap; the other values that can be
+// sent hold no object.
+struct Actors::Message {
+  Value value;
+  std::string string;
+  bool isString{false};
+};
+
+struct Actors::Actor {
+  uint32_t id{0};
+  // Spawned actors own theirs until their function returns. Actor 0 runs
+  // the interpreter that Actors was constructed with.
+  std::unique_ptr<Interpreter> owned;
+  Interpreter* interpreter{nullptr};
+  MpscQueue<Message> mailbox;
+  // kParked while the actor sleeps in receive(), until a sender wakes it or
+  // join() closes its mailbox.
+  std::atomic<uint32_t> state{0};
+  std::thread thread;
+};
+
+namespace {
+
+// Values of Actor::state.
+constexpr uint32_t kRunning = 0;
+constexpr uint32_t kParked = 1;
+constexpr uint32_t kClosed = 2;
+
+// Thrown out of receive() once nothing can be sent to the actor, to unwind
+// it.
+struct Closed {};
+
+// Sleeps while `word` holds `value`, or until woken. May return early, so
+// callers check again.
+void wait(std::atomic<uint32_t>& word, uint32_t value) {
+#ifdef __linux__
+  syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+#else
+  (void)word;
+  (void)value;
+  std::this_thread::yield();
+#endif
+}
+
+// Wakes every thread in wait() on `word`.
+void wake(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+  syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+}  // namespace
+
+// spawn, send, receive and self, bound to the actor whose globals hold them.
+class Actors::Native : public LoxCallable {
+ public:
+  using Body = Value (Actors::*)(Actor& self, Value* arguments);
+
+  Native(Actors& actors, Actor& actor, int arity, Body body)
+      : actors_{actors}, actor_{actor}, arity_{arity}, body_{body} {}
+  int arity() override { return arity_; }
+  Value call(Interpreter& interpreter, Value* arguments) override {
+    return (actors_.*body_)(actor_, arguments);
+  }
+  std::string toString() override { return "<native fn>"; }
+
+ private:
+  Actors& actors_;
+  Actor& actor_;
+  int arity_;
+  Body body_;
+};
+
+// Deep-copies values into the heap of another interpreter, preserving
+// sharing and cycles: every object is copied once, and registered before
+// what it references is, so a reference back to it finds the copy.
+class Actors::Copier {
+ public:
+  explicit Copier(Interpreter& to) : to_{to} {}
+
+  // Defines the globals of `from` in the destination, which then stands in
+  // for `from` wherever a closure refers to it. A native still held by the
+  // global it was defined as maps to the destination's own, so that a
+  // spawned actor's `self` is its own.
+  void copyGlobals(const Environment& from) {
+    Environment& globals = *to_.globals;
+    environments_.emplace(&from, to_.globals);
+    for (Symbol name = 0; name < from.defined.size(); ++name) {
+      const Value& value = from.values[name];
+      if (from.defined[name] && isNative(value) && globals.isDefined(name)) {
+        objects_.emplace(value.asObject(), globals.values[name]);
+      }
+    }
+    for (Symbol name = 0; name < from.defined.size(); ++name) {
+      if (from.defined[name]) globals.define(name, copy(from.values[name]));
+    }
+  }
+
+  Value copy(const Value& value) {
+    if (!value.isObject()) return value;
+    const LoxObject* object = value.asObject();
+    if (auto copied = objects_.find(object); copied != objects_.end()) {
+      return copied->second;
+    }
+    if (value.isString()) {
+      return remember(object, new LoxString{value.asString()});
+    }
+    if (value.isInstance()) return copy(value.asInstance());
+    if (auto* function = dynamic_cast<LoxFunction*>(value.asCallable())) {
+      return copy(function);
+    }
+    if (auto* klass = dynamic_cast<LoxClass*>(value.asCallable())) {
+      return copy(klass);
+    }
+    throw NativeError{"Can only copy natives that are globals!"};
+  }
+
+ private:
+  static bool isNative(const Value& value) {
+    return value.isCallable() &&
+           dynamic_cast<LoxFunction*>(value.asCallable()) == nullptr &&
+           dynamic_cast<LoxClass*>(value.asCallable()) == nullptr;
+  }
+
+  Value remember(const LoxObject* original, Value copy) {
+    objects_.emplace(original, copy);
+    return copy;
+  }
+
+  Value copy(LoxFunction* function) {
+    auto* copy = to_.heap().make<LoxFunction>(
+        function->declaration(), nullptr, function->isInitializer);
+    Value result = remember(function, copy);
+    copy->closure = this->copy(function->closure.get());
+    return result;
+  }
+
+  Value copy(LoxClass* klass) {
+    auto* copy = to_.heap().make<LoxClass>(
+        klass->name, nullptr, std::unordered_map<Symbol, Value>{});
+    Value result = remember(klass, copy);
+    for (const auto& [name, method] : klass->methods) {
+      copy->methods.emplace(name, this->copy(method));
+    }
+    copy->findInitializer();
+    return result;
+  }
+
+  Value copy(LoxInstance* instance) {
+    // Copying the class can reach this instance (through a method's
+    // closure), and copy it first.
+    Value klass = copy(Value{instance->klass.get()});
+    if (auto copied = objects_.find(instance); copied != objects_.end()) {
+      return copied->second;
+    }
+    auto* copy = to_.heap().make<LoxInstance>(
+        static_cast<LoxClass*>(klass.asCallable()));
+    Value result = remember(instance, copy);
+    for (Symbol field : instance->shape->fields()) {
+      copy->shape = copy->shape->withField(field);
+    }
+    copy->fields.reserve(instance->fields.size());
+    for (const Value& field : instance->fields) {
+      copy->fields.push_back(this->copy(field));
+    }
+    return result;
+  }
+
+  Ref<Environment> copy(Environment* environment) {
+    if (environment == nullptr) return nullptr;
+    if (auto copied = environments_.find(environment);
+        copied != environments_.end()) {
+      return copied->second;
+    }
+    Ref<Environment> copy = to_.heap().make<Environment>();
+    environments_.emplace(environment, copy);
+    copy->enclosing = this->copy(environment->enclosing.get());
+    for (const Value& slot : environment->slots) {
+      copy->define(this->copy(slot));
+    }
+    return copy;
+  }
+
+  Interpreter& to_;
+  std::unordered_map<const LoxObject*, Value> objects_;
+  std::unordered_map<const Environment*, Ref<Environment>> environments_;
+};
+
+Actors::Actors(Interpreter& main)
+    : actors_{new std::atomic<Actor*>[kMaxActors]()} {
+  auto* actor = new Actor{};
+  actor->interpreter = &main;
+  actors_[0] = actor;
+  count_ = 1;
+  main.shareTrees(&sharedTrees_);
+  defineNatives(*actor);
+}
+
+Actors::~Actors() {
+  join();
+  actors_[0].load()->interpreter->shareTrees(nullptr);
+  for (uint32_t id = 0; id < count_; ++id) delete actors_[id].load();
+}
+
+void Actors::join() {
+  // Actor 0 is busy running this. Once the others are done or parked, none
+  // can send, so a parked actor would sleep forever: it is woken to find its
+  // mailbox closed instead.
+  for (uint32_t busy; (busy = busy_.load()) != 1;) wait(busy_, busy);
+  // Spawners publish actors before they can be done, so all are by now.
+  for (uint32_t id = 1; id < count_; ++id) {
+    Actor* actor = actors_[id].load();
+    if (!actor->thread.joinable()) continue;
+    {
+      // The last actor to park may not have let go of the lock yet.
+      std::lock_guard<std::mutex> lock{parking_};
+      if (actor->state.load() == kParked) {
+        actor->state.store(kClosed);
+        wake(actor->state);
+      }
+    }
+    actor->thread.join();
+  }
+}
+
+void Actors::idle() {
+  uint32_t busy = --busy_;
+  if (busy == 1) {
+    // join() may be waiting for actor 0 to be left alone.
+    wake(busy_);
+  } else if (busy == 0) {
+    // Actor 0, which is only counted off when it parks, waits for a message
+    // no actor is left to send.
+    Actor& main = *actors_[0];
+    main.state.store(kClosed);
+    wake(main.state);
+  }
+}
+
+void Actors::defineNatives(Actor& actor) {
+  Environment& globals = *actor.interpreter->globals;
+  globals.define(symbols().intern("spawn"),
+                 new Native{*this, actor, 1, &Actors::spawn});
+  globals.define(symbols().intern("send"),
+                 new Native{*this, actor, 2, &Actors::send});
+  globals.define(symbols().intern("receive"),
+                 new Native{*this, actor, 0, &Actors::receive});
+  globals.define(symbols().intern("self"),
+                 new Native{*this, actor, 0, &Actors::self});
+}
+
+Value Actors::spawn(Actor& self, Value* arguments) {
+  auto* function =
+      arguments[0].isCallable()
+          ? dynamic_cast<LoxFunction*>(arguments[0].asCallable())
+          : nullptr;
+  if (function == nullptr || function->arity() != 0) {
+    throw NativeError{"Can only spawn functions without parameters!"};
+  }
+
+  auto actor = std::make_unique<Actor>();
+  actor->owned = std::make_unique<Interpreter>();
+  actor->interpreter = actor->owned.get();
+  actor->interpreter->shareTrees(&sharedTrees_);
+  actor->interpreter->copyStringLiterals();
+  defineNatives(*actor);
+  Value body;
+  {
+    // The copies are only touched by this thread until the new one starts.
+    Copier copier{*actor->interpreter};
+    copier.copyGlobals(*self.interpreter->globals);
+    body = copier.copy(arguments[0]);
+  }
+
+  uint32_t id = count_;
+  do {
+    if (id == kMaxActors) throw NativeError{"Too many actors!"};
+  } while (!count_.compare_exchange_weak(id, id + 1));
+  actor->id = id;
+  Actor* spawned = actor.release();
+  // Senders wait for the ids below count_ to be published, see find().
+  actors_[id] = spawned;
+  {
+    // Before the thread starts, so that it can't be counted off first.
+    std::lock_guard<std::mutex> lock{parking_};
+    ++busy_;
+    ++running_;
+    sharedTrees_.store(true, std::memory_order_release);
+  }
+
+  try {
+    spawned->thread = std::thread{[this, spawned,
+                                   body = std::move(body)]() mutable {
+      bool closed = false;
+      try {
+        body.asCallable()->call(*spawned->interpreter, nullptr);
+      } catch (const RuntimeError& error) {
+        runtimeError(error);
+      } catch (const Closed&) {
+        closed = true;
+      }
+      // The heap goes with the thread that used it. The mailbox stays, for
+      // whoever still sends to this actor.
+      body = nullptr;
+      spawned->owned.reset();
+      std::lock_guard<std::mutex> lock{parking_};
+      finished();
+      // A closed actor was counted off when it parked.
+      if (!closed) idle();
+    }};
+  } catch (const std::system_error&) {
+    spawned->owned.reset();
+    std::lock_guard<std::mutex> lock{parking_};
+    finished();
+    --busy_;
+    throw NativeError{"Can't start another thread!"};
+  }
+  return static_cast<double>(id);
+}
+
+Value Actors::send(Actor& self, Value* arguments) {
+  Actor* actor = find(arguments[0]);
+  if (actor == nullptr) throw NativeError{"Can only send to actors!"};
+  const Value& value = arguments[1];
+  Message message;
+  if (value.isString()) {
+    message.string = value.asString();
+    message.isString = true;
+  } else if (value.isObject()) {
+    throw NativeError{"Can only send nil, booleans, numbers and strings!"};
+  } else {
+    message.value = value;
+  }
+  actor->mailbox.push(std::move(message));
+  // Either the receiver sees the message before parking, or this sees it
+  // parked, see park().
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (actor->state.load() == kParked) {
+    {
+      std::lock_guard<std::mutex> lock{parking_};
+      if (actor->state.load() != kParked) return nullptr;
+      actor->state.store(kRunning);
+      ++busy_;
+    }
+    wake(actor->state);
+  }
+  return nullptr;
+}
+
+Value Actors::receive(Actor& self, Value* arguments) {
+  for (;;) {
+    std::optional<Message> message = self.mailbox.pop();
+    if (!message) message = park(self);
+    if (message) {
+      if (message->isString) return new LoxString{std::move(message->string)};
+      return message->value;
+    }
+  }
+}
+
+std::optional<Actors::Message> Actors::park(Actor& self) {
+  {
+    // A sender clears the flag and counts the actor busy again under the
+    // lock, so it does neither before the actor is counted off, nor for an
+    // actor that finds a message here and stays busy.
+    std::lock_guard<std::mutex> lock{parking_};
+    self.state.store(kParked);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (std::optional<Message> message = self.mailbox.pop()) {
+      self.state.store(kRunning);
+      return message;
+    }
+    idle();
+  }
+  uint32_t state;
+  while ((state = self.state.load()) == kParked) wait(self.state, kParked);
+  if (state != kClosed) return std::nullopt;
+  if (self.id != 0) throw Closed{};
+  // Closed by idle(). Actor 0 goes on, to report the error and to join().
+  {
+    std::lock_guard<std::mutex> lock{parking_};
+    self.state.store(kRunning);
+    ++busy_;
+  }
+  throw NativeError{"No actor is left to send a message!"};
+}
+
+void Actors::finished() {
+  // Actor 0 alone walks the trees again, and can cache what it finds.
+  if (--running_ == 0) sharedTrees_.store(false, std::memory_order_release);
+}
+
+Value Actors::self(Actor& self, Value* arguments) {
+  return static_cast<double>(self.id);
+}
+
+Actors::Actor* Actors::find(const Value& id) const {
+  if (!id.isNumber()) return nullptr;
+  double number = id.asNumber();
+  if (!(number >= 0 && number < count_)) return nullptr;
+  auto index = static_cast<uint32_t>(number);
+  if (index != number) return nullptr;
+  // Handed out, but not published yet: that takes a few instructions.
+  Actor* actor;
+  while ((actor = actors_[index].load()) == nullptr) std::this_thread::yield();
+  return actor;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "interpreter.h"
+#include "mpsc_queue.h"
+#include "value.h"
+
+// Lox programs can run on several cores as actors: OS threads that share
+// nothing but the program's trees and talk by message passing. Constructing
+// an Actors makes the interpreter it is given actor 0 and defines these
+// globals in it (and, in turn, in every actor it spawns):
+//
+//   spawn(fn)       Runs the zero-argument function `fn` on a new thread and
+//                   returns the new actor's id.
+//   send(id, v)     Queues `v` for actor `id`. Never waits.
+//   receive()       Takes the oldest message sent to this actor, sleeping
+//                   until one is sent if there is none yet. An error in
+//                   actor 0 if no other actor is left to send one.
+//   self()          This actor's id.
+//
+// Every actor has an Interpreter, and so a Heap, of its own: reference counts
+// and the collector need no synchronization. spawn() gives the new actor deep
+// copies of `fn` and of the spawner's globals, made on the spawning thread
+// before the new one starts, so the new actor starts out seeing what its
+// parent saw but never shares an object with it. Messages only carry nil,
+// booleans, numbers and strings, which are copied out of the sender's heap;
+// they travel through lock-free queues (see MpscQueue).
+//
+// Spawned actors walk the tree; --jit, --closures and --profile only apply
+// to actor 0.
+class Actors {
+ public:
+  static constexpr uint32_t kMaxActors = 1 << 12;
+
+  explicit Actors(Interpreter& main);
+  // Waits for the spawned actors, see join().
+  ~Actors();
+  Actors(const Actors&) = delete;
+  Actors& operator=(const Actors&) = delete;
+
+  // Waits until every spawned actor has returned, including those spawned
+  // while waiting. An actor left waiting in receive() for a message that no
+  // actor is left to send is stopped there instead. Only called from actor
+  // 0's thread.
+  void join();
+
+ private:
+  struct Message;
+  struct Actor;
+  class Native;
+  class Copier;
+
+  // Makes the natives of `actor` globals of its interpreter.
+  void defineNatives(Actor& actor);
+  Value spawn(Actor& self, Value* arguments);
+  Value send(Actor& self, Value* arguments);
+  Value receive(Actor& self, Value* arguments);
+  Value self(Actor& self, Value* arguments);
+  // Puts `self` to sleep until a message is sent to it, unless one came in
+  // already, which it returns.
+  std::optional<Message> park(Actor& self);
+  // Counts off an actor that returned or went to sleep, under `parking_`.
+  void idle();
+  // Counts off a spawned actor whose function returned, under `parking_`.
+  void finished();
+  // The actor whose id is `id`, or nullptr.
+  Actor* find(const Value& id) const;
+
+  // Indexed by id. An actor is published here right after its id is handed
+  // out, before its thread starts, and lives until the Actors does, so
+  // lookups need no lock.
+  std::unique_ptr<std::atomic<Actor*>[]> actors_;
+  // Ids handed out so far.
+  std::atomic<uint32_t> count_{0};
+
+  // Actors, actor 0 included, that are neither done nor parked in receive():
+  // counted up by spawn() and by a send() that wakes an actor, and down by
+  // an actor that returns or parks. When join() sees actor 0 alone, no
+  // message can be sent any more.
+  std::atomic<uint32_t> busy_{1};
+  // Orders parking against waking, see park().
+  std::mutex parking_;
+
+  // Spawned actors whose function hasn't returned, and whether there are
+  // any, which is what the interpreters check (see
+  // Interpreter::shareTrees()). Both change under `parking_`.
+  uint32_t running_{0};
+  std::atomic<bool> sharedTrees_{false};
+};
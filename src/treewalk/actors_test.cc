@@ -0,0 +1,228 @@
+#include "actors.h"
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>  // std::pair
+#include <vector>
+
+#include "interpreter.h"
+#include "mpsc_queue.h"
+#include "parser.h"
+#include "resolver.h"
+#include "runtime_error.h"
+
+namespace {
+
+// Runs `source` and every actor it spawns, and returns what they printed,
+// errors included.
+std::string run(std::string_view source) {
+  std::vector<StmtPtr> statements = Parser{source}.parse();
+  Resolver{}.resolve(statements);
+
+  Interpreter interpreter;
+  Actors actors{interpreter};
+  std::ostringstream out;
+  std::streambuf* savedOut = std::cout.rdbuf(out.rdbuf());
+  std::streambuf* savedErr = std::cerr.rdbuf(out.rdbuf());
+  interpreter.interpret(statements);
+  actors.join();
+  std::cout.rdbuf(savedOut);
+  std::cerr.rdbuf(savedErr);
+  hadRuntimeError = false;
+  return out.str();
+}
+
+}  // namespace
+
+TEST(ActorsTests, QueueKeepsEachProducersOrder) {
+  constexpr int kProducers = 4;
+  constexpr int kMessages = 10000;
+  MpscQueue<std::pair<int, int>> queue;
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < kProducers; ++producer) {
+    producers.emplace_back([&queue, producer] {
+      for (int i = 0; i < kMessages; ++i) queue.push({producer, i});
+    });
+  }
+  std::vector<int> next(kProducers, 0);
+  for (int received = 0; received < kProducers * kMessages;) {
+    auto message = queue.pop();
+    if (!message) continue;
+    auto [producer, i] = *message;
+    ASSERT_EQ(i, next[producer]++);
+    ++received;
+  }
+  for (std::thread& producer : producers) producer.join();
+  EXPECT_FALSE(queue.pop());
+}
+
+TEST(ActorsTests, SplitsWorkBetweenActors) {
+  EXPECT_EQ(run(R"(
+    var parent = self();
+    for (var w = 0; w < 4; w = w + 1) {
+      var start = w * 1000;
+      fun work() {
+        var sum = 0;
+        for (var i = start; i < start + 1000; i = i + 1) sum = sum + i;
+        send(parent, sum);
+      }
+      spawn(work);
+    }
+    var total = 0;
+    for (var i = 0; i < 4; i = i + 1) total = total + receive();
+    print total;
+  )"),
+            "7998000.000000\n");
+}
+
+TEST(ActorsTests, GivesActorsCopiesOfWhatTheySee) {
+  EXPECT_EQ(run(R"(
+    class Point {
+      init(x, y) { this.x = x; this.y = y; }
+      sum() { return this.x + this.y; }
+    }
+    var p = Point(1, 2);
+    p.self = p;
+    var greeting = "hello";
+    fun child() {
+      p.self.x = 10;
+      send(0, greeting);
+      send(0, p.sum());
+      send(0, self());
+    }
+    spawn(child);
+    print receive();
+    print receive();
+    print receive();
+    print p.x;
+  )"),
+            "hello\n12.000000\n1.000000\n1.000000\n");
+}
+
+TEST(ActorsTests, AnswersMessages) {
+  EXPECT_EQ(run(R"(
+    fun doubler() {
+      var from = receive();
+      while (from != nil) {
+        send(from, receive() * 2);
+        from = receive();
+      }
+    }
+    var worker = spawn(doubler);
+    for (var i = 1; i <= 3; i = i + 1) {
+      send(worker, self());
+      send(worker, i);
+      print receive();
+    }
+    send(worker, nil);
+  )"),
+            "2.000000\n4.000000\n6.000000\n");
+}
+
+TEST(ActorsTests, ReportsErrors) {
+  EXPECT_EQ(run("fun f(a) {}\nspawn(f);"),
+            "Can only spawn functions without parameters!\n[line 2]\n");
+  EXPECT_EQ(run("class A {}\nsend(0, A);"),
+            "Can only send nil, booleans, numbers and strings!\n[line 2]\n");
+  EXPECT_EQ(run("send(1, 2);"), "Can only send to actors!\n[line 1]\n");
+  EXPECT_EQ(run("fun f() { print nil + 1; }\nspawn(f);"),
+            "Operand must be two numbers or two strings!\n[line 1]\n");
+}
+
+TEST(ActorsTests, AbandonsActorsNoOneCanWake) {
+  // Waiting on each other, or for actor 0, which is done.
+  EXPECT_EQ(run(R"(
+    fun waiter() {
+      print "waiting";
+      receive();
+      print "woken";
+    }
+    var first = spawn(waiter);
+    fun relay() {
+      receive();
+      send(first, 1);
+    }
+    spawn(relay);
+    spawn(relay);
+  )"),
+            "waiting\n");
+  // Woken, then left waiting again.
+  EXPECT_EQ(run(R"(
+    fun echo() {
+      for (;;) send(0, receive());
+    }
+    var echoer = spawn(echo);
+    send(echoer, "ping");
+    print receive();
+  )"),
+            "ping\n");
+}
+
+TEST(ActorsTests, StopsTheMainActorWaitingForNothing) {
+  EXPECT_EQ(run("print receive();"),
+            "No actor is left to send a message!\n[line 1]\n");
+  // Whether the worker is done before or after actor 0 parks.
+  EXPECT_EQ(run(R"(
+    fun worker() { print "worker done"; }
+    spawn(worker);
+    print receive();
+  )"),
+            "worker done\nNo actor is left to send a message!\n[line 4]\n");
+  EXPECT_EQ(run(R"(
+    fun waiter() { receive(); print "never"; }
+    var w = spawn(waiter);
+    send(0, "queued");
+    print receive();
+    print receive();
+  )"),
+            "queued\nNo actor is left to send a message!\n[line 6]\n");
+}
+
+TEST(ActorsTests, CachesAgainOnceActorsAreDone) {
+  auto parse = [](std::string_view source) {
+    std::vector<StmtPtr> statements = Parser{source}.parse();
+    Resolver{}.resolve(statements);
+    return statements;
+  };
+  // How many shapes the inline cache of `print a.b;` has seen.
+  auto cached = [](const std::vector<StmtPtr>& statements) {
+    const auto& print = static_cast<const Print&>(*statements.back());
+    return static_cast<const Get&>(*print.expression).cache.count;
+  };
+
+  Interpreter interpreter;
+  Actors actors{interpreter};
+  std::vector<StmtPtr> setup = parse(R"(
+    class P { init() { this.x = 1; } }
+    var p = P();
+    fun waiter() { receive(); }
+    var w = spawn(waiter);
+    print p.x;
+  )");
+  std::ostringstream out;
+  std::streambuf* saved = std::cout.rdbuf(out.rdbuf());
+  interpreter.interpret(setup);
+  // Another group of interpreters isn't held back by this one's actors.
+  Interpreter other;
+  std::vector<StmtPtr> alone = parse(R"(
+    class Q { init() { this.y = 2; } }
+    var q = Q();
+    print q.y;
+  )");
+  other.interpret(alone);
+
+  actors.join();
+  std::vector<StmtPtr> after = parse("print p.x;");
+  interpreter.interpret(after);
+  std::cout.rdbuf(saved);
+
+  EXPECT_EQ(out.str(), "1.000000\n2.000000\n1.000000\n");
+  EXPECT_EQ(cached(setup), 0);
+  EXPECT_EQ(cached(alone), 1);
+  EXPECT_EQ(cached(after), 1);
+}
@@ -0,0 +1,591 @@
+#include "closure_compiler.h"
+
+#include <string>
+#include <utility>  // std::exchange
+
+#include "LoxFunction.h"
+#include "LoxInstance.h"
+#include "environment.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "runtime_error.h"
+
+namespace {
+
+using ExprCode = ClosureCompiler::ExprCode;
+using Condition = std::function<bool(Interpreter&)>;
+
+// The value of a number literal, possibly in parentheses.
+bool numberLiteral(const Expr& expr, double& number) {
+  if (expr.kind == ExprKind::Grouping) {
+    return numberLiteral(*static_cast<const Grouping&>(expr).expression,
+                         number);
+  }
+  if (expr.kind != ExprKind::Literal) return false;
+  const Value& value = static_cast<const Literal&>(expr).value;
+  if (!value.isNumber()) return false;
+  number = value.asNumber();
+  return true;
+}
+
+[[noreturn]] void notNumbers(const Token& op) {
+  throw RuntimeError{op, "Operand must be two numbers!"};
+}
+
+// `left <op> right` for - * / and the comparisons, which only take numbers.
+template <class Result, class Operation>
+std::function<Result(Interpreter&)> numeric(ExprCode left, ExprCode right,
+                                            const Token& op,
+                                            Operation operation) {
+  return [left, right, &op, operation](Interpreter& interpreter) {
+    Value a = left(interpreter);
+    Value b = right(interpreter);
+    if (!a.isNumber() || !b.isNumber()) notNumbers(op);
+    return Result{operation(a.asNumber(), b.asNumber())};
+  };
+}
+
+// The same with a number literal on the right.
+template <class Result, class Operation>
+std::function<Result(Interpreter&)> numeric(ExprCode left, double b,
+                                            const Token& op,
+                                            Operation operation) {
+  return [left, b, &op, operation](Interpreter& interpreter) {
+    Value a = left(interpreter);
+    if (!a.isNumber()) notNumbers(op);
+    return Result{operation(a.asNumber(), b)};
+  };
+}
+
+template <class Result, class Operation>
+std::function<Result(Interpreter&)> numeric(Binary& expr, ExprCode left,
+                                            ExprCode right,
+                                            Operation operation) {
+  double b;
+  if (numberLiteral(*expr.right, b)) {
+    return numeric<Result>(std::move(left), b, expr.op, operation);
+  }
+  return numeric<Result>(std::move(left), std::move(right), expr.op,
+                         operation);
+}
+
+}  // namespace
+
+ClosureCompiler::StmtCode ClosureCompiler::compile(
+    const std::vector<StmtPtr>& statements) {
+  return sequence(statements);
+}
+
+const ClosureCompiler::StmtCode& ClosureCompiler::body(
+    const Function& declaration) {
+  auto [entry, inserted] = bodies_.try_emplace(&declaration);
+  if (inserted) {
+    int scopes = std::exchange(scopes_, 1);
+    entry->second = sequence(declaration.body);
+    scopes_ = scopes;
+  }
+  return entry->second;
+}
+
+ClosureCompiler::StmtCode ClosureCompiler::statement(Stmt& stmt) {
+  switch (stmt.kind) {
+    case StmtKind::Block:
+      return block(static_cast<Block&>(stmt));
+    case StmtKind::Class: {
+      // Classes are declared once; their methods are compiled like any
+      // other function when they are called.
+      auto& klass = static_cast<Class&>(stmt);
+      return [&klass](Interpreter& interpreter) {
+        return interpreter.visitClassStmt(klass);
+      };
+    }
+    case StmtKind::Expression: {
+      ExprCode expression =
+          this->expression(*static_cast<Expression&>(stmt).expression);
+      return [expression](Interpreter& interpreter) {
+        expression(interpreter);
+        return Completion::NORMAL;
+      };
+    }
+    case StmtKind::Function: {
+      auto& function = static_cast<Function&>(stmt);
+      return declaration(function.name, [&function](Interpreter& interpreter) {
+        return Value{interpreter.heap_.make<LoxFunction>(
+            &function, interpreter.environment)};
+      });
+    }
+    case StmtKind::If: {
+      auto& ifStmt = static_cast<If&>(stmt);
+      Condition test = condition(*ifStmt.condition);
+      StmtCode then = statement(*ifStmt.thenBranch);
+      if (ifStmt.elseBranch == nullptr) {
+        return [test, then](Interpreter& interpreter) {
+          if (test(interpreter)) return then(interpreter);
+          return Completion::NORMAL;
+        };
+      }
+      StmtCode otherwise = statement(*ifStmt.elseBranch);
+      return [test, then, otherwise](Interpreter& interpreter) {
+        return test(interpreter) ? then(interpreter) : otherwise(interpreter);
+      };
+    }
+    case StmtKind::Import: {
+      // Modules run once, compiled like the program that imports them.
+      auto& import = static_cast<Import&>(stmt);
+      return [&import](Interpreter& interpreter) {
+        return interpreter.visitImportStmt(import);
+      };
+    }
+    case StmtKind::Print: {
+      ExprCode expression =
+          this->expression(*static_cast<Print&>(stmt).expression);
+      return [expression](Interpreter& interpreter) {
+        Value value = expression(interpreter);
+        interpreter.output() << interpreter.stringify(value) + "\n";
+        return Completion::NORMAL;
+      };
+    }
+    case StmtKind::Return: {
+      auto& returnStmt = static_cast<Return&>(stmt);
+      if (returnStmt.value == nullptr) {
+        return [](Interpreter& interpreter) {
+          interpreter.returnValue_ = nullptr;
+          return Completion::RETURN;
+        };
+      }
+      ExprCode value =
+          returnStmt.tailCall
+              ? call(static_cast<Call&>(*returnStmt.value), true)
+              : expression(*returnStmt.value);
+      return [value](Interpreter& interpreter) {
+        interpreter.returnValue_ = value(interpreter);
+        return Completion::RETURN;
+      };
+    }
+    case StmtKind::Var: {
+      auto& var = static_cast<Var&>(stmt);
+      if (var.initializer == nullptr) {
+        return declaration(var.name, [](Interpreter&) { return Value{}; });
+      }
+      return declaration(var.name, expression(*var.initializer));
+    }
+    case StmtKind::While:
+      return loop(static_cast<While&>(stmt));
+  }
+  return StmtCode();
+}
+
+ClosureCompiler::StmtCode ClosureCompiler::sequence(
+    const std::vector<StmtPtr>& statements) {
+  std::vector<StmtCode> code;
+  for (const auto& statement : statements) {
+    code.push_back(this->statement(*statement));
+  }
+  if (code.size() == 1) return std::move(code[0]);
+  return [code = std::move(code)](Interpreter& interpreter) {
+    for (const StmtCode& statement : code) {
+      if (statement(interpreter) == Completion::RETURN) {
+        return Completion::RETURN;
+      }
+    }
+    return Completion::NORMAL;
+  };
+}
+
+ClosureCompiler::StmtCode ClosureCompiler::block(Block& stmt) {
+  if (stmt.flat) {
+    // Runs in the enclosing environment, see Interpreter::visitBlockStmt.
+    StmtCode body = sequence(stmt.statements);
+    return [body](Interpreter& interpreter) {
+      size_t frame = interpreter.environment->size();
+      Completion completion = body(interpreter);
+      interpreter.environment->truncate(frame);
+      return completion;
+    };
+  }
+  ++scopes_;
+  StmtCode body = sequence(stmt.statements);
+  --scopes_;
+  return [body](Interpreter& interpreter) {
+    Ref<Environment> block =
+        interpreter.heap_.makeEnvironment(interpreter.environment);
+    Completion completion;
+    {
+      Interpreter::EnvironmentScope scope{
+          interpreter, std::exchange(interpreter.environment, block)};
+      completion = body(interpreter);
+    }
+    interpreter.heap_.recycle(std::move(block));
+    return completion;
+  };
+}
+
+ClosureCompiler::StmtCode ClosureCompiler::declaration(const Token& name,
+                                                       ExprCode value) {
+  if (scopes_ == 0) {
+    return [&name, value](Interpreter& interpreter) {
+      interpreter.globals->define(name.symbol_, value(interpreter));
+      return Completion::NORMAL;
+    };
+  }
+  return [value](Interpreter& interpreter) {
+    interpreter.environment->define(value(interpreter));
+    return Completion::NORMAL;
+  };
+}
+
+ClosureCompiler::StmtCode ClosureCompiler::loop(While& stmt) {
+  Condition test = condition(*stmt.condition);
+  StmtCode body = statement(*stmt.body);
+  return [test, body, &stmt](Interpreter& interpreter) {
+    uint32_t iterations = 0;
+    while (test(interpreter)) {
+      if (body(interpreter) == Completion::RETURN) return Completion::RETURN;
+      // See Interpreter::visitWhileStmt.
+      Jit* jit = interpreter.jit_;
+      if (jit != nullptr && ++iterations == jit->threshold() &&
+          interpreter.function_ != nullptr &&
+          jit->enterLoop(*interpreter.function_, stmt,
+                         *interpreter.environment, interpreter.returnValue_)) {
+        return Completion::RETURN;
+      }
+    }
+    return Completion::NORMAL;
+  };
+}
+
+ExprCode ClosureCompiler::expression(Expr& expr) {
+  switch (expr.kind) {
+    case ExprKind::Assign:
+      return assign(static_cast<Assign&>(expr));
+    case ExprKind::Binary:
+      return binary(static_cast<Binary&>(expr));
+    case ExprKind::Call:
+      return call(static_cast<Call&>(expr));
+    case ExprKind::Get:
+      return get(static_cast<Get&>(expr));
+    case ExprKind::Grouping:
+      return expression(*static_cast<Grouping&>(expr).expression);
+    case ExprKind::Literal: {
+      Value value = static_cast<Literal&>(expr).value;
+      return [value](Interpreter&) { return value; };
+    }
+    case ExprKind::Logical:
+      return logical(static_cast<Logical&>(expr));
+    case ExprKind::Set:
+      return set(static_cast<Set&>(expr));
+    case ExprKind::Super: {
+      auto& super = static_cast<Super&>(expr);
+      return [&super](Interpreter& interpreter) {
+        return interpreter.visitSuperExpr(super);
+      };
+    }
+    case ExprKind::This: {
+      auto& self = static_cast<This&>(expr);
+      return [&self](Interpreter& interpreter) {
+        return interpreter.visitThisExpr(self);
+      };
+    }
+    case ExprKind::Unary:
+      return unary(static_cast<Unary&>(expr));
+    case ExprKind::Variable:
+      return variable(static_cast<Variable&>(expr));
+  }
+  return ExprCode();
+}
+
+ExprCode ClosureCompiler::unary(Unary& expr) {
+  if (expr.op.type_ == BANG) {
+    Condition test = condition(*expr.right);
+    return [test](Interpreter& interpreter) {
+      return Value{!test(interpreter)};
+    };
+  }
+  ExprCode right = expression(*expr.right);
+  const Token& op = expr.op;
+  return [right, &op](Interpreter& interpreter) {
+    Value value = right(interpreter);
+    interpreter.checkNumberOperand(op, value);
+    return Value{-value.asNumber()};
+  };
+}
+
+ExprCode ClosureCompiler::binary(Binary& expr) {
+  ExprCode left = expression(*expr.left);
+  ExprCode right = expression(*expr.right);
+  switch (expr.op.type_) {
+    case PLUS: {
+      const Token& op = expr.op;
+      return [left, right, &op](Interpreter& interpreter) {
+        Value a = left(interpreter);
+        Value b = right(interpreter);
+        if (a.isNumber() && b.isNumber()) {
+          return Value{a.asNumber() + b.asNumber()};
+        }
+        if (a.isString() && b.isString()) {
+          return Value{new LoxString{a.asString() + b.asString()}};
+        }
+        throw RuntimeError{op, "Operand must be two numbers or two strings!"};
+      };
+    }
+    case MINUS:
+      return numeric<Value>(expr, left, right, std::minus<double>());
+    case STAR:
+      return numeric<Value>(expr, left, right, std::multiplies<double>());
+    case SLASH:
+      return numeric<Value>(expr, left, right, std::divides<double>());
+    default: {
+      Condition test = comparison(expr);
+      return [test](Interpreter& interpreter) {
+        return Value{test(interpreter)};
+      };
+    }
+  }
+}
+
+ExprCode ClosureCompiler::variable(Variable& expr) {
+  if (expr.depth == -1) {
+    const Token& name = expr.name;
+    return [&name](Interpreter& interpreter) {
+      return interpreter.globals->get(name);
+    };
+  }
+  int slot = expr.slot;
+  // Most variables are the current function's or block's own.
+  if (expr.depth == 0) {
+    return [slot](Interpreter& interpreter) {
+      return interpreter.environment->getAt(0, slot);
+    };
+  }
+  int depth = expr.depth;
+  return [depth, slot](Interpreter& interpreter) {
+    return interpreter.environment->getAt(depth, slot);
+  };
+}
+
+ExprCode ClosureCompiler::assign(Assign& expr) {
+  ExprCode value = expression(*expr.value);
+  if (expr.depth == -1) {
+    const Token& name = expr.name;
+    return [value, &name](Interpreter& interpreter) {
+      Value result = value(interpreter);
+      interpreter.globals->assign(name, result);
+      return result;
+    };
+  }
+  int slot = expr.slot;
+  if (expr.depth == 0) {
+    return [value, slot](Interpreter& interpreter) {
+      Value result = value(interpreter);
+      interpreter.environment->assignAt(0, slot, result);
+      return result;
+    };
+  }
+  int depth = expr.depth;
+  return [value, depth, slot](Interpreter& interpreter) {
+    Value result = value(interpreter);
+    interpreter.environment->assignAt(depth, slot, result);
+    return result;
+  };
+}
+
+ExprCode ClosureCompiler::logical(Logical& expr) {
+  ExprCode left = expression(*expr.left);
+  ExprCode right = expression(*expr.right);
+  if (expr.op.type_ == OR) {
+    return [left, right](Interpreter& interpreter) {
+      Value value = left(interpreter);
+      if (value.isTruthy()) return value;
+      return right(interpreter);
+    };
+  }
+  return [left, right](Interpreter& interpreter) {
+    Value value = left(interpreter);
+    if (!value.isTruthy()) return value;
+    return right(interpreter);
+  };
+}
+
+ExprCode ClosureCompiler::call(Call& expr, bool tail) {
+  std::vector<ExprCode> arguments;
+  for (const auto& argument : expr.arguments) {
+    arguments.push_back(expression(*argument));
+  }
+
+  // Methods are called directly, as in Interpreter::invoke.
+  if (expr.callee->kind == ExprKind::Get) {
+    auto& get = static_cast<Get&>(*expr.callee);
+    ExprCode object = expression(*get.object);
+    return [object, arguments, tail, &expr, &get](Interpreter& interpreter) {
+      Value value = object(interpreter);
+      if (!value.isInstance()) {
+        throw RuntimeError{get.name, "Only instances have properties!"};
+      }
+      LoxInstance* instance = value.asInstance();
+      PropertyCache::Entry property =
+          interpreter.findProperty(instance, get.name, get.cache);
+      if (property.slot >= 0) {
+        Value callee = instance->fields[property.slot];
+        return apply(interpreter, expr, callee, arguments, tail);
+      }
+      Interpreter::ArgumentScope scope{interpreter, interpreter.argumentsTop_};
+      Value* values = push(interpreter, expr, *property.method, arguments);
+      if (tail && interpreter.deferCall(*property.method, instance, values)) {
+        return Value{};
+      }
+      return property.method->invoke(interpreter, instance, values);
+    };
+  }
+  if (expr.callee->kind == ExprKind::Super) {
+    auto& super = static_cast<Super&>(*expr.callee);
+    return [arguments, tail, &expr, &super](Interpreter& interpreter) {
+      LoxFunction* method = interpreter.findSuperMethod(super);
+      Interpreter::ArgumentScope scope{interpreter, interpreter.argumentsTop_};
+      Value* values = push(interpreter, expr, *method, arguments);
+      LoxInstance* instance =
+          interpreter.environment->getAt(super.depth - 1, 0).asInstance();
+      if (tail && interpreter.deferCall(*method, instance, values)) {
+        return Value{};
+      }
+      return method->invoke(interpreter, instance, values);
+    };
+  }
+
+  ExprCode callee = expression(*expr.callee);
+  return [callee, arguments, tail, &expr](Interpreter& interpreter) {
+    return apply(interpreter, expr, callee(interpreter), arguments, tail);
+  };
+}
+
+Value ClosureCompiler::apply(Interpreter& interpreter, Call& expr,
+                             const Value& callee,
+                             const std::vector<ExprCode>& arguments,
+                             bool tail) {
+  if (!callee.isCallable()) {
+    throw RuntimeError{expr.paren, "Can only call function and classes!"};
+  }
+  LoxCallable* function = callee.asCallable();
+  Interpreter::ArgumentScope scope{interpreter, interpreter.argumentsTop_};
+  Value* values = push(interpreter, expr, *function, arguments);
+  if (tail && interpreter.deferCall(*function, nullptr, values)) return Value{};
+  return interpreter.call(expr, *function, values);
+}
+
+Value* ClosureCompiler::push(Interpreter& interpreter, Call& expr,
+                             LoxCallable& function,
+                             const std::vector<ExprCode>& arguments) {
+  Value* values = interpreter.argumentsTop_;
+  size_t used = interpreter.argumentsTop_ - interpreter.arguments_.get();
+  if (arguments.size() > Interpreter::kArgumentsMax - used) {
+    throw RuntimeError{expr.paren, "Stack overflow!"};
+  }
+  for (const ExprCode& argument : arguments) {
+    Value value = argument(interpreter);
+    *interpreter.argumentsTop_++ = std::move(value);
+  }
+  interpreter.checkArity(expr, function);
+  return values;
+}
+
+ExprCode ClosureCompiler::get(Get& expr) {
+  ExprCode object = expression(*expr.object);
+  return [object, &expr](Interpreter& interpreter) {
+    Value value = object(interpreter);
+    if (!value.isInstance()) {
+      throw RuntimeError{expr.name, "Only instances have properties!"};
+    }
+    LoxInstance* instance = value.asInstance();
+    PropertyCache::Entry property =
+        interpreter.findProperty(instance, expr.name, expr.cache);
+    if (property.slot >= 0) return instance->fields[property.slot];
+    return property.method->bind(interpreter, instance);
+  };
+}
+
+ExprCode ClosureCompiler::set(Set& expr) {
+  ExprCode object = expression(*expr.object);
+  ExprCode value = expression(*expr.value);
+  return [object, value, &expr](Interpreter& interpreter) {
+    Value target = object(interpreter);
+    if (!target.isInstance()) {
+      throw RuntimeError{expr.name, "Only instances have fields!"};
+    }
+    Value result = value(interpreter);
+    interpreter.setProperty(target.asInstance(), expr, result);
+    return result;
+  };
+}
+
+Condition ClosureCompiler::condition(Expr& expr) {
+  switch (expr.kind) {
+    case ExprKind::Grouping:
+      return condition(*static_cast<Grouping&>(expr).expression);
+    case ExprKind::Literal: {
+      bool truthy = static_cast<Literal&>(expr).value.isTruthy();
+      return [truthy](Interpreter&) { return truthy; };
+    }
+    case ExprKind::Unary: {
+      auto& unary = static_cast<Unary&>(expr);
+      if (unary.op.type_ != BANG) break;
+      Condition test = condition(*unary.right);
+      return [test](Interpreter& interpreter) { return !test(interpreter); };
+    }
+    case ExprKind::Logical: {
+      auto& logical = static_cast<Logical&>(expr);
+      Condition left = condition(*logical.left);
+      Condition right = condition(*logical.right);
+      if (logical.op.type_ == OR) {
+        return [left, right](Interpreter& interpreter) {
+          return left(interpreter) || right(interpreter);
+        };
+      }
+      return [left, right](Interpreter& interpreter) {
+        return left(interpreter) && right(interpreter);
+      };
+    }
+    case ExprKind::Binary: {
+      auto& binary = static_cast<Binary&>(expr);
+      TokenType op = binary.op.type_;
+      if (op == BANG_EQUAL || op == EQUAL_EQUAL || op == GREATER ||
+          op == GREATER_EQUAL || op == LESS || op == LESS_EQUAL) {
+        return comparison(binary);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  ExprCode value = expression(expr);
+  return [value](Interpreter& interpreter) {
+    return value(interpreter).isTruthy();
+  };
+}
+
+Condition ClosureCompiler::comparison(Binary& expr) {
+  ExprCode left = expression(*expr.left);
+  ExprCode right = expression(*expr.right);
+  switch (expr.op.type_) {
+    case BANG_EQUAL:
+      return [left, right](Interpreter& interpreter) {
+        Value a = left(interpreter);
+        Value b = right(interpreter);
+        return a != b;
+      };
+    case EQUAL_EQUAL:
+      return [left, right](Interpreter& interpreter) {
+        Value a = left(interpreter);
+        Value b = right(interpreter);
+        return a == b;
+      };
+    case GREATER:
+      return numeric<bool>(expr, left, right, std::greater<double>());
+    case GREATER_EQUAL:
+      return numeric<bool>(expr, left, right, std::greater_equal<double>());
+    case LESS:
+      return numeric<bool>(expr, left, right, std::less<double>());
+    case LESS_EQUAL:
+      return numeric<bool>(expr, left, right, std::less_equal<double>());
+    default:
+      return Condition();
+  }
+}
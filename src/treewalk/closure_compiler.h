@@ -0,0 +1,75 @@
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "expr.h"
+#include "stmt.h"
+#include "value.h"
+
+class Interpreter;
+class LoxCallable;
+enum class Completion;
+
+// Turns the resolved tree into closures, each specialized for its node:
+// operators are picked at compile time, local variables are read at the
+// depth the Resolver found, number literals are folded into the operation
+// that uses them, and conditions produce a bool instead of a Value. Running
+// a program then is a chain of direct calls with no dispatch on node kinds.
+//
+// Compiled code runs on an Interpreter that has the compiler set, sharing
+// its environments, heap and callables; only the evaluation of nodes is
+// replaced. Function bodies are compiled on their first call.
+//
+// Compiling costs an allocation per node, and every call then looks its
+// body up, so the closures only pay off on code that runs many times: hot
+// loops and functions called over and over. Short programs that mostly
+// create closures and call each one a few times run about as fast as, or a
+// little slower than, walking the tree (bench/closures.lox).
+class ClosureCompiler {
+ public:
+  using ExprCode = std::function<Value(Interpreter&)>;
+  using StmtCode = std::function<Completion(Interpreter&)>;
+
+  // `statements` runs at the top level, declaring globals.
+  StmtCode compile(const std::vector<StmtPtr>& statements);
+  // The body of `declaration`, to run in the environment of a call.
+  const StmtCode& body(const Function& declaration);
+
+ private:
+  using Condition = std::function<bool(Interpreter&)>;
+
+  StmtCode statement(Stmt& stmt);
+  StmtCode sequence(const std::vector<StmtPtr>& statements);
+  StmtCode block(Block& stmt);
+  StmtCode declaration(const Token& name, ExprCode value);
+  StmtCode loop(While& stmt);
+
+  ExprCode expression(Expr& expr);
+  ExprCode unary(Unary& expr);
+  ExprCode binary(Binary& expr);
+  ExprCode variable(Variable& expr);
+  ExprCode assign(Assign& expr);
+  ExprCode logical(Logical& expr);
+  // A `tail` call is deferred when it can be, see Interpreter::deferCall.
+  ExprCode call(Call& expr, bool tail = false);
+  ExprCode get(Get& expr);
+  ExprCode set(Set& expr);
+  // Evaluates `expr` for its truthiness only.
+  Condition condition(Expr& expr);
+  Condition comparison(Binary& expr);
+
+  // Calls `callee` with the arguments of `expr`.
+  static Value apply(Interpreter& interpreter, Call& expr, const Value& callee,
+                     const std::vector<ExprCode>& arguments, bool tail);
+  // Evaluates `arguments` onto the interpreter's argument stack and checks
+  // their number against `function`. Returns where they start.
+  static Value* push(Interpreter& interpreter, Call& expr,
+                     LoxCallable& function,
+                     const std::vector<ExprCode>& arguments);
+
+  std::unordered_map<const Function*, StmtCode> bodies_;
+  // Statements outside any block or function declare globals.
+  int scopes_{0};
+};
@@ -0,0 +1,183 @@
+#include "closure_compiler.h"
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "interpreter.h"
+#include "parser.h"
+#include "resolver.h"
+#include "runtime_error.h"
+
+namespace {
+
+// Runs `source` and returns what it printed, errors included, either
+// walking the tree or through compiled closures.
+std::string run(std::string_view source, bool compiled) {
+  std::vector<StmtPtr> statements = Parser{source}.parse();
+  Resolver{}.resolve(statements);
+
+  Interpreter interpreter;
+  ClosureCompiler compiler;
+  if (compiled) interpreter.setClosureCompiler(&compiler);
+  std::ostringstream out;
+  std::streambuf* savedOut = std::cout.rdbuf(out.rdbuf());
+  std::streambuf* savedErr = std::cerr.rdbuf(out.rdbuf());
+  interpreter.interpret(statements);
+  std::cout.rdbuf(savedOut);
+  std::cerr.rdbuf(savedErr);
+  hadRuntimeError = false;
+  return out.str();
+}
+
+}  // namespace
+
+#define EXPECT_SAME_OUTPUT(source) \
+  EXPECT_EQ(run(source, true), run(source, false))
+
+TEST(ClosureCompilerTests, RunsStatements) {
+  EXPECT_SAME_OUTPUT(R"(
+    var a = 1;
+    { var b = a + 1; print b; }
+    print a;
+    if (a > 1) print "big"; else print "small";
+    var i = 0;
+    while (i < 3) { print i; i = i + 1; }
+    for (var j = 0; j < 2; j = j + 1) print j * 10;
+    print nil or "default";
+    print 0 and "zero";
+    print !(1 == 1) == false;
+    print "a" + "b" != "ab";
+    print -(2 / 4) * 3 - 1;
+  )");
+}
+
+TEST(ClosureCompilerTests, CallsFunctionsAndClosures) {
+  EXPECT_SAME_OUTPUT(R"(
+    fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+    print fib(15);
+    fun counter() {
+      var count = 0;
+      fun increment() { count = count + 1; return count; }
+      return increment;
+    }
+    var next = counter();
+    next();
+    print next();
+    fun early(n) {
+      while (true) { if (n > 3) return n; n = n + 1; }
+    }
+    print early(0);
+    fun nothing() {}
+    print nothing();
+    print clock() > 0;
+  )");
+}
+
+TEST(ClosureCompilerTests, RunsFlatBlocks) {
+  // Only the last block of `scopes` gets an environment of its own.
+  const char* program = R"(
+    fun scopes(n) {
+      var a = "outer";
+      for (var i = 0; i < n; i = i + 1) {
+        var a = "inner";
+        { var b = a + "!"; if (i == n - 1) print b; }
+        if (i == 1000) return a;
+      }
+      { var c = "sibling"; print c + " " + a; }
+      var d = "after";
+      {
+        var e = d;
+        fun get() { return e; }
+        return get();
+      }
+    }
+    print scopes(2000);
+    print scopes(3);
+  )";
+  EXPECT_EQ(run(program, false), "inner\ninner!\nsibling outer\nafter\n");
+  EXPECT_SAME_OUTPUT(program);
+}
+
+TEST(ClosureCompilerTests, RunsTailCallsInConstantStack) {
+  // Far deeper than the argument stack, let alone the C++ stack, would
+  // allow if every call nested.
+  const char* program = R"(
+    fun count(n, total) {
+      if (n == 0) return total;
+      return count(n - 1, total + 1);
+    }
+    print count(200000, 0);
+    fun isEven(n) { if (n == 0) return true; return isOdd(n - 1); }
+    fun isOdd(n) { if (n == 0) return false; return isEven(n - 1); }
+    print isEven(100001);
+    class Walker {
+      init(steps) { this.steps = steps; }
+      walk(n) {
+        if (n == this.steps) return n;
+        return this.walk(n + 1);
+      }
+    }
+    class Runner < Walker {
+      walk(n) { return super.walk(n); }
+    }
+    print Runner(100000).walk(0);
+    fun adder(a) { fun add(b) { return a + b; } return add; }
+    fun viaValue(n) { return adder(n)(1); }
+    print viaValue(41);
+    fun make() { return Walker(3); }
+    print make().steps;
+    fun now() { return clock(); }
+    print now() > 0;
+  )";
+  EXPECT_EQ(run(program, false),
+            "200000.000000\nfalse\n100000.000000\n42.000000\n3.000000\n"
+            "true\n");
+  EXPECT_SAME_OUTPUT(program);
+}
+
+TEST(ClosureCompilerTests, RunsClasses) {
+  EXPECT_SAME_OUTPUT(R"(
+    class Shape {
+      init(name) { this.name = name; }
+      describe() { return this.name + " with area " + this.area(); }
+      area() { return "unknown"; }
+    }
+    class Square < Shape {
+      init(side) { super.init("square"); this.side = side; }
+      area() { return "some"; }
+      parent() { return super.area; }
+    }
+    var square = Square(2);
+    print square.describe();
+    print square.parent()();
+    fun field() { return "field"; }
+    square.callback = field;
+    print square.callback();
+    print square;
+  )");
+}
+
+TEST(ClosureCompilerTests, RaisesTheInterpreterErrors) {
+  const char* programs[] = {
+      "print -\"a\";",
+      "print 1 < \"a\";",
+      "print 1 + nil;",
+      "print 1 * \"a\";",
+      "print undefined;",
+      "undefined = 1;",
+      "var a = 1; a();",
+      "fun f(a) {} f();",
+      "var a = 1; print a.b;",
+      "var a = 1; a.b = 2;",
+      "class A {} print A().b;",
+      "class A {} class B < A { f() { return super.g(); } } B().f();",
+  };
+  for (const char* program : programs) {
+    EXPECT_SAME_OUTPUT(program) << program;
+  }
+}
@@ -2,26 +2,47 @@
 
 #include "runtime_error.h"
 
-void Environment::define(const std::string& name, std::any value) {
+void Environment::define(Symbol name, Value value) {
+  if (name >= values.size()) {
+    values.resize(name + 1);
+    defined.resize(name + 1);
+  }
   values[name] = std::move(value);
+  defined[name] = true;
 }
-std::any Environment::get(const Token& name) {
-  auto elem = values.find(name.lexeme_);
-  if (elem != values.end()) {
-    return elem->second;
+Value Environment::get(const Token& name) {
+  if (isDefined(name.symbol_)) {
+    return values[name.symbol_];
   }
   if (enclosing != nullptr) return enclosing->get(name);
-  throw RuntimeError(name, "Undefined variable '" + name.lexeme_ + "'!");
+  throw RuntimeError(name, "Undefined variable '" +
+                               symbols().name(name.symbol_) + "'!");
 }
-void Environment::assign(const Token& name, std::any value) {
-  auto elem = values.find(name.lexeme_);
-  if (elem != values.end()) {
-    elem->second = std::move(value);
+void Environment::assign(const Token& name, Value value) {
+  if (isDefined(name.symbol_)) {
+    values[name.symbol_] = std::move(value);
     return;
   }
   if (enclosing != nullptr) {
     enclosing->assign(name, value);
     return;
   }
-  throw RuntimeError(name, "Undefined variable '" + name.lexeme_ + "'!");
+  throw RuntimeError(name, "Undefined variable '" +
+                               symbols().name(name.symbol_) + "'!");
+}
+
+void Environment::trace(std::vector<LoxObject*>& references) const {
+  for (const Value& value : values) {
+    if (value.isObject()) references.push_back(value.asObject());
+  }
+  for (const Value& value : slots) {
+    if (value.isObject()) references.push_back(value.asObject());
+  }
+  if (enclosing != nullptr) references.push_back(enclosing.get());
+}
+void Environment::clear() {
+  values.clear();
+  defined.clear();
+  slots.clear();
+  enclosing = nullptr;
 }
@@ -1,23 +1,70 @@
 #pragma once
 
-#include <any>
-#include <map>
-#include <memory>
+#include <cstddef>
 #include <string>
+#include <vector>
 
+#include "../token/symbol.h"
 #include "../token/token.h"
+#include "LoxObject.h"
+#include "value.h"
 
-class Environment : public std::enable_shared_from_this<Environment> {
+// Globals are looked up by name since they can be referenced before they are
+// defined; they are indexed by interned Symbol. Every other environment only
+// holds locals, stored in the order they were declared so the slots computed
+// by the Resolver index them directly.
+//
+// Environments are allocated on the interpreter's Heap: a closure stored in
+// the environment it captures is a cycle that only the collector can free.
+class Environment : public LoxObject {
  public:
-  Environment() : enclosing(nullptr) {}
-  Environment(std::shared_ptr<Environment> enclosing)
-      : enclosing(std::move(enclosing)) {}
+  Environment() : LoxObject{ObjectType::ENVIRONMENT} {}
+  Environment(Ref<Environment> enclosing)
+      : LoxObject{ObjectType::ENVIRONMENT}, enclosing(std::move(enclosing)) {}
 
-  void define(const std::string& name, std::any value);
-  void assign(const Token& name, std::any value);
-  std::any get(const Token& name);
+  void define(Symbol name, Value value);
+  void assign(const Token& name, Value value);
+  Value get(const Token& name);
+  // The global `name`, or nullptr if there is none.
+  const Value* find(Symbol name) const {
+    return isDefined(name) ? &values[name] : nullptr;
+  }
+
+  void define(Value value) { slots.push_back(std::move(value)); }
+  const Value& getAt(int depth, int slot) {
+    return ancestor(depth)->slots[slot];
+  }
+  void assignAt(int depth, int slot, Value value) {
+    ancestor(depth)->slots[slot] = std::move(value);
+  }
+  // A flat block (see Resolver) keeps its locals on the end of the
+  // environment it runs in, and pops them off with truncate(size()) when it
+  // is done with them.
+  size_t size() const { return slots.size(); }
+  void truncate(size_t size) {
+    slots.erase(slots.begin() + size, slots.end());
+  }
+
+  void trace(std::vector<LoxObject*>& references) const override;
+  void clear() override;
 
  private:
-  std::map<std::string, std::any> values;
-  std::shared_ptr<Environment> enclosing;
-};
\ No newline at end of file
+  friend class Heap;    // Resets pooled environments.
+  friend class Actors;  // Copies environments into another actor's heap.
+
+  Environment* ancestor(int depth) {
+    Environment* environment = this;
+    for (int i = 0; i < depth; ++i) {
+      environment = environment->enclosing.get();
+    }
+    return environment;
+  }
+  bool isDefined(Symbol name) const {
+    return name < defined.size() && defined[name];
+  }
+
+  std::vector<Value> values;
+  std::vector<bool> defined;
+  std::vector<Value> slots;
+  Ref<Environment> enclosing;
+};
@@ -1,130 +1,209 @@
 #pragma once
 
-#include <any>
 #include <memory>
 #include <utility>  // std::move
 #include <vector>
 
 #include "../token/token.h"
+#include "shape.h"
+#include "value.h"
 
 struct Assign;
 struct Binary;
 struct Call;
+struct Get;
 struct Grouping;
 struct Literal;
 struct Logical;
+struct Set;
+struct Super;
+struct This;
 struct Unary;
 struct Variable;
 
-struct ExprVisitor {
-  virtual std::any visitAssignExpr(std::shared_ptr<Assign> expr) = 0;
-  virtual std::any visitBinaryExpr(std::shared_ptr<Binary> expr) = 0;
-  virtual std::any visitCallExpr(std::shared_ptr<Call> expr) = 0;
-  virtual std::any visitGroupingExpr(std::shared_ptr<Grouping> expr) = 0;
-  virtual std::any visitLiteralExpr(std::shared_ptr<Literal> expr) = 0;
-  virtual std::any visitLogicalExpr(std::shared_ptr<Logical> expr) = 0;
-  virtual std::any visitUnaryExpr(std::shared_ptr<Unary> expr) = 0;
-  virtual std::any visitVariableExpr(std::shared_ptr<Variable> expr) = 0;
-  virtual ~ExprVisitor() = default;
+enum class ExprKind {
+  Assign,
+  Binary,
+  Call,
+  Get,
+  Grouping,
+  Literal,
+  Logical,
+  Set,
+  Super,
+  This,
+  Unary,
+  Variable,
 };
 
 struct Expr {
-  virtual std::any accept(ExprVisitor& visitor) = 0;
+  explicit Expr(ExprKind kind) : kind{kind} {}
+  virtual ~Expr() = default;
+
+  const ExprKind kind;
 };
 
-struct Assign : Expr, public std::enable_shared_from_this<Assign> {
-  Assign(Token name, std::shared_ptr<Expr> value)
-      : name{std::move(name)}, value{std::move(value)} {}
+using ExprPtr = std::unique_ptr<Expr>;
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitAssignExpr(shared_from_this());
-  }
+struct Assign : Expr {
+  Assign(Token name, ExprPtr value)
+      : Expr{ExprKind::Assign},
+        name{std::move(name)},
+        value{std::move(value)} {}
 
   const Token name;
-  const std::shared_ptr<Expr> value;
+  ExprPtr value;
+
+  int depth{-1};
+  int slot{-1};
 };
 
-struct Binary : Expr, public std::enable_shared_from_this<Binary> {
-  Binary(std::shared_ptr<Expr> left, Token op, std::shared_ptr<Expr> right)
-      : left{std::move(left)}, op{std::move(op)}, right{std::move(right)} {}
+struct Binary : Expr {
+  Binary(ExprPtr left, Token op, ExprPtr right)
+      : Expr{ExprKind::Binary},
+        left{std::move(left)},
+        op{std::move(op)},
+        right{std::move(right)} {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitBinaryExpr(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> left;
+  ExprPtr left;
   const Token op;
-  const std::shared_ptr<Expr> right;
+  ExprPtr right;
 };
 
-struct Call : Expr, public std::enable_shared_from_this<Call> {
-  Call(std::shared_ptr<Expr> callee, Token paren,
-       std::vector<std::shared_ptr<Expr>> arguments)
-      : callee{std::move(callee)},
+struct Call : Expr {
+  Call(ExprPtr callee, Token paren, std::vector<ExprPtr> arguments)
+      : Expr{ExprKind::Call},
+        callee{std::move(callee)},
         paren{std::move(paren)},
         arguments{std::move(arguments)} {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitCallExpr(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> callee;
+  ExprPtr callee;
   const Token paren;
-  const std::vector<std::shared_ptr<Expr>> arguments;
+  std::vector<ExprPtr> arguments;
+
+  const void* checkedDeclaration{nullptr};
 };
 
-struct Grouping : Expr, public std::enable_shared_from_this<Grouping> {
-  Grouping(std::shared_ptr<Expr> expression)
-      : expression{std::move(expression)} {}
+struct Get : Expr {
+  Get(ExprPtr object, Token name)
+      : Expr{ExprKind::Get}, object{std::move(object)}, name{std::move(name)} {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitGroupingExpr(shared_from_this());
-  }
+  ExprPtr object;
+  const Token name;
 
-  const std::shared_ptr<Expr> expression;
+  PropertyCache cache{};
 };
 
-struct Literal : Expr, public std::enable_shared_from_this<Literal> {
-  Literal(std::any value) : value{std::move(value)} {}
+struct Grouping : Expr {
+  Grouping(ExprPtr expression)
+      : Expr{ExprKind::Grouping}, expression{std::move(expression)} {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitLiteralExpr(shared_from_this());
-  }
-
-  const std::any value;
+  ExprPtr expression;
 };
 
-struct Logical : Expr, public std::enable_shared_from_this<Logical> {
-  Logical(std::shared_ptr<Expr> left, Token op, std::shared_ptr<Expr> right)
-      : left{std::move(left)}, op{std::move(op)}, right{std::move(right)} {}
+struct Literal : Expr {
+  Literal(Value value) : Expr{ExprKind::Literal}, value{std::move(value)} {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitLogicalExpr(shared_from_this());
-  }
+  const Value value;
+};
+
+struct Logical : Expr {
+  Logical(ExprPtr left, Token op, ExprPtr right)
+      : Expr{ExprKind::Logical},
+        left{std::move(left)},
+        op{std::move(op)},
+        right{std::move(right)} {}
 
-  const std::shared_ptr<Expr> left;
+  ExprPtr left;
   const Token op;
-  const std::shared_ptr<Expr> right;
+  ExprPtr right;
 };
 
-struct Unary : Expr, public std::enable_shared_from_this<Unary> {
-  Unary(Token op, std::shared_ptr<Expr> right)
-      : op{std::move(op)}, right{std::move(right)} {}
+struct Set : Expr {
+  Set(ExprPtr object, Token name, ExprPtr value)
+      : Expr{ExprKind::Set},
+        object{std::move(object)},
+        name{std::move(name)},
+        value{std::move(value)} {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitUnaryExpr(shared_from_this());
-  }
+  ExprPtr object;
+  const Token name;
+  ExprPtr value;
 
-  const Token op;
-  const std::shared_ptr<Expr> right;
+  PropertyCache cache{};
 };
 
-struct Variable : Expr, public std::enable_shared_from_this<Variable> {
-  Variable(Token name) : name{std::move(name)} {}
+struct Super : Expr {
+  Super(Token keyword, Token method)
+      : Expr{ExprKind::Super},
+        keyword{std::move(keyword)},
+        method{std::move(method)} {}
 
-  std::any accept(ExprVisitor& visitor) override {
-    return visitor.visitVariableExpr(shared_from_this());
-  }
+  const Token keyword;
+  const Token method;
+
+  int depth{-1};
+  int slot{-1};
+};
+
+struct This : Expr {
+  This(Token keyword) : Expr{ExprKind::This}, keyword{std::move(keyword)} {}
+
+  const Token keyword;
+
+  int depth{-1};
+  int slot{-1};
+};
+
+struct Unary : Expr {
+  Unary(Token op, ExprPtr right)
+      : Expr{ExprKind::Unary}, op{std::move(op)}, right{std::move(right)} {}
+
+  const Token op;
+  ExprPtr right;
+};
+
+struct Variable : Expr {
+  Variable(Token name) : Expr{ExprKind::Variable}, name{std::move(name)} {}
 
   const Token name;
+
+  int depth{-1};
+  int slot{-1};
+};
+
+// A visitor derives from ExprVisitor<Self, R> and implements
+// R visit<Kind>Expr(<Kind>&) for every node kind.
+template <class Visitor, class R>
+struct ExprVisitor {
+  R visitExpr(Expr& expr) {
+    auto& visitor = static_cast<Visitor&>(*this);
+    switch (expr.kind) {
+      case ExprKind::Assign:
+        return visitor.visitAssignExpr(static_cast<Assign&>(expr));
+      case ExprKind::Binary:
+        return visitor.visitBinaryExpr(static_cast<Binary&>(expr));
+      case ExprKind::Call:
+        return visitor.visitCallExpr(static_cast<Call&>(expr));
+      case ExprKind::Get:
+        return visitor.visitGetExpr(static_cast<Get&>(expr));
+      case ExprKind::Grouping:
+        return visitor.visitGroupingExpr(static_cast<Grouping&>(expr));
+      case ExprKind::Literal:
+        return visitor.visitLiteralExpr(static_cast<Literal&>(expr));
+      case ExprKind::Logical:
+        return visitor.visitLogicalExpr(static_cast<Logical&>(expr));
+      case ExprKind::Set:
+        return visitor.visitSetExpr(static_cast<Set&>(expr));
+      case ExprKind::Super:
+        return visitor.visitSuperExpr(static_cast<Super&>(expr));
+      case ExprKind::This:
+        return visitor.visitThisExpr(static_cast<This&>(expr));
+      case ExprKind::Unary:
+        return visitor.visitUnaryExpr(static_cast<Unary&>(expr));
+      case ExprKind::Variable:
+        return visitor.visitVariableExpr(static_cast<Variable&>(expr));
+    }
+    return R();
+  }
 };
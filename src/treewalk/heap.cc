@@ -0,0 +1,99 @@
+#include "heap.h"
+
+#include <algorithm>
+
+Heap::~Heap() {
+  environmentPool_.clear();
+  std::vector<LoxObject*> garbage;
+  for (LoxObject* object = objects_; object != nullptr;
+       object = object->next_) {
+    garbage.push_back(object);
+  }
+  objects_ = nullptr;
+  free(garbage);
+}
+
+void Heap::collect() {
+  std::vector<LoxObject*> references;
+
+  // Subtract the references that come from inside the heap.
+  for (LoxObject* object = objects_; object != nullptr;
+       object = object->next_) {
+    object->gcRefs_ = object->refCount_;
+  }
+  for (LoxObject* object = objects_; object != nullptr;
+       object = object->next_) {
+    references.clear();
+    object->trace(references);
+    for (LoxObject* reference : references) {
+      if (reference->traced_) --reference->gcRefs_;
+    }
+  }
+
+  // Whatever is still referenced is a root.
+  std::vector<LoxObject*> gray;
+  for (LoxObject* object = objects_; object != nullptr;
+       object = object->next_) {
+    if (object->gcRefs_ > 0) {
+      object->marked_ = true;
+      gray.push_back(object);
+    }
+  }
+  while (!gray.empty()) {
+    LoxObject* object = gray.back();
+    gray.pop_back();
+    references.clear();
+    object->trace(references);
+    for (LoxObject* reference : references) {
+      if (reference->traced_ && !reference->marked_) {
+        reference->marked_ = true;
+        gray.push_back(reference);
+      }
+    }
+  }
+
+  std::vector<LoxObject*> garbage;
+  LoxObject** link = &objects_;
+  while (*link != nullptr) {
+    LoxObject* object = *link;
+    if (object->marked_) {
+      object->marked_ = false;
+      link = &object->next_;
+    } else {
+      *link = object->next_;
+      garbage.push_back(object);
+    }
+  }
+  free(garbage);
+
+  nextGC_ = std::max(kInitialThreshold,
+                     static_cast<size_t>(liveObjects_ * growthFactor_));
+}
+
+Ref<Environment> Heap::makeEnvironment(Ref<Environment> enclosing) {
+  if (environmentPool_.empty()) return make<Environment>(std::move(enclosing));
+  Ref<Environment> environment = std::move(environmentPool_.back());
+  environmentPool_.pop_back();
+  environment->enclosing = std::move(enclosing);
+  return environment;
+}
+
+void Heap::recycle(Ref<Environment> environment) {
+  // Anyone else holding it, such as a closure, keeps it as it is.
+  if (environment->refCount_ != 1 || environmentPool_.size() == kPoolSize) {
+    return;
+  }
+  // Keeps the capacity of its slots, so refilling them does not allocate.
+  environment->clear();
+  environmentPool_.push_back(std::move(environment));
+}
+
+void Heap::free(std::vector<LoxObject*>& garbage) {
+  for (LoxObject* object : garbage) {
+    object->clear();
+  }
+  for (LoxObject* object : garbage) {
+    delete object;
+  }
+  liveObjects_ -= garbage.size();
+}
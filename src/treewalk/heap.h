@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>  // std::forward
+#include <vector>
+
+#include "LoxObject.h"
+#include "environment.h"
+
+// Owns the objects of one interpreter that can form reference cycles and
+// reclaims them with a mark-and-sweep pass once the number of live objects
+// grows past a threshold.
+//
+// Roots are not registered explicitly. Every reference to a traced object
+// is counted, so any object whose count is higher than the number of
+// references coming from other traced objects is held from outside the heap:
+// by Interpreter::globals, by the environment chain saved on the C++ stack
+// while blocks and calls execute, or by a Value temporary. Those objects and
+// everything reachable from them survive; the rest is garbage even if it is
+// still referenced from within a cycle.
+class Heap {
+ public:
+  static constexpr size_t kInitialThreshold = 1 << 14;
+  static constexpr double kDefaultGrowthFactor = 2.0;
+
+  explicit Heap(double growthFactor = kDefaultGrowthFactor)
+      : growthFactor_{growthFactor} {}
+  ~Heap();
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+
+  template <class T, class... Args>
+  T* make(Args&&... args) {
+    if (liveObjects_ >= nextGC_) collect();
+    T* object = new T(std::forward<Args>(args)...);
+    object->traced_ = true;
+    object->next_ = objects_;
+    objects_ = object;
+    ++liveObjects_;
+    ++allocations_;
+    return object;
+  }
+
+  void collect();
+
+  // Environments are most of what gets allocated: one per call and one per
+  // block executed that could be captured (the rest are flat, see Resolver).
+  // Callers hand them back with recycle() when they are done;
+  // one that nothing else references by then is reset and reused by the next
+  // makeEnvironment() instead of waiting for the collector.
+  Ref<Environment> makeEnvironment(Ref<Environment> enclosing);
+  void recycle(Ref<Environment> environment);
+
+  // After each collection the next one is scheduled once the heap has grown
+  // to `factor` times the number of objects that survived.
+  void setGrowthFactor(double factor) { growthFactor_ = factor; }
+  size_t liveObjects() const { return liveObjects_; }
+  // Objects allocated so far; reused environments are not counted.
+  uint64_t allocations() const { return allocations_; }
+
+ private:
+  static constexpr size_t kPoolSize = 256;
+
+  void free(std::vector<LoxObject*>& garbage);
+
+  // Pooled environments are empty, so holding them only keeps them alive.
+  std::vector<Ref<Environment>> environmentPool_;
+  LoxObject* objects_{nullptr};
+  size_t liveObjects_{0};
+  uint64_t allocations_{0};
+  size_t nextGC_{kInitialThreshold};
+  double growthFactor_;
+};
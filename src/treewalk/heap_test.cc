@@ -0,0 +1,97 @@
+#include "heap.h"
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "LoxFunction.h"
+#include "environment.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "resolver.h"
+
+std::string run(Interpreter& interpreter, std::string_view source) {
+  std::vector<StmtPtr> statements = Parser{source}.parse();
+  Resolver{}.resolve(statements);
+
+  std::ostringstream out;
+  std::streambuf* saved = std::cout.rdbuf(out.rdbuf());
+  interpreter.interpret(statements);
+  std::cout.rdbuf(saved);
+  return out.str();
+}
+
+TEST(HeapTests, CollectsClosureCycles) {
+  Heap heap;
+  {
+    Ref<Environment> environment = heap.make<Environment>();
+    environment->define(heap.make<LoxFunction>(nullptr, environment));
+  }
+  ASSERT_EQ(heap.liveObjects(), 2);
+  heap.collect();
+  ASSERT_EQ(heap.liveObjects(), 0);
+}
+
+TEST(HeapTests, KeepsObjectsHeldOutsideTheHeap) {
+  Heap heap;
+  Ref<Environment> outer = heap.make<Environment>();
+  Value function = heap.make<LoxFunction>(nullptr, outer);
+  {
+    Ref<Environment> inner = heap.make<Environment>(outer);
+    inner->define(function);
+  }
+  heap.collect();
+  // The unreferenced inner environment goes, the temporary function and the
+  // environment it captured stay.
+  ASSERT_EQ(heap.liveObjects(), 2);
+}
+
+TEST(HeapTests, ClosuresInLoopsDoNotAccumulate) {
+  Interpreter interpreter;
+  std::string output = run(interpreter, R"(
+    fun make(n) {
+      var x = n;
+      fun get() { return x; }
+      return get;
+    }
+    var sum = 0;
+    for (var i = 0; i < 50000; i = i + 1) {
+      var f = make(i);
+      sum = sum + f();
+    }
+    print sum;
+  )");
+  ASSERT_EQ(output, "1249975000.000000\n");
+  ASSERT_LT(interpreter.heap().liveObjects(), 2 * Heap::kInitialThreshold);
+}
+
+TEST(HeapTests, RecyclesEnvironmentsThatDoNotEscape) {
+  Heap heap;
+  Ref<Environment> local = heap.makeEnvironment(nullptr);
+  Environment* address = local.get();
+  heap.recycle(std::move(local));
+  EXPECT_EQ(heap.makeEnvironment(nullptr).get(), address);
+
+  Ref<Environment> captured = heap.makeEnvironment(nullptr);
+  Value function = heap.make<LoxFunction>(nullptr, captured);
+  address = captured.get();
+  heap.recycle(std::move(captured));
+  EXPECT_NE(heap.makeEnvironment(nullptr).get(), address);
+}
+
+TEST(HeapTests, CallsDoNotAllocate) {
+  Interpreter interpreter;
+  std::string output = run(interpreter, R"(
+    fun fib(n) {
+      if (n < 2) return n;
+      return fib(n - 1) + fib(n - 2);
+    }
+    print fib(15);
+  )");
+  ASSERT_EQ(output, "610.000000\n");
+  // Only as many environments as calls were active at once.
+  ASSERT_LT(interpreter.heap().liveObjects(), 64);
+}
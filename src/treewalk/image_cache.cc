@@ -0,0 +1,648 @@
+#include "image_cache.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../scanner/source.h"
+#include "../token/symbol.h"
+#include "expr.h"
+#include "module_loader.h"
+#include "stmt.h"
+
+namespace {
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t variant;
+  uint32_t reserved;
+  uint64_t sourceSize;
+  uint64_t sourceHash;
+  // The tree follows the header, and the strings follow the tree.
+  uint64_t treeSize;
+};
+
+constexpr char kMagic[4] = {'L', 'O', 'X', 'I'};
+// Stands for a missing child, in place of a node kind.
+constexpr uint8_t kNull = 0xff;
+// Marks the type of a token that has a Symbol.
+constexpr uint8_t kInterned = 0x80;
+
+enum class Tag : uint8_t { NIL, FALSE, TRUE, NUMBER, STRING };
+
+// FNV-1a: images only need to tell sources apart, not resist attackers.
+uint64_t hash(std::string_view text) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (unsigned char c : text) {
+    hash = (hash ^ c) * 0x100000001b3;
+  }
+  return hash;
+}
+
+// Thrown for trees an image can't hold, such as literals of other types.
+struct Unsupported {};
+// Thrown for images that are truncated or otherwise don't decode.
+struct Corrupt {};
+
+class ImageWriter {
+ public:
+  std::string write(std::string_view source, uint32_t variant,
+                    const std::vector<StmtPtr>& statements) {
+    list(statements, [this](const StmtPtr& stmt) { this->stmt(stmt.get()); });
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof kMagic);
+    header.version = ImageCache::kVersion;
+    header.variant = variant;
+    header.sourceSize = source.size();
+    header.sourceHash = hash(source);
+    header.treeSize = tree_.size();
+    std::string image{reinterpret_cast<const char*>(&header), sizeof header};
+    return image + tree_ + strings_;
+  }
+
+ private:
+  template <class T>
+  void put(T value) {
+    tree_.append(reinterpret_cast<const char*>(&value), sizeof value);
+  }
+  // Integers are stored in LEB128, seven bits a byte, since most of them are
+  // small.
+  void putVarint(uint64_t value) {
+    for (; value >= 0x80; value >>= 7) {
+      tree_.push_back(static_cast<char>(value | 0x80));
+    }
+    tree_.push_back(static_cast<char>(value));
+  }
+  // Zigzag encoded, so that the -1 of unresolved names takes one byte.
+  void putSigned(int64_t value) {
+    putVarint((static_cast<uint64_t>(value) << 1) ^
+              static_cast<uint64_t>(value >> 63));
+  }
+
+  template <class T, class F>
+  void list(const std::vector<T>& items, F item) {
+    putVarint(items.size());
+    for (const T& each : items) {
+      item(each);
+    }
+  }
+
+  // Identical lexemes, such as the uses of a name, are stored once.
+  void string(std::string_view text) {
+    auto [entry, inserted] =
+        offsets_.try_emplace(text, static_cast<uint32_t>(strings_.size()));
+    if (inserted) strings_.append(text);
+    putVarint(entry->second);
+    putVarint(text.size());
+  }
+
+  void token(const Token& token) {
+    // Symbols are interned from the lexeme again when loading, so a flag in
+    // the top bit of the type is enough.
+    put(static_cast<uint8_t>(token.type_ |
+                             (token.symbol_ != kNoSymbol ? kInterned : 0)));
+    putVarint(token.line_);
+    string(token.lexeme_);
+  }
+
+  void value(const Value& value) {
+    if (value.isNil()) {
+      put(Tag::NIL);
+    } else if (value.isBool()) {
+      put(value.asBool() ? Tag::TRUE : Tag::FALSE);
+    } else if (value.isNumber()) {
+      put(Tag::NUMBER);
+      put(value.asNumber());
+    } else if (value.isString()) {
+      put(Tag::STRING);
+      string(value.asString());
+    } else {
+      throw Unsupported{};
+    }
+  }
+
+  void expr(const Expr* expr) {
+    if (expr == nullptr) {
+      put(kNull);
+      return;
+    }
+    put(static_cast<uint8_t>(expr->kind));
+    switch (expr->kind) {
+      case ExprKind::Assign: {
+        auto& assign = static_cast<const Assign&>(*expr);
+        token(assign.name);
+        this->expr(assign.value.get());
+        putSigned(assign.depth);
+        putSigned(assign.slot);
+        return;
+      }
+      case ExprKind::Binary: {
+        auto& binary = static_cast<const Binary&>(*expr);
+        this->expr(binary.left.get());
+        token(binary.op);
+        this->expr(binary.right.get());
+        return;
+      }
+      case ExprKind::Call: {
+        auto& call = static_cast<const Call&>(*expr);
+        this->expr(call.callee.get());
+        token(call.paren);
+        list(call.arguments,
+             [this](const ExprPtr& argument) { this->expr(argument.get()); });
+        return;
+      }
+      case ExprKind::Get: {
+        auto& get = static_cast<const Get&>(*expr);
+        this->expr(get.object.get());
+        token(get.name);
+        return;
+      }
+      case ExprKind::Grouping:
+        this->expr(static_cast<const Grouping&>(*expr).expression.get());
+        return;
+      case ExprKind::Literal:
+        value(static_cast<const Literal&>(*expr).value);
+        return;
+      case ExprKind::Logical: {
+        auto& logical = static_cast<const Logical&>(*expr);
+        this->expr(logical.left.get());
+        token(logical.op);
+        this->expr(logical.right.get());
+        return;
+      }
+      case ExprKind::Set: {
+        auto& set = static_cast<const Set&>(*expr);
+        this->expr(set.object.get());
+        token(set.name);
+        this->expr(set.value.get());
+        return;
+      }
+      case ExprKind::Super: {
+        auto& super = static_cast<const Super&>(*expr);
+        token(super.keyword);
+        token(super.method);
+        putSigned(super.depth);
+        putSigned(super.slot);
+        return;
+      }
+      case ExprKind::This: {
+        auto& self = static_cast<const This&>(*expr);
+        token(self.keyword);
+        putSigned(self.depth);
+        putSigned(self.slot);
+        return;
+      }
+      case ExprKind::Unary: {
+        auto& unary = static_cast<const Unary&>(*expr);
+        token(unary.op);
+        this->expr(unary.right.get());
+        return;
+      }
+      case ExprKind::Variable: {
+        auto& variable = static_cast<const Variable&>(*expr);
+        token(variable.name);
+        putSigned(variable.depth);
+        putSigned(variable.slot);
+        return;
+      }
+    }
+  }
+
+  void stmt(const Stmt* stmt) {
+    if (stmt == nullptr) {
+      put(kNull);
+      return;
+    }
+    put(static_cast<uint8_t>(stmt->kind));
+    switch (stmt->kind) {
+      case StmtKind::Block: {
+        auto& block = static_cast<const Block&>(*stmt);
+        put(static_cast<uint8_t>(block.flat));
+        statements(block.statements);
+        return;
+      }
+      case StmtKind::Class: {
+        auto& klass = static_cast<const Class&>(*stmt);
+        token(klass.name);
+        expr(klass.superclass.get());
+        list(klass.methods, [this](const std::unique_ptr<Function>& method) {
+          this->stmt(method.get());
+        });
+        return;
+      }
+      case StmtKind::Expression:
+        expr(static_cast<const Expression&>(*stmt).expression.get());
+        return;
+      case StmtKind::Function: {
+        auto& function = static_cast<const Function&>(*stmt);
+        token(function.name);
+        list(function.params, [this](const Token& param) { token(param); });
+        statements(function.body);
+        return;
+      }
+      case StmtKind::If: {
+        auto& ifStmt = static_cast<const If&>(*stmt);
+        expr(ifStmt.condition.get());
+        this->stmt(ifStmt.thenBranch.get());
+        this->stmt(ifStmt.elseBranch.get());
+        return;
+      }
+      case StmtKind::Import: {
+        auto& import = static_cast<const Import&>(*stmt);
+        token(import.keyword);
+        token(import.path);
+        return;
+      }
+      case StmtKind::Print:
+        expr(static_cast<const Print&>(*stmt).expression.get());
+        return;
+      case StmtKind::Return: {
+        auto& returnStmt = static_cast<const Return&>(*stmt);
+        token(returnStmt.keyword);
+        put(static_cast<uint8_t>(returnStmt.tailCall));
+        expr(returnStmt.value.get());
+        return;
+      }
+      case StmtKind::Var: {
+        auto& var = static_cast<const Var&>(*stmt);
+        token(var.name);
+        expr(var.initializer.get());
+        return;
+      }
+      case StmtKind::While: {
+        auto& whileStmt = static_cast<const While&>(*stmt);
+        expr(whileStmt.condition.get());
+        this->stmt(whileStmt.body.get());
+        return;
+      }
+    }
+  }
+
+  void statements(const std::vector<StmtPtr>& statements) {
+    list(statements, [this](const StmtPtr& stmt) { this->stmt(stmt.get()); });
+  }
+
+  std::string tree_;
+  std::string strings_;
+  std::unordered_map<std::string_view, uint32_t> offsets_;
+};
+
+class ImageReader {
+ public:
+  // `image` must be checked against its Header first.
+  explicit ImageReader(std::string_view image) {
+    Header header;
+    std::memcpy(&header, image.data(), sizeof header);
+    cursor_ = image.data() + sizeof header;
+    end_ = cursor_ + header.treeSize;
+    strings_ = image.substr(sizeof header + header.treeSize);
+  }
+
+  std::vector<StmtPtr> read() {
+    std::vector<StmtPtr> statements = this->statements();
+    if (cursor_ != end_) throw Corrupt{};
+    return statements;
+  }
+
+ private:
+  template <class T>
+  T get() {
+    if (static_cast<size_t>(end_ - cursor_) < sizeof(T)) throw Corrupt{};
+    T value;
+    std::memcpy(&value, cursor_, sizeof value);
+    cursor_ += sizeof value;
+    return value;
+  }
+
+  uint64_t getVarint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte = get<uint8_t>();
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) return value;
+    }
+    throw Corrupt{};
+  }
+  int getSigned() {
+    uint64_t value = getVarint();
+    return static_cast<int>(static_cast<int64_t>(value >> 1) ^
+                            -static_cast<int64_t>(value & 1));
+  }
+
+  template <class T, class F>
+  std::vector<T> list(F item) {
+    uint64_t size = getVarint();
+    // Every item takes at least one byte.
+    if (size > static_cast<size_t>(end_ - cursor_)) throw Corrupt{};
+    std::vector<T> items;
+    items.reserve(size);
+    for (uint64_t i = 0; i < size; ++i) {
+      items.push_back(item());
+    }
+    return items;
+  }
+
+  std::string_view string() {
+    uint64_t offset = getVarint();
+    uint64_t size = getVarint();
+    if (offset > strings_.size() || size > strings_.size() - offset) {
+      throw Corrupt{};
+    }
+    return strings_.substr(offset, size);
+  }
+
+  Token token() {
+    uint8_t type = get<uint8_t>();
+    bool interned = type & kInterned;
+    type &= ~kInterned;
+    int line = static_cast<int>(getVarint());
+    std::string_view lexeme = string();
+    if (type > END_OF_FILE) throw Corrupt{};
+    // Token::string() strips the quotes.
+    if (type == STRING && lexeme.size() < 2) throw Corrupt{};
+    Symbol symbol = kNoSymbol;
+    if (interned) {
+      auto [entry, inserted] = symbols_.try_emplace(lexeme.data());
+      if (inserted) entry->second = symbols().intern(lexeme);
+      symbol = entry->second;
+    }
+    return Token{static_cast<TokenType>(type), lexeme, line, symbol};
+  }
+
+  Value value() {
+    switch (get<Tag>()) {
+      case Tag::NIL:
+        return Value{};
+      case Tag::FALSE:
+        return Value{false};
+      case Tag::TRUE:
+        return Value{true};
+      case Tag::NUMBER:
+        return Value{get<double>()};
+      case Tag::STRING:
+        return Value{new LoxString{std::string{string()}}};
+    }
+    throw Corrupt{};
+  }
+
+  // Reads a child the tree can't do without.
+  ExprPtr operand() {
+    ExprPtr expr = this->expr();
+    if (expr == nullptr) throw Corrupt{};
+    return expr;
+  }
+
+  template <class T>
+  std::unique_ptr<T> resolved(std::unique_ptr<T> expr) {
+    expr->depth = getSigned();
+    expr->slot = getSigned();
+    return expr;
+  }
+
+  ExprPtr expr() {
+    uint8_t kind = get<uint8_t>();
+    if (kind == kNull) return nullptr;
+    switch (static_cast<ExprKind>(kind)) {
+      case ExprKind::Assign: {
+        Token name = token();
+        return resolved(std::make_unique<Assign>(std::move(name), operand()));
+      }
+      case ExprKind::Binary: {
+        ExprPtr left = operand();
+        Token op = token();
+        return std::make_unique<Binary>(std::move(left), std::move(op),
+                                        operand());
+      }
+      case ExprKind::Call: {
+        ExprPtr callee = operand();
+        Token paren = token();
+        return std::make_unique<Call>(
+            std::move(callee), std::move(paren),
+            list<ExprPtr>([this] { return operand(); }));
+      }
+      case ExprKind::Get: {
+        ExprPtr object = operand();
+        return std::make_unique<Get>(std::move(object), token());
+      }
+      case ExprKind::Grouping:
+        return std::make_unique<Grouping>(operand());
+      case ExprKind::Literal:
+        return std::make_unique<Literal>(value());
+      case ExprKind::Logical: {
+        ExprPtr left = operand();
+        Token op = token();
+        return std::make_unique<Logical>(std::move(left), std::move(op),
+                                         operand());
+      }
+      case ExprKind::Set: {
+        ExprPtr object = operand();
+        Token name = token();
+        return std::make_unique<Set>(std::move(object), std::move(name),
+                                     operand());
+      }
+      case ExprKind::Super: {
+        Token keyword = token();
+        Token method = token();
+        return resolved(
+            std::make_unique<Super>(std::move(keyword), std::move(method)));
+      }
+      case ExprKind::This:
+        return resolved(std::make_unique<This>(token()));
+      case ExprKind::Unary: {
+        Token op = token();
+        return std::make_unique<Unary>(std::move(op), operand());
+      }
+      case ExprKind::Variable:
+        return variable();
+    }
+    throw Corrupt{};
+  }
+
+  // The rest of a Variable, whose kind has been read.
+  std::unique_ptr<Variable> variable() {
+    return resolved(std::make_unique<Variable>(token()));
+  }
+
+  std::unique_ptr<Function> function() {
+    Token name = token();
+    std::vector<Token> params = list<Token>([this] { return token(); });
+    return std::make_unique<Function>(std::move(name), std::move(params),
+                                      statements());
+  }
+
+  StmtPtr stmt() {
+    uint8_t kind = get<uint8_t>();
+    if (kind == kNull) return nullptr;
+    switch (static_cast<StmtKind>(kind)) {
+      case StmtKind::Block: {
+        bool flat = get<uint8_t>() != 0;
+        auto block = std::make_unique<Block>(statements());
+        block->flat = flat;
+        return block;
+      }
+      case StmtKind::Class: {
+        Token name = token();
+        std::unique_ptr<Variable> superclass;
+        uint8_t superKind = get<uint8_t>();
+        if (superKind == static_cast<uint8_t>(ExprKind::Variable)) {
+          superclass = variable();
+        } else if (superKind != kNull) {
+          throw Corrupt{};
+        }
+        std::vector<std::unique_ptr<Function>> methods =
+            list<std::unique_ptr<Function>>([this] {
+              if (get<uint8_t>() != static_cast<uint8_t>(StmtKind::Function)) {
+                throw Corrupt{};
+              }
+              return function();
+            });
+        return std::make_unique<Class>(std::move(name), std::move(superclass),
+                                       std::move(methods));
+      }
+      case StmtKind::Expression:
+        return std::make_unique<Expression>(operand());
+      case StmtKind::Function:
+        return function();
+      case StmtKind::If: {
+        ExprPtr condition = operand();
+        StmtPtr thenBranch = statement();
+        return std::make_unique<If>(std::move(condition),
+                                    std::move(thenBranch), stmt());
+      }
+      case StmtKind::Import: {
+        Token keyword = token();
+        Token path = token();
+        if (path.type_ != STRING) throw Corrupt{};
+        return std::make_unique<Import>(std::move(keyword), std::move(path));
+      }
+      case StmtKind::Print:
+        return std::make_unique<Print>(operand());
+      case StmtKind::Return: {
+        Token keyword = token();
+        bool tailCall = get<uint8_t>() != 0;
+        auto returnStmt = std::make_unique<Return>(std::move(keyword), expr());
+        returnStmt->tailCall = tailCall;
+        return returnStmt;
+      }
+      case StmtKind::Var: {
+        Token name = token();
+        return std::make_unique<Var>(std::move(name), expr());
+      }
+      case StmtKind::While: {
+        ExprPtr condition = operand();
+        return std::make_unique<While>(std::move(condition), statement());
+      }
+    }
+    throw Corrupt{};
+  }
+
+  // Reads a statement the tree can't do without.
+  StmtPtr statement() {
+    StmtPtr stmt = this->stmt();
+    if (stmt == nullptr) throw Corrupt{};
+    return stmt;
+  }
+
+  std::vector<StmtPtr> statements() {
+    return list<StmtPtr>([this] { return statement(); });
+  }
+
+  const char* cursor_;
+  const char* end_;
+  std::string_view strings_;
+  // Each lexeme is interned once, however many tokens share it.
+  std::unordered_map<const char*, Symbol> symbols_;
+};
+
+}  // namespace
+
+ImageCache::ImageCache(std::string directory, uint32_t variant)
+    : directory_{std::move(directory)}, variant_{variant} {}
+
+std::string ImageCache::defaultDirectory() {
+  if (const char* directory = std::getenv("LOX_CACHE_DIR")) return directory;
+  if (const char* cache = std::getenv("XDG_CACHE_HOME")) {
+    return std::string{cache} + "/lox";
+  }
+  const char* home = std::getenv("HOME");
+  return std::string{home != nullptr ? home : "."} + "/.cache/lox";
+}
+
+bool ImageCache::load(Module& module) const {
+  std::string_view source = module.source->text();
+  uint32_t variant = this->variant(module);
+  std::unique_ptr<SourceBuffer> image =
+      SourceBuffer::fromFile(path(source, variant));
+  if (image == nullptr) return false;
+  std::string_view text = image->text();
+  Header header;
+  if (text.size() < sizeof header) return false;
+  std::memcpy(&header, text.data(), sizeof header);
+  if (std::memcmp(header.magic, kMagic, sizeof kMagic) != 0 ||
+      header.version != kVersion || header.variant != variant ||
+      header.sourceSize != source.size() || header.sourceHash != hash(source) ||
+      header.treeSize > text.size() - sizeof header) {
+    return false;
+  }
+  try {
+    module.statements = ImageReader{text}.read();
+  } catch (const Corrupt&) {
+    return false;
+  }
+  module.source = std::move(image);
+  return true;
+}
+
+void ImageCache::store(const Module& module) const {
+  std::string_view source = module.source->text();
+  uint32_t variant = this->variant(module);
+  std::string image;
+  try {
+    image = ImageWriter{}.write(source, variant, module.statements);
+  } catch (const Unsupported&) {
+    return;
+  }
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+  if (error) return;
+  // Written aside and renamed into place, so that a concurrent run never
+  // maps half an image.
+  std::string target = path(source, variant);
+  std::string temporary =
+      target + "." + std::to_string(::getpid()) + "." +
+      std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+  {
+    std::ofstream out{temporary, std::ios::binary};
+    out.write(image.data(), static_cast<std::streamsize>(image.size()));
+    if (!out) {
+      out.close();
+      std::remove(temporary.c_str());
+      return;
+    }
+  }
+  std::filesystem::rename(temporary, target, error);
+  if (error) std::remove(temporary.c_str());
+}
+
+uint32_t ImageCache::variant(const Module& module) const {
+  return variant_ << 1 | (module.importedBy != nullptr);
+}
+
+std::string ImageCache::path(std::string_view source, uint32_t variant) const {
+  char name[40];
+  std::snprintf(name, sizeof name, "/%016llx-%u.loxi",
+                static_cast<unsigned long long>(hash(source)), variant);
+  return directory_ + name;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+struct Module;
+
+// Keeps the trees of programs on disk, so that running a file that hasn't
+// changed skips the scanner, the parser and the passes that ran over its
+// tree.
+//
+// An image holds one program's tree in pre-order, followed by the lexemes
+// and identifier names it refers to. Nodes and tokens refer to those by
+// offset only, so the file is mapped as it is; loading rebuilds the nodes
+// while every token's lexeme keeps pointing into the mapping. Images are
+// named after a hash of the source they were built from, so an edited file
+// misses and gets a new one. They are in native byte order: the cache
+// belongs to one machine.
+class ImageCache {
+ public:
+  // Bump whenever the tree or its encoding changes.
+  static constexpr uint32_t kVersion = 5;
+
+  // Images are stored in `directory`, which is created on the first store().
+  // `variant` sets apart trees prepared differently from the same source,
+  // such as resolved or not. A file run as the program and the same file
+  // imported by another are kept apart as well, since the passes may treat
+  // them differently: only a whole program has its globals propagated.
+  ImageCache(std::string directory, uint32_t variant);
+
+  // $LOX_CACHE_DIR, or else $XDG_CACHE_HOME/lox or ~/.cache/lox.
+  static std::string defaultDirectory();
+
+  // Gives `module` the statements stored for its source, and replaces the
+  // source with the image they point into. Returns false if there is no
+  // image for the source or it can't be used.
+  bool load(Module& module) const;
+  // Stores the statements of `module`, built from its source. An image that
+  // can't be written is only a missed chance to skip the front end next
+  // time, so that is not reported.
+  void store(const Module& module) const;
+
+ private:
+  // variant_, and whether `module` was imported.
+  uint32_t variant(const Module& module) const;
+  std::string path(std::string_view source, uint32_t variant) const;
+
+  std::string directory_;
+  uint32_t variant_;
+};
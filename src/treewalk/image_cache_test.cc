@@ -0,0 +1,168 @@
+#include "image_cache.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../utils/ast_printer.h"
+#include "interpreter.h"
+#include "module_loader.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "resolver.h"
+
+namespace {
+
+// Every kind of node, resolved and optimized.
+constexpr std::string_view kProgram = R"(
+  var greeting = "hello";
+  var count;
+  fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+  class Base {
+    init(name) { this.name = name; }
+    describe() { return "base " + this.name; }
+  }
+  class Derived < Base {
+    describe() { return "derived " + super.describe(); }
+  }
+  {
+    var i = 0;
+    while (i < 3 and !false or nil) { count = i; i = i + 1; }
+  }
+  var d = Derived(greeting);
+  d.name = (d.name + "!");
+  print d.describe();
+  print -fib(10) * 2.5;
+  print count;
+)";
+
+Module compile(std::string_view source) {
+  Module module;
+  module.path = "program.lox";
+  module.source = std::make_unique<SourceBuffer>(std::string{source});
+  module.statements = Parser{module.source->text()}.parse();
+  Resolver{}.resolve(module.statements);
+  Optimizer{true}.optimize(module.statements);
+  return module;
+}
+
+std::string print(const Module& module) {
+  AstPrinter printer;
+  std::string tree;
+  for (const auto& statement : module.statements) {
+    tree += printer.print(*statement) + "\n";
+  }
+  return tree;
+}
+
+std::string run(const Module& module) {
+  std::ostringstream out;
+  std::streambuf* saved = std::cout.rdbuf(out.rdbuf());
+  Interpreter interpreter;
+  interpreter.interpret(module.statements);
+  std::cout.rdbuf(saved);
+  return out.str();
+}
+
+}  // namespace
+
+class ImageCacheTests : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+                 ("lox_images_" + std::to_string(::getpid()));
+  }
+  void TearDown() override { std::filesystem::remove_all(directory_); }
+
+  // Loads the image of `source`, if there is one.
+  bool load(std::string_view source, Module& module, uint32_t variant = 0) {
+    module.path = "program.lox";
+    module.source = std::make_unique<SourceBuffer>(std::string{source});
+    return ImageCache{directory_.string(), variant}.load(module);
+  }
+
+  std::filesystem::path directory_;
+};
+
+TEST_F(ImageCacheTests, RoundTripsPrograms) {
+  Module compiled = compile(kProgram);
+  ImageCache{directory_.string(), 0}.store(compiled);
+
+  Module loaded;
+  ASSERT_TRUE(load(kProgram, loaded));
+  EXPECT_EQ(print(loaded), print(compiled));
+  EXPECT_EQ(run(loaded), run(compiled));
+  EXPECT_EQ(run(loaded), "derived base hello!\n-137.500000\n2.000000\n");
+
+  // Tokens point into the image instead of a copy.
+  std::string_view image = loaded.source->text();
+  const auto& var = static_cast<const Var&>(*loaded.statements[0]);
+  EXPECT_GE(var.name.lexeme_.data(), image.data());
+  EXPECT_LT(var.name.lexeme_.data(), image.data() + image.size());
+  EXPECT_EQ(var.name.symbol_,
+            static_cast<const Var&>(*compiled.statements[0]).name.symbol_);
+}
+
+TEST_F(ImageCacheTests, MissesChangedSourcesAndVariants) {
+  ImageCache{directory_.string(), 0}.store(compile(kProgram));
+
+  Module module;
+  std::string edited{kProgram};
+  edited.back() = ' ';
+  EXPECT_FALSE(load(edited, module));
+  EXPECT_FALSE(load(kProgram, module, 1));
+  EXPECT_TRUE(load(kProgram, module, 0));
+}
+
+TEST_F(ImageCacheTests, RejectsDamagedImages) {
+  ImageCache{directory_.string(), 0}.store(compile(kProgram));
+  std::filesystem::path image =
+      std::filesystem::directory_iterator{directory_}->path();
+  uintmax_t size = std::filesystem::file_size(image);
+
+  // Cut short at any point, the image is refused rather than misread.
+  Module module;
+  for (uintmax_t cut : {size - 1, size / 2, uintmax_t{40}, uintmax_t{3}}) {
+    std::filesystem::resize_file(image, cut);
+    EXPECT_FALSE(load(kProgram, module)) << cut;
+  }
+}
+
+TEST_F(ImageCacheTests, KeepsProgramsAndImportsApart) {
+  std::filesystem::create_directories(directory_);
+  auto write = [this](const char* name, std::string_view text) {
+    std::string path = (directory_ / name).string();
+    std::ofstream{path} << text;
+    return path;
+  };
+  std::string library =
+      write("a.lox", "var x = 1; fun show() { print x; } show();");
+  std::string program = write("main.lox", "import \"a.lox\"; x = 2; show();");
+
+  // As lox does: only the program, not what it imports, sees all the code
+  // that assigns its globals and has them propagated into functions.
+  ImageCache cache{(directory_ / "images").string(), 0};
+  auto run = [&cache](const std::string& path) {
+    ModuleLoader loader{[](Module& module) {
+      Resolver{}.resolve(module.statements);
+      Optimizer{module.importedBy == nullptr}.optimize(module.statements);
+      return true;
+    }};
+    loader.setImageCache(&cache);
+    Module& module = loader.load(SourceBuffer::fromFile(path), path);
+    return ::run(module);
+  };
+  EXPECT_EQ(run(library), "1.000000\n");
+  // The tree a.lox was stored as a program would print 1 twice.
+  EXPECT_EQ(run(program), "1.000000\n2.000000\n");
+  EXPECT_EQ(run(program), "1.000000\n2.000000\n");
+  EXPECT_EQ(run(library), "1.000000\n");
+}
@@ -1,238 +1,499 @@
 #include "interpreter.h"
 
+#include <iterator>  // std::make_move_iterator
+#include <string>
+#include <unordered_map>
+
+#include "LoxClass.h"
 #include "LoxFunction.h"
-#include "LoxReturn.h"
+#include "closure_compiler.h"
+#include "jit.h"
 #include "runtime_error.h"
 
-void Interpreter::interpret(std::vector<std::shared_ptr<Stmt>>& statements) {
+void Interpreter::interpret(const std::vector<StmtPtr>& statements) {
   try {
-    for (auto statement : statements) {
-      execute(statement);
-    }
+    modules_.insert(&statements);
+    run(statements);
   } catch (RuntimeError error) {
     runtimeError(error);
   }
 }
-std::any Interpreter::visitLiteralExpr(std::shared_ptr<Literal> expr) {
-  return expr->value;
+void Interpreter::run(const std::vector<StmtPtr>& statements) {
+  if (closures_ != nullptr) {
+    closures_->compile(statements)(*this);
+    return;
+  }
+  for (const auto& statement : statements) {
+    execute(statement);
+  }
+}
+Value Interpreter::visitLiteralExpr(Literal& expr) {
+  if (copyStringLiterals_ && expr.value.isString()) {
+    Value& copy = stringLiterals_[&expr];
+    if (copy.isNil()) copy = new LoxString{expr.value.asString()};
+    return copy;
+  }
+  return expr.value;
 }
-std::any Interpreter::visitGroupingExpr(std::shared_ptr<Grouping> expr) {
-  return evaluate(expr->expression);
+Value Interpreter::visitGroupingExpr(Grouping& expr) {
+  return evaluate(expr.expression);
 }
-std::any Interpreter::visitUnaryExpr(std::shared_ptr<Unary> expr) {
-  std::any right = evaluate(expr->right);
-  switch (expr->op.type_) {
+Value Interpreter::visitUnaryExpr(Unary& expr) {
+  Value right = evaluate(expr.right);
+  switch (expr.op.type_) {
     case BANG:
-      return !isTruthy(right);
+      return Value{!right.isTruthy()};
     case MINUS:
-      checkNumberOperand(expr->op, right);
-      return -std::any_cast<double>(right);
+      checkNumberOperand(expr.op, right);
+      return Value{-right.asNumber()};
     default:
-      return std::any{};
+      return Value{};
   }
 }
-std::any Interpreter::visitBinaryExpr(std::shared_ptr<Binary> expr) {
-  std::any left = evaluate(expr->left);
-  std::any right = evaluate(expr->right);
-  switch (expr->op.type_) {
+Value Interpreter::visitBinaryExpr(Binary& expr) {
+  Value left = evaluate(expr.left);
+  Value right = evaluate(expr.right);
+  switch (expr.op.type_) {
     case BANG_EQUAL:
-      return !isEqual(left, right);
+      return Value{left != right};
     case EQUAL_EQUAL:
-      return isEqual(left, right);
+      return Value{left == right};
     case GREATER:
-      checkNumberOperand(expr->op, left, right);
-      return std::any_cast<double>(left) > std::any_cast<double>(right);
+      checkNumberOperand(expr.op, left, right);
+      return Value{left.asNumber() > right.asNumber()};
     case GREATER_EQUAL:
-      checkNumberOperand(expr->op, left, right);
-      return std::any_cast<double>(left) >= std::any_cast<double>(right);
+      checkNumberOperand(expr.op, left, right);
+      return Value{left.asNumber() >= right.asNumber()};
     case LESS:
-      checkNumberOperand(expr->op, left, right);
-      return std::any_cast<double>(left) < std::any_cast<double>(right);
+      checkNumberOperand(expr.op, left, right);
+      return Value{left.asNumber() < right.asNumber()};
     case LESS_EQUAL:
-      checkNumberOperand(expr->op, left, right);
-      return std::any_cast<double>(left) <= std::any_cast<double>(right);
+      checkNumberOperand(expr.op, left, right);
+      return Value{left.asNumber() <= right.asNumber()};
     case MINUS:
-      checkNumberOperand(expr->op, left, right);
-      return std::any_cast<double>(left) - std::any_cast<double>(right);
+      checkNumberOperand(expr.op, left, right);
+      return Value{left.asNumber() - right.asNumber()};
     case PLUS:
-      if (left.type() == typeid(double) && right.type() == typeid(double)) {
-        return std::any_cast<double>(left) + std::any_cast<double>(right);
+      if (left.isNumber() && right.isNumber()) {
+        return Value{left.asNumber() + right.asNumber()};
       }
-      if (left.type() == typeid(std::string) &&
-          right.type() == typeid(std::string)) {
-        return std::any_cast<std::string>(left) +
-               std::any_cast<std::string>(right);
+      if (left.isString() && right.isString()) {
+        return Value{new LoxString{left.asString() + right.asString()}};
       }
-      throw RuntimeError{expr->op,
+      throw RuntimeError{expr.op,
                          "Operand must be two numbers or two strings!"};
     case SLASH:
-      checkNumberOperand(expr->op, left, right);
-      return std::any_cast<double>(left) / std::any_cast<double>(right);
+      checkNumberOperand(expr.op, left, right);
+      return Value{left.asNumber() / right.asNumber()};
     case STAR:
-      checkNumberOperand(expr->op, left, right);
-      return std::any_cast<double>(left) * std::any_cast<double>(right);
+      checkNumberOperand(expr.op, left, right);
+      return Value{left.asNumber() * right.asNumber()};
     default:
-      return std::any{};
+      return Value{};
   }
 }
-std::any Interpreter::visitVariableExpr(std::shared_ptr<Variable> expr) {
-  return environment->get(expr->name);
+Value Interpreter::visitVariableExpr(Variable& expr) {
+  if (expr.depth == -1) return globals->get(expr.name);
+  return environment->getAt(expr.depth, expr.slot);
 }
-std::any Interpreter::visitAssignExpr(std::shared_ptr<Assign> expr) {
-  std::any value = evaluate(expr->value);
-  environment->assign(expr->name, value);
+Value Interpreter::visitAssignExpr(Assign& expr) {
+  Value value = evaluate(expr.value);
+  if (expr.depth == -1) {
+    globals->assign(expr.name, value);
+  } else {
+    environment->assignAt(expr.depth, expr.slot, value);
+  }
   return value;
 }
-std::any Interpreter::visitLogicalExpr(std::shared_ptr<Logical> expr) {
-  std::any left = evaluate(expr->left);
-  if (expr->op.type_ == OR) {
-    if (isTruthy(left)) return left;
+Value Interpreter::visitLogicalExpr(Logical& expr) {
+  Value left = evaluate(expr.left);
+  if (expr.op.type_ == OR) {
+    if (left.isTruthy()) return left;
   } else {
-    if (!isTruthy(left)) return left;
+    if (!left.isTruthy()) return left;
   }
-  return evaluate(expr->right);
+  return evaluate(expr.right);
 }
 
-std::any Interpreter::visitCallExpr(std::shared_ptr<Call> expr) {
-  std::any callee = evaluate(expr->callee);
-  std::vector<std::any> arguments;
-  for (const auto& argument : expr->arguments) {
-    arguments.emplace_back(evaluate(argument));
+Value Interpreter::visitCallExpr(Call& expr) {
+  if (expr.callee->kind == ExprKind::Get) {
+    return invoke(expr, static_cast<Get&>(*expr.callee));
   }
-  std::shared_ptr<LoxCallable> function;
-  if (callee.type() == typeid(std::shared_ptr<LoxFunction>)) {
-    function = std::any_cast<std::shared_ptr<LoxFunction>>(callee);
-  } else {
-    throw RuntimeError{expr->paren, "Can only call function and classes!"};
+  if (expr.callee->kind == ExprKind::Super) {
+    return invoke(expr, static_cast<Super&>(*expr.callee));
   }
+  return call(expr, evaluate(expr.callee));
+}
 
-  if (arguments.size() != function->arity()) {
-    throw RuntimeError{expr->paren, "Expected" +
-                                        std::to_string(function->arity()) +
-                                        " arguments but got " +
-                                        std::to_string(arguments.size()) + "!"};
+Value Interpreter::call(Call& expr, const Value& callee, bool tail) {
+  if (!callee.isCallable()) {
+    throw RuntimeError{expr.paren, "Can only call function and classes!"};
   }
+  LoxCallable* function = callee.asCallable();
+  ArgumentScope scope{*this, argumentsTop_};
+  Value* arguments = pushArguments(expr, *function);
+  if (tail && deferCall(*function, nullptr, arguments)) return nullptr;
+  return call(expr, *function, arguments);
+}
 
-  return function->call(*this, std::move(arguments));
+Value Interpreter::call(Call& expr, LoxCallable& function, Value* arguments) {
+  // LoxFunctions time themselves however they are called; this covers
+  // natives and classes without an initializer.
+  Profiler* profiler = function.declaration() == nullptr ? profiler_ : nullptr;
+  Profiler::Scope profile{profiler, function};
+  try {
+    return function.call(*this, arguments);
+  } catch (const NativeError& error) {
+    throw RuntimeError{expr.paren, error.what()};
+  }
 }
 
-std::any Interpreter::evaluate(std::shared_ptr<Expr> expr) {
-  return expr->accept(*this);
+Value Interpreter::call(LoxCallable& function, std::vector<Value> arguments) {
+  ArgumentScope scope{*this, argumentsTop_};
+  if (arguments.size() > kArgumentsMax - (argumentsTop_ - arguments_.get())) {
+    throw NativeError{"Stack overflow!"};
+  }
+  for (Value& argument : arguments) *argumentsTop_++ = std::move(argument);
+  Profiler* profiler = function.declaration() == nullptr ? profiler_ : nullptr;
+  Profiler::Scope profile{profiler, function};
+  return function.call(*this, scope.base);
 }
-bool Interpreter::isTruthy(const std::any& object) {
-  if (object.type() == typeid(nullptr)) return false;
-  if (object.type() == typeid(bool)) {
-    return std::any_cast<bool>(object);
+
+Value Interpreter::invoke(Call& expr, Get& callee, bool tail) {
+  Value object = evaluate(callee.object);
+  if (!object.isInstance()) {
+    throw RuntimeError{callee.name, "Only instances have properties!"};
+  }
+  LoxInstance* instance = object.asInstance();
+  PropertyCache::Entry property =
+      findProperty(instance, callee.name, callee.cache);
+  // A field holding a function is called like any other value.
+  if (property.slot >= 0) {
+    return call(expr, instance->fields[property.slot], tail);
   }
+  ArgumentScope scope{*this, argumentsTop_};
+  Value* arguments = pushArguments(expr, *property.method);
+  if (tail && deferCall(*property.method, instance, arguments)) return nullptr;
+  return property.method->invoke(*this, instance, arguments);
+}
+
+Value Interpreter::invoke(Call& expr, Super& callee, bool tail) {
+  LoxFunction* method = findSuperMethod(callee);
+  ArgumentScope scope{*this, argumentsTop_};
+  Value* arguments = pushArguments(expr, *method);
+  LoxInstance* instance =
+      environment->getAt(callee.depth - 1, 0).asInstance();
+  if (tail && deferCall(*method, instance, arguments)) return nullptr;
+  return method->invoke(*this, instance, arguments);
+}
+
+Completion Interpreter::returnCall(Call& expr) {
+  if (expr.callee->kind == ExprKind::Get) {
+    returnValue_ = invoke(expr, static_cast<Get&>(*expr.callee), true);
+  } else if (expr.callee->kind == ExprKind::Super) {
+    returnValue_ = invoke(expr, static_cast<Super&>(*expr.callee), true);
+  } else {
+    returnValue_ = call(expr, evaluate(expr.callee), true);
+  }
+  return Completion::RETURN;
+}
+
+bool Interpreter::deferCall(LoxCallable& function, LoxInstance* receiver,
+                            Value* arguments) {
+  auto* callee = dynamic_cast<LoxFunction*>(&function);
+  if (callee == nullptr || callee->isInitializer) return false;
+  tailCall_.callee = callee;
+  if (receiver != nullptr) tailCall_.receiver = receiver;
+  tailCall_.arguments.assign(std::make_move_iterator(arguments),
+                             std::make_move_iterator(argumentsTop_));
   return true;
 }
-bool Interpreter::isEqual(const std::any& left, const std::any& right) {
-  if (left.type() == typeid(nullptr) && right.type() == typeid(nullptr)) {
-    return true;
+
+Value* Interpreter::pushArguments(Call& expr, LoxCallable& function) {
+  Value* arguments = argumentsTop_;
+  size_t count = expr.arguments.size();
+  if (count > kArgumentsMax - (argumentsTop_ - arguments_.get())) {
+    throw RuntimeError{expr.paren, "Stack overflow!"};
   }
-  if (left.type() == typeid(nullptr)) return false;
-  if (left.type() == typeid(std::string) &&
-      right.type() == typeid(std::string)) {
-    return std::any_cast<std::string>(left) ==
-           std::any_cast<std::string>(right);
+  for (const auto& argument : expr.arguments) {
+    Value value = evaluate(argument);
+    *argumentsTop_++ = std::move(value);
   }
-  if (left.type() == typeid(double) && right.type() == typeid(double)) {
-    return std::any_cast<double>(left) == std::any_cast<double>(right);
+  checkArity(expr, function);
+  return arguments;
+}
+
+void Interpreter::checkArity(Call& expr, LoxCallable& function) {
+  // The arity of a declaration never changes, so a site that keeps calling
+  // the same function checks it once.
+  const Function* declaration = function.declaration();
+  if (declaration != nullptr && declaration == expr.checkedDeclaration) return;
+  size_t count = expr.arguments.size();
+  if (count != function.arity()) {
+    throw RuntimeError{expr.paren, "Expected" +
+                                        std::to_string(function.arity()) +
+                                        " arguments but got " +
+                                        std::to_string(count) + "!"};
   }
-  if (left.type() == typeid(bool) && right.type() == typeid(bool)) {
-    return std::any_cast<bool>(left) == std::any_cast<bool>(right);
+  if (!treesShared()) expr.checkedDeclaration = declaration;
+}
+
+PropertyCache::Entry Interpreter::findProperty(LoxInstance* instance,
+                                               const Token& name,
+                                               PropertyCache& cache) {
+  uint32_t shape = instance->shape->id();
+  if (const PropertyCache::Entry* entry = cache.find(shape)) return *entry;
+
+  // Fields shadow methods.
+  PropertyCache::Entry entry{shape, instance->shape->indexOf(name.symbol_),
+                             nullptr, nullptr};
+  if (entry.slot < 0) {
+    entry.method = instance->klass->findMethod(name.symbol_);
+    if (entry.method == nullptr) {
+      throw RuntimeError{
+          name, "Undefined property '" + std::string{name.lexeme_} + "'!"};
+    }
   }
-  return false;
+  if (!treesShared()) cache.add(entry);
+  return entry;
 }
-void Interpreter::checkNumberOperand(const Token& op, const std::any& operand) {
-  if (operand.type() == typeid(double)) return;
+
+Value Interpreter::visitGetExpr(Get& expr) {
+  Value object = evaluate(expr.object);
+  if (!object.isInstance()) {
+    throw RuntimeError{expr.name, "Only instances have properties!"};
+  }
+  LoxInstance* instance = object.asInstance();
+  PropertyCache::Entry property =
+      findProperty(instance, expr.name, expr.cache);
+  if (property.slot >= 0) return instance->fields[property.slot];
+  return property.method->bind(*this, instance);
+}
+
+Value Interpreter::visitSetExpr(Set& expr) {
+  Value object = evaluate(expr.object);
+  if (!object.isInstance()) {
+    throw RuntimeError{expr.name, "Only instances have fields!"};
+  }
+  Value value = evaluate(expr.value);
+  setProperty(object.asInstance(), expr, value);
+  return value;
+}
+
+void Interpreter::setProperty(LoxInstance* instance, Set& expr,
+                              const Value& value) {
+  uint32_t shape = instance->shape->id();
+  PropertyCache::Entry entry;
+  if (const PropertyCache::Entry* cached = expr.cache.find(shape)) {
+    entry = *cached;
+  } else {
+    // A new field is appended, moving the instance to a child shape.
+    entry = {shape, instance->shape->indexOf(expr.name.symbol_), nullptr,
+             nullptr};
+    if (entry.slot < 0) {
+      entry.slot = static_cast<int>(instance->shape->size());
+      entry.transition = instance->shape->withField(expr.name.symbol_);
+    }
+    if (!treesShared()) expr.cache.add(entry);
+  }
+  if (entry.transition != nullptr) {
+    instance->shape = entry.transition;
+    instance->fields.push_back(value);
+  } else {
+    instance->fields[entry.slot] = value;
+  }
+}
+
+Value Interpreter::visitThisExpr(This& expr) {
+  return environment->getAt(expr.depth, expr.slot);
+}
+
+Value Interpreter::visitSuperExpr(Super& expr) {
+  LoxFunction* method = findSuperMethod(expr);
+  // `this` is bound in the environment just inside the one holding `super`.
+  LoxInstance* instance = environment->getAt(expr.depth - 1, 0).asInstance();
+  return method->bind(*this, instance);
+}
+
+LoxFunction* Interpreter::findSuperMethod(Super& expr) {
+  auto* superclass = static_cast<LoxClass*>(
+      environment->getAt(expr.depth, expr.slot).asCallable());
+  LoxFunction* method = superclass->findMethod(expr.method.symbol_);
+  if (method == nullptr) {
+    throw RuntimeError{expr.method, "Undefined property '" +
+                                        std::string{expr.method.lexeme_} +
+                                        "'!"};
+  }
+  return method;
+}
+
+void Interpreter::checkNumberOperand(const Token& op, const Value& operand) {
+  if (operand.isNumber()) return;
   throw RuntimeError{op, "Operand must be a number"};
 }
-void Interpreter::checkNumberOperand(const Token& op, const std::any& left,
-                                     const std::any& right) {
-  if (left.type() == typeid(double) && right.type() == typeid(double)) return;
+void Interpreter::checkNumberOperand(const Token& op, const Value& left,
+                                     const Value& right) {
+  if (left.isNumber() && right.isNumber()) return;
   throw RuntimeError{op, "Operand must be two numbers!"};
 }
 
-std::string Interpreter::stringify(const std::any& value) {
-  if (value.type() == typeid(nullptr)) return "nil";
-  if (value.type() == typeid(double)) {
-    std::string text = std::to_string(std::any_cast<double>(value));
+std::string Interpreter::stringify(const Value& value) {
+  if (value.isNil()) return "nil";
+  if (value.isNumber()) {
+    std::string text = std::to_string(value.asNumber());
     int len = text.size();
     if (text[len - 1] == '0' && text[len - 2] == '.') {
       text = text.substr(0, len - 2);
     }
     return text;
   }
-  if (value.type() == typeid(std::string)) {
-    return std::any_cast<std::string>(value);
-  }
-  if (value.type() == typeid(bool)) {
-    return std::any_cast<bool>(value) ? "true" : "false";
-  }
+  if (value.isString()) return value.asString();
+  if (value.isBool()) return value.asBool() ? "true" : "false";
+  if (value.isCallable()) return value.asCallable()->toString();
+  if (value.isInstance()) return value.asInstance()->toString();
   return "Error in stringify: value type not recognized!";
 }
-std::any Interpreter::visitExpressionStmt(std::shared_ptr<Expression> stmt) {
-  evaluate(stmt->expression);
-  return std::any{};
+Completion Interpreter::visitExpressionStmt(Expression& stmt) {
+  evaluate(stmt.expression);
+  return Completion::NORMAL;
+}
+Completion Interpreter::visitPrintStmt(Print& stmt) {
+  Value value = evaluate(stmt.expression);
+  // One write per line, so lines printed by several actors don't interleave.
+  *out_ << stringify(value) + "\n";
+  return Completion::NORMAL;
 }
-std::any Interpreter::visitPrintStmt(std::shared_ptr<Print> stmt) {
-  std::any value = evaluate(stmt->expression);
-  std::cout << stringify(value) << "\n";
-  return std::any{};
+Completion Interpreter::visitVarStmt(Var& stmt) {
+  Value value = nullptr;
+  if (stmt.initializer != nullptr) {
+    value = evaluate(stmt.initializer);
+  }
+  declare(stmt.name, std::move(value));
+  return Completion::NORMAL;
 }
-std::any Interpreter::visitVarStmt(std::shared_ptr<Var> stmt) {
-  std::any value = nullptr;
-  if (stmt->initializer != nullptr) {
-    value = evaluate(stmt->initializer);
+Completion Interpreter::visitBlockStmt(Block& stmt) {
+  if (stmt.flat) {
+    // No environment of its own: its locals come and go on the end of this
+    // one. A runtime error leaves them there, but it also unwinds the call
+    // (or block) that owns the environment.
+    size_t frame = environment->size();
+    Completion completion = Completion::NORMAL;
+    for (auto& statement : stmt.statements) {
+      completion = execute(statement);
+      if (completion == Completion::RETURN) break;
+    }
+    environment->truncate(frame);
+    return completion;
   }
-  environment->define(stmt->name.lexeme_, std::move(value));
-  return std::any{};
+  Ref<Environment> block = heap_.makeEnvironment(environment);
+  Completion completion = executeBlock(stmt.statements, block);
+  heap_.recycle(std::move(block));
+  return completion;
 }
-std::any Interpreter::visitBlockStmt(std::shared_ptr<Block> stmt) {
-  executeBlock(stmt->statements, std::make_shared<Environment>(environment));
-  return std::any{};
+Completion Interpreter::visitIfStmt(If& stmt) {
+  if (evaluate(stmt.condition).isTruthy()) {
+    return execute(stmt.thenBranch);
+  } else if (stmt.elseBranch != nullptr) {
+    return execute(stmt.elseBranch);
+  }
+  return Completion::NORMAL;
+}
+Completion Interpreter::visitWhileStmt(While& stmt) {
+  uint32_t iterations = 0;
+  while (evaluate(stmt.condition).isTruthy()) {
+    if (execute(stmt.body) == Completion::RETURN) return Completion::RETURN;
+    // A hot loop in a function finishes the call in compiled code.
+    if (jit_ != nullptr && ++iterations == jit_->threshold() &&
+        function_ != nullptr &&
+        jit_->enterLoop(*function_, stmt, *environment, returnValue_)) {
+      return Completion::RETURN;
+    }
+  }
+  return Completion::NORMAL;
 }
-std::any Interpreter::visitIfStmt(std::shared_ptr<If> stmt) {
-  if (isTruthy(evaluate(stmt->condition))) {
-    execute(stmt->thenBranch);
-  } else if (stmt->elseBranch != nullptr) {
-    execute(stmt->elseBranch);
+
+void Interpreter::declare(const Token& name, Value value) {
+  if (environment == globals) {
+    globals->define(name.symbol_, std::move(value));
+  } else {
+    environment->define(std::move(value));
   }
-  return std::any{};
 }
-std::any Interpreter::visitWhileStmt(std::shared_ptr<While> stmt) {
-  while (isTruthy(evaluate(stmt->condition))) {
-    execute(stmt->body);
+Completion Interpreter::executeBlock(const std::vector<StmtPtr>& statements,
+                                     Ref<Environment> environment1) {
+  EnvironmentScope scope{*this, std::move(environment)};
+  environment = std::move(environment1);
+  for (auto& statement : statements) {
+    if (execute(statement) == Completion::RETURN) return Completion::RETURN;
   }
-  return std::any{};
+  return Completion::NORMAL;
 }
+Completion Interpreter::executeBody(const Function& declaration,
+                                    Ref<Environment> environment1) {
+  struct Restore {
+    Interpreter& interpreter;
+    const Function* previous;
+    ~Restore() { interpreter.function_ = previous; }
+  } restore{*this, function_};
 
-void Interpreter::execute(std::shared_ptr<Stmt> stmt) { stmt->accept(*this); }
-void Interpreter::executeBlock(
-    const std::vector<std::shared_ptr<Stmt>>& statements,
-    std::shared_ptr<Environment> environment1) {
-  std::shared_ptr<Environment> previous = this->environment;
-  try {
-    this->environment = environment1;
-    for (auto& statement : statements) {
-      execute(statement);
-    }
-  } catch (...) {
-    this->environment = previous;
-    throw;
+  function_ = &declaration;
+  if (closures_ == nullptr) {
+    return executeBlock(declaration.body, std::move(environment1));
   }
-  this->environment = previous;
+  const ClosureCompiler::StmtCode& body = closures_->body(declaration);
+  EnvironmentScope scope{*this, std::move(environment)};
+  environment = std::move(environment1);
+  return body(*this);
 }
-std::any Interpreter::visitFunctionStmt(std::shared_ptr<Function> stmt) {
-  auto function = std::make_shared<LoxFunction>(stmt, environment);
-  environment->define(stmt->name.lexeme_, function);
-  return std::any{};
+Completion Interpreter::visitFunctionStmt(Function& stmt) {
+  declare(stmt.name, heap_.make<LoxFunction>(&stmt, environment));
+  return Completion::NORMAL;
+}
+Completion Interpreter::visitReturnStmt(Return& stmt) {
+  if (stmt.tailCall) return returnCall(static_cast<Call&>(*stmt.value));
+  Value value = nullptr;
+  if (stmt.value != nullptr) {
+    value = evaluate(stmt.value);
+  }
+  returnValue_ = std::move(value);
+  return Completion::RETURN;
+}
+Completion Interpreter::visitClassStmt(Class& stmt) {
+  Value superclass;
+  if (stmt.superclass != nullptr) {
+    superclass = visitVariableExpr(*stmt.superclass);
+    if (!superclass.isCallable() ||
+        dynamic_cast<LoxClass*>(superclass.asCallable()) == nullptr) {
+      throw RuntimeError{stmt.superclass->name, "Superclass must be a class!"};
+    }
+  }
+
+  // Methods close over an extra environment holding `super` in slot 0.
+  Ref<Environment> closure = environment;
+  if (!superclass.isNil()) {
+    closure = heap_.make<Environment>(environment);
+    closure->define(superclass);
+  }
+  static const Symbol init = symbols().intern("init");
+  std::unordered_map<Symbol, Value> methods;
+  for (const auto& method : stmt.methods) {
+    methods[method->name.symbol_] = heap_.make<LoxFunction>(
+        method.get(), closure, method->name.symbol_ == init);
+  }
+
+  auto* superclassPtr =
+      superclass.isNil() ? nullptr
+                         : static_cast<LoxClass*>(superclass.asCallable());
+  declare(stmt.name, heap_.make<LoxClass>(std::string{stmt.name.lexeme_},
+                                          superclassPtr, std::move(methods)));
+  return Completion::NORMAL;
 }
-std::any Interpreter::visitReturnStmt(std::shared_ptr<Return> stmt) {
-  std::any value = nullptr;
-  if (stmt->value != nullptr) {
-    value = evaluate(stmt->value);
+Completion Interpreter::visitImportStmt(Import& stmt) {
+  if (stmt.program == nullptr) {
+    throw RuntimeError{stmt.path, "Module " + std::string{stmt.path.lexeme_} +
+                                      " was not loaded!"};
   }
-  throw LoxReturn{value};
+  // Imports are top-level statements, so the module runs among the globals.
+  if (modules_.insert(stmt.program).second) run(*stmt.program);
+  return Completion::NORMAL;
 }
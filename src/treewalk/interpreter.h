@@ -1,64 +1,222 @@
 #pragma once
-#include <any>
+#include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <iostream>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "LoxCallable.h"
+#include "LoxInstance.h"
 #include "environment.h"
 #include "expr.h"
+#include "heap.h"
+#include "profiler.h"
 #include "stmt.h"
+#include "value.h"
+
+class ClosureCompiler;
+class Jit;
+class LoxFunction;
 
 class NativeClock : public LoxCallable {
  public:
   int arity() override { return 0; }
-  std::any call(Interpreter& interpreter,
-                std::vector<std::any> arguments) override {
+  Value call(Interpreter& interpreter, Value* arguments) override {
     auto ticks = std::chrono::system_clock::now().time_since_epoch();
-    return std::chrono::duration<double>{ticks}.count() / 1000.0;
+    return std::chrono::duration<double>{ticks}.count();
   }
   std::string toString() override { return "<native fn>"; }
 };
 
-class Interpreter : public ExprVisitor, StmtVisitor {
+// How a statement finished. A `return` travels back to LoxFunction::call as
+// a plain value instead of a C++ exception; the returned value itself is
+// parked in the interpreter until the call picks it up.
+enum class Completion { NORMAL, RETURN };
+
+class Interpreter : public ExprVisitor<Interpreter, Value>,
+                    public StmtVisitor<Interpreter, Completion> {
+ private:
+  // Declared first so that it outlives every reference into it.
+  Heap heap_;
+
+  // Arguments are evaluated onto this stack and handed to the callee in
+  // place. It never reallocates, so the pointers stay valid while nested
+  // calls push above them.
+  static constexpr size_t kArgumentsMax = 1 << 16;
+  std::unique_ptr<Value[]> arguments_{new Value[kArgumentsMax]};
+  Value* argumentsTop_{arguments_.get()};
+
  public:
-  std::shared_ptr<Environment> globals{new Environment};
+  Ref<Environment> globals{heap_.make<Environment>()};
 
  private:
-  std::shared_ptr<Environment> environment = globals;
+  Ref<Environment> environment = globals;
 
  public:
-  Interpreter() { globals->define("clock", std::shared_ptr<NativeClock>{}); };
-
-  void interpret(std::vector<std::shared_ptr<Stmt>>& statements);
-
-  std::any visitLiteralExpr(std::shared_ptr<Literal> expr) override;
-  std::any visitGroupingExpr(std::shared_ptr<Grouping> expr) override;
-  std::any visitUnaryExpr(std::shared_ptr<Unary> expr) override;
-  std::any visitBinaryExpr(std::shared_ptr<Binary> expr) override;
-  std::any visitVariableExpr(std::shared_ptr<Variable> expr) override;
-  std::any visitAssignExpr(std::shared_ptr<Assign> expr) override;
-  std::any visitLogicalExpr(std::shared_ptr<Logical> expr) override;
-  std::any visitCallExpr(std::shared_ptr<Call> expr) override;
-
-  std::any visitExpressionStmt(std::shared_ptr<Expression> stmt) override;
-  std::any visitPrintStmt(std::shared_ptr<Print> stmt) override;
-  std::any visitVarStmt(std::shared_ptr<Var> stmt) override;
-  std::any visitBlockStmt(std::shared_ptr<Block> stmt) override;
-  std::any visitIfStmt(std::shared_ptr<If> stmt) override;
-  std::any visitWhileStmt(std::shared_ptr<While> stmt) override;
-  std::any visitFunctionStmt(std::shared_ptr<Function> stmt) override;
-  std::any visitReturnStmt(std::shared_ptr<Return> stmt) override;
-
-  void executeBlock(const std::vector<std::shared_ptr<Stmt>>& statements,
-                    std::shared_ptr<Environment> environment1);
+  Interpreter() {
+    globals->define(symbols().intern("clock"), new NativeClock);
+  };
+
+  Heap& heap() { return heap_; }
+  // Calls are only timed while a profiler is set.
+  void setProfiler(Profiler* profiler) { profiler_ = profiler; }
+  Profiler* profiler() { return profiler_; }
+  // Hot functions are only compiled while a JIT is set.
+  void setJit(Jit* jit) { jit_ = jit; }
+  Jit* jit() { return jit_; }
+  // Programs and function bodies run as closures while a compiler is set,
+  // instead of being walked node by node.
+  void setClosureCompiler(ClosureCompiler* compiler) { closures_ = compiler; }
+  // Where `print` writes, std::cout unless set.
+  void setOutput(std::ostream* out) { out_ = out; }
+  std::ostream& output() { return *out_; }
+
+  // Interpreters that can walk the same trees on several threads, such as
+  // actors (see Actors), share a flag that is set while they might. While it
+  // is, none of them fills in the caches kept in the nodes, whose updates
+  // nothing orders between threads. What was cached before stays valid: the
+  // entries of one heap's shapes never match another heap's instances.
+  void shareTrees(const std::atomic<bool>* shared) { sharedTrees_ = shared; }
+  // Reference counts are not atomic, so an interpreter running trees that
+  // another thread built evaluates string literals to copies of its own.
+  void copyStringLiterals() { copyStringLiterals_ = true; }
+
+  void interpret(const std::vector<StmtPtr>& statements);
+  // Calls `function` from outside any Lox code, as an embedder does (see
+  // Isolate). The caller has checked the number of arguments. Errors are
+  // thrown, not reported.
+  Value call(LoxCallable& function, std::vector<Value> arguments);
+
+  Value visitLiteralExpr(Literal& expr);
+  Value visitGroupingExpr(Grouping& expr);
+  Value visitUnaryExpr(Unary& expr);
+  Value visitBinaryExpr(Binary& expr);
+  Value visitVariableExpr(Variable& expr);
+  Value visitAssignExpr(Assign& expr);
+  Value visitLogicalExpr(Logical& expr);
+  Value visitCallExpr(Call& expr);
+  Value visitGetExpr(Get& expr);
+  Value visitSetExpr(Set& expr);
+  Value visitThisExpr(This& expr);
+  Value visitSuperExpr(Super& expr);
+
+  Completion visitExpressionStmt(Expression& stmt);
+  Completion visitPrintStmt(Print& stmt);
+  Completion visitVarStmt(Var& stmt);
+  Completion visitBlockStmt(Block& stmt);
+  Completion visitIfStmt(If& stmt);
+  Completion visitWhileStmt(While& stmt);
+  Completion visitFunctionStmt(Function& stmt);
+  Completion visitReturnStmt(Return& stmt);
+  Completion visitClassStmt(Class& stmt);
+  Completion visitImportStmt(Import& stmt);
+
+  Completion executeBlock(const std::vector<StmtPtr>& statements,
+                          Ref<Environment> environment1);
+  // Runs the body of a function call, whose hot loops the JIT may take
+  // over.
+  Completion executeBody(const Function& declaration,
+                         Ref<Environment> environment1);
+  // Hands over the value of the `return` that produced Completion::RETURN.
+  Value takeReturnValue() { return std::move(returnValue_); }
+
+  // A call in tail position, which the body making it left to the
+  // LoxFunction::call running that body (see deferCall()). `callee` is nil
+  // while none is pending.
+  struct TailCall {
+    Value callee;
+    // The instance a method is called on, or nil.
+    Value receiver;
+    std::vector<Value> arguments;
+  };
+  TailCall& tailCall() { return tailCall_; }
 
  private:
-  std::any evaluate(std::shared_ptr<Expr> expr);
-  void execute(std::shared_ptr<Stmt> stmt);
-  bool isTruthy(const std::any& object);
-  bool isEqual(const std::any& left, const std::any& right);
-  void checkNumberOperand(const Token& op, const std::any& operand);
-  void checkNumberOperand(const Token& op, const std::any& left,
-                          const std::any& right);
-  std::string stringify(const std::any& value);
+  Value evaluate(const ExprPtr& expr) { return visitExpr(*expr); }
+  Completion execute(const StmtPtr& stmt) { return visitStmt(*stmt); }
+  void declare(const Token& name, Value value);
+  // Runs the top level of a program or module.
+  void run(const std::vector<StmtPtr>& statements);
+  // Calls `callee` with the arguments of `expr`. A `tail` call is deferred
+  // when it can be, and then returns nil.
+  Value call(Call& expr, const Value& callee, bool tail = false);
+  // Calls `function` with arguments already on the argument stack. A
+  // NativeError is reported at `expr`.
+  Value call(Call& expr, LoxCallable& function, Value* arguments);
+  // `object.name(...)` and `super.name(...)`: methods are called directly
+  // instead of through a bound method.
+  Value invoke(Call& expr, Get& callee, bool tail = false);
+  Value invoke(Call& expr, Super& callee, bool tail = false);
+  // Runs `return expr;` for a Return the Resolver marked as a tail call.
+  Completion returnCall(Call& expr);
+  // Moves a call in tail position into tailCall_, so that the caller's frame
+  // is gone by the time the callee runs and tail recursion takes constant
+  // stack. Only calls of Lox functions that are not initializers can wait;
+  // returns false for anything else, which is then called as usual.
+  bool deferCall(LoxCallable& function, LoxInstance* receiver,
+                 Value* arguments);
+  // Pops the arguments pushed while it is alive, including when a
+  // RuntimeError unwinds through the call.
+  struct ArgumentScope {
+    ~ArgumentScope() {
+      while (interpreter.argumentsTop_ != base) {
+        *--interpreter.argumentsTop_ = nullptr;
+      }
+    }
+    Interpreter& interpreter;
+    Value* const base;
+  };
+  // Restores the environment it saved on every way out, including a
+  // RuntimeError unwinding to interpret().
+  struct EnvironmentScope {
+    ~EnvironmentScope() { interpreter.environment = std::move(previous); }
+    Interpreter& interpreter;
+    Ref<Environment> previous;
+  };
+  // Evaluates the arguments of `expr` onto the argument stack and checks
+  // their number against `function`, unless this call site already has.
+  // Returns where they start.
+  Value* pushArguments(Call& expr, LoxCallable& function);
+  void checkArity(Call& expr, LoxCallable& function);
+  // Finds the field or method `name` of `instance` through the site's cache.
+  PropertyCache::Entry findProperty(LoxInstance* instance, const Token& name,
+                                    PropertyCache& cache);
+  LoxFunction* findSuperMethod(Super& expr);
+  // Stores `value` in the field of `instance` that `expr` names.
+  void setProperty(LoxInstance* instance, Set& expr, const Value& value);
+  void checkNumberOperand(const Token& op, const Value& operand);
+  void checkNumberOperand(const Token& op, const Value& left,
+                          const Value& right);
+  std::string stringify(const Value& value);
+
+  // Compiled code calls back in through the argument stack.
+  friend class ClosureCompiler;
+  friend class Jit;
+
+  // Whether other threads may be walking the trees, see shareTrees().
+  bool treesShared() const {
+    return sharedTrees_ != nullptr &&
+           sharedTrees_->load(std::memory_order_acquire);
+  }
+
+  const std::atomic<bool>* sharedTrees_{nullptr};
+
+  Value returnValue_;
+  TailCall tailCall_;
+  std::ostream* out_{&std::cout};
+  Profiler* profiler_{nullptr};
+  Jit* jit_{nullptr};
+  ClosureCompiler* closures_{nullptr};
+  // The function whose body is running, if any.
+  const Function* function_{nullptr};
+  // Programs that have run, so that each module runs once, on its first
+  // import.
+  std::unordered_set<const std::vector<StmtPtr>*> modules_;
+  // This interpreter's copies of string literals, see copyStringLiterals().
+  bool copyStringLiterals_{false};
+  std::unordered_map<const Literal*, Value> stringLiterals_;
 };
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "isolate.h"
+
+#include <mutex>
+#include <sstream>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>  // std::exchange, std::move
+
+#include "../scanner/source.h"
+#include "../utils/error.h"
+#include "closure_compiler.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "module_loader.h"
+#include "optimizer.h"
+#include "resolver.h"
+#include "runtime_error.h"
+
+namespace {
+
+Value toValue(const Scalar& scalar) {
+  return std::visit(
+      [](const auto& value) -> Value {
+        if constexpr (std::is_same_v<std::decay_t<decltype(value)>,
+                                     std::string>) {
+          return new LoxString{value};
+        } else {
+          return value;
+        }
+      },
+      scalar);
+}
+
+std::optional<Scalar> toScalar(const Value& value) {
+  if (value.isNil()) return nullptr;
+  if (value.isBool()) return value.asBool();
+  if (value.isNumber()) return value.asNumber();
+  if (value.isString()) return value.asString();
+  return std::nullopt;
+}
+
+}  // namespace
+
+struct Isolate::State {
+  explicit State(Options options) {
+    interpreter.setOutput(&output);
+    if (options.closures) {
+      closures = std::make_unique<ClosureCompiler>();
+      interpreter.setClosureCompiler(closures.get());
+    }
+    if (options.jit) {
+      jit = std::make_unique<Jit>(interpreter);
+      interpreter.setJit(jit.get());
+    }
+  }
+
+  void add(Error error) {
+    std::lock_guard<std::mutex> lock{mutex};
+    errors.push_back(std::move(error));
+  }
+  size_t errorCount() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return errors.size();
+  }
+
+  // Runs `module` unless it, or an import of it, failed to compile. A
+  // module the loader had already loaded only reports how that went.
+  bool run(Module& module, size_t errorsBefore) {
+    auto [result, first] = results.emplace(&module, false);
+    if (!first) return result->second;
+    if (errorCount() != errorsBefore) return false;
+    ErrorScope scope{&handler};
+    interpreter.interpret(module.statements);
+    return result->second = errorCount() == errorsBefore;
+  }
+
+  // Functions point into the programs, so the loader is declared first and
+  // outlives the rest. Globals can be redefined by later loads and are
+  // looked up by call(), so no program is optimized as a whole.
+  ModuleLoader loader{[](Module& module) {
+    Resolver resolver{};
+    resolver.resolve(module.statements);
+    if (resolver.hadError()) return false;
+    Optimizer{false}.optimize(module.statements);
+    return true;
+  }};
+  // Whether each module loaded so far ran without errors.
+  std::unordered_map<const Module*, bool> results;
+
+  // Called from the loader's workers too.
+  std::mutex mutex;
+  std::vector<Error> errors;
+  const ErrorHandler handler{[this](int line, const std::string& where,
+                                    const std::string& msg) {
+    add({line, where, msg});
+  }};
+
+  std::ostringstream output;
+  Interpreter interpreter;
+  std::unique_ptr<ClosureCompiler> closures;
+  std::unique_ptr<Jit> jit;
+};
+
+Isolate::Isolate() : Isolate{Options{}} {}
+
+Isolate::Isolate(Options options)
+    : state_{std::make_unique<State>(options)} {}
+
+Isolate::~Isolate() = default;
+
+bool Isolate::load(std::string source) {
+  ErrorScope scope{&state_->handler};
+  size_t errors = state_->errorCount();
+  Module& module = state_->loader.load(
+      std::make_unique<SourceBuffer>(std::move(source)), "");
+  return state_->run(module, errors);
+}
+
+bool Isolate::loadFile(const std::string& path) {
+  std::unique_ptr<SourceBuffer> source = SourceBuffer::fromFile(path);
+  if (source == nullptr) {
+    state_->add({0, "", "Can't open file " + path + "!"});
+    return false;
+  }
+  ErrorScope scope{&state_->handler};
+  size_t errors = state_->errorCount();
+  Module& module = state_->loader.load(std::move(source), path);
+  return state_->run(module, errors);
+}
+
+std::optional<Scalar> Isolate::call(std::string_view name,
+                                    const std::vector<Scalar>& arguments) {
+  State& state = *state_;
+  const Value* global = state.interpreter.globals->find(symbols().intern(name));
+  if (global == nullptr || !global->isCallable()) {
+    state.add({0, "", "Undefined function '" + std::string{name} + "'!"});
+    return std::nullopt;
+  }
+  // Holds the callee even if the call redefines its global.
+  Value callee = *global;
+  LoxCallable& function = *callee.asCallable();
+  if (arguments.size() != static_cast<size_t>(function.arity())) {
+    state.add({0, "", "Expected " + std::to_string(function.arity()) +
+                          " arguments but got " +
+                          std::to_string(arguments.size()) + "!"});
+    return std::nullopt;
+  }
+
+  std::vector<Value> values;
+  values.reserve(arguments.size());
+  for (const Scalar& argument : arguments) values.push_back(toValue(argument));
+  try {
+    Value result = state.interpreter.call(function, std::move(values));
+    if (std::optional<Scalar> scalar = toScalar(result)) return scalar;
+    state.add({0, "", "Can only return nil, booleans, numbers and strings!"});
+  } catch (const RuntimeError& error) {
+    state.add({error.token_.line_, "", error.what()});
+  } catch (const NativeError& error) {
+    state.add({0, "", error.what()});
+  }
+  return std::nullopt;
+}
+
+std::vector<Isolate::Error> Isolate::takeErrors() {
+  std::lock_guard<std::mutex> lock{state_->mutex};
+  return std::exchange(state_->errors, {});
+}
+
+std::string Isolate::takeOutput() {
+  std::string output = state_->output.str();
+  state_->output.str("");
+  return output;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+// What crosses into and out of an isolate: nil, a boolean, a number or a
+// string. Objects stay inside the isolate that made them.
+using Scalar = std::variant<std::nullptr_t, bool, double, std::string>;
+
+// An instance of the tree-walking runtime for embedding Lox in a C++
+// program, built as the liblox library:
+//
+//   Isolate rules;
+//   rules.load("fun score(age) { if (age < 18) return 0; return 1; }");
+//   std::optional<Scalar> score = rules.call("score", {41.0});
+//   if (!score) for (const auto& error : rules.takeErrors()) ...
+//
+// An isolate owns its interpreter, heap, globals, loaded programs and the
+// output of `print`. Errors are collected instead of printed. Any number of
+// isolates can run on different threads at once; each one is used by one
+// thread at a time, which need not be the one that created it.
+//
+// Some state is still process-wide. Identifiers, including the names passed
+// to call(), are interned into the one symbol table (see symbols()), which
+// takes a lock and never shrinks: a host that keeps loading new names grows
+// it for as long as the process runs. Shape ids come from one counter.
+class Isolate {
+ public:
+  struct Options {
+    // Run programs and function bodies as compiled closures (--closures).
+    bool closures{false};
+    // Compile hot functions and loops to machine code (--jit).
+    bool jit{false};
+  };
+
+  struct Error {
+    int line;
+    // Where on the line, such as " at 'x'"; empty for runtime errors.
+    std::string where;
+    std::string message;
+  };
+
+  Isolate();
+  explicit Isolate(Options options);
+  ~Isolate();
+  Isolate(const Isolate&) = delete;
+  Isolate& operator=(const Isolate&) = delete;
+
+  // Compiles and runs `source`, whose globals later loads and calls see.
+  // Imports are relative to the working directory. Returns false if it
+  // failed to compile or stopped at a runtime error, see takeErrors().
+  bool load(std::string source);
+  // Loads the script at `path`, whose imports are relative to it. A file is
+  // only loaded once; loading it again returns what the first load did.
+  bool loadFile(const std::string& path);
+
+  // Calls the global function or class `name` and returns its result, or
+  // nullopt on an error (see takeErrors()), including a result that is an
+  // object.
+  std::optional<Scalar> call(std::string_view name,
+                             const std::vector<Scalar>& arguments = {});
+
+  // The errors since the last call, oldest first.
+  std::vector<Error> takeErrors();
+  // What `print` wrote since the last call.
+  std::string takeOutput();
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
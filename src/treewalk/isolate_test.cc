@@ -0,0 +1,111 @@
+#include "isolate.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../utils/error.h"
+#include "runtime_error.h"
+
+namespace {
+
+const char* const kRules = R"(
+  var threshold = 18;
+  fun allowed(age) { return age >= threshold; }
+  fun greet(name) { print "checking " + name; return "hello " + name; }
+  fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+  class Counter { init() { this.count = 0; } }
+  fun counter() { return Counter(); }
+)";
+
+}  // namespace
+
+TEST(IsolateTests, CallsGlobalFunctions) {
+  Isolate isolate;
+  ASSERT_TRUE(isolate.load(kRules));
+  EXPECT_EQ(isolate.call("allowed", {20.0}), Scalar{true});
+  EXPECT_EQ(isolate.call("allowed", {12.0}), Scalar{false});
+  EXPECT_EQ(isolate.call("greet", {std::string{"ann"}}),
+            Scalar{std::string{"hello ann"}});
+  EXPECT_EQ(isolate.call("fib", {20.0}), Scalar{6765.0});
+  EXPECT_EQ(isolate.call("clock")->index(), 2u);
+  EXPECT_EQ(isolate.takeOutput(), "checking ann\n");
+  EXPECT_EQ(isolate.takeOutput(), "");
+
+  // Later loads see and replace earlier globals.
+  ASSERT_TRUE(isolate.load("threshold = 21;"));
+  EXPECT_EQ(isolate.call("allowed", {20.0}), Scalar{false});
+  EXPECT_TRUE(isolate.takeErrors().empty());
+}
+
+TEST(IsolateTests, CollectsErrors) {
+  Isolate isolate;
+  EXPECT_FALSE(isolate.load("var a = ;"));
+  EXPECT_TRUE(isolate.load(kRules));
+  EXPECT_FALSE(isolate.load("print 1;\nprint nil + 1;"));
+  EXPECT_FALSE(isolate.call("missing"));
+  EXPECT_FALSE(isolate.call("fib"));
+  EXPECT_FALSE(isolate.call("allowed", {std::string{"old"}}));
+  EXPECT_FALSE(isolate.call("counter"));
+
+  std::vector<Isolate::Error> errors = isolate.takeErrors();
+  ASSERT_EQ(errors.size(), 6u);
+  EXPECT_EQ(errors[0].line, 1);
+  EXPECT_EQ(errors[0].where, " at ';'");
+  EXPECT_EQ(errors[0].message, "Expect expression.");
+  EXPECT_EQ(errors[1].line, 2);
+  EXPECT_EQ(errors[1].message, "Operand must be two numbers or two strings!");
+  EXPECT_EQ(errors[2].message, "Undefined function 'missing'!");
+  EXPECT_EQ(errors[3].message, "Expected 1 arguments but got 0!");
+  EXPECT_EQ(errors[4].line, 3);
+  EXPECT_EQ(errors[4].message, "Operand must be two numbers!");
+  EXPECT_EQ(errors[5].message,
+            "Can only return nil, booleans, numbers and strings!");
+  EXPECT_TRUE(isolate.takeErrors().empty());
+  EXPECT_EQ(isolate.takeOutput(), "1.000000\n");
+
+  // None of it reached the process-wide flags the command line uses.
+  EXPECT_FALSE(hadError);
+  EXPECT_FALSE(hadRuntimeError);
+}
+
+TEST(IsolateTests, KeepsIsolatesApart) {
+  Isolate first;
+  Isolate second;
+  ASSERT_TRUE(first.load("var name = \"first\"; fun get() { return name; }"));
+  ASSERT_TRUE(second.load("var name = \"second\"; fun get() { return name; }"));
+  EXPECT_EQ(first.call("get"), Scalar{std::string{"first"}});
+  EXPECT_EQ(second.call("get"), Scalar{std::string{"second"}});
+  EXPECT_FALSE(second.load("undefined;"));
+  EXPECT_TRUE(first.takeErrors().empty());
+  EXPECT_EQ(second.takeErrors().size(), 1u);
+}
+
+TEST(IsolateTests, RunsIsolatesOnThreads) {
+  constexpr int kThreads = 4;
+  std::vector<std::thread> threads;
+  bool passed[kThreads] = {};
+  for (int thread = 0; thread < kThreads; ++thread) {
+    threads.emplace_back([thread, &passed] {
+      Isolate::Options options;
+      options.closures = thread % 2 == 1;
+      options.jit = thread == 2;
+      Isolate isolate{options};
+      bool ok = isolate.load(kRules);
+      for (int i = 0; ok && i < 200; ++i) {
+        ok = isolate.call("fib", {10.0}) == Scalar{55.0} &&
+             isolate.call("greet", {std::to_string(thread)}) ==
+                 Scalar{"hello " + std::to_string(thread)};
+      }
+      ok = ok && !isolate.load("var x = 1;\nx();") &&
+           isolate.takeErrors().size() == 1;
+      passed[thread] = ok;
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  for (int thread = 0; thread < kThreads; ++thread) {
+    EXPECT_TRUE(passed[thread]) << "isolate " << thread;
+  }
+}
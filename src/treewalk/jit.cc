@@ -0,0 +1,1201 @@
+#include "jit.h"
+
+#include <algorithm>  // std::all_of
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <utility>  // std::exchange
+
+#if LOX_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "LoxCallable.h"
+#include "LoxFunction.h"
+#include "environment.h"
+#include "expr.h"
+#include "interpreter.h"
+#include "runtime_error.h"
+#include "stmt.h"
+
+namespace {
+
+// Value's encoding, as compiled code tests it inline (see value.h).
+constexpr uint64_t kQNaN = 0x7ffc000000000000;
+constexpr uint64_t kSignBit = 0x8000000000000000;
+constexpr uint64_t kNil = kQNaN | 1;
+constexpr uint64_t kFalse = kQNaN | 2;
+constexpr uint64_t kTrue = kQNaN | 3;
+// Returned instead of a Value once an error is parked in Jit::error_. No
+// Value is encoded like this.
+constexpr uint64_t kBailout = kQNaN | 4;
+
+// Stack that recursion through compiled code may use, measured from the
+// outermost compiled call; well inside the default 8 MiB.
+constexpr ptrdiff_t kMaxStack = 4 << 20;
+
+// General purpose registers by their encoding.
+enum Reg : uint8_t {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+};
+
+// The second opcode byte of jcc rel32.
+enum class Condition : uint8_t {
+  BELOW = 0x82,
+  ABOVE_EQUAL = 0x83,
+  EQUAL = 0x84,
+  NOT_EQUAL = 0x85,
+  BELOW_EQUAL = 0x86,
+  ABOVE = 0x87,
+  PARITY = 0x8a,
+};
+
+// Scalar double SSE2 opcodes, after the F2 prefix.
+constexpr uint8_t kMovsdLoad = 0x10;
+constexpr uint8_t kMovsdStore = 0x11;
+constexpr uint8_t kAddsd = 0x58;
+constexpr uint8_t kMulsd = 0x59;
+constexpr uint8_t kSubsd = 0x5c;
+constexpr uint8_t kDivsd = 0x5e;
+
+// Just the x86-64 encodings the compiler below needs. xmm registers are
+// plain ints 0-15.
+class Assembler {
+ public:
+  struct Label {
+    int offset{-1};
+    std::vector<size_t> uses;  // rel32 fields still waiting for the offset
+  };
+
+  const std::vector<uint8_t>& bytes() const { return bytes_; }
+
+  void bind(Label& label) {
+    label.offset = static_cast<int>(bytes_.size());
+    for (size_t use : label.uses) {
+      patch32(use, label.offset - static_cast<int>(use + 4));
+    }
+  }
+  void jmp(Label& label) {
+    bytes_.push_back(0xe9);
+    rel32(label);
+  }
+  void jcc(Condition condition, Label& label) {
+    emit({0x0f, static_cast<uint8_t>(condition)});
+    rel32(label);
+  }
+
+  // movsd, addsd and friends between two xmm registers...
+  void sse(uint8_t op, int reg, int rm) {
+    bytes_.push_back(0xf2);
+    rex(false, reg, rm);
+    emit({0x0f, op, modrm(3, reg, rm)});
+  }
+  // ...and with a [base + disp32] operand.
+  void sse(uint8_t op, int reg, Reg base, int32_t disp) {
+    bytes_.push_back(0xf2);
+    rex(false, reg, base);
+    emit({0x0f, op, modrm(2, reg, base)});
+    emit32(disp);
+  }
+  // Copies a whole register: movsd would keep the upper half and so wait
+  // for whatever last wrote it.
+  void movapd(int to, int from) {
+    bytes_.push_back(0x66);
+    rex(false, to, from);
+    emit({0x0f, 0x28, modrm(3, to, from)});
+  }
+  void ucomisd(int a, int b) {
+    bytes_.push_back(0x66);
+    rex(false, a, b);
+    emit({0x0f, 0x2e, modrm(3, a, b)});
+  }
+  void xorpd(int a, int b) {
+    bytes_.push_back(0x66);
+    rex(false, a, b);
+    emit({0x0f, 0x57, modrm(3, a, b)});
+  }
+  void movqToXmm(int xmm, Reg from) {
+    bytes_.push_back(0x66);
+    rex(true, xmm, from);
+    emit({0x0f, 0x6e, modrm(3, xmm, from)});
+  }
+  void movqFromXmm(Reg to, int xmm) {
+    bytes_.push_back(0x66);
+    rex(true, xmm, to);
+    emit({0x0f, 0x7e, modrm(3, xmm, to)});
+  }
+
+  void mov(Reg to, uint64_t immediate) {
+    rex(true, 0, to);
+    bytes_.push_back(0xb8 + (to & 7));
+    emit64(immediate);
+  }
+  void mov(Reg to, Reg from) {
+    rex(true, from, to);
+    emit({0x89, modrm(3, from, to)});
+  }
+  void lea(Reg to, Reg base, int32_t disp) {
+    rex(true, to, base);
+    emit({0x8d, modrm(2, to, base)});
+    emit32(disp);
+  }
+  void andq(Reg to, Reg from) {
+    rex(true, from, to);
+    emit({0x21, modrm(3, from, to)});
+  }
+  void cmp(Reg a, Reg b) {
+    rex(true, b, a);
+    emit({0x39, modrm(3, b, a)});
+  }
+  // mov to, [base + disp32], and back.
+  void load(Reg to, Reg base, int32_t disp) {
+    rex(true, to, base);
+    emit({0x8b, modrm(2, to, base)});
+    emit32(disp);
+  }
+  void store(Reg base, int32_t disp, Reg from) {
+    rex(true, from, base);
+    emit({0x89, modrm(2, from, base)});
+    emit32(disp);
+  }
+  void cmp(Reg a, Reg base, int32_t disp) {
+    rex(true, a, base);
+    emit({0x3b, modrm(2, a, base)});
+    emit32(disp);
+  }
+  void test(Reg a, Reg b) {
+    rex(true, b, a);
+    emit({0x85, modrm(3, b, a)});
+  }
+  // sub reg, imm32, returning where the immediate is for patch32().
+  size_t sub(Reg reg, uint32_t immediate) {
+    rex(true, 0, reg);
+    emit({0x81, modrm(3, 5, reg)});
+    emit32(immediate);
+    return bytes_.size() - 4;
+  }
+  void push(Reg reg) {
+    rex(false, 0, reg);
+    bytes_.push_back(0x50 + (reg & 7));
+  }
+  void pop(Reg reg) {
+    rex(false, 0, reg);
+    bytes_.push_back(0x58 + (reg & 7));
+  }
+  void call(Reg reg) {
+    rex(false, 0, reg);
+    emit({0xff, modrm(3, 2, reg)});
+  }
+  void ret() { bytes_.push_back(0xc3); }
+
+  void patch32(size_t at, uint32_t value) {
+    for (int i = 0; i < 4; ++i) bytes_[at + i] = value >> (8 * i);
+  }
+
+ private:
+  static uint8_t modrm(int mod, int reg, int rm) {
+    return mod << 6 | (reg & 7) << 3 | (rm & 7);
+  }
+  void rex(bool wide, int reg, int rm) {
+    uint8_t prefix = 0x40 | wide << 3 | (reg >> 3) << 2 | rm >> 3;
+    if (prefix != 0x40) bytes_.push_back(prefix);
+  }
+  void rel32(Label& label) {
+    if (label.offset >= 0) {
+      emit32(label.offset - static_cast<int>(bytes_.size() + 4));
+    } else {
+      label.uses.push_back(bytes_.size());
+      emit32(0);
+    }
+  }
+  void emit(std::initializer_list<uint8_t> bytes) {
+    bytes_.insert(bytes_.end(), bytes);
+  }
+  void emit32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) bytes_.push_back(value >> (8 * i));
+  }
+  void emit64(uint64_t value) {
+    for (int i = 0; i < 8; ++i) bytes_.push_back(value >> (8 * i));
+  }
+
+  std::vector<uint8_t> bytes_;
+};
+
+const Expr& unwrap(const Expr& expr) {
+  if (expr.kind != ExprKind::Grouping) return expr;
+  return unwrap(*static_cast<const Grouping&>(expr).expression);
+}
+
+bool containsCall(const Expr& expr) {
+  switch (expr.kind) {
+    case ExprKind::Call:
+      return true;
+    case ExprKind::Assign:
+      return containsCall(*static_cast<const Assign&>(expr).value);
+    case ExprKind::Binary: {
+      const auto& binary = static_cast<const Binary&>(expr);
+      return containsCall(*binary.left) || containsCall(*binary.right);
+    }
+    case ExprKind::Logical: {
+      const auto& logical = static_cast<const Logical&>(expr);
+      return containsCall(*logical.left) || containsCall(*logical.right);
+    }
+    case ExprKind::Grouping:
+      return containsCall(*static_cast<const Grouping&>(expr).expression);
+    case ExprKind::Unary:
+      return containsCall(*static_cast<const Unary&>(expr).right);
+    default:
+      return false;
+  }
+}
+
+bool isNumber(uint64_t bits) { return (bits & kQNaN) != kQNaN; }
+
+// A new reference to the Value encoded as `bits`, which stays valid.
+Value borrow(uint64_t bits) {
+  Value value = Value::fromBits(bits);
+  Value copy = value;
+  value.takeBits();
+  return copy;
+}
+
+}  // namespace
+
+// What the code at a call site does with the result.
+struct Jit::CallSite {
+  enum class Use { VALUE, DISCARD, RETURN };
+
+  Call* expr;
+  Use use;
+  // The callee is looked up onto pending_ before arguments that make calls
+  // of their own, as the interpreter evaluates it first.
+  bool calleeFirst{false};
+  // The function last called from here, held so the pointer stays unique.
+  // Once it is compiled, calls to it jump straight into its code.
+  Value callee;
+  LoxFunction* function{nullptr};
+};
+
+struct Jit::Code {
+  using Entry = uint64_t (*)(Jit* jit, const Value* values);
+
+  ~Code() {
+#if LOX_JIT_SUPPORTED
+    if (memory != nullptr) munmap(memory, size);
+#endif
+  }
+
+  // Copies `bytes` into fresh executable memory.
+  bool install(const std::vector<uint8_t>& bytes) {
+#if LOX_JIT_SUPPORTED
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t length = (bytes.size() + page - 1) / page * page;
+    void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return false;
+    std::memcpy(mapping, bytes.data(), bytes.size());
+    if (mprotect(mapping, length, PROT_READ | PROT_EXEC) != 0) {
+      munmap(mapping, length);
+      return false;
+    }
+    memory = mapping;
+    size = length;
+    entry = reinterpret_cast<Entry>(mapping);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void* memory{nullptr};
+  size_t size{0};
+  Entry entry{nullptr};
+  // The number of values the entry takes: the arguments of a function, or
+  // the locals in scope at a loop, found by (depth, slot) in `locals`.
+  size_t arity{0};
+  std::vector<std::pair<int, int>> locals;
+  std::vector<std::unique_ptr<CallSite>> sites;
+};
+
+// Generates the code for one function in a single pass over its body.
+//
+// Registers: rbx points at the native frame, r12 holds the Jit and r13
+// kBailout. Expressions are evaluated into xmm0-xmm7 like a stack, the
+// operand at depth d in xmm<d>. The first eight locals live in xmm8-xmm15,
+// the rest in the frame; every local also has a home slot in the frame,
+// where it is saved while the runtime is called.
+class JitCompiler {
+ public:
+  // With a `loop`, the code starts at that loop's condition instead of the
+  // top of the function, see Jit::enterLoop().
+  JitCompiler(Jit& jit, Jit::Code& code, const While* loop)
+      : jit_{jit}, code_{code}, loop_{loop} {}
+
+  bool compile(const Function& function);
+  const std::vector<uint8_t>& bytes() const { return assembler_.bytes(); }
+
+ private:
+  using Use = Jit::CallSite::Use;
+  using Label = Assembler::Label;
+
+  // Thrown on the first construct that is not compiled.
+  struct Unsupported {};
+
+  struct Local {
+    int home;  // frame slot
+    int xmm;   // register, or -1 for locals that only live in the frame
+  };
+
+  static constexpr int kTemporaries = 8;
+  static constexpr int kLocalRegisters = 8;
+
+  void statement(const Stmt& stmt);
+  void loop(const While& stmt);
+  // Evaluates `expr` into xmm<d> as a double. Where `unchecked` allows it,
+  // call results may leave the encoding of any Value instead; then this
+  // returns true, and it is up to the caller to check.
+  bool number(const Expr& expr, int d, bool unchecked);
+  bool arithmetic(const Binary& expr, int d);
+  // `+` of two call results, which may be strings.
+  void add(const Binary& expr, int d);
+  void negate(const Unary& expr, int d);
+  // Jumps to `target` if `expr` is truthy, or falsey when `when` is false.
+  void branch(const Expr& expr, int d, bool when, Label& target);
+  void compare(const Binary& expr, int d, bool when, Label& target);
+  void call(const Call& expr, int d, Use use);
+  // Raises the RuntimeError of `op` unless xmm<reg> holds a number.
+  void check(int reg, const Token& op, const char* message);
+  void jumpUnlessNumber(int reg, Label& target);
+  void bailOnError();
+  // Drops the call results the frame kept since its entry.
+  void trimKept();
+
+  Local declare();
+  const Local& resolve(int depth, int slot);
+  void load(int reg, const Local& local);
+  void store(const Local& local, int reg);
+  void constant(int reg, uint64_t bits);
+  // Saves the registers the runtime may clobber: temporaries below d and the
+  // locals.
+  void spill(int d);
+  void reload(int d);
+  void callRuntime(const void* function);
+  int allocate(int slots);
+
+  Jit& jit_;
+  Jit::Code& code_;
+  const While* loop_;
+  Assembler assembler_;
+  Label epilogue_;
+  Label bailout_;
+  Label loopEntry_;
+  Label loopHead_;
+  std::vector<Local> loopLocals_;
+  std::vector<Local> locals_;
+  // Mirrors the Resolver's scopes: each one lists its locals by slot.
+  std::vector<std::vector<int>> scopes_;
+  int slots_{kTemporaries};
+  // Where the prologue saves Jit::keptCount_.
+  int kept_{allocate(1)};
+};
+
+bool JitCompiler::compile(const Function& function) {
+  assembler_.push(RBP);
+  assembler_.mov(RBP, RSP);
+  assembler_.push(RBX);
+  assembler_.push(R12);
+  assembler_.push(R13);
+  assembler_.push(R14);  // Keeps rsp 16-byte aligned.
+  size_t frameSize = assembler_.sub(RSP, 0);
+  assembler_.mov(RBX, RSP);
+  assembler_.mov(R12, RDI);
+  assembler_.mov(R13, kBailout);
+  assembler_.mov(RAX, reinterpret_cast<uint64_t>(&jit_.keptCount_));
+  assembler_.load(RAX, RAX, 0);
+  assembler_.store(RBX, 8 * kept_, RAX);
+
+  try {
+    // Parameters and body share a scope, see Resolver::resolveFunction.
+    scopes_.emplace_back();
+    for (size_t i = 0; i < function.params.size(); ++i) {
+      Local local = declare();
+      if (loop_ != nullptr) continue;
+      int reg = local.xmm >= 0 ? local.xmm : 0;
+      assembler_.sse(kMovsdLoad, reg, RSI, 8 * i);
+      store(local, reg);
+    }
+    if (loop_ != nullptr) assembler_.jmp(loopEntry_);
+    for (const auto& statement : function.body) {
+      this->statement(*statement);
+    }
+  } catch (Unsupported) {
+    return false;
+  }
+  assembler_.mov(RAX, kNil);
+
+  assembler_.bind(epilogue_);
+  assembler_.lea(RSP, RBP, -32);
+  assembler_.pop(R14);
+  assembler_.pop(R13);
+  assembler_.pop(R12);
+  assembler_.pop(RBX);
+  assembler_.pop(RBP);
+  assembler_.ret();
+
+  assembler_.bind(bailout_);
+  assembler_.mov(RAX, R13);
+  assembler_.jmp(epilogue_);
+
+  if (loop_ != nullptr) {
+    if (loopHead_.offset < 0) return false;
+    // The locals in scope at the loop arrive in the order of code_.locals.
+    assembler_.bind(loopEntry_);
+    for (size_t i = 0; i < loopLocals_.size(); ++i) {
+      const Local& local = loopLocals_[i];
+      int reg = local.xmm >= 0 ? local.xmm : 0;
+      assembler_.sse(kMovsdLoad, reg, RSI, 8 * i);
+      store(local, reg);
+    }
+    assembler_.jmp(loopHead_);
+  }
+
+  assembler_.patch32(frameSize, (8 * slots_ + 15) / 16 * 16);
+  code_.arity =
+      loop_ != nullptr ? loopLocals_.size() : function.params.size();
+  return true;
+}
+
+void JitCompiler::statement(const Stmt& stmt) {
+  switch (stmt.kind) {
+    case StmtKind::Block: {
+      const auto& block = static_cast<const Block&>(stmt);
+      // A flat block's locals follow those of the scope around it.
+      size_t flatLocals = scopes_.back().size();
+      if (!block.flat) scopes_.emplace_back();
+      for (const auto& statement : block.statements) {
+        this->statement(*statement);
+      }
+      if (block.flat) {
+        scopes_.back().resize(flatLocals);
+      } else {
+        scopes_.pop_back();
+      }
+      return;
+    }
+    case StmtKind::Expression: {
+      const Expr& expr =
+          unwrap(*static_cast<const Expression&>(stmt).expression);
+      if (expr.kind == ExprKind::Call) {
+        call(static_cast<const Call&>(expr), 0, Use::DISCARD);
+        return;
+      }
+      if (expr.kind == ExprKind::Binary || expr.kind == ExprKind::Logical ||
+          expr.kind == ExprKind::Unary || expr.kind == ExprKind::Literal) {
+        // Conditions are only evaluated for their calls.
+        Label next;
+        branch(expr, 0, true, next);
+        assembler_.bind(next);
+        return;
+      }
+      number(expr, 0, true);
+      return;
+    }
+    case StmtKind::If: {
+      const auto& ifStmt = static_cast<const If&>(stmt);
+      Label otherwise;
+      branch(*ifStmt.condition, 0, false, otherwise);
+      statement(*ifStmt.thenBranch);
+      if (ifStmt.elseBranch == nullptr) {
+        assembler_.bind(otherwise);
+        return;
+      }
+      Label done;
+      assembler_.jmp(done);
+      assembler_.bind(otherwise);
+      statement(*ifStmt.elseBranch);
+      assembler_.bind(done);
+      return;
+    }
+    case StmtKind::Return: {
+      const auto& returnStmt = static_cast<const Return&>(stmt);
+      if (returnStmt.value == nullptr) {
+        assembler_.mov(RAX, kNil);
+        assembler_.jmp(epilogue_);
+        return;
+      }
+      const Expr& value = unwrap(*returnStmt.value);
+      if (value.kind == ExprKind::Call) {
+        // Whatever the callee returns is passed on as it is.
+        call(static_cast<const Call&>(value), 0, Use::RETURN);
+        return;
+      }
+      bool condition = false;
+      if (value.kind == ExprKind::Binary) {
+        TokenType op = static_cast<const Binary&>(value).op.type_;
+        condition = op == BANG_EQUAL || op == EQUAL_EQUAL || op == GREATER ||
+                    op == GREATER_EQUAL || op == LESS || op == LESS_EQUAL;
+      }
+      condition = condition || value.kind == ExprKind::Logical ||
+                  (value.kind == ExprKind::Unary &&
+                   static_cast<const Unary&>(value).op.type_ == BANG);
+      if (condition) {
+        Label falsey;
+        branch(value, 0, false, falsey);
+        assembler_.mov(RAX, kTrue);
+        assembler_.jmp(epilogue_);
+        assembler_.bind(falsey);
+        assembler_.mov(RAX, kFalse);
+        assembler_.jmp(epilogue_);
+        return;
+      }
+      if (number(value, 0, true)) {
+        // The caller needs a reference of its own to anything but a number.
+        Label object;
+        jumpUnlessNumber(0, object);
+        assembler_.movqFromXmm(RAX, 0);
+        assembler_.jmp(epilogue_);
+        assembler_.bind(object);
+        assembler_.movqFromXmm(RDI, 0);
+        callRuntime(reinterpret_cast<const void*>(&Jit::retain));
+        assembler_.jmp(epilogue_);
+        return;
+      }
+      assembler_.movqFromXmm(RAX, 0);
+      assembler_.jmp(epilogue_);
+      return;
+    }
+    case StmtKind::Var: {
+      const auto& var = static_cast<const Var&>(stmt);
+      // A variable without an initializer holds nil.
+      if (var.initializer == nullptr) throw Unsupported{};
+      number(*var.initializer, 0, false);
+      store(declare(), 0);
+      return;
+    }
+    case StmtKind::While:
+      loop(static_cast<const While&>(stmt));
+      return;
+    default:
+      throw Unsupported{};
+  }
+}
+
+void JitCompiler::loop(const While& stmt) {
+  size_t sites = code_.sites.size();
+  Label head;
+  Label done;
+  assembler_.bind(head);
+  if (&stmt == loop_) {
+    // Jit::enterLoop() comes in here, with every local in scope.
+    loopHead_ = head;
+    int depth = static_cast<int>(scopes_.size());
+    for (const auto& scope : scopes_) {
+      --depth;
+      for (size_t slot = 0; slot < scope.size(); ++slot) {
+        code_.locals.emplace_back(depth, static_cast<int>(slot));
+        loopLocals_.push_back(locals_[scope[slot]]);
+      }
+    }
+  }
+  branch(*stmt.condition, 0, false, done);
+  statement(*stmt.body);
+  if (code_.sites.size() != sites) trimKept();
+  assembler_.jmp(head);
+  assembler_.bind(done);
+}
+
+bool JitCompiler::number(const Expr& expr, int d, bool unchecked) {
+  if (d >= kTemporaries - 1) throw Unsupported{};
+  switch (expr.kind) {
+    case ExprKind::Literal: {
+      Value value = static_cast<const Literal&>(expr).value;
+      if (!value.isNumber()) throw Unsupported{};
+      constant(d, value.takeBits());
+      return false;
+    }
+    case ExprKind::Grouping:
+      return number(*static_cast<const Grouping&>(expr).expression, d,
+                    unchecked);
+    case ExprKind::Variable: {
+      const auto& variable = static_cast<const Variable&>(expr);
+      load(d, resolve(variable.depth, variable.slot));
+      return false;
+    }
+    case ExprKind::Assign: {
+      const auto& assign = static_cast<const Assign&>(expr);
+      const Local& local = resolve(assign.depth, assign.slot);
+      number(*assign.value, d, false);
+      store(local, d);
+      return false;
+    }
+    case ExprKind::Unary:
+      negate(static_cast<const Unary&>(expr), d);
+      return false;
+    case ExprKind::Binary: {
+      bool result = arithmetic(static_cast<const Binary&>(expr), d);
+      if (result && !unchecked) throw Unsupported{};
+      return result;
+    }
+    case ExprKind::Call:
+      if (!unchecked) throw Unsupported{};
+      call(static_cast<const Call&>(expr), d, Use::VALUE);
+      return true;
+    default:
+      throw Unsupported{};
+  }
+}
+
+bool JitCompiler::arithmetic(const Binary& expr, int d) {
+  uint8_t op;
+  const char* message = "Operand must be two numbers!";
+  switch (expr.op.type_) {
+    case PLUS:
+      op = kAddsd;
+      message = "Operand must be two numbers or two strings!";
+      break;
+    case MINUS:
+      op = kSubsd;
+      break;
+    case STAR:
+      op = kMulsd;
+      break;
+    case SLASH:
+      op = kDivsd;
+      break;
+    default:
+      throw Unsupported{};
+  }
+  bool left = number(*expr.left, d, true);
+  const Expr& operand = unwrap(*expr.right);
+  if (operand.kind == ExprKind::Variable) {
+    // Locals are used where they are.
+    const auto& variable = static_cast<const Variable&>(operand);
+    const Local& local = resolve(variable.depth, variable.slot);
+    if (left) check(d, expr.op, message);
+    if (local.xmm >= 0) {
+      assembler_.sse(op, d, local.xmm);
+    } else {
+      assembler_.sse(op, d, RBX, 8 * local.home);
+    }
+    return false;
+  }
+  bool right = number(operand, d + 1, true);
+  if (left && right && expr.op.type_ == PLUS) {
+    add(expr, d);
+    return true;
+  }
+  if (left) check(d, expr.op, message);
+  if (right) check(d + 1, expr.op, message);
+  assembler_.sse(op, d, d + 1);
+  return false;
+}
+
+void JitCompiler::add(const Binary& expr, int d) {
+  Label slow;
+  Label done;
+  jumpUnlessNumber(d, slow);
+  jumpUnlessNumber(d + 1, slow);
+  assembler_.sse(kAddsd, d, d + 1);
+  assembler_.jmp(done);
+
+  assembler_.bind(slow);
+  spill(d);
+  assembler_.mov(RDI, R12);
+  assembler_.mov(RSI, reinterpret_cast<uint64_t>(&expr.op));
+  assembler_.movqFromXmm(RDX, d);
+  assembler_.movqFromXmm(RCX, d + 1);
+  callRuntime(reinterpret_cast<const void*>(&Jit::add));
+  reload(d);
+  bailOnError();
+  assembler_.movqToXmm(d, RAX);
+  assembler_.bind(done);
+}
+
+void JitCompiler::negate(const Unary& expr, int d) {
+  if (expr.op.type_ != MINUS) throw Unsupported{};
+  if (number(*expr.right, d, true)) {
+    check(d, expr.op, "Operand must be a number");
+  }
+  constant(d + 1, kSignBit);
+  assembler_.xorpd(d, d + 1);
+}
+
+void JitCompiler::branch(const Expr& expr, int d, bool when, Label& target) {
+  switch (expr.kind) {
+    case ExprKind::Grouping:
+      branch(*static_cast<const Grouping&>(expr).expression, d, when, target);
+      return;
+    case ExprKind::Literal:
+      if (static_cast<const Literal&>(expr).value.isTruthy() == when) {
+        assembler_.jmp(target);
+      }
+      return;
+    case ExprKind::Unary: {
+      const auto& unary = static_cast<const Unary&>(expr);
+      if (unary.op.type_ != BANG) break;
+      branch(*unary.right, d, !when, target);
+      return;
+    }
+    case ExprKind::Logical: {
+      const auto& logical = static_cast<const Logical&>(expr);
+      // `and` jumps on its first falsey operand, `or` on its first truthy
+      // one; the other way round both operands decide.
+      bool shortCircuit = logical.op.type_ == OR;
+      if (when == shortCircuit) {
+        branch(*logical.left, d, when, target);
+        branch(*logical.right, d, when, target);
+      } else {
+        Label next;
+        branch(*logical.left, d, !when, next);
+        branch(*logical.right, d, when, target);
+        assembler_.bind(next);
+      }
+      return;
+    }
+    case ExprKind::Binary: {
+      const auto& binary = static_cast<const Binary&>(expr);
+      TokenType op = binary.op.type_;
+      if (op == BANG_EQUAL || op == EQUAL_EQUAL || op == GREATER ||
+          op == GREATER_EQUAL || op == LESS || op == LESS_EQUAL) {
+        compare(binary, d, when, target);
+        return;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  if (!number(expr, d, true)) {
+    // Numbers are always truthy.
+    if (when) assembler_.jmp(target);
+    return;
+  }
+  Label skip;
+  Label& falsey = when ? skip : target;
+  assembler_.movqFromXmm(RAX, d);
+  assembler_.mov(RCX, kNil);
+  assembler_.cmp(RAX, RCX);
+  assembler_.jcc(Condition::EQUAL, falsey);
+  assembler_.mov(RCX, kFalse);
+  assembler_.cmp(RAX, RCX);
+  assembler_.jcc(Condition::EQUAL, falsey);
+  if (when) assembler_.jmp(target);
+  assembler_.bind(skip);
+}
+
+void JitCompiler::compare(const Binary& expr, int d, bool when,
+                          Label& target) {
+  bool left = number(*expr.left, d, true);
+  bool right = number(*expr.right, d + 1, true);
+  TokenType op = expr.op.type_;
+  if (op == EQUAL_EQUAL || op == BANG_EQUAL) {
+    bool equal = (op == EQUAL_EQUAL) == when;
+    if (left && right) {
+      // Two call results could be equal strings.
+      spill(d);
+      assembler_.movqFromXmm(RDI, d);
+      assembler_.movqFromXmm(RSI, d + 1);
+      callRuntime(reinterpret_cast<const void*>(&Jit::equal));
+      reload(d);
+      assembler_.test(RAX, RAX);
+      assembler_.jcc(equal ? Condition::NOT_EQUAL : Condition::EQUAL, target);
+      return;
+    }
+    // Any other value is a NaN to ucomisd, unequal to every number.
+    // Unordered sets ZF and PF.
+    assembler_.ucomisd(d, d + 1);
+    if (equal) {
+      Label unordered;
+      assembler_.jcc(Condition::PARITY, unordered);
+      assembler_.jcc(Condition::EQUAL, target);
+      assembler_.bind(unordered);
+    } else {
+      assembler_.jcc(Condition::PARITY, target);
+      assembler_.jcc(Condition::NOT_EQUAL, target);
+    }
+    return;
+  }
+
+  const char* message = "Operand must be two numbers!";
+  if (left) check(d, expr.op, message);
+  if (right) check(d + 1, expr.op, message);
+  // Unordered sets CF and ZF, so only ABOVE and ABOVE_EQUAL can be used
+  // for true; `<` is `>` with the operands swapped.
+  bool strict = op == GREATER || op == LESS;
+  if (op == GREATER || op == GREATER_EQUAL) {
+    assembler_.ucomisd(d, d + 1);
+  } else {
+    assembler_.ucomisd(d + 1, d);
+  }
+  if (when) {
+    assembler_.jcc(strict ? Condition::ABOVE : Condition::ABOVE_EQUAL, target);
+  } else {
+    assembler_.jcc(strict ? Condition::BELOW_EQUAL : Condition::BELOW, target);
+  }
+}
+
+void JitCompiler::call(const Call& expr, int d, Use use) {
+  const Expr& callee = *expr.callee;
+  if (callee.kind != ExprKind::Variable ||
+      static_cast<const Variable&>(callee).depth != -1) {
+    throw Unsupported{};
+  }
+  if (d >= kTemporaries - 1) throw Unsupported{};
+
+  auto& site = *code_.sites.emplace_back(new Jit::CallSite{
+      const_cast<Call*>(&expr), use});
+  int arguments = allocate(expr.arguments.size());
+  for (const auto& argument : expr.arguments) {
+    site.calleeFirst = site.calleeFirst || containsCall(*argument);
+  }
+  if (site.calleeFirst) {
+    spill(d);
+    assembler_.mov(RDI, R12);
+    assembler_.mov(RSI, reinterpret_cast<uint64_t>(&site));
+    callRuntime(reinterpret_cast<const void*>(&Jit::lookupCallee));
+    reload(d);
+    bailOnError();
+  }
+  // Arguments may be any value; the callee guards its parameters.
+  for (size_t i = 0; i < expr.arguments.size(); ++i) {
+    number(*expr.arguments[i], d, true);
+    assembler_.sse(kMovsdStore, d, RBX, 8 * (arguments + i));
+  }
+
+  spill(d);
+  assembler_.mov(RDI, R12);
+  assembler_.mov(RSI, reinterpret_cast<uint64_t>(&site));
+  assembler_.lea(RDX, RBX, 8 * arguments);
+  callRuntime(reinterpret_cast<const void*>(&Jit::callFunction));
+  reload(d);
+  bailOnError();
+  if (use == Use::VALUE) assembler_.movqToXmm(d, RAX);
+  if (use == Use::RETURN) assembler_.jmp(epilogue_);
+}
+
+void JitCompiler::check(int reg, const Token& op, const char* message) {
+  Label fail;
+  Label number;
+  jumpUnlessNumber(reg, fail);
+  assembler_.jmp(number);
+  assembler_.bind(fail);
+  assembler_.mov(RDI, R12);
+  assembler_.mov(RSI, reinterpret_cast<uint64_t>(&op));
+  assembler_.mov(RDX, reinterpret_cast<uint64_t>(message));
+  callRuntime(reinterpret_cast<const void*>(&Jit::fail));
+  assembler_.jmp(bailout_);
+  assembler_.bind(number);
+}
+
+void JitCompiler::jumpUnlessNumber(int reg, Label& target) {
+  assembler_.movqFromXmm(RAX, reg);
+  assembler_.mov(RCX, kQNaN);
+  assembler_.andq(RAX, RCX);
+  assembler_.cmp(RAX, RCX);
+  assembler_.jcc(Condition::EQUAL, target);
+}
+
+void JitCompiler::bailOnError() {
+  assembler_.cmp(RAX, R13);
+  assembler_.jcc(Condition::EQUAL, bailout_);
+}
+
+void JitCompiler::trimKept() {
+  Label same;
+  assembler_.mov(RAX, reinterpret_cast<uint64_t>(&jit_.keptCount_));
+  assembler_.load(RAX, RAX, 0);
+  assembler_.cmp(RAX, RBX, 8 * kept_);
+  assembler_.jcc(Condition::EQUAL, same);
+  spill(0);
+  assembler_.mov(RDI, R12);
+  assembler_.load(RSI, RBX, 8 * kept_);
+  callRuntime(reinterpret_cast<const void*>(&Jit::trim));
+  reload(0);
+  assembler_.bind(same);
+}
+
+JitCompiler::Local JitCompiler::declare() {
+  int count = static_cast<int>(locals_.size());
+  Local local{allocate(1), count < kLocalRegisters ? 8 + count : -1};
+  scopes_.back().push_back(count);
+  locals_.push_back(local);
+  return local;
+}
+
+const JitCompiler::Local& JitCompiler::resolve(int depth, int slot) {
+  // Globals and the locals of enclosing functions can change type.
+  int scope = static_cast<int>(scopes_.size()) - 1 - depth;
+  if (depth < 0 || scope < 0 || slot >= scopes_[scope].size()) {
+    throw Unsupported{};
+  }
+  return locals_[scopes_[scope][slot]];
+}
+
+void JitCompiler::load(int reg, const Local& local) {
+  if (local.xmm >= 0) {
+    assembler_.movapd(reg, local.xmm);
+  } else {
+    assembler_.sse(kMovsdLoad, reg, RBX, 8 * local.home);
+  }
+}
+
+void JitCompiler::store(const Local& local, int reg) {
+  if (local.xmm >= 0) {
+    if (local.xmm != reg) assembler_.movapd(local.xmm, reg);
+  } else {
+    assembler_.sse(kMovsdStore, reg, RBX, 8 * local.home);
+  }
+}
+
+void JitCompiler::constant(int reg, uint64_t bits) {
+  assembler_.mov(RAX, bits);
+  assembler_.movqToXmm(reg, RAX);
+}
+
+void JitCompiler::spill(int d) {
+  for (int i = 0; i < d; ++i) assembler_.sse(kMovsdStore, i, RBX, 8 * i);
+  for (const Local& local : locals_) {
+    if (local.xmm >= 0) {
+      assembler_.sse(kMovsdStore, local.xmm, RBX, 8 * local.home);
+    }
+  }
+}
+
+void JitCompiler::reload(int d) {
+  for (int i = 0; i < d; ++i) assembler_.sse(kMovsdLoad, i, RBX, 8 * i);
+  for (const Local& local : locals_) {
+    if (local.xmm >= 0) {
+      assembler_.sse(kMovsdLoad, local.xmm, RBX, 8 * local.home);
+    }
+  }
+}
+
+void JitCompiler::callRuntime(const void* function) {
+  assembler_.mov(RAX, reinterpret_cast<uint64_t>(function));
+  assembler_.call(RAX);
+}
+
+int JitCompiler::allocate(int slots) {
+  int first = slots_;
+  slots_ += slots;
+  return first;
+}
+
+Jit::Jit(Interpreter& interpreter, uint32_t threshold)
+    : interpreter_{interpreter}, threshold_{threshold} {}
+
+Jit::~Jit() = default;
+
+const Jit::Code* Jit::compile(const Function& declaration) {
+  auto [entry, inserted] = code_.try_emplace(&declaration);
+  if (inserted) entry->second = build(declaration, nullptr);
+  return entry->second.get();
+}
+
+bool Jit::run(const Code& code, Value* arguments, Value& result) {
+  return enter(code, arguments, result);
+}
+
+bool Jit::enterLoop(const Function& function, const While& loop,
+                    Environment& environment, Value& result) {
+  auto [entry, inserted] = loops_.try_emplace(&loop);
+  if (inserted) entry->second = build(function, &loop);
+  const Code* code = entry->second.get();
+  if (code == nullptr) return false;
+  std::vector<Value> values;
+  values.reserve(code->locals.size());
+  for (auto [depth, slot] : code->locals) {
+    values.push_back(environment.getAt(depth, slot));
+  }
+  return enter(*code, values.data(), result);
+}
+
+std::unique_ptr<Jit::Code> Jit::build(const Function& function,
+                                      const While* loop) {
+#if LOX_JIT_SUPPORTED
+  auto code = std::make_unique<Code>();
+  JitCompiler compiler{*this, *code, loop};
+  if (compiler.compile(function) && code->install(compiler.bytes())) {
+    return code;
+  }
+#endif
+  return nullptr;
+}
+
+bool Jit::enter(const Code& code, const Value* values, Value& result) {
+  for (size_t i = 0; i < code.arity; ++i) {
+    if (!values[i].isNumber()) return false;
+  }
+  size_t pending = pending_.size();
+  size_t kept = keptCount_;
+  char* outermost = nullptr;
+  if (stackBase_ == nullptr) {
+    outermost = static_cast<char*>(__builtin_frame_address(0));
+    stackBase_ = outermost;
+  }
+  uint64_t bits = code.entry(this, values);
+  if (outermost != nullptr) stackBase_ = nullptr;
+  trim(this, kept);
+  if (bits == kBailout) {
+    pending_.resize(pending);
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+  result = Value::fromBits(bits);
+  return true;
+}
+
+uint64_t Jit::callFunction(Jit* jit, CallSite* site,
+                           const uint64_t* arguments) {
+  try {
+    Interpreter& interpreter = jit->interpreter_;
+    Call& expr = *site->expr;
+    size_t count = expr.arguments.size();
+    Value callee;
+    if (site->calleeFirst) {
+      callee = std::move(jit->pending_.back());
+      jit->pending_.pop_back();
+    } else {
+      callee = interpreter.globals->get(
+          static_cast<Variable&>(*expr.callee).name);
+    }
+
+    // Compiled to compiled, with numbers for arguments. A call in tail
+    // position is deferred instead, below.
+    LoxFunction* function = site->function;
+    if (site->use != CallSite::Use::RETURN && function != nullptr &&
+        callee.isCallable() &&
+        callee.asCallable() == function && function->native != nullptr &&
+        interpreter.profiler_ == nullptr &&
+        std::all_of(arguments, arguments + count, isNumber)) {
+      jit->checkStack(expr);
+      size_t kept = jit->keptCount_;
+      uint64_t bits = function->native->entry(
+          jit, reinterpret_cast<const Value*>(arguments));
+      if (bits == kBailout) return kBailout;
+      trim(jit, kept);
+      // Nothing but LoxFunction::call would make the callee's tail calls.
+      return jit->consume(*site, LoxFunction::finishTailCalls(
+                                     interpreter, Value::fromBits(bits)));
+    }
+
+    if (!callee.isCallable()) {
+      throw RuntimeError{expr.paren, "Can only call function and classes!"};
+    }
+    LoxCallable* callable = callee.asCallable();
+
+    // The arguments go on the interpreter's stack like any others.
+    Interpreter::ArgumentScope scope{interpreter, interpreter.argumentsTop_};
+    size_t used = interpreter.argumentsTop_ - interpreter.arguments_.get();
+    if (count > Interpreter::kArgumentsMax - used) {
+      throw RuntimeError{expr.paren, "Stack overflow!"};
+    }
+    Value* values = interpreter.argumentsTop_;
+    for (size_t i = 0; i < count; ++i) {
+      *interpreter.argumentsTop_++ = borrow(arguments[i]);
+    }
+    interpreter.checkArity(expr, *callable);
+    if (callable != site->function) {
+      site->function = dynamic_cast<LoxFunction*>(callable);
+      site->callee = site->function != nullptr ? callee : nullptr;
+    }
+    // `return f(...)`: the compiled frame returns nil right away and the
+    // call is made in its place, as in the interpreter.
+    if (site->use == CallSite::Use::RETURN &&
+        interpreter.deferCall(*callable, nullptr, values)) {
+      return kNil;
+    }
+    jit->checkStack(expr);
+    return jit->consume(*site, interpreter.call(expr, *callable, values));
+  } catch (...) {
+    jit->error_ = std::current_exception();
+    return kBailout;
+  }
+}
+
+void Jit::checkStack(const Call& expr) {
+  char* frame = static_cast<char*>(__builtin_frame_address(0));
+  if (stackBase_ - frame > kMaxStack) {
+    throw RuntimeError{expr.paren, "Stack overflow!"};
+  }
+}
+
+uint64_t Jit::consume(const CallSite& site, Value result) {
+  switch (site.use) {
+    case CallSite::Use::VALUE:
+      return keep(std::move(result));
+    case CallSite::Use::RETURN:
+      return result.takeBits();
+    case CallSite::Use::DISCARD:
+      return 0;
+  }
+  return 0;
+}
+
+uint64_t Jit::keep(Value value) {
+  bool object = value.isObject();
+  uint64_t bits = value.takeBits();
+  // kept_ takes the reference over; the code only borrows the encoding.
+  if (object) {
+    kept_.push_back(Value::fromBits(bits));
+    keptCount_ = kept_.size();
+  }
+  return bits;
+}
+
+uint64_t Jit::lookupCallee(Jit* jit, const CallSite* site) {
+  try {
+    Call& expr = *site->expr;
+    Value callee = jit->interpreter_.globals->get(
+        static_cast<Variable&>(*expr.callee).name);
+    if (!callee.isCallable()) {
+      throw RuntimeError{expr.paren, "Can only call function and classes!"};
+    }
+    jit->pending_.push_back(std::move(callee));
+    return 0;
+  } catch (...) {
+    jit->error_ = std::current_exception();
+    return kBailout;
+  }
+}
+
+uint64_t Jit::add(Jit* jit, const Token* op, uint64_t left,
+                  uint64_t right) {
+  try {
+    Value a = borrow(left);
+    Value b = borrow(right);
+    if (a.isString() && b.isString()) {
+      return jit->keep(Value{new LoxString{a.asString() + b.asString()}});
+    }
+    // Two numbers never get here.
+    throw RuntimeError{*op, "Operand must be two numbers or two strings!"};
+  } catch (...) {
+    jit->error_ = std::current_exception();
+    return kBailout;
+  }
+}
+
+uint64_t Jit::equal(uint64_t left, uint64_t right) {
+  return borrow(left) == borrow(right);
+}
+
+uint64_t Jit::retain(uint64_t value) { return borrow(value).takeBits(); }
+
+void Jit::trim(Jit* jit, size_t count) {
+  jit->kept_.resize(count);
+  jit->keptCount_ = count;
+}
+
+void Jit::fail(Jit* jit, const Token* op, const char* message) {
+  jit->error_ = std::make_exception_ptr(RuntimeError{*op, message});
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "value.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define LOX_JIT_SUPPORTED 1
+#else
+#define LOX_JIT_SUPPORTED 0
+#endif
+
+class Environment;
+class Interpreter;
+class Token;
+struct Call;
+struct Function;
+struct While;
+
+// Baseline compiler from hot Lox functions to x86-64 machine code.
+//
+// Only numeric functions are compiled: their locals are parameters and
+// variables holding numbers, their expressions arithmetic, comparisons and
+// calls to global functions, their statements blocks, `if`, `while` and
+// `return`. Locals live in xmm registers or in the native frame as plain
+// doubles; anything else in the body leaves the function to the
+// interpreter.
+//
+// A function is compiled once a LoxFunction has been called threshold()
+// times, and a loop that runs threshold() iterations finishes its call in
+// compiled code. Both ways in are guarded: if a parameter or local holds
+// anything but a number, the interpreter carries on instead. Call results
+// are the only other values compiled code sees. They are checked wherever
+// the interpreter would check them, raising the same RuntimeError, and
+// handed to the runtime where the interpreter accepts any value.
+class Jit {
+ public:
+  static constexpr uint32_t kThreshold = 1000;
+
+  // Compiled functions stay valid for the Jit's lifetime.
+  explicit Jit(Interpreter& interpreter, uint32_t threshold = kThreshold);
+  ~Jit();
+  Jit(const Jit&) = delete;
+  Jit& operator=(const Jit&) = delete;
+
+  // Calls a LoxFunction takes, and iterations a loop runs, before they are
+  // compiled.
+  uint32_t threshold() const { return threshold_; }
+
+  struct Code;
+  // The native code for `declaration`, compiled on the first request.
+  // Returns nullptr if the function cannot be compiled or this platform has
+  // no JIT.
+  const Code* compile(const Function& declaration);
+  // Runs `code` unless an argument fails the entry guard, in which case it
+  // returns false and the caller interprets the function instead.
+  bool run(const Code& code, Value* arguments, Value& result);
+  // Finishes the call of `function` that is about to test the condition of
+  // `loop` again, with its locals taken from `environment`. Returns false
+  // if the interpreter has to carry on.
+  bool enterLoop(const Function& function, const While& loop,
+                 Environment& environment, Value& result);
+
+ private:
+  struct CallSite;
+
+  std::unique_ptr<Code> build(const Function& function, const While* loop);
+  bool enter(const Code& code, const Value* values, Value& result);
+
+  // Entry points of compiled code back into the runtime. None of them
+  // throws: an error is parked in error_ and the code returns kBailout.
+  static uint64_t callFunction(Jit* jit, CallSite* site,
+                               const uint64_t* arguments);
+  static uint64_t lookupCallee(Jit* jit, const CallSite* site);
+  static uint64_t add(Jit* jit, const Token* op, uint64_t left,
+                      uint64_t right);
+  static uint64_t equal(uint64_t left, uint64_t right);
+  static uint64_t retain(uint64_t value);
+  static void trim(Jit* jit, size_t count);
+  static void fail(Jit* jit, const Token* op, const char* message);
+
+  // Hands a call result to the code in the form its call site expects.
+  uint64_t consume(const CallSite& site, Value result);
+  // Holds on to `value` for the compiled frame that uses its encoding.
+  uint64_t keep(Value value);
+  void checkStack(const Call& expr);
+
+  Interpreter& interpreter_;
+  uint32_t threshold_;
+  std::unordered_map<const Function*, std::unique_ptr<Code>> code_;
+  std::unordered_map<const While*, std::unique_ptr<Code>> loops_;
+
+  // Callees looked up before arguments that make calls of their own.
+  std::vector<Value> pending_;
+  // Call results compiled frames refer to by their encoding. Each frame
+  // drops the ones it added when it returns and between loop iterations;
+  // keptCount_ is the size, where compiled code can read it.
+  std::vector<Value> kept_;
+  size_t keptCount_{0};
+  std::exception_ptr error_;
+  // The frame of the outermost compiled call, to bound native recursion.
+  char* stackBase_{nullptr};
+
+  friend class JitCompiler;
+};
@@ -0,0 +1,254 @@
+#include "jit.h"
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "interpreter.h"
+#include "parser.h"
+#include "resolver.h"
+#include "runtime_error.h"
+
+// Runs `source` and returns what it printed, errors included. With `jit`
+// every function is compiled on its first call.
+std::string interpret(std::string_view source, bool jit) {
+  std::vector<StmtPtr> statements = Parser{source}.parse();
+  Resolver{}.resolve(statements);
+
+  Interpreter interpreter;
+  Jit compiler{interpreter, 1};
+  if (jit) interpreter.setJit(&compiler);
+  std::ostringstream out;
+  std::streambuf* savedOut = std::cout.rdbuf(out.rdbuf());
+  std::streambuf* savedErr = std::cerr.rdbuf(out.rdbuf());
+  interpreter.interpret(statements);
+  std::cout.rdbuf(savedOut);
+  std::cerr.rdbuf(savedErr);
+  hadRuntimeError = false;
+  return out.str();
+}
+
+#define EXPECT_SAME_OUTPUT(source) \
+  EXPECT_EQ(interpret(source, true), interpret(source, false))
+
+class JitTests : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    if (!LOX_JIT_SUPPORTED) GTEST_SKIP() << "no JIT on this platform";
+  }
+};
+
+TEST_F(JitTests, MatchesTheInterpreter) {
+  EXPECT_SAME_OUTPUT(R"(
+    fun fib(n) {
+      if (n < 2) return n;
+      return fib(n - 1) + fib(n - 2);
+    }
+    print fib(20);
+  )");
+  EXPECT_SAME_OUTPUT(R"(
+    fun sum(n) {
+      var total = 0;
+      for (var i = 0; i < n; i = i + 1) {
+        if (i / 3 <= 10 and !(i == 7) or i >= n - 2) total = total + i * 0.5;
+      }
+      return total;
+    }
+    print sum(100);
+  )");
+  EXPECT_SAME_OUTPUT(R"(
+    fun ack(m, n) {
+      if (m == 0) return n + 1;
+      if (n == 0) return ack(m - 1, 1);
+      return ack(m - 1, ack(m, n - 1));
+    }
+    print ack(2, 3);
+  )");
+  // More locals than registers, and temporaries live across calls.
+  EXPECT_SAME_OUTPUT(R"(
+    fun id(x) { return x; }
+    fun many(a, b, c, d, e) {
+      var f = a + b; var g = c * d; var h = e - a; var i = f / g;
+      var j = -h; var k = i + j;
+      return a + (b * (c - id(d + e * id(f))) + g) - h * i + j / k;
+    }
+    print many(1, 2, 3, 4, 5);
+  )");
+  EXPECT_SAME_OUTPUT(R"(
+    fun nothing(n) { if (n > 0) return; }
+    fun nan(n) { var x = 0 / 0; return x == x or x < n or x >= n; }
+    fun inverse(n) { return n != 0 and 1 / n > 0.5; }
+    print nothing(1);
+    print nan(1);
+    print inverse(1);
+    print inverse(4);
+  )");
+}
+
+TEST_F(JitTests, CompilesOnlyNumericFunctions) {
+  std::string_view source = R"(
+    var g = 1;
+    fun numeric(a, b) { while (a < b) a = a + 1; return a; }
+    fun prints(a) { print a; }
+    fun global(a) { return a + g; }
+    fun string() { return "s"; }
+    fun closure(a) { fun inner() { return a; } return inner; }
+  )";
+  std::vector<StmtPtr> statements = Parser{source}.parse();
+  Resolver{}.resolve(statements);
+  Interpreter interpreter;
+  Jit jit{interpreter};
+
+  std::vector<bool> compiled;
+  for (const auto& statement : statements) {
+    if (statement->kind != StmtKind::Function) continue;
+    compiled.push_back(
+        jit.compile(static_cast<const Function&>(*statement)) != nullptr);
+  }
+  EXPECT_EQ(compiled, (std::vector<bool>{true, false, false, false, false}));
+}
+
+TEST_F(JitTests, FallsBackOnOtherArguments) {
+  EXPECT_EQ(interpret(R"(
+    fun add(a, b) { return a + b; }
+    print add(1, 2);
+    print add("a", "b");
+  )",
+                      true),
+            "3.000000\nab\n");
+}
+
+TEST_F(JitTests, ChecksCallResultsLikeTheInterpreter) {
+  // Passed on or compared, any value is fine.
+  EXPECT_SAME_OUTPUT(R"(
+    fun s() { return "s"; }
+    fun pass() { return s(); }
+    fun same(n) { return s() == n; }
+    fun twice(f, n) { return n * 2; }
+    print pass();
+    print same(1);
+    print twice(s(), 2);
+  )");
+  EXPECT_EQ(interpret(R"(
+    fun s() { print "called"; return "s"; }
+    fun f(n) {
+      return n * (s() -
+        s());
+    }
+    print f(1);
+  )",
+                      true),
+            "called\ncalled\nOperand must be two numbers!\n[line 4]\n");
+  EXPECT_EQ(interpret("fun f() { return -g(); } fun g() {} f();", true),
+            "Operand must be a number\n[line 1]\n");
+  EXPECT_EQ(interpret("fun f() { return g(); } f();", true),
+            "Undefined variable 'g'!\n[line 1]\n");
+}
+
+TEST_F(JitTests, PassesOtherValuesThrough) {
+  EXPECT_SAME_OUTPUT(R"(
+    fun s(n) { if (n > 1) return "s"; return n; }
+    fun join(n) { return s(n) + s(n); }
+    fun same(a, b) { return s(a) == s(b); }
+    fun truthy(n) { if (s(n)) return 1; return 0; }
+    fun count(n) {
+      var found = 0;
+      var i = 0;
+      while (i < n) {
+        if (s(i) + s(i) == "ss") found = found + 1;
+        i = i + 1;
+      }
+      return found;
+    }
+    print join(1);
+    print join(2);
+    print same(2, 3);
+    print same(1, 2);
+    print truthy(0);
+    print count(100);
+  )");
+  EXPECT_EQ(interpret("fun f() { return g() + g(); } fun g() {} f();", true),
+            "Operand must be two numbers or two strings!\n[line 1]\n");
+}
+
+TEST_F(JitTests, EntersHotLoops) {
+  // With a threshold of 1 every loop moves into compiled code after its
+  // first iteration, locals of enclosing blocks included.
+  EXPECT_SAME_OUTPUT(R"(
+    fun integrate(n) {
+      var sum = 0;
+      var step = 1 / n;
+      for (var i = 0; i < n; i = i + 1) {
+        var x = (i + 0.5) * step;
+        sum = sum + 4 / (1 + x * x);
+      }
+      print "done";
+      return sum * step;
+    }
+    print integrate(1000);
+  )");
+  EXPECT_SAME_OUTPUT(R"(
+    fun nested(n) {
+      var total = 0;
+      {
+        var scale = 2;
+        for (var i = 0; i < n; i = i + 1) {
+          var twice = i * scale;
+          total = total + twice;
+        }
+      }
+      { var last = total; return last; }
+    }
+    print nested(100);
+  )");
+  EXPECT_EQ(interpret(R"(
+    fun loop(n) {
+      var i = 0;
+      while (i < n) i = i + 1;
+    }
+    print loop(10);
+    fun mixed(n) {
+      var i = 0;
+      while (i < 3) { i = i + 1; if (i == 2) n = "s"; }
+      return n;
+    }
+    print mixed(1);
+    fun guarded(s, n) {
+      var i = 0;
+      while (i < n) i = i + 1;
+      return i;
+    }
+    print guarded("s", 3);
+  )",
+                      true),
+            "nil\ns\n3.000000\n");
+}
+
+TEST_F(JitTests, RunsTailCallsInConstantStack) {
+  // Compiled code hands tail calls back to LoxFunction::call too, whether it
+  // was called from the interpreter or from other compiled code.
+  EXPECT_EQ(interpret(R"(
+    fun count(n, total) {
+      if (n == 0) return total;
+      return count(n - 1, total + 2);
+    }
+    fun twice(n) { return count(n, 0) + count(n, 0); }
+    print count(200000, 0);
+    print twice(100000);
+  )",
+                      true),
+            "400000.000000\n400000.000000\n");
+}
+
+TEST_F(JitTests, LimitsRecursion) {
+  EXPECT_EQ(interpret(R"(
+    fun down(n) { return 1 + down(n + 1); }
+    down(0);
+  )",
+                      true),
+            "Stack overflow!\n[line 2]\n");
+}
@@ -0,0 +1,155 @@
+#include "module_loader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>  // std::strerror
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+
+#include "../utils/error.h"
+#include "image_cache.h"
+#include "parser.h"
+
+namespace {
+
+// The key a file is loaded under, the same for every path that names it.
+std::string canonicalPath(const std::filesystem::path& path) {
+  std::error_code error;
+  std::filesystem::path result = std::filesystem::weakly_canonical(path, error);
+  if (error) result = std::filesystem::absolute(path).lexically_normal();
+  return result.string();
+}
+
+}  // namespace
+
+ModuleLoader::ModuleLoader(Pass pass, unsigned threads)
+    : pass_{std::move(pass)}, threads_{std::max(threads, 1u)} {}
+
+Module& ModuleLoader::load(std::unique_ptr<SourceBuffer> source,
+                           const std::string& path) {
+  Module* program;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (path.empty()) {
+      program = programs_.emplace_back(std::make_unique<Module>()).get();
+    } else {
+      std::string key = canonicalPath(path);
+      std::unique_ptr<Module>& entry = modules_[key];
+      if (entry != nullptr) {
+        program = entry.get();
+        reportUnreadable(*program);
+        return *program;
+      }
+      entry = std::make_unique<Module>();
+      entry->path = std::move(key);
+      program = entry.get();
+    }
+  }
+  program->source = std::move(source);
+  compile(*program);
+
+  // Parse imports here too rather than only wait for the workers. Once the
+  // queue is empty, the workers still running are parsing the last modules
+  // and may queue more, so this goes on until none is left.
+  while (true) {
+    work();
+    std::vector<std::thread> workers;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (workers_.empty()) break;
+      workers.swap(workers_);
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+  }
+  reportUnreadable(*program);
+  return *program;
+}
+
+void ModuleLoader::parse(Module& module) {
+  module.source = SourceBuffer::fromFile(module.path);
+  if (module.source == nullptr) {
+    // Reported once loading is done, and again by every later load that
+    // reaches it, instead of running as an empty module.
+    module.failure = std::strerror(errno);
+    return;
+  }
+  compile(module);
+}
+
+void ModuleLoader::compile(Module& module) {
+  // Only files are cached: REPL lines are rarely entered twice.
+  bool cached = cache_ != nullptr && !module.path.empty();
+  if (cached && cache_->load(module)) {
+    link(module);
+    return;
+  }
+  Parser parser{module.source->text()};
+  module.statements = parser.parse();
+  link(module);
+  if (parser.hadError()) return;
+  if (pass_ != nullptr && !pass_(module)) return;
+  if (cached) cache_->store(module);
+}
+
+void ModuleLoader::link(Module& module) {
+  std::filesystem::path directory =
+      std::filesystem::path{module.path}.parent_path();
+  for (const auto& statement : module.statements) {
+    // Failed declarations leave a nullptr behind.
+    if (statement == nullptr || statement->kind != StmtKind::Import) continue;
+    auto& import = static_cast<Import&>(*statement);
+    std::string path = canonicalPath(directory / import.path.string());
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    std::unique_ptr<Module>& entry = modules_[path];
+    if (entry == nullptr) {
+      entry = std::make_unique<Module>();
+      entry->path = std::move(path);
+      entry->importedBy = &import;
+      queue_.push_back(entry.get());
+      if (running_ + 1 < threads_) {
+        ++running_;
+        workers_.emplace_back([this, handler = errorHandler] {
+          ErrorScope errors{handler};
+          work();
+          std::lock_guard<std::mutex> lock{mutex_};
+          --running_;
+        });
+      }
+    }
+    import.program = &entry->statements;
+    module.imports.push_back(entry.get());
+  }
+}
+
+void ModuleLoader::work() {
+  while (true) {
+    Module* module;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (queue_.empty()) return;
+      module = queue_.front();
+      queue_.pop_front();
+    }
+    parse(*module);
+  }
+}
+
+void ModuleLoader::reportUnreadable(const Module& module) const {
+  std::unordered_set<const Module*> seen{&module};
+  std::vector<const Module*> pending{&module};
+  while (!pending.empty()) {
+    const Module* next = pending.back();
+    pending.pop_back();
+    if (!next->failure.empty()) {
+      error(next->importedBy->path, "Can't open module: " + next->failure);
+    }
+    for (auto it = next->imports.rbegin(); it != next->imports.rend(); ++it) {
+      if (seen.insert(*it).second) pending.push_back(*it);
+    }
+  }
+}
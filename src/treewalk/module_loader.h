@@ -0,0 +1,102 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../scanner/source.h"
+#include "stmt.h"
+
+class ImageCache;
+
+// A source file and the program parsed from it.
+struct Module {
+  // Canonical path of the file; empty for input that isn't one, like a REPL
+  // line.
+  std::string path;
+  std::unique_ptr<SourceBuffer> source;
+  std::vector<StmtPtr> statements;
+  // The import that first named the file, to report a file that can't be
+  // read.
+  const Import* importedBy{nullptr};
+  // Why the file couldn't be read, or empty.
+  std::string failure;
+  // The modules its imports name, in order.
+  std::vector<const Module*> imports;
+};
+
+// Loads a program together with every module it imports, directly or not.
+//
+// Imported files are read, scanned and parsed on a pool of worker threads,
+// each one as soon as the first import naming it has been parsed, so a
+// program split across many files loads in about the time of its slowest
+// chain of imports instead of the sum of all of them. A file is identified
+// by its canonical path and parsed once per loader, however many modules or
+// programs import it; the loader keeps every module for its lifetime, since
+// the tree and the runtimes point into them.
+//
+// Nothing runs while loading. Each Import is linked to the statements of its
+// module, and a module runs at its first import, so modules run in the order
+// the program reaches their imports whatever order they were parsed in.
+class ModuleLoader {
+ public:
+  // Runs over every module that parsed without errors, such as the program
+  // passed to load(), on the thread that parsed it. Returns false if it
+  // found errors in the module.
+  using Pass = std::function<bool(Module& module)>;
+
+  // At most `threads` files are parsed at once, counting the thread that
+  // called load(). Workers are started as files are queued and stop when
+  // there are none left, so no thread outlives a call to load().
+  explicit ModuleLoader(Pass pass = nullptr,
+                        unsigned threads = std::thread::hardware_concurrency());
+  ModuleLoader(const ModuleLoader&) = delete;
+  ModuleLoader& operator=(const ModuleLoader&) = delete;
+
+  // Parses `source`, the text of the file at `path`, and loads everything it
+  // imports before returning it. Imports are relative to the directory of
+  // `path`, or to the working directory if `path` is empty. Errors are
+  // reported as they are found and set hadError, or go to the calling
+  // thread's errorHandler if it has one. A file that can't be read is
+  // reported at every load that imports it, not just the first.
+  Module& load(std::unique_ptr<SourceBuffer> source, const std::string& path);
+
+  // While a cache is set, files whose source hasn't changed since they were
+  // last loaded are read back from their image, as they were after the pass,
+  // and the others stored once they pass.
+  void setImageCache(const ImageCache* cache) { cache_ = cache; }
+
+ private:
+  // Reads the file of an imported module, then compiles it.
+  void parse(Module& module);
+  // Builds the tree of `module` from its source and links it.
+  void compile(Module& module);
+  // Points each import of `module` at the module it names, queueing the
+  // files no import has named before.
+  void link(Module& module);
+  // Parses queued modules until there are none left.
+  void work();
+  // Reports each file `module` imports, directly or not, that couldn't be
+  // read.
+  void reportUnreadable(const Module& module) const;
+
+  Pass pass_;
+  unsigned threads_;
+  const ImageCache* cache_{nullptr};
+
+  std::mutex mutex_;
+  std::deque<Module*> queue_;
+  // Workers that have not found the queue empty yet.
+  unsigned running_{0};
+  // Workers to join before load() returns.
+  std::vector<std::thread> workers_;
+
+  std::unordered_map<std::string, std::unique_ptr<Module>> modules_;
+  // Programs that aren't files.
+  std::vector<std::unique_ptr<Module>> programs_;
+};
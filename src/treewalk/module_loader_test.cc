@@ -0,0 +1,162 @@
+#include "module_loader.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "../utils/error.h"
+#include "interpreter.h"
+#include "resolver.h"
+#include "runtime_error.h"
+
+class ModuleLoaderTests : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = std::filesystem::temp_directory_path() /
+                 ("lox_modules_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory_);
+  }
+  void TearDown() override {
+    std::filesystem::remove_all(directory_);
+    hadError = false;
+    hadRuntimeError = false;
+  }
+
+  std::string write(const std::string& name, std::string_view text) {
+    std::filesystem::path path = directory_ / name;
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream{path} << text;
+    return path.string();
+  }
+
+  // Loads `path` and everything it imports, then runs it and returns what it
+  // printed, errors included.
+  std::string run(const std::string& path) {
+    std::ostringstream out;
+    std::streambuf* savedOut = std::cout.rdbuf(out.rdbuf());
+    std::streambuf* savedErr = std::cerr.rdbuf(out.rdbuf());
+    ModuleLoader::Pass pass = [this](Module& module) {
+      ++passes_;
+      Resolver resolver;
+      resolver.resolve(module.statements);
+      return !resolver.hadError();
+    };
+    // Always some workers, however many cores there are.
+    ModuleLoader loader{pass, 8};
+    Module& program = loader.load(SourceBuffer::fromFile(path), path);
+    if (!hadError) {
+      Interpreter interpreter;
+      interpreter.interpret(program.statements);
+    }
+    std::cout.rdbuf(savedOut);
+    std::cerr.rdbuf(savedErr);
+    return out.str();
+  }
+
+  std::filesystem::path directory_;
+  std::atomic<int> passes_{0};
+};
+
+TEST_F(ModuleLoaderTests, RunsEachModuleOnceInImportOrder) {
+  write("shared.lox", R"(
+    print "shared";
+    var greeting = "hello";
+  )");
+  write("lib/a.lox", R"(
+    import "../shared.lox";
+    print "a";
+    fun greet(name) { return greeting + " " + name; }
+  )");
+  write("b.lox", R"(
+    import "shared.lox";
+    import "lib/a.lox";
+    print "b";
+  )");
+  std::string main = write("main.lox", R"(
+    import "b.lox";
+    import "./lib/a.lox";
+    print greet("world");
+  )");
+  EXPECT_EQ(run(main), "shared\na\nb\nhello world\n");
+  // Each file was parsed, and resolved, once.
+  EXPECT_EQ(passes_, 4);
+}
+
+TEST_F(ModuleLoaderTests, ImportsCycles) {
+  write("a.lox", R"(
+    import "main.lox";
+    print "a";
+    fun a() { return "called a"; }
+  )");
+  std::string main = write("main.lox", R"(
+    import "a.lox";
+    print a();
+  )");
+  EXPECT_EQ(run(main), "a\ncalled a\n");
+}
+
+TEST_F(ModuleLoaderTests, LoadsManyModules) {
+  std::string imports;
+  for (int i = 0; i < 64; ++i) {
+    std::string name = "module" + std::to_string(i) + ".lox";
+    write(name, "var v" + std::to_string(i) + " = " + std::to_string(i) +
+                    ";\nimport \"module" + std::to_string((i + 1) % 64) +
+                    ".lox\";\n");
+    imports += "import \"" + name + "\";\n";
+  }
+  std::string main = write("main.lox", imports + "print v0 + v63;\n");
+  EXPECT_EQ(run(main), "63.000000\n");
+  EXPECT_EQ(passes_, 65);
+}
+
+TEST_F(ModuleLoaderTests, ReportsErrors) {
+  std::string main = write("main.lox", "import \"missing.lox\";\n");
+  run(main);
+  EXPECT_TRUE(hadError);
+  hadError = false;
+
+  write("broken.lox", "var = 1;\n");
+  main = write("main.lox", "import \"broken.lox\";\n");
+  run(main);
+  EXPECT_TRUE(hadError);
+  // Modules with syntax errors are not passed on.
+  EXPECT_EQ(passes_, 2);
+  hadError = false;
+
+  main = write("main.lox", "{ import \"broken.lox\"; }\n");
+  run(main);
+  EXPECT_TRUE(hadError);
+}
+
+TEST_F(ModuleLoaderTests, ReportsUnreadableModulesAtEveryImport) {
+  std::string missing = (directory_ / "missing.lox").string();
+  std::string lib = write("lib.lox", "import \"missing.lox\";\n");
+  std::ostringstream err;
+  std::streambuf* savedErr = std::cerr.rdbuf(err.rdbuf());
+  // One loader for several lines, as in the REPL, which resets hadError
+  // after each.
+  ModuleLoader loader{nullptr, 8};
+  for (const std::string& line :
+       {"import \"" + missing + "\";", "import \"" + missing + "\";",
+        "import \"" + lib + "\";", "import \"" + lib + "\";"}) {
+    loader.load(std::make_unique<SourceBuffer>(line), "");
+    EXPECT_TRUE(hadError) << line;
+    hadError = false;
+  }
+  std::cerr.rdbuf(savedErr);
+  std::string errors = err.str();
+  int reports = 0;
+  for (size_t at = errors.find("Can't open module"); at != std::string::npos;
+       at = errors.find("Can't open module", at + 1)) {
+    ++reports;
+  }
+  EXPECT_EQ(reports, 4) << errors;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>  // std::move
+
+// An unbounded lock-free queue that any number of threads push to and one
+// thread pops from (Vyukov's intrusive MPSC queue). A push is one exchange
+// and one store, whatever the other producers are doing; pop() never waits
+// either, it reports an empty queue instead.
+//
+// The queue is a singly linked list from tail_ (oldest) to head_ (newest).
+// tail_ is always a node whose value has already been taken, starting with
+// stub_.
+template <class T>
+class MpscQueue {
+ public:
+  MpscQueue() = default;
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+  ~MpscQueue() {
+    while (pop()) {
+    }
+    if (tail_ != &stub_) delete tail_;
+  }
+
+  // Safe to call from any thread.
+  void push(T value) {
+    Node* node = new Node{std::move(value)};
+    Node* previous = head_.exchange(node, std::memory_order_acq_rel);
+    // Until this store, the consumer sees the queue end at `previous`.
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  // Only ever called from the consuming thread.
+  std::optional<T> pop() {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) return std::nullopt;
+    std::optional<T> value{std::move(next->value)};
+    tail_ = next;
+    if (tail != &stub_) delete tail;
+    return value;
+  }
+
+ private:
+  struct Node {
+    T value;
+    std::atomic<Node*> next{nullptr};
+  };
+
+  Node stub_{};
+  std::atomic<Node*> head_{&stub_};
+  Node* tail_{&stub_};
+};
@@ -0,0 +1,394 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "LoxObject.h"
+
+namespace {
+
+// Finds every declaration that is assigned anywhere in the program. Locals
+// are resolved with the same scoping rules as the Resolver; assignments that
+// don't hit a local go to a global of that name, wherever they appear.
+class AssignmentScan : public ExprVisitor<AssignmentScan, void>,
+                       public StmtVisitor<AssignmentScan, void> {
+ public:
+  using Declaration = Optimizer::Declaration;
+
+  AssignmentScan(std::unordered_set<Declaration>& assignedLocals,
+                 std::unordered_set<Symbol>& assignedGlobals,
+                 std::unordered_map<Symbol, int>& globalDeclarations)
+      : assignedLocals_{assignedLocals},
+        assignedGlobals_{assignedGlobals},
+        globalDeclarations_{globalDeclarations} {}
+
+  void scan(const std::vector<StmtPtr>& statements) {
+    for (const auto& statement : statements) {
+      visitStmt(*statement);
+    }
+  }
+
+  void visitAssignExpr(Assign& expr) {
+    scan(expr.value);
+    for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+      auto elem = scope->find(expr.name.symbol_);
+      if (elem != scope->end()) {
+        assignedLocals_.insert(elem->second);
+        return;
+      }
+    }
+    assignedGlobals_.insert(expr.name.symbol_);
+  }
+  void visitBinaryExpr(Binary& expr) {
+    scan(expr.left);
+    scan(expr.right);
+  }
+  void visitCallExpr(Call& expr) {
+    scan(expr.callee);
+    for (const auto& argument : expr.arguments) {
+      scan(argument);
+    }
+  }
+  void visitGetExpr(Get& expr) { scan(expr.object); }
+  void visitGroupingExpr(Grouping& expr) { scan(expr.expression); }
+  void visitLiteralExpr(Literal& expr) {}
+  void visitLogicalExpr(Logical& expr) {
+    scan(expr.left);
+    scan(expr.right);
+  }
+  void visitSetExpr(Set& expr) {
+    scan(expr.object);
+    scan(expr.value);
+  }
+  void visitSuperExpr(Super& expr) {}
+  void visitThisExpr(This& expr) {}
+  void visitUnaryExpr(Unary& expr) { scan(expr.right); }
+  void visitVariableExpr(Variable& expr) {}
+
+  void visitBlockStmt(Block& stmt) {
+    scopes_.emplace_back();
+    scan(stmt.statements);
+    scopes_.pop_back();
+  }
+  void visitClassStmt(Class& stmt) {
+    declare(stmt.name, &stmt);
+    for (const auto& method : stmt.methods) {
+      scanFunction(*method);
+    }
+  }
+  void visitExpressionStmt(Expression& stmt) { scan(stmt.expression); }
+  void visitFunctionStmt(Function& stmt) {
+    declare(stmt.name, &stmt);
+    scanFunction(stmt);
+  }
+  void visitIfStmt(If& stmt) {
+    scan(stmt.condition);
+    visitStmt(*stmt.thenBranch);
+    if (stmt.elseBranch != nullptr) visitStmt(*stmt.elseBranch);
+  }
+  void visitImportStmt(Import& stmt) {}
+  void visitPrintStmt(Print& stmt) { scan(stmt.expression); }
+  void visitReturnStmt(Return& stmt) {
+    if (stmt.value != nullptr) scan(stmt.value);
+  }
+  void visitVarStmt(Var& stmt) {
+    declare(stmt.name, &stmt);
+    if (stmt.initializer != nullptr) scan(stmt.initializer);
+  }
+  void visitWhileStmt(While& stmt) {
+    scan(stmt.condition);
+    visitStmt(*stmt.body);
+  }
+
+ private:
+  void scan(const ExprPtr& expr) { visitExpr(*expr); }
+  void scanFunction(const Function& function) {
+    scopes_.emplace_back();
+    for (const Token& param : function.params) {
+      declare(param, &param);
+    }
+    scan(function.body);
+    scopes_.pop_back();
+  }
+  void declare(const Token& name, Declaration declaration) {
+    if (scopes_.empty()) {
+      ++globalDeclarations_[name.symbol_];
+    } else {
+      scopes_.back()[name.symbol_] = declaration;
+    }
+  }
+
+  std::unordered_set<Declaration>& assignedLocals_;
+  std::unordered_set<Symbol>& assignedGlobals_;
+  std::unordered_map<Symbol, int>& globalDeclarations_;
+  std::vector<std::unordered_map<Symbol, Declaration>> scopes_;
+};
+
+bool isLiteral(const ExprPtr& expr) { return expr->kind == ExprKind::Literal; }
+
+const Value& literal(const ExprPtr& expr) {
+  return static_cast<const Literal&>(*expr).value;
+}
+
+// Stands in for a statement that does nothing. With no locals, it needs no
+// environment of its own.
+StmtPtr emptyBlock() {
+  auto block = std::make_unique<Block>(std::vector<StmtPtr>{});
+  block->flat = true;
+  return block;
+}
+
+bool isEmptyBlock(const StmtPtr& stmt) {
+  return stmt->kind == StmtKind::Block &&
+         static_cast<const Block&>(*stmt).statements.empty();
+}
+
+}  // namespace
+
+void Optimizer::optimize(std::vector<StmtPtr>& statements) {
+  // Imported modules share the globals and may assign any of them.
+  for (const auto& statement : statements) {
+    if (statement->kind == StmtKind::Import) wholeProgram_ = false;
+  }
+  AssignmentScan{assignedLocals_, assignedGlobals_, globalDeclarations_}.scan(
+      statements);
+  optimizeBlock(statements);
+}
+
+void Optimizer::optimizeBlock(std::vector<StmtPtr>& statements) {
+  for (auto& statement : statements) {
+    optimize(statement);
+  }
+  // Statements that were reduced to nothing.
+  statements.erase(
+      std::remove_if(statements.begin(), statements.end(), isEmptyBlock),
+      statements.end());
+}
+
+void Optimizer::optimize(ExprPtr& expr) {
+  if (ExprPtr replacement = visitExpr(*expr)) expr = std::move(replacement);
+}
+
+void Optimizer::optimize(StmtPtr& stmt) {
+  if (StmtPtr replacement = visitStmt(*stmt)) stmt = std::move(replacement);
+}
+
+void Optimizer::optimizeFunction(Function& function) {
+  // Parameters and body share one scope, as in the Resolver.
+  scopes_.emplace_back();
+  for (const Token& param : function.params) {
+    scopes_.back()[param.symbol_] = Binding{false, Value{}};
+  }
+  optimizeBlock(function.body);
+  scopes_.pop_back();
+}
+
+void Optimizer::declareVariable(const Var& stmt) {
+  const Token& name = stmt.name;
+  bool constant = stmt.initializer == nullptr || isLiteral(stmt.initializer);
+  Value value = constant && stmt.initializer != nullptr
+                    ? literal(stmt.initializer)
+                    : Value{};
+  if (scopes_.empty()) {
+    if (wholeProgram_ && constant && globalDeclarations_[name.symbol_] == 1 &&
+        assignedGlobals_.count(name.symbol_) == 0) {
+      constantGlobals_[name.symbol_] = std::move(value);
+    }
+    return;
+  }
+  constant = constant && assignedLocals_.count(&stmt) == 0;
+  scopes_.back()[name.symbol_] = Binding{constant, std::move(value)};
+}
+
+ExprPtr Optimizer::visitAssignExpr(Assign& expr) {
+  optimize(expr.value);
+  return nullptr;
+}
+
+ExprPtr Optimizer::visitBinaryExpr(Binary& expr) {
+  optimize(expr.left);
+  optimize(expr.right);
+  if (!isLiteral(expr.left) || !isLiteral(expr.right)) return nullptr;
+
+  const Value& left = literal(expr.left);
+  const Value& right = literal(expr.right);
+  switch (expr.op.type_) {
+    case BANG_EQUAL:
+      return std::make_unique<Literal>(left != right);
+    case EQUAL_EQUAL:
+      return std::make_unique<Literal>(left == right);
+    case PLUS:
+      if (left.isString() && right.isString()) {
+        return std::make_unique<Literal>(
+            new LoxString{left.asString() + right.asString()});
+      }
+      break;
+    default:
+      break;
+  }
+  if (!left.isNumber() || !right.isNumber()) return nullptr;
+  double a = left.asNumber();
+  double b = right.asNumber();
+  switch (expr.op.type_) {
+    case GREATER:
+      return std::make_unique<Literal>(a > b);
+    case GREATER_EQUAL:
+      return std::make_unique<Literal>(a >= b);
+    case LESS:
+      return std::make_unique<Literal>(a < b);
+    case LESS_EQUAL:
+      return std::make_unique<Literal>(a <= b);
+    case MINUS:
+      return std::make_unique<Literal>(a - b);
+    case PLUS:
+      return std::make_unique<Literal>(a + b);
+    case SLASH:
+      return std::make_unique<Literal>(a / b);
+    case STAR:
+      return std::make_unique<Literal>(a * b);
+    default:
+      return nullptr;
+  }
+}
+
+ExprPtr Optimizer::visitCallExpr(Call& expr) {
+  optimize(expr.callee);
+  for (auto& argument : expr.arguments) {
+    optimize(argument);
+  }
+  return nullptr;
+}
+
+ExprPtr Optimizer::visitGetExpr(Get& expr) {
+  optimize(expr.object);
+  return nullptr;
+}
+
+ExprPtr Optimizer::visitGroupingExpr(Grouping& expr) {
+  optimize(expr.expression);
+  return std::move(expr.expression);
+}
+
+ExprPtr Optimizer::visitLiteralExpr(Literal& expr) { return nullptr; }
+
+ExprPtr Optimizer::visitLogicalExpr(Logical& expr) {
+  optimize(expr.left);
+  optimize(expr.right);
+  if (!isLiteral(expr.left)) return nullptr;
+  // `or` yields its left operand when that is truthy, `and` when it is not.
+  bool truthy = literal(expr.left).isTruthy();
+  bool shortCircuits = expr.op.type_ == OR ? truthy : !truthy;
+  return std::move(shortCircuits ? expr.left : expr.right);
+}
+
+ExprPtr Optimizer::visitSetExpr(Set& expr) {
+  optimize(expr.object);
+  optimize(expr.value);
+  return nullptr;
+}
+
+ExprPtr Optimizer::visitSuperExpr(Super& expr) { return nullptr; }
+
+ExprPtr Optimizer::visitThisExpr(This& expr) { return nullptr; }
+
+ExprPtr Optimizer::visitUnaryExpr(Unary& expr) {
+  optimize(expr.right);
+  if (!isLiteral(expr.right)) return nullptr;
+  const Value& right = literal(expr.right);
+  if (expr.op.type_ == BANG) {
+    return std::make_unique<Literal>(!right.isTruthy());
+  }
+  if (expr.op.type_ == MINUS && right.isNumber()) {
+    return std::make_unique<Literal>(-right.asNumber());
+  }
+  return nullptr;
+}
+
+ExprPtr Optimizer::visitVariableExpr(Variable& expr) {
+  for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+    auto elem = scope->find(expr.name.symbol_);
+    if (elem != scope->end()) {
+      if (!elem->second.constant) return nullptr;
+      return std::make_unique<Literal>(elem->second.value);
+    }
+  }
+  auto global = constantGlobals_.find(expr.name.symbol_);
+  if (global == constantGlobals_.end()) return nullptr;
+  return std::make_unique<Literal>(global->second);
+}
+
+StmtPtr Optimizer::visitBlockStmt(Block& stmt) {
+  scopes_.emplace_back();
+  optimizeBlock(stmt.statements);
+  scopes_.pop_back();
+  return nullptr;
+}
+
+StmtPtr Optimizer::visitClassStmt(Class& stmt) {
+  if (!scopes_.empty()) {
+    scopes_.back()[stmt.name.symbol_] = Binding{false, Value{}};
+  }
+  // The superclass stays a Variable: it is never a constant that could be
+  // folded, since only classes are valid there.
+  for (auto& method : stmt.methods) {
+    optimizeFunction(*method);
+  }
+  return nullptr;
+}
+
+StmtPtr Optimizer::visitExpressionStmt(Expression& stmt) {
+  optimize(stmt.expression);
+  // A literal on its own has no effect.
+  if (isLiteral(stmt.expression)) return emptyBlock();
+  return nullptr;
+}
+
+StmtPtr Optimizer::visitFunctionStmt(Function& stmt) {
+  if (!scopes_.empty()) {
+    scopes_.back()[stmt.name.symbol_] = Binding{false, Value{}};
+  }
+  optimizeFunction(stmt);
+  return nullptr;
+}
+
+StmtPtr Optimizer::visitIfStmt(If& stmt) {
+  optimize(stmt.condition);
+  optimize(stmt.thenBranch);
+  if (stmt.elseBranch != nullptr) optimize(stmt.elseBranch);
+  if (!isLiteral(stmt.condition)) return nullptr;
+  if (literal(stmt.condition).isTruthy()) return std::move(stmt.thenBranch);
+  if (stmt.elseBranch != nullptr) return std::move(stmt.elseBranch);
+  return emptyBlock();
+}
+
+StmtPtr Optimizer::visitImportStmt(Import& stmt) { return nullptr; }
+
+StmtPtr Optimizer::visitPrintStmt(Print& stmt) {
+  optimize(stmt.expression);
+  return nullptr;
+}
+
+StmtPtr Optimizer::visitReturnStmt(Return& stmt) {
+  if (stmt.value != nullptr) optimize(stmt.value);
+  return nullptr;
+}
+
+StmtPtr Optimizer::visitVarStmt(Var& stmt) {
+  // The name is in scope, but not yet a constant, while its initializer is
+  // optimized; reading it there is an error the Resolver reports.
+  if (!scopes_.empty()) {
+    scopes_.back()[stmt.name.symbol_] = Binding{false, Value{}};
+  }
+  if (stmt.initializer != nullptr) optimize(stmt.initializer);
+  declareVariable(stmt);
+  return nullptr;
+}
+
+StmtPtr Optimizer::visitWhileStmt(While& stmt) {
+  optimize(stmt.condition);
+  if (isLiteral(stmt.condition) && !literal(stmt.condition).isTruthy()) {
+    return emptyBlock();
+  }
+  optimize(stmt.body);
+  return nullptr;
+}
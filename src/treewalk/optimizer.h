@@ -0,0 +1,85 @@
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../token/symbol.h"
+#include "expr.h"
+#include "stmt.h"
+#include "value.h"
+
+// Rewrites the parser output in place before it runs:
+//  - operators whose operands are all literals are folded into a literal,
+//  - reads of variables that are initialized with a constant and never
+//    assigned are replaced by that constant,
+//  - `if` and `while` statements whose condition is known are reduced to the
+//    branch that can run.
+// Anything that would raise a runtime error, such as `-"a"`, is left in the
+// tree so the error still happens when the program runs.
+//
+// Declarations are never removed, so the slots computed by the Resolver stay
+// valid and the pass can run either before or after it.
+class Optimizer : public ExprVisitor<Optimizer, ExprPtr>,
+                  public StmtVisitor<Optimizer, StmtPtr> {
+ public:
+  // Unless `wholeProgram` is set (i.e. in the REPL), later input may assign
+  // to any global, so only locals are propagated. Neither is a program that
+  // imports modules whole: they share its globals.
+  explicit Optimizer(bool wholeProgram) : wholeProgram_{wholeProgram} {}
+
+  void optimize(std::vector<StmtPtr>& statements);
+
+  // Each visit returns the node that replaces the visited one, or nullptr to
+  // keep it.
+  ExprPtr visitAssignExpr(Assign& expr);
+  ExprPtr visitBinaryExpr(Binary& expr);
+  ExprPtr visitCallExpr(Call& expr);
+  ExprPtr visitGetExpr(Get& expr);
+  ExprPtr visitSetExpr(Set& expr);
+  ExprPtr visitSuperExpr(Super& expr);
+  ExprPtr visitThisExpr(This& expr);
+  ExprPtr visitGroupingExpr(Grouping& expr);
+  ExprPtr visitLiteralExpr(Literal& expr);
+  ExprPtr visitLogicalExpr(Logical& expr);
+  ExprPtr visitUnaryExpr(Unary& expr);
+  ExprPtr visitVariableExpr(Variable& expr);
+
+  StmtPtr visitBlockStmt(Block& stmt);
+  StmtPtr visitClassStmt(Class& stmt);
+  StmtPtr visitExpressionStmt(Expression& stmt);
+  StmtPtr visitFunctionStmt(Function& stmt);
+  StmtPtr visitIfStmt(If& stmt);
+  StmtPtr visitImportStmt(Import& stmt);
+  StmtPtr visitPrintStmt(Print& stmt);
+  StmtPtr visitReturnStmt(Return& stmt);
+  StmtPtr visitVarStmt(Var& stmt);
+  StmtPtr visitWhileStmt(While& stmt);
+
+  // Declarations are identified by the address of the node (or parameter
+  // token) that introduces them.
+  using Declaration = const void*;
+
+ private:
+  // A local in scope, with its value if it is a constant.
+  struct Binding {
+    bool constant;
+    Value value;
+  };
+  using Scope = std::unordered_map<Symbol, Binding>;
+
+  void optimizeBlock(std::vector<StmtPtr>& statements);
+  void optimize(ExprPtr& expr);
+  void optimize(StmtPtr& stmt);
+  void optimizeFunction(Function& function);
+  void declareVariable(const Var& stmt);
+
+  bool wholeProgram_;
+  std::vector<Scope> scopes_;
+  std::unordered_map<Symbol, Value> constantGlobals_;
+
+  // Filled in by a first walk over the whole program.
+  std::unordered_set<Declaration> assignedLocals_;
+  std::unordered_set<Symbol> assignedGlobals_;
+  std::unordered_map<Symbol, int> globalDeclarations_;
+};
@@ -0,0 +1,75 @@
+#include "optimizer.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../utils/ast_printer.h"
+#include "parser.h"
+
+std::string optimize(std::string_view source, bool wholeProgram = true) {
+  std::vector<StmtPtr> statements = Parser{source}.parse();
+  Optimizer{wholeProgram}.optimize(statements);
+
+  std::string out;
+  AstPrinter printer;
+  for (const auto& statement : statements) {
+    out += printer.print(*statement) + "\n";
+  }
+  return out;
+}
+
+TEST(OptimizerTests, FoldsConstantExpressions) {
+  EXPECT_EQ(optimize("print 60 * 60 * 24;"), "(print 86400.000000)\n");
+  EXPECT_EQ(optimize("print -(1 + 2) < 0 and !nil;"), "(print true)\n");
+  EXPECT_EQ(optimize("print \"a\" + \"b\" == \"ab\";"), "(print true)\n");
+  EXPECT_EQ(optimize("print nil or x;"), "(print x)\n");
+}
+
+TEST(OptimizerTests, KeepsOperationsThatFailAtRuntime) {
+  EXPECT_EQ(optimize("print -\"a\";"), "(print (- a))\n");
+  EXPECT_EQ(optimize("print 1 + \"a\";"), "(print (+ 1.000000 a))\n");
+}
+
+TEST(OptimizerTests, PropagatesConstants) {
+  EXPECT_EQ(optimize("{ var a = 2; var b = a * 3; print b; }"),
+            "(block (var a 2.000000) (var b 6.000000) (print 6.000000))\n");
+  EXPECT_EQ(optimize("{ var a = 2; a = 3; print a; }"),
+            "(block (var a 2.000000) (; (= a 3.000000)) (print a))\n");
+  // Assigned from a closure declared before the variable.
+  EXPECT_EQ(optimize("fun set() { g = 1; } var g = 2; print g;"),
+            "(fun set () (; (= g 1.000000)))\n"
+            "(var g 2.000000)\n"
+            "(print g)\n");
+  EXPECT_EQ(optimize("var g = 2; print g;"),
+            "(var g 2.000000)\n(print 2.000000)\n");
+  EXPECT_EQ(optimize("var g = 2; print g;", false),
+            "(var g 2.000000)\n(print g)\n");
+  EXPECT_EQ(optimize("{ var a = 1; fun f(a) { return a; } }"),
+            "(block (var a 1.000000) (fun f (a) (return a)))\n");
+}
+
+TEST(OptimizerTests, RemovesDeadBranches) {
+  EXPECT_EQ(optimize("if (false) print 1; else print 2;"),
+            "(print 2.000000)\n");
+  EXPECT_EQ(optimize("var debug = false; if (debug) print 1; print 3;"),
+            "(var debug false)\n(print 3.000000)\n");
+  EXPECT_EQ(optimize("while (1 > 2) print 1;"), "");
+}
+
+TEST(OptimizerTests, LeavesBranchesThatDoNothingFlat) {
+  std::vector<StmtPtr> statements =
+      Parser{"if (x) 1; else while (false) print 1;"}.parse();
+  Optimizer{true}.optimize(statements);
+  ASSERT_EQ(statements.size(), 1u);
+  const auto& branch = static_cast<const If&>(*statements[0]);
+  for (const StmtPtr* stmt : {&branch.thenBranch, &branch.elseBranch}) {
+    ASSERT_EQ((*stmt)->kind, StmtKind::Block);
+    const auto& block = static_cast<const Block&>(**stmt);
+    EXPECT_TRUE(block.statements.empty());
+    // So the interpreter doesn't make an environment to run nothing in.
+    EXPECT_TRUE(block.flat);
+  }
+}
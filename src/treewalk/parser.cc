@@ -2,14 +2,13 @@
 
 #include <cassert>
 #include <memory>
+#include <string>
+#include <string_view>
 
 #include "../utils/error.h"
 
-Token Parser::previous() { return tokens_.at(current_ - 1); }
-
-Token Parser::peek() { return tokens_.at(current_); }
-
-bool Parser::isAtEnd() { return peek().type_ == END_OF_FILE; }
+Parser::Parser(std::string_view source)
+    : scanner_{source}, current_{scanner_.next()}, previous_{current_} {}
 
 bool Parser::check(TokenType type) {
   if (isAtEnd()) {
@@ -18,11 +17,12 @@ bool Parser::check(TokenType type) {
   return peek().type_ == type;
 }
 
-Token Parser::advance() {
+const Token& Parser::advance() {
   if (!isAtEnd()) {
-    ++current_;
+    previous_ = std::move(current_);
+    current_ = scanner_.next();
   }
-  return previous();
+  return previous_;
 }
 
 Token Parser::consume(TokenType type, std::string msg) {
@@ -47,7 +47,8 @@ ExprPtr Parser::equality() {
   while (match(BANG_EQUAL, EQUAL_EQUAL)) {
     Token op = previous();
     ExprPtr right = comparison();
-    expr = std::make_shared<Binary>(expr, std::move(op), right);
+    expr = std::make_unique<Binary>(std::move(expr), std::move(op),
+                                    std::move(right));
   }
   return expr;
 }
@@ -59,7 +60,8 @@ ExprPtr Parser::comparison() {
   while (match(GREATER, GREATER_EQUAL, LESS, LESS_EQUAL)) {
     Token op = previous();
     ExprPtr right = term();
-    expr = std::make_shared<Binary>(expr, std::move(op), right);
+    expr = std::make_unique<Binary>(std::move(expr), std::move(op),
+                                    std::move(right));
   }
   return expr;
 }
@@ -69,7 +71,8 @@ ExprPtr Parser::term() {
   while (match(MINUS, PLUS)) {
     Token op = previous();
     ExprPtr right = factor();
-    expr = std::make_shared<Binary>(expr, std::move(op), right);
+    expr = std::make_unique<Binary>(std::move(expr), std::move(op),
+                                    std::move(right));
   }
   return expr;
 }
@@ -79,7 +82,8 @@ ExprPtr Parser::factor() {
   while (match(SLASH, STAR)) {
     Token op = previous();
     ExprPtr right = unary();
-    expr = std::make_shared<Binary>(expr, std::move(op), right);
+    expr = std::make_unique<Binary>(std::move(expr), std::move(op),
+                                    std::move(right));
   }
   return expr;
 }
@@ -88,7 +92,7 @@ ExprPtr Parser::unary() {
   if (match(BANG, MINUS)) {
     Token op = previous();
     ExprPtr right = unary();
-    return std::make_shared<Unary>(std::move(op), right);
+    return std::make_unique<Unary>(std::move(op), std::move(right));
   }
   return call();
 }
@@ -97,7 +101,10 @@ ExprPtr Parser::call() {
   ExprPtr expr = primary();
   while (true) {
     if (match(LEFT_PAREN)) {
-      expr = finishCall(expr);
+      expr = finishCall(std::move(expr));
+    } else if (match(DOT)) {
+      Token name = consume(IDENTIFIER, "Expect property name after '.'!");
+      expr = std::make_unique<Get>(std::move(expr), std::move(name));
     } else {
       break;
     }
@@ -107,24 +114,37 @@ ExprPtr Parser::call() {
 
 ExprPtr Parser::primary() {
   if (match(FALSE)) {
-    return std::make_shared<Literal>(false);
+    return std::make_unique<Literal>(false);
   }
   if (match(TRUE)) {
-    return std::make_shared<Literal>(true);
+    return std::make_unique<Literal>(true);
   }
   if (match(NIL)) {
-    return std::make_shared<Literal>(nullptr);
+    return std::make_unique<Literal>(nullptr);
+  }
+  if (match(NUMBER)) {
+    return std::make_unique<Literal>(previous().number());
+  }
+  if (match(STRING)) {
+    return std::make_unique<Literal>(
+        new LoxString{std::string{previous().string()}});
   }
-  if (match(NUMBER, STRING)) {
-    return std::make_shared<Literal>(previous().literal_);
+  if (match(SUPER)) {
+    Token keyword = previous();
+    consume(DOT, "Expect '.' after 'super'!");
+    Token method = consume(IDENTIFIER, "Expect superclass method name!");
+    return std::make_unique<Super>(std::move(keyword), std::move(method));
+  }
+  if (match(THIS)) {
+    return std::make_unique<This>(previous());
   }
   if (match(LEFT_PAREN)) {
     ExprPtr expr = expression();
     consume(RIGHT_PAREN, "Expect ')' after expression.");
-    return std::make_shared<Grouping>(expr);
+    return std::make_unique<Grouping>(std::move(expr));
   }
   if (match(IDENTIFIER)) {
-    return std::make_shared<Variable>(previous());
+    return std::make_unique<Variable>(previous());
   }
   throw error(peek(), "Expect expression.");
 }
@@ -134,9 +154,14 @@ ExprPtr Parser::assignment() {
   if (match(EQUAL)) {
     Token equals = previous();
     ExprPtr value = assignment();
-    if (Variable* e = dynamic_cast<Variable*>(expr.get())) {
-      Token name = e->name;
-      return std::make_shared<Assign>(std::move(name), value);
+    if (expr->kind == ExprKind::Variable) {
+      Token name = static_cast<Variable*>(expr.get())->name;
+      return std::make_unique<Assign>(std::move(name), std::move(value));
+    }
+    if (expr->kind == ExprKind::Get) {
+      auto* get = static_cast<Get*>(expr.get());
+      return std::make_unique<Set>(std::move(get->object), get->name,
+                                   std::move(value));
     }
     error(std::move(equals), "Invalid assignment target!");
   }
@@ -147,7 +172,8 @@ ExprPtr Parser::orExpression() {
   while (match(OR)) {
     Token op = previous();
     ExprPtr right = andExpression();
-    expr = std::make_shared<Logical>(expr, std::move(op), right);
+    expr = std::make_unique<Logical>(std::move(expr), std::move(op),
+                                     std::move(right));
   }
   return expr;
 }
@@ -156,7 +182,8 @@ ExprPtr Parser::andExpression() {
   while (match(AND)) {
     Token op = previous();
     ExprPtr right = equality();
-    expr = std::make_shared<Logical>(expr, std::move(op), right);
+    expr = std::make_unique<Logical>(std::move(expr), std::move(op),
+                                     std::move(right));
   }
   return expr;
 }
@@ -174,10 +201,12 @@ ExprPtr Parser::finishCall(ExprPtr callee) {
 
   Token paren = consume(RIGHT_PAREN, "Expect ')' after arguments.");
 
-  return std::make_shared<Call>(callee, std::move(paren), std::move(arguments));
+  return std::make_unique<Call>(std::move(callee), std::move(paren),
+                                std::move(arguments));
 }
 
 Parser::ParseError Parser::error(const Token& token, std::string msg) {
+  hadError_ = true;
   ::error(token, msg);
   return ParseError{""};
 }
@@ -194,6 +223,7 @@ void Parser::synchronize() {
       case VAR:
       case FOR:
       case IF:
+      case IMPORT:
       case WHILE:
       case PRINT:
       case RETURN:
@@ -206,7 +236,7 @@ void Parser::synchronize() {
 std::vector<StmtPtr> Parser::parse() {
   std::vector<StmtPtr> statements;
   while (!isAtEnd()) {
-    statements.push_back(declaration());
+    statements.push_back(match(IMPORT) ? importDeclaration() : declaration());
   }
   return statements;
 }
@@ -216,21 +246,23 @@ StmtPtr Parser::statement() {
   if (match(PRINT)) return printStatement();
   if (match(RETURN)) return returnStatement();
   if (match(WHILE)) return whileStatement();
-  if (match(LEFT_BRACE)) return std::make_shared<Block>(block());
+  if (match(LEFT_BRACE)) return std::make_unique<Block>(block());
   return expressionStatement();
 }
 StmtPtr Parser::printStatement() {
   ExprPtr value = expression();
   consume(SEMICOLON, "Expect ';' after value!");
-  return std::make_shared<Print>(value);
+  return std::make_unique<Print>(std::move(value));
 }
 StmtPtr Parser::expressionStatement() {
   ExprPtr expr = expression();
   consume(SEMICOLON, "Expect ';' after expression!");
-  return std::make_shared<Expression>(expr);
+  return std::make_unique<Expression>(std::move(expr));
 }
 StmtPtr Parser::declaration() {
   try {
+    if (check(IMPORT)) throw error(peek(), "Can only import at the top level!");
+    if (match(CLASS)) return classDeclaration();
     if (match(FUN)) return function("function");
     if (match(VAR)) return varDeclaration();
     return statement();
@@ -239,6 +271,33 @@ StmtPtr Parser::declaration() {
     return nullptr;
   }
 }
+StmtPtr Parser::importDeclaration() {
+  try {
+    Token keyword = previous();
+    Token path = consume(STRING, "Expect module path after 'import'!");
+    consume(SEMICOLON, "Expect ';' after module path!");
+    return std::make_unique<Import>(std::move(keyword), std::move(path));
+  } catch (ParseError error) {
+    synchronize();
+    return nullptr;
+  }
+}
+StmtPtr Parser::classDeclaration() {
+  Token name = consume(IDENTIFIER, "Expect class name!");
+  std::unique_ptr<Variable> superclass;
+  if (match(LESS)) {
+    consume(IDENTIFIER, "Expect superclass name!");
+    superclass = std::make_unique<Variable>(previous());
+  }
+  consume(LEFT_BRACE, "Expect '{' before class body!");
+  std::vector<std::unique_ptr<Function>> methods;
+  while (!check(RIGHT_BRACE) && !isAtEnd()) {
+    methods.push_back(function("method"));
+  }
+  consume(RIGHT_BRACE, "Expect '}' after class body!");
+  return std::make_unique<Class>(std::move(name), std::move(superclass),
+                                 std::move(methods));
+}
 StmtPtr Parser::varDeclaration() {
   Token name = consume(IDENTIFIER, "Expect variable name!");
   ExprPtr initializer = nullptr;
@@ -246,7 +305,7 @@ StmtPtr Parser::varDeclaration() {
     initializer = expression();
   }
   consume(SEMICOLON, "Expect ';' after expression!");
-  return std::make_shared<Var>(std::move(name), initializer);
+  return std::make_unique<Var>(std::move(name), std::move(initializer));
 }
 std::vector<StmtPtr> Parser::block() {
   std::vector<StmtPtr> statements;
@@ -265,14 +324,15 @@ StmtPtr Parser::ifStatement() {
   if (match(ELSE)) {
     elseBranch = statement();
   }
-  return std::make_shared<If>(condition, theBranch, elseBranch);
+  return std::make_unique<If>(std::move(condition), std::move(theBranch),
+                              std::move(elseBranch));
 }
 StmtPtr Parser::whileStatement() {
   consume(LEFT_PAREN, "Expect '(' after while!");
   ExprPtr condition = expression();
   consume(RIGHT_PAREN, "Expect ')' after condition!");
   StmtPtr body = statement();
-  return std::make_shared<While>(condition, body);
+  return std::make_unique<While>(std::move(condition), std::move(body));
 }
 StmtPtr Parser::forStatement() {
   consume(LEFT_PAREN, "Expect '(' after for!");
@@ -296,15 +356,20 @@ StmtPtr Parser::forStatement() {
   consume(RIGHT_PAREN, "Expect ')' after for clauses!");
   StmtPtr body = statement();
   if (increment != nullptr) {
-    body = std::make_shared<Block>(
-        std::vector<StmtPtr>{body, std::make_shared<Expression>(increment)});
+    std::vector<StmtPtr> statements;
+    statements.push_back(std::move(body));
+    statements.push_back(std::make_unique<Expression>(std::move(increment)));
+    body = std::make_unique<Block>(std::move(statements));
   }
   if (condition == nullptr) {
-    condition = std::make_shared<Literal>(true);
+    condition = std::make_unique<Literal>(true);
   }
-  body = std::make_shared<While>(condition, body);
+  body = std::make_unique<While>(std::move(condition), std::move(body));
   if (initializer != nullptr) {
-    body = std::make_shared<Block>(std::vector<StmtPtr>{initializer, body});
+    std::vector<StmtPtr> statements;
+    statements.push_back(std::move(initializer));
+    statements.push_back(std::move(body));
+    body = std::make_unique<Block>(std::move(statements));
   }
   return body;
 }
@@ -316,10 +381,10 @@ StmtPtr Parser::returnStatement() {
     value = expression();
   }
   consume(SEMICOLON, "Expect ';' after return value!");
-  return std::make_shared<Return>(keyword, value);
+  return std::make_unique<Return>(keyword, std::move(value));
 }
 
-std::shared_ptr<Function> Parser::function(std::string kind) {
+std::unique_ptr<Function> Parser::function(std::string kind) {
   Token name = consume(IDENTIFIER, "Expect " + kind + " name!");
   consume(LEFT_PAREN, "Expect '(' after " + kind + " name!");
   std::vector<Token> parameters;
@@ -334,6 +399,6 @@ std::shared_ptr<Function> Parser::function(std::string kind) {
   consume(RIGHT_PAREN, "Expect ')' after parameters!");
   consume(LEFT_BRACE, "Expect '{' before " + kind + "body!");
   std::vector<StmtPtr> body = block();
-  return std::make_shared<Function>(std::move(name), std::move(parameters),
+  return std::make_unique<Function>(std::move(name), std::move(parameters),
                                     std::move(body));
 }
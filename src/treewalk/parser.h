@@ -3,24 +3,29 @@
 #include <iostream>
 #include <memory>
 #include <stdexcept>
+#include <string_view>
 #include <vector>
 
+#include "../scanner/scanner.h"
 #include "../token/token.h"
 #include "expr.h"
 #include "stmt.h"
 
-using ExprPtr = std::shared_ptr<Expr>;
-using StmtPtr = std::shared_ptr<Stmt>;
-
 class Parser {
   struct ParseError : public std::runtime_error {
     using std::runtime_error::runtime_error;
   };
 
  public:
-  Parser(const std::vector<Token>& tokens) : tokens_{tokens} {}
+  // Tokens are scanned as the parser gets to them: only the current one and
+  // the one before are kept, however long `source` is. The tree keeps
+  // string_views into `source`, so it has to outlive the tree.
+  explicit Parser(std::string_view source);
 
   std::vector<StmtPtr> parse();
+  // Whether parse() reported an error. Unlike the global hadError, this
+  // only covers this source.
+  bool hadError() const { return hadError_; }
 
  private:
   ExprPtr expression();
@@ -38,6 +43,9 @@ class Parser {
 
   StmtPtr statement();
   StmtPtr declaration();
+  // Imports are only allowed outside of any block or function.
+  StmtPtr importDeclaration();
+  StmtPtr classDeclaration();
   StmtPtr printStatement();
   StmtPtr expressionStatement();
   StmtPtr varDeclaration();
@@ -49,16 +57,18 @@ class Parser {
   template <class... T>
   bool match(T... type);
   Token consume(TokenType type, std::string msg);
-  Token previous();
-  Token advance();
+  const Token& previous() const { return previous_; }
+  const Token& advance();
   bool check(TokenType type);
-  bool isAtEnd();
-  Token peek();
+  bool isAtEnd() const { return current_.type_ == END_OF_FILE; }
+  const Token& peek() const { return current_; }
   ParseError error(const Token& token, std::string msg);
   void synchronize();
   std::vector<StmtPtr> block();
-  std::shared_ptr<Function> function(std::string kind);
+  std::unique_ptr<Function> function(std::string kind);
 
-  const std::vector<Token>& tokens_;
-  int current_{0};
+  Scanner scanner_;
+  Token current_;
+  Token previous_;
+  bool hadError_{false};
 };
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+
+#include "LoxCallable.h"
+#include "stmt.h"
+
+namespace {
+
+double milliseconds(Profiler::Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>{duration}.count();
+}
+
+long long nanoseconds(Profiler::Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+      .count();
+}
+
+std::string quote(const std::string& text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+}  // namespace
+
+void Profiler::enter(LoxCallable& callable) {
+  const Function* declaration = callable.declaration();
+  const void* key = declaration != nullptr
+                        ? static_cast<const void*>(declaration)
+                        : static_cast<const void*>(&callable);
+  auto [elem, inserted] = index_.emplace(key, entries_.size());
+  if (inserted) {
+    int line = declaration != nullptr ? declaration->name.line_ : 0;
+    entries_.push_back(Entry{callable.toString(), line});
+  }
+  Entry& entry = entries_[elem->second];
+  ++entry.calls;
+  ++entry.active;
+  stack_.push_back(Frame{elem->second, Clock::now(), heap_.allocations()});
+}
+
+void Profiler::exit() {
+  Frame frame = stack_.back();
+  stack_.pop_back();
+  Clock::duration elapsed = Clock::now() - frame.start;
+  uint64_t allocations = heap_.allocations() - frame.allocationsAtStart;
+
+  Entry& entry = entries_[frame.entry];
+  if (--entry.active == 0) entry.inclusive += elapsed;
+  entry.exclusive += elapsed - frame.childTime;
+  entry.allocations += allocations - frame.childAllocations;
+  if (!stack_.empty()) {
+    stack_.back().childTime += elapsed;
+    stack_.back().childAllocations += allocations;
+  }
+}
+
+std::vector<Profiler::Entry> Profiler::entries() const {
+  std::vector<Entry> sorted = entries_;
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Entry& a, const Entry& b) {
+                     return a.exclusive > b.exclusive;
+                   });
+  return sorted;
+}
+
+void Profiler::report(std::ostream& out) const {
+  out << std::left << std::setw(28) << "function" << std::right
+      << std::setw(12) << "calls" << std::setw(14) << "incl. ms"
+      << std::setw(14) << "excl. ms" << std::setw(12) << "allocs" << "\n";
+  out << std::fixed << std::setprecision(3);
+  for (const Entry& entry : entries()) {
+    std::string name = entry.name;
+    if (entry.line > 0) name += " line " + std::to_string(entry.line);
+    out << std::left << std::setw(28) << name << std::right << std::setw(12)
+        << entry.calls << std::setw(14) << milliseconds(entry.inclusive)
+        << std::setw(14) << milliseconds(entry.exclusive) << std::setw(12)
+        << entry.allocations << "\n";
+  }
+}
+
+void Profiler::writeJson(std::ostream& out) const {
+  out << "{\"functions\": [";
+  bool first = true;
+  for (const Entry& entry : entries()) {
+    out << (first ? "\n" : ",\n") << "  {\"name\": " << quote(entry.name)
+        << ", \"line\": " << entry.line << ", \"calls\": " << entry.calls
+        << ", \"inclusive_ns\": " << nanoseconds(entry.inclusive)
+        << ", \"exclusive_ns\": " << nanoseconds(entry.exclusive)
+        << ", \"allocations\": " << entry.allocations << "}";
+    first = false;
+  }
+  out << "\n]}\n";
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "heap.h"
+
+class LoxCallable;
+
+// Records, per Lox function and per native, how often it was called, the
+// wall time spent in it with and without its callees, and how many heap
+// objects it allocated itself.
+//
+// A function is identified by its declaration, so every closure made from one
+// `fun` shares an entry. Time spent in recursive activations is only counted
+// once towards inclusive time.
+//
+// The interpreter holds a null Profiler* unless profiling was asked for, so
+// the hooks cost a pointer test when it is off.
+class Profiler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::string name;
+    int line;  // 0 for natives
+    uint64_t calls{0};
+    Clock::duration inclusive{0};
+    Clock::duration exclusive{0};
+    uint64_t allocations{0};
+    int active{0};  // activations currently on the stack
+  };
+
+  // Counts the objects allocated on `heap`.
+  explicit Profiler(const Heap& heap) : heap_{heap} {}
+
+  void enter(LoxCallable& callable);
+  void exit();
+
+  // Entries sorted by exclusive time, longest first.
+  std::vector<Entry> entries() const;
+  void report(std::ostream& out) const;
+  void writeJson(std::ostream& out) const;
+
+  // Brackets one call; does nothing without a profiler.
+  class Scope {
+   public:
+    Scope(Profiler* profiler, LoxCallable& callable)
+        : profiler_{profiler} {
+      if (profiler_ != nullptr) profiler_->enter(callable);
+    }
+    ~Scope() {
+      if (profiler_ != nullptr) profiler_->exit();
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    Profiler* const profiler_;
+  };
+
+ private:
+  struct Frame {
+    size_t entry;
+    Clock::time_point start;
+    uint64_t allocationsAtStart;
+    Clock::duration childTime{0};
+    uint64_t childAllocations{0};
+  };
+
+  const Heap& heap_;
+  std::vector<Entry> entries_;
+  std::unordered_map<const void*, size_t> index_;
+  std::vector<Frame> stack_;
+};
@@ -0,0 +1,66 @@
+#include "profiler.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "interpreter.h"
+
+// Defined in heap_test.cc.
+std::string run(Interpreter& interpreter, std::string_view source);
+
+TEST(ProfilerTests, CountsCallsPerDeclaration) {
+  Interpreter interpreter;
+  Profiler profiler{interpreter.heap()};
+  interpreter.setProfiler(&profiler);
+  run(interpreter, R"(
+    fun fib(n) {
+      if (n < 2) return n;
+      return fib(n - 1) + fib(n - 2);
+    }
+    fun make() {
+      fun leaf() { return clock(); }
+      return leaf;
+    }
+    fib(10);
+    for (var i = 0; i < 3; i = i + 1) make()();
+  )");
+
+  std::vector<Profiler::Entry> entries = profiler.entries();
+  auto find = [&](const std::string& name) {
+    for (const auto& entry : entries) {
+      if (entry.name == name) return entry;
+    }
+    ADD_FAILURE() << "no entry for " << name;
+    return Profiler::Entry{};
+  };
+  EXPECT_EQ(find("<fn fib>").calls, 177);
+  EXPECT_EQ(find("<fn fib>").line, 2);
+  // Three closures, one declaration.
+  EXPECT_EQ(find("<fn leaf>").calls, 3);
+  EXPECT_EQ(find("<fn make>").calls, 3);
+  EXPECT_EQ(find("<native fn>").calls, 3);
+  // Each make() allocates the closure it returns.
+  EXPECT_EQ(find("<fn make>").allocations, 3);
+  for (const auto& entry : entries) {
+    EXPECT_LE(entry.exclusive, entry.inclusive) << entry.name;
+    EXPECT_EQ(entry.active, 0) << entry.name;
+  }
+}
+
+TEST(ProfilerTests, WritesJson) {
+  Interpreter interpreter;
+  Profiler profiler{interpreter.heap()};
+  interpreter.setProfiler(&profiler);
+  run(interpreter, "fun f() {} f(); f();");
+
+  std::ostringstream json;
+  profiler.writeJson(json);
+  EXPECT_NE(json.str().find("{\"name\": \"<fn f>\", \"line\": 1, "
+                            "\"calls\": 2, \"inclusive_ns\": "),
+            std::string::npos)
+      << json.str();
+}
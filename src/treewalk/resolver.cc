@@ -0,0 +1,272 @@
+#include "resolver.h"
+
+#include "../utils/error.h"
+
+namespace {
+
+const Symbol kThis = symbols().intern("this");
+const Symbol kSuper = symbols().intern("super");
+const Symbol kInit = symbols().intern("init");
+
+// Whether running `statements` can create a closure, which would keep the
+// environment they run in alive. Lox has no function expressions, so only
+// declarations need looking for.
+bool declaresClosure(const std::vector<StmtPtr>& statements);
+
+bool declaresClosure(const Stmt* stmt) {
+  if (stmt == nullptr) return false;
+  switch (stmt->kind) {
+    case StmtKind::Class:
+    case StmtKind::Function:
+      return true;
+    case StmtKind::Block:
+      return declaresClosure(static_cast<const Block&>(*stmt).statements);
+    case StmtKind::If: {
+      const auto& ifStmt = static_cast<const If&>(*stmt);
+      return declaresClosure(ifStmt.thenBranch.get()) ||
+             declaresClosure(ifStmt.elseBranch.get());
+    }
+    case StmtKind::While:
+      return declaresClosure(static_cast<const While&>(*stmt).body.get());
+    default:
+      return false;
+  }
+}
+
+bool declaresClosure(const std::vector<StmtPtr>& statements) {
+  for (const auto& statement : statements) {
+    if (declaresClosure(statement.get())) return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+void Resolver::resolve(const std::vector<StmtPtr>& statements) {
+  for (const auto& statement : statements) {
+    resolve(statement);
+  }
+}
+
+void Resolver::resolve(const StmtPtr& stmt) { visitStmt(*stmt); }
+
+void Resolver::resolve(const ExprPtr& expr) { visitExpr(*expr); }
+
+void Resolver::resolveFunction(const Function& function, FunctionType type) {
+  FunctionType enclosingFunction = currentFunction_;
+  currentFunction_ = type;
+  // Parameters and body share one environment at runtime, see
+  // LoxFunction::call.
+  beginScope();
+  for (const Token& param : function.params) {
+    declare(param);
+    define(param);
+  }
+  resolve(function.body);
+  endScope();
+  currentFunction_ = enclosingFunction;
+}
+
+void Resolver::resolveLocal(Symbol name, int& depth, int& slot) {
+  // Flat scopes are no environment to hop.
+  int hops = 0;
+  for (int i = static_cast<int>(scopes_.size()) - 1; i >= 0; --i) {
+    auto elem = scopes_[i].bindings.find(name);
+    if (elem != scopes_[i].bindings.end()) {
+      depth = hops;
+      slot = elem->second.slot;
+      return;
+    }
+    if (!scopes_[i].flat) ++hops;
+  }
+}
+
+void Resolver::beginScope() { scopes_.push_back(Scope{{}, 0, false}); }
+
+void Resolver::beginFlatScope() {
+  scopes_.push_back(Scope{{}, scopes_.back().slots, true});
+}
+
+void Resolver::beginScope(Symbol name) {
+  scopes_.push_back(Scope{{{name, Binding{0, true}}}, 1, false});
+}
+
+void Resolver::endScope() { scopes_.pop_back(); }
+
+void Resolver::error(const Token& token, const std::string& msg) {
+  hadError_ = true;
+  ::error(token, msg);
+}
+
+void Resolver::declare(const Token& name) {
+  if (scopes_.empty()) return;
+  Scope& scope = scopes_.back();
+  if (scope.bindings.find(name.symbol_) != scope.bindings.end()) {
+    error(name, "Already a variable with this name in this scope!");
+    return;
+  }
+  scope.bindings.emplace(name.symbol_, Binding{scope.slots++, false});
+}
+
+void Resolver::define(const Token& name) {
+  if (scopes_.empty()) return;
+  auto& bindings = scopes_.back().bindings;
+  auto elem = bindings.find(name.symbol_);
+  if (elem != bindings.end()) elem->second.defined = true;
+}
+
+void Resolver::visitAssignExpr(Assign& expr) {
+  resolve(expr.value);
+  resolveLocal(expr.name.symbol_, expr.depth, expr.slot);
+}
+
+void Resolver::visitBinaryExpr(Binary& expr) {
+  resolve(expr.left);
+  resolve(expr.right);
+}
+
+void Resolver::visitCallExpr(Call& expr) {
+  resolve(expr.callee);
+  for (const auto& argument : expr.arguments) {
+    resolve(argument);
+  }
+}
+
+void Resolver::visitGetExpr(Get& expr) { resolve(expr.object); }
+
+void Resolver::visitSetExpr(Set& expr) {
+  resolve(expr.value);
+  resolve(expr.object);
+}
+
+void Resolver::visitSuperExpr(Super& expr) {
+  if (currentClass_ == ClassType::NONE) {
+    error(expr.keyword, "Can't use 'super' outside of a class!");
+  } else if (currentClass_ != ClassType::SUBCLASS) {
+    error(expr.keyword, "Can't use 'super' in a class with no superclass!");
+  }
+  resolveLocal(kSuper, expr.depth, expr.slot);
+}
+
+void Resolver::visitThisExpr(This& expr) {
+  if (currentClass_ == ClassType::NONE) {
+    error(expr.keyword, "Can't use 'this' outside of a class!");
+    return;
+  }
+  resolveLocal(kThis, expr.depth, expr.slot);
+}
+
+void Resolver::visitGroupingExpr(Grouping& expr) {
+  resolve(expr.expression);
+}
+
+void Resolver::visitLiteralExpr(Literal& expr) {}
+
+void Resolver::visitLogicalExpr(Logical& expr) {
+  resolve(expr.left);
+  resolve(expr.right);
+}
+
+void Resolver::visitUnaryExpr(Unary& expr) {
+  resolve(expr.right);
+}
+
+void Resolver::visitVariableExpr(Variable& expr) {
+  if (!scopes_.empty()) {
+    auto& bindings = scopes_.back().bindings;
+    auto elem = bindings.find(expr.name.symbol_);
+    if (elem != bindings.end() && !elem->second.defined) {
+      error(expr.name, "Can't read local variable in its own initializer!");
+    }
+  }
+  resolveLocal(expr.name.symbol_, expr.depth, expr.slot);
+}
+
+void Resolver::visitBlockStmt(Block& stmt) {
+  stmt.flat = !scopes_.empty() && !declaresClosure(stmt.statements);
+  if (stmt.flat) {
+    beginFlatScope();
+  } else {
+    beginScope();
+  }
+  resolve(stmt.statements);
+  endScope();
+}
+
+// Matches the environments of Interpreter::visitClassStmt and
+// LoxFunction::bind: methods close over a scope holding `super` (subclasses
+// only), and each call runs inside a scope holding `this`.
+void Resolver::visitClassStmt(Class& stmt) {
+  ClassType enclosingClass = currentClass_;
+  currentClass_ = ClassType::CLASS;
+  declare(stmt.name);
+  define(stmt.name);
+
+  if (stmt.superclass != nullptr) {
+    if (stmt.superclass->name.symbol_ == stmt.name.symbol_) {
+      error(stmt.superclass->name, "A class can't inherit from itself!");
+    }
+    currentClass_ = ClassType::SUBCLASS;
+    visitVariableExpr(*stmt.superclass);
+    beginScope(kSuper);
+  }
+  beginScope(kThis);
+  for (const auto& method : stmt.methods) {
+    resolveFunction(*method, method->name.symbol_ == kInit
+                                 ? FunctionType::INITIALIZER
+                                 : FunctionType::METHOD);
+  }
+  endScope();
+  if (stmt.superclass != nullptr) endScope();
+  currentClass_ = enclosingClass;
+}
+
+void Resolver::visitExpressionStmt(Expression& stmt) {
+  resolve(stmt.expression);
+}
+
+void Resolver::visitFunctionStmt(Function& stmt) {
+  declare(stmt.name);
+  define(stmt.name);
+  resolveFunction(stmt, FunctionType::FUNCTION);
+}
+
+void Resolver::visitIfStmt(If& stmt) {
+  resolve(stmt.condition);
+  resolve(stmt.thenBranch);
+  if (stmt.elseBranch != nullptr) resolve(stmt.elseBranch);
+}
+
+// Each module is resolved on its own; the globals it shares with the
+// importing program are looked up by name.
+void Resolver::visitImportStmt(Import& stmt) {}
+
+void Resolver::visitPrintStmt(Print& stmt) {
+  resolve(stmt.expression);
+}
+
+void Resolver::visitReturnStmt(Return& stmt) {
+  if (currentFunction_ == FunctionType::NONE) {
+    error(stmt.keyword, "Can't return from top-level code!");
+  }
+  if (stmt.value != nullptr) {
+    if (currentFunction_ == FunctionType::INITIALIZER) {
+      error(stmt.keyword, "Can't return a value from an initializer!");
+    }
+    resolve(stmt.value);
+    stmt.tailCall = stmt.value->kind == ExprKind::Call &&
+                    (currentFunction_ == FunctionType::FUNCTION ||
+                     currentFunction_ == FunctionType::METHOD);
+  }
+}
+
+void Resolver::visitVarStmt(Var& stmt) {
+  declare(stmt.name);
+  if (stmt.initializer != nullptr) resolve(stmt.initializer);
+  define(stmt.name);
+}
+
+void Resolver::visitWhileStmt(While& stmt) {
+  resolve(stmt.condition);
+  resolve(stmt.body);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../token/symbol.h"
+#include "expr.h"
+#include "stmt.h"
+
+// Static pass run between Parser::parse() and Interpreter::interpret(). It
+// annotates every Variable and Assign with the number of environments to hop
+// (`depth`) and the index of the variable inside that environment (`slot`).
+// Names that are not found in any enclosing scope are left at depth -1 and
+// looked up among the globals at runtime. A `return` of a call in a function
+// or method is marked as a tail call, whose callee can take over the frame
+// of the function returning.
+//
+// It also marks the blocks whose environment could never escape as `flat`:
+// with no function or class declared anywhere inside, nothing can capture
+// their locals, so they are kept in the environment around the block, after
+// its own slots, and dropped again at the end of it. Only blocks nested in a
+// function or another block qualify, since top-level locals would otherwise
+// land among the globals.
+class Resolver : public ExprVisitor<Resolver, void>,
+                 public StmtVisitor<Resolver, void> {
+ public:
+  void resolve(const std::vector<StmtPtr>& statements);
+  // Whether resolve() reported an error.
+  bool hadError() const { return hadError_; }
+
+  void visitAssignExpr(Assign& expr);
+  void visitBinaryExpr(Binary& expr);
+  void visitCallExpr(Call& expr);
+  void visitGetExpr(Get& expr);
+  void visitSetExpr(Set& expr);
+  void visitSuperExpr(Super& expr);
+  void visitThisExpr(This& expr);
+  void visitGroupingExpr(Grouping& expr);
+  void visitLiteralExpr(Literal& expr);
+  void visitLogicalExpr(Logical& expr);
+  void visitUnaryExpr(Unary& expr);
+  void visitVariableExpr(Variable& expr);
+
+  void visitBlockStmt(Block& stmt);
+  void visitClassStmt(Class& stmt);
+  void visitExpressionStmt(Expression& stmt);
+  void visitFunctionStmt(Function& stmt);
+  void visitIfStmt(If& stmt);
+  void visitImportStmt(Import& stmt);
+  void visitPrintStmt(Print& stmt);
+  void visitReturnStmt(Return& stmt);
+  void visitVarStmt(Var& stmt);
+  void visitWhileStmt(While& stmt);
+
+ private:
+  enum class FunctionType { NONE, FUNCTION, INITIALIZER, METHOD };
+  enum class ClassType { NONE, CLASS, SUBCLASS };
+
+  struct Binding {
+    int slot;
+    bool defined;
+  };
+  struct Scope {
+    std::unordered_map<Symbol, Binding> bindings;
+    // The next free slot of the environment this scope's locals live in.
+    int slots;
+    // Shares the environment of the enclosing scope.
+    bool flat;
+  };
+
+  void resolve(const StmtPtr& stmt);
+  void resolve(const ExprPtr& expr);
+  void resolveFunction(const Function& function, FunctionType type);
+  void resolveLocal(Symbol name, int& depth, int& slot);
+  void beginScope();
+  // Opens a scope for a flat block, see visitBlockStmt.
+  void beginFlatScope();
+  void endScope();
+  void declare(const Token& name);
+  void define(const Token& name);
+  // Opens a scope holding only `name`, at slot 0.
+  void beginScope(Symbol name);
+  void error(const Token& token, const std::string& msg);
+
+  // Slots are handed out in declaration order, which is also the order the
+  // interpreter appends them to the runtime Environment.
+  std::vector<Scope> scopes_;
+  FunctionType currentFunction_{FunctionType::NONE};
+  ClassType currentClass_{ClassType::NONE};
+  bool hadError_{false};
+};
@@ -0,0 +1,82 @@
+#include "resolver.h"
+
+#include <gtest/gtest.h>
+
+#include <string_view>
+#include <vector>
+
+#include "parser.h"
+
+namespace {
+
+std::vector<StmtPtr> resolve(std::string_view source) {
+  std::vector<StmtPtr> statements = Parser{source}.parse();
+  Resolver{}.resolve(statements);
+  return statements;
+}
+
+template <class T>
+T& as(const StmtPtr& stmt) {
+  return static_cast<T&>(*stmt);
+}
+
+}  // namespace
+
+TEST(ResolverTests, FlattensBlocksNothingCanCapture) {
+  std::vector<StmtPtr> program = resolve(R"(
+    { var top = 1; { var nested = top; } }
+    fun f(a) {
+      { var b = a; { var c = b; print c; } }
+      { fun g() {} }
+      { if (a) { class C {} } }
+      { var d = a; print d; }
+    }
+  )");
+  auto& top = as<Block>(program[0]);
+  // Its locals would become globals.
+  EXPECT_FALSE(top.flat);
+  EXPECT_TRUE(as<Block>(top.statements[1]).flat);
+
+  auto& body = as<Function>(program[1]).body;
+  auto& outer = as<Block>(body[0]);
+  auto& inner = as<Block>(outer.statements[1]);
+  EXPECT_TRUE(outer.flat);
+  EXPECT_TRUE(inner.flat);
+  EXPECT_FALSE(as<Block>(body[1]).flat);
+  EXPECT_FALSE(as<Block>(body[2]).flat);
+  EXPECT_TRUE(as<Block>(body[3]).flat);
+
+  // Flat blocks append to the function's slots without adding a hop, and
+  // a sibling reuses the slots of the one before it.
+  auto& c = as<Var>(inner.statements[0]);
+  auto& b = static_cast<Variable&>(*c.initializer);
+  EXPECT_EQ(b.depth, 0);
+  EXPECT_EQ(b.slot, 1);
+  auto& print = as<Print>(inner.statements[1]);
+  EXPECT_EQ(static_cast<Variable&>(*print.expression).slot, 2);
+  auto& d = as<Var>(as<Block>(body[3]).statements[0]);
+  auto& a = static_cast<Variable&>(*d.initializer);
+  EXPECT_EQ(a.depth, 0);
+  EXPECT_EQ(a.slot, 0);
+  auto& printD = as<Print>(as<Block>(body[3]).statements[1]);
+  EXPECT_EQ(static_cast<Variable&>(*printD.expression).slot, 1);
+}
+
+TEST(ResolverTests, MarksCallsInTailPosition) {
+  std::vector<StmtPtr> program = resolve(R"(
+    fun f(n) {
+      if (n) return f(n - 1);
+      return 1 + f(n);
+    }
+    class A {
+      init() { return; }
+      m() { return this.m(); }
+    }
+  )");
+  auto& body = as<Function>(program[0]).body;
+  EXPECT_TRUE(as<Return>(as<If>(body[0]).thenBranch).tailCall);
+  EXPECT_FALSE(as<Return>(body[1]).tailCall);
+  auto& methods = as<Class>(program[1]).methods;
+  EXPECT_FALSE(as<Return>(methods[0]->body[0]).tailCall);
+  EXPECT_TRUE(as<Return>(methods[1]->body[0]).tailCall);
+}
@@ -1,11 +1,16 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
+#include <string>
 
 #include "../token/token.h"
+#include "../utils/error.h"
 
-inline bool hadRuntimeError = false;
+// Set by actors on any thread (see Actors), read once they have all stopped.
+inline std::atomic<bool> hadRuntimeError{false};
 
 class RuntimeError : public std::runtime_error {
  public:
@@ -14,7 +19,21 @@ class RuntimeError : public std::runtime_error {
       : std::runtime_error{msg.data()}, token_{token} {}
 };
 
+// Thrown by natives, which have no token to blame; the interpreter reports it
+// as a RuntimeError at the call.
+class NativeError : public std::runtime_error {
+ public:
+  explicit NativeError(const std::string& msg) : std::runtime_error{msg} {}
+};
+
 inline void runtimeError(const RuntimeError& error) {
+  if (errorHandler != nullptr) {
+    (*errorHandler)(error.token_.line_, "", error.what());
+    return;
+  }
+  // Keeps the reports of actors failing together from interleaving.
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock{mutex};
   std::cerr << error.what() << "\n[line " << error.token_.line_ << "]\n";
   hadRuntimeError = true;
 }
@@ -0,0 +1,32 @@
+#include "shape.h"
+
+#include <atomic>
+
+namespace {
+
+std::atomic<uint32_t> nextShapeId{0};
+
+}  // namespace
+
+Shape::Shape() : id_{nextShapeId++} {}
+
+Shape::Shape(const Shape& parent, Symbol name)
+    : id_{nextShapeId++}, fields_{parent.fields_} {
+  fields_.push_back(name);
+}
+
+int Shape::indexOf(Symbol name) const {
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    if (fields_[i] == name) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+Shape* Shape::withField(Symbol name) {
+  for (const auto& [field, child] : transitions_) {
+    if (field == name) return child.get();
+  }
+  transitions_.emplace_back(name,
+                            std::unique_ptr<Shape>{new Shape{*this, name}});
+  return transitions_.back().second.get();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>  // std::pair
+#include <vector>
+
+#include "../token/symbol.h"
+
+// A hidden class: the ordered list of field names an instance has. Instances
+// with the same fields, added in the same order, share one Shape, so a field
+// lives at the same index of every such instance's dense field vector.
+//
+// Every class owns the empty root shape of its instances. Adding a field
+// follows (or creates) a transition to a child shape, which the parent owns.
+class Shape {
+ public:
+  Shape();
+  Shape(const Shape&) = delete;
+  Shape& operator=(const Shape&) = delete;
+
+  // Never reused, even after the shape is freed, so caches can key on it
+  // without keeping the shape alive.
+  uint32_t id() const { return id_; }
+  size_t size() const { return fields_.size(); }
+  // The field names, in the order instances store them.
+  const std::vector<Symbol>& fields() const { return fields_; }
+
+  // Index of `name` in instances of this shape, or -1.
+  int indexOf(Symbol name) const;
+  // The shape of an instance of this shape after `name` is added.
+  Shape* withField(Symbol name);
+
+ private:
+  Shape(const Shape& parent, Symbol name);
+
+  uint32_t id_;
+  std::vector<Symbol> fields_;
+  std::vector<std::pair<Symbol, std::unique_ptr<Shape>>> transitions_;
+};
+
+// A polymorphic inline cache for one property access site, keyed on the
+// receiver's shape. A hit turns the lookup into an index load (fields) or a
+// pointer load (methods). After kEntries shapes have been seen at a site the
+// oldest entry is replaced.
+template <class Method>
+struct InlineCache {
+  struct Entry {
+    uint32_t shape;
+    int slot;           // field index, -1 when the name is a method
+    Method* method;     // the method, for reads that hit one
+    Shape* transition;  // for writes that add a field: the new shape
+  };
+  static constexpr int kEntries = 4;
+
+  const Entry* find(uint32_t shape) const {
+    for (int i = 0; i < count; ++i) {
+      if (entries[i].shape == shape) return &entries[i];
+    }
+    return nullptr;
+  }
+  void add(const Entry& entry) {
+    if (count < kEntries) {
+      entries[count++] = entry;
+    } else {
+      entries[next] = entry;
+      next = (next + 1) % kEntries;
+    }
+  }
+
+  Entry entries[kEntries];
+  int count{0};
+  int next{0};
+};
+
+// The tree-walker caches LoxFunctions in its Get/Set/Super nodes.
+class LoxFunction;
+using PropertyCache = InlineCache<LoxFunction>;
@@ -0,0 +1,59 @@
+#include "shape.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <string_view>
+
+#include "../token/symbol.h"
+#include "interpreter.h"
+
+// Defined in heap_test.cc.
+std::string run(Interpreter& interpreter, std::string_view source);
+
+TEST(ShapeTests, SharesTransitions) {
+  Symbol x = symbols().intern("x");
+  Symbol y = symbols().intern("y");
+  Shape root;
+  Shape* xy = root.withField(x)->withField(y);
+  Shape* yx = root.withField(y)->withField(x);
+
+  EXPECT_EQ(root.withField(x)->withField(y), xy);
+  EXPECT_NE(xy, yx);
+  EXPECT_NE(xy->id(), yx->id());
+  EXPECT_EQ(xy->size(), 2);
+  EXPECT_EQ(xy->indexOf(x), 0);
+  EXPECT_EQ(yx->indexOf(x), 1);
+  EXPECT_EQ(root.indexOf(x), -1);
+}
+
+TEST(ShapeTests, InlineCacheReplacesOldestEntry) {
+  InlineCache<int> cache;
+  for (uint32_t shape = 0; shape < InlineCache<int>::kEntries; ++shape) {
+    cache.add({shape, static_cast<int>(shape), nullptr, nullptr});
+  }
+  ASSERT_NE(cache.find(0), nullptr);
+  EXPECT_EQ(cache.find(2)->slot, 2);
+
+  cache.add({100, 7, nullptr, nullptr});
+  EXPECT_EQ(cache.find(0), nullptr);
+  EXPECT_EQ(cache.find(100)->slot, 7);
+  EXPECT_NE(cache.find(1), nullptr);
+}
+
+TEST(ShapeTests, PolymorphicPropertySites) {
+  Interpreter interpreter;
+  // `o.x` sees three shapes; `o.m()` finds a field shadowing the method.
+  EXPECT_EQ(run(interpreter,
+                "class A {\n"
+                "  init() { this.x = 1; }\n"
+                "  m() { return \"method\"; }\n"
+                "}\n"
+                "class B { init() { this.y = 0; this.x = 2; } }\n"
+                "fun f() { return \"field\"; }\n"
+                "var c = A(); c.z = 0;\n"
+                "fun show(o) { print o.x; }\n"
+                "show(A()); show(B()); show(c); show(A());\n"
+                "var d = A(); print d.m(); d.m = f; print d.m();\n"),
+            "1.000000\n2.000000\n1.000000\n1.000000\nmethod\nfield\n");
+}
@@ -1,133 +1,177 @@
 #pragma once
 
-#include <any>
 #include <memory>
 #include <utility>  // std::move
 #include <vector>
 
 #include "../token/token.h"
+#include "expr.h"
 
 struct Block;
+struct Class;
 struct Expression;
 struct Function;
 struct If;
+struct Import;
 struct Print;
 struct Return;
 struct Var;
 struct While;
 
-struct StmtVisitor {
-  virtual std::any visitBlockStmt(std::shared_ptr<Block> stmt) = 0;
-  virtual std::any visitExpressionStmt(std::shared_ptr<Expression> stmt) = 0;
-  virtual std::any visitFunctionStmt(std::shared_ptr<Function> stmt) = 0;
-  virtual std::any visitIfStmt(std::shared_ptr<If> stmt) = 0;
-  virtual std::any visitPrintStmt(std::shared_ptr<Print> stmt) = 0;
-  virtual std::any visitReturnStmt(std::shared_ptr<Return> stmt) = 0;
-  virtual std::any visitVarStmt(std::shared_ptr<Var> stmt) = 0;
-  virtual std::any visitWhileStmt(std::shared_ptr<While> stmt) = 0;
-  virtual ~StmtVisitor() = default;
+enum class StmtKind {
+  Block,
+  Class,
+  Expression,
+  Function,
+  If,
+  Import,
+  Print,
+  Return,
+  Var,
+  While,
 };
 
 struct Stmt {
-  virtual std::any accept(StmtVisitor& visitor) = 0;
+  explicit Stmt(StmtKind kind) : kind{kind} {}
+  virtual ~Stmt() = default;
+
+  const StmtKind kind;
 };
 
-struct Block : Stmt, public std::enable_shared_from_this<Block> {
-  Block(std::vector<std::shared_ptr<Stmt>> statements)
-      : statements{std::move(statements)} {}
+using StmtPtr = std::unique_ptr<Stmt>;
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitBlockStmt(shared_from_this());
-  }
+struct Block : Stmt {
+  Block(std::vector<StmtPtr> statements)
+      : Stmt{StmtKind::Block}, statements{std::move(statements)} {}
+
+  std::vector<StmtPtr> statements;
 
-  const std::vector<std::shared_ptr<Stmt>> statements;
+  bool flat{false};
 };
 
-struct Expression : Stmt, public std::enable_shared_from_this<Expression> {
-  Expression(std::shared_ptr<Expr> expression)
-      : expression{std::move(expression)} {}
+struct Class : Stmt {
+  Class(Token name, std::unique_ptr<Variable> superclass,
+        std::vector<std::unique_ptr<Function>> methods)
+      : Stmt{StmtKind::Class},
+        name{std::move(name)},
+        superclass{std::move(superclass)},
+        methods{std::move(methods)} {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitExpressionStmt(shared_from_this());
-  }
+  const Token name;
+  std::unique_ptr<Variable> superclass;
+  std::vector<std::unique_ptr<Function>> methods;
+};
 
-  const std::shared_ptr<Expr> expression;
+struct Expression : Stmt {
+  Expression(ExprPtr expression)
+      : Stmt{StmtKind::Expression}, expression{std::move(expression)} {}
+
+  ExprPtr expression;
 };
 
-struct Function : Stmt, public std::enable_shared_from_this<Function> {
-  Function(Token name, std::vector<Token> params,
-           std::vector<std::shared_ptr<Stmt>> body)
-      : name{std::move(name)},
+struct Function : Stmt {
+  Function(Token name, std::vector<Token> params, std::vector<StmtPtr> body)
+      : Stmt{StmtKind::Function},
+        name{std::move(name)},
         params{std::move(params)},
         body{std::move(body)} {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitFunctionStmt(shared_from_this());
-  }
-
   const Token name;
   const std::vector<Token> params;
-  const std::vector<std::shared_ptr<Stmt>> body;
+  std::vector<StmtPtr> body;
 };
 
-struct If : Stmt, public std::enable_shared_from_this<If> {
-  If(std::shared_ptr<Expr> condition, std::shared_ptr<Stmt> thenBranch,
-     std::shared_ptr<Stmt> elseBranch)
-      : condition{std::move(condition)},
+struct If : Stmt {
+  If(ExprPtr condition, StmtPtr thenBranch, StmtPtr elseBranch)
+      : Stmt{StmtKind::If},
+        condition{std::move(condition)},
         thenBranch{std::move(thenBranch)},
         elseBranch{std::move(elseBranch)} {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitIfStmt(shared_from_this());
-  }
-
-  const std::shared_ptr<Expr> condition;
-  const std::shared_ptr<Stmt> thenBranch;
-  const std::shared_ptr<Stmt> elseBranch;
+  ExprPtr condition;
+  StmtPtr thenBranch;
+  StmtPtr elseBranch;
 };
 
-struct Print : Stmt, public std::enable_shared_from_this<Print> {
-  Print(std::shared_ptr<Expr> expression) : expression{std::move(expression)} {}
+struct Import : Stmt {
+  Import(Token keyword, Token path)
+      : Stmt{StmtKind::Import},
+        keyword{std::move(keyword)},
+        path{std::move(path)} {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitPrintStmt(shared_from_this());
-  }
+  const Token keyword;
+  const Token path;
 
-  const std::shared_ptr<Expr> expression;
+  const std::vector<StmtPtr>* program{nullptr};
 };
 
-struct Return : Stmt, public std::enable_shared_from_this<Return> {
-  Return(Token keyword, std::shared_ptr<Expr> value)
-      : keyword{std::move(keyword)}, value{std::move(value)} {}
+struct Print : Stmt {
+  Print(ExprPtr expression)
+      : Stmt{StmtKind::Print}, expression{std::move(expression)} {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitReturnStmt(shared_from_this());
-  }
+  ExprPtr expression;
+};
+
+struct Return : Stmt {
+  Return(Token keyword, ExprPtr value)
+      : Stmt{StmtKind::Return},
+        keyword{std::move(keyword)},
+        value{std::move(value)} {}
 
   const Token keyword;
-  const std::shared_ptr<Expr> value;
-};
+  ExprPtr value;
 
-struct Var : Stmt, public std::enable_shared_from_this<Var> {
-  Var(Token name, std::shared_ptr<Expr> initializer)
-      : name{std::move(name)}, initializer{std::move(initializer)} {}
+  bool tailCall{false};
+};
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitVarStmt(shared_from_this());
-  }
+struct Var : Stmt {
+  Var(Token name, ExprPtr initializer)
+      : Stmt{StmtKind::Var},
+        name{std::move(name)},
+        initializer{std::move(initializer)} {}
 
   const Token name;
-  const std::shared_ptr<Expr> initializer;
+  ExprPtr initializer;
 };
 
-struct While : Stmt, public std::enable_shared_from_this<While> {
-  While(std::shared_ptr<Expr> condition, std::shared_ptr<Stmt> body)
-      : condition{std::move(condition)}, body{std::move(body)} {}
+struct While : Stmt {
+  While(ExprPtr condition, StmtPtr body)
+      : Stmt{StmtKind::While},
+        condition{std::move(condition)},
+        body{std::move(body)} {}
 
-  std::any accept(StmtVisitor& visitor) override {
-    return visitor.visitWhileStmt(shared_from_this());
-  }
+  ExprPtr condition;
+  StmtPtr body;
+};
 
-  const std::shared_ptr<Expr> condition;
-  const std::shared_ptr<Stmt> body;
+// A visitor derives from StmtVisitor<Self, R> and implements
+// R visit<Kind>Stmt(<Kind>&) for every node kind.
+template <class Visitor, class R>
+struct StmtVisitor {
+  R visitStmt(Stmt& stmt) {
+    auto& visitor = static_cast<Visitor&>(*this);
+    switch (stmt.kind) {
+      case StmtKind::Block:
+        return visitor.visitBlockStmt(static_cast<Block&>(stmt));
+      case StmtKind::Class:
+        return visitor.visitClassStmt(static_cast<Class&>(stmt));
+      case StmtKind::Expression:
+        return visitor.visitExpressionStmt(static_cast<Expression&>(stmt));
+      case StmtKind::Function:
+        return visitor.visitFunctionStmt(static_cast<Function&>(stmt));
+      case StmtKind::If:
+        return visitor.visitIfStmt(static_cast<If&>(stmt));
+      case StmtKind::Import:
+        return visitor.visitImportStmt(static_cast<Import&>(stmt));
+      case StmtKind::Print:
+        return visitor.visitPrintStmt(static_cast<Print&>(stmt));
+      case StmtKind::Return:
+        return visitor.visitReturnStmt(static_cast<Return&>(stmt));
+      case StmtKind::Var:
+        return visitor.visitVarStmt(static_cast<Var&>(stmt));
+      case StmtKind::While:
+        return visitor.visitWhileStmt(static_cast<While&>(stmt));
+    }
+    return R();
+  }
 };
@@ -0,0 +1,13 @@
+#include "value.h"
+
+#include "LoxCallable.h"
+
+LoxCallable* Value::asCallable() const {
+  return static_cast<LoxCallable*>(asObject());
+}
+
+bool Value::operator==(const Value& other) const {
+  if (isNumber() && other.isNumber()) return asNumber() == other.asNumber();
+  if (isString() && other.isString()) return asString() == other.asString();
+  return bits_ == other.bits_;
+}
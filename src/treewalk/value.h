@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>  // std::swap
+
+#include "LoxObject.h"
+
+class LoxCallable;
+class LoxInstance;
+
+// An 8-byte NaN-boxed runtime value. Numbers are stored as plain doubles;
+// nil, booleans and object pointers live in the payload of a quiet NaN, so
+// every type test is a mask and compare instead of an RTTI lookup.
+class Value {
+ public:
+  Value() : bits_{kNil} {}
+  Value(std::nullptr_t) : bits_{kNil} {}
+  Value(bool boolean) : bits_{boolean ? kTrue : kFalse} {}
+  Value(double number) { std::memcpy(&bits_, &number, sizeof(double)); }
+  template <class T>
+  Value(T* object)
+      : bits_{kSignBit | kQNaN | reinterpret_cast<uintptr_t>(object)} {
+    static_assert(std::is_base_of_v<LoxObject, T>,
+                  "only LoxObjects can be stored in a Value");
+    object->retain();
+  }
+
+  Value(const Value& other) : bits_{other.bits_} { retain(); }
+  Value(Value&& other) noexcept : bits_{other.bits_} { other.bits_ = kNil; }
+  Value& operator=(const Value& other) {
+    if (this != &other) {
+      Value copy{other};
+      std::swap(bits_, copy.bits_);
+    }
+    return *this;
+  }
+  Value& operator=(Value&& other) noexcept {
+    std::swap(bits_, other.bits_);
+    return *this;
+  }
+  ~Value() { release(); }
+
+  bool isNil() const { return bits_ == kNil; }
+  bool isBool() const { return (bits_ | 1) == kTrue; }
+  bool isNumber() const { return (bits_ & kQNaN) != kQNaN; }
+  bool isObject() const {
+    return (bits_ & (kQNaN | kSignBit)) == (kQNaN | kSignBit);
+  }
+  bool isString() const {
+    return isObject() && asObject()->type == ObjectType::STRING;
+  }
+  bool isCallable() const {
+    return isObject() && asObject()->type == ObjectType::CALLABLE;
+  }
+  bool isInstance() const {
+    return isObject() && asObject()->type == ObjectType::INSTANCE;
+  }
+
+  bool asBool() const { return bits_ == kTrue; }
+  double asNumber() const {
+    double number;
+    std::memcpy(&number, &bits_, sizeof(double));
+    return number;
+  }
+  LoxObject* asObject() const {
+    return reinterpret_cast<LoxObject*>(
+        static_cast<uintptr_t>(bits_ & ~(kSignBit | kQNaN)));
+  }
+  const std::string& asString() const {
+    return static_cast<LoxString*>(asObject())->value;
+  }
+  LoxCallable* asCallable() const;
+  LoxInstance* asInstance() const;
+
+  bool isTruthy() const {
+    if (isNil()) return false;
+    if (isBool()) return asBool();
+    return true;
+  }
+
+  bool operator==(const Value& other) const;
+  bool operator!=(const Value& other) const { return !(*this == other); }
+
+  // The raw encoding, for compiled code. takeBits() hands this Value's
+  // reference to the caller, which fromBits() takes back over.
+  uint64_t takeBits() {
+    uint64_t bits = bits_;
+    bits_ = kNil;
+    return bits;
+  }
+  static Value fromBits(uint64_t bits) {
+    Value value;
+    value.bits_ = bits;
+    return value;
+  }
+
+ private:
+  static constexpr uint64_t kSignBit = 0x8000000000000000;
+  static constexpr uint64_t kQNaN = 0x7ffc000000000000;
+  static constexpr uint64_t kNil = kQNaN | 1;
+  static constexpr uint64_t kFalse = kQNaN | 2;
+  static constexpr uint64_t kTrue = kQNaN | 3;
+
+  void retain() {
+    if (isObject()) asObject()->retain();
+  }
+  void release() {
+    if (isObject()) asObject()->release();
+  }
+
+  uint64_t bits_;
+};
+
+static_assert(sizeof(Value) == 8, "Value must stay NaN-boxed");
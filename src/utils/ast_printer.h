@@ -1,60 +1,182 @@
 #pragma once
 
-#include <any>
 #include <cassert>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 #include "../treewalk/expr.h"
+#include "../treewalk/stmt.h"
 
-class AstPrinter : public ExprVisitor {
+class AstPrinter : public ExprVisitor<AstPrinter, std::string>,
+                   public StmtVisitor<AstPrinter, std::string> {
  public:
-  std::string print(std::shared_ptr<Expr> expr) {
-    return std::any_cast<std::string>(expr->accept(*this));
+  std::string print(Expr& expr) { return visitExpr(expr); }
+  std::string print(Stmt& stmt) { return visitStmt(stmt); }
+
+  std::string visitAssignExpr(Assign& expr) {
+    return parenthesize("= " + std::string{expr.name.lexeme_}, expr.value);
+  }
+
+  std::string visitBinaryExpr(Binary& expr) {
+    return parenthesize(expr.op.lexeme_, expr.left, expr.right);
+  }
+
+  std::string visitCallExpr(Call& expr) {
+    std::ostringstream builder;
+
+    builder << "(call " << print(*expr.callee);
+    for (const auto& argument : expr.arguments) {
+      builder << " " << print(*argument);
+    }
+    builder << ")";
+
+    return builder.str();
   }
 
-  std::any visitBinaryExpr(std::shared_ptr<Binary> expr) override {
-    return parenthesize(expr->op.lexeme_, expr->left, expr->right);
+  std::string visitGetExpr(Get& expr) {
+    return parenthesize(". " + std::string{expr.name.lexeme_}, expr.object);
   }
 
-  std::any visitGroupingExpr(std::shared_ptr<Grouping> expr) override {
-    return parenthesize("group", expr->expression);
+  std::string visitGroupingExpr(Grouping& expr) {
+    return parenthesize("group", expr.expression);
   }
 
-  std::any visitLiteralExpr(std::shared_ptr<Literal> expr) override {
-    auto &value_type = expr->value.type();
+  std::string visitLiteralExpr(Literal& expr) {
+    const Value &value = expr.value;
 
-    if (value_type == typeid(nullptr)) {
+    if (value.isNil()) {
       return "nil";
-    } else if (value_type == typeid(std::string)) {
-      return std::any_cast<std::string>(expr->value);
-    } else if (value_type == typeid(double)) {
-      return std::to_string(std::any_cast<double>(expr->value));
-    } else if (value_type == typeid(bool)) {
-      return std::any_cast<bool>(expr->value) ? "true" : "false";
+    } else if (value.isString()) {
+      return value.asString();
+    } else if (value.isNumber()) {
+      return std::to_string(value.asNumber());
+    } else if (value.isBool()) {
+      return value.asBool() ? "true" : "false";
     }
 
     return "Error in visitLiteralExpr: literal type not recognized.";
   }
 
-  std::any visitUnaryExpr(std::shared_ptr<Unary> expr) override {
-    return parenthesize(expr->op.lexeme_, expr->right);
+  std::string visitLogicalExpr(Logical& expr) {
+    return parenthesize(expr.op.lexeme_, expr.left, expr.right);
+  }
+
+  std::string visitSetExpr(Set& expr) {
+    return parenthesize("=. " + std::string{expr.name.lexeme_}, expr.object,
+                        expr.value);
+  }
+
+  std::string visitSuperExpr(Super& expr) {
+    return "(super " + std::string{expr.method.lexeme_} + ")";
+  }
+
+  std::string visitThisExpr(This& expr) { return "this"; }
+
+  std::string visitUnaryExpr(Unary& expr) {
+    return parenthesize(expr.op.lexeme_, expr.right);
+  }
+
+  std::string visitVariableExpr(Variable& expr) {
+    return std::string{expr.name.lexeme_};
+  }
+
+  std::string visitBlockStmt(Block& stmt) {
+    return parenthesize("block", stmt.statements);
+  }
+
+  std::string visitClassStmt(Class& stmt) {
+    std::ostringstream builder;
+
+    builder << "(class " << stmt.name.lexeme_;
+    if (stmt.superclass != nullptr) {
+      builder << " < " << stmt.superclass->name.lexeme_;
+    }
+    for (const auto& method : stmt.methods) {
+      builder << " " << print(*method);
+    }
+    builder << ")";
+
+    return builder.str();
+  }
+
+  std::string visitExpressionStmt(Expression& stmt) {
+    return parenthesize(";", stmt.expression);
+  }
+
+  std::string visitFunctionStmt(Function& stmt) {
+    std::ostringstream builder;
+
+    builder << "(fun " << stmt.name.lexeme_ << " (";
+    for (const Token& param : stmt.params) {
+      if (&param != &stmt.params.front()) builder << " ";
+      builder << param.lexeme_;
+    }
+    builder << ")";
+    for (const auto& statement : stmt.body) {
+      builder << " " << print(*statement);
+    }
+    builder << ")";
+
+    return builder.str();
+  }
+
+  std::string visitIfStmt(If& stmt) {
+    std::string branches = print(*stmt.thenBranch);
+    if (stmt.elseBranch != nullptr) branches += " " + print(*stmt.elseBranch);
+    return "(if " + print(*stmt.condition) + " " + branches + ")";
+  }
+
+  std::string visitImportStmt(Import& stmt) {
+    return "(import " + std::string{stmt.path.lexeme_} + ")";
+  }
+
+  std::string visitPrintStmt(Print& stmt) {
+    return parenthesize("print", stmt.expression);
+  }
+
+  std::string visitReturnStmt(Return& stmt) {
+    if (stmt.value == nullptr) return "(return)";
+    return parenthesize("return", stmt.value);
+  }
+
+  std::string visitVarStmt(Var& stmt) {
+    std::string name = "var " + std::string{stmt.name.lexeme_};
+    if (stmt.initializer == nullptr) return "(" + name + ")";
+    return parenthesize(name, stmt.initializer);
+  }
+
+  std::string visitWhileStmt(While& stmt) {
+    return "(while " + print(*stmt.condition) + " " + print(*stmt.body) + ")";
   }
 
  private:
   template <class... E>
-  std::string parenthesize(std::string_view name, E... expr) {
-    assert((... && std::is_same_v<E, std::shared_ptr<Expr>>));
+  std::string parenthesize(std::string_view name, const E&... expr) {
+    assert((... && std::is_same_v<E, ExprPtr>));
+
+    std::ostringstream builder;
+
+    builder << "(" << name;
+    ((builder << " " << print(*expr)), ...);
+    builder << ")";
 
+    return builder.str();
+  }
+
+  std::string parenthesize(std::string_view name,
+                           const std::vector<StmtPtr>& statements) {
     std::ostringstream builder;
 
     builder << "(" << name;
-    ((builder << " " << print(expr)), ...);
+    for (const auto& statement : statements) {
+      builder << " " << print(*statement);
+    }
     builder << ")";
 
     return builder.str();
   }
-};
\ No newline at end of file
+};
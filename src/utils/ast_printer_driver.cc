@@ -1,11 +1,11 @@
 #include "ast_printer.h"
 
 int main(int argc, char* argv[]) {
-  std::shared_ptr<Expr> expression = std::make_shared<Binary>(
-      std::make_shared<Unary>(Token{MINUS, "-", nullptr, 1},
-                              std::make_shared<Literal>(123.)),
-      Token{STAR, "*", nullptr, 1},
-      std::make_shared<Grouping>(std::make_shared<Literal>(45.67)));
+  ExprPtr expression = std::make_unique<Binary>(
+      std::make_unique<Unary>(Token{MINUS, "-", 1},
+                              std::make_unique<Literal>(123.)),
+      Token{STAR, "*", 1},
+      std::make_unique<Grouping>(std::make_unique<Literal>(45.67)));
 
-  std::cout << AstPrinter{}.print(expression) << "\n";
-}
\ No newline at end of file
+  std::cout << AstPrinter{}.print(*expression) << "\n";
+}
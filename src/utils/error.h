@@ -1,13 +1,45 @@
 #pragma once
 
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <string>
 
 #include "../token/token.h"
 
 inline bool hadError = false;
+// Modules are parsed on several threads at once.
+inline std::mutex errorMutex;
 
-static void report(int line, std::string where, std::string msg) {
+// Receives the errors reported on a thread that set it with an ErrorScope,
+// instead of stderr: compile errors, and runtime errors reported through
+// runtimeError(). They then set neither hadError nor hadRuntimeError. The
+// module loader hands the handler of the thread loading a program on to its
+// workers, so it may be called from several threads at once.
+using ErrorHandler = std::function<void(int line, const std::string& where,
+                                        const std::string& msg)>;
+inline thread_local const ErrorHandler* errorHandler = nullptr;
+
+// Sends the errors reported on this thread to `handler` while it is alive.
+class ErrorScope {
+ public:
+  explicit ErrorScope(const ErrorHandler* handler) : saved_{errorHandler} {
+    errorHandler = handler;
+  }
+  ~ErrorScope() { errorHandler = saved_; }
+  ErrorScope(const ErrorScope&) = delete;
+  ErrorScope& operator=(const ErrorScope&) = delete;
+
+ private:
+  const ErrorHandler* saved_;
+};
+
+inline void report(int line, std::string where, std::string msg) {
+  if (errorHandler != nullptr) {
+    (*errorHandler)(line, where, msg);
+    return;
+  }
+  std::lock_guard<std::mutex> lock{errorMutex};
   std::cerr << "[line " << line << "] error " << where << ": " << msg << "\n";
   hadError = true;
 }
@@ -18,6 +50,6 @@ inline void error(const Token& token, std::string msg) {
   if (token.type_ == END_OF_FILE) {
     report(token.line_, "at end", msg);
   } else {
-    report(token.line_, " at '" + token.lexeme_ + "'", msg);
+    report(token.line_, " at '" + std::string{token.lexeme_} + "'", msg);
   }
 }
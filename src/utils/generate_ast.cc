@@ -3,6 +3,8 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <string_view>
 #include <vector>
 
 std::vector<std::string_view> split(std::string_view str,
@@ -43,11 +45,21 @@ std::string toLowerCase(std::string_view str) {
   return out;
 }
 
-// In C++ we cannot rely on garbage collection to clean up our pointer
-// messes for us. Instead of having to worry about calling delete
-// every time we're done with some heap memory, we can dump this job
-// onto std::shared_ptr. This function lets us use a '*' in our
-// metaprogramming to indicate that we actually want a smart pointer.
+// Two flavours of tree can be generated:
+//
+//  * The default, statically dispatched form. Children are owned through
+//    std::unique_ptr, every node records its kind, and visitors derive from
+//    a CRTP base whose visit<Base>() switches on that kind. Visiting a node
+//    is a jump table and a static_cast: no virtual calls, no refcounting and
+//    no std::any boxing of the result.
+//
+//  * With --shared, the original form: every node is a std::shared_ptr,
+//    inherits enable_shared_from_this and dispatches through a virtual
+//    accept() returning std::any.
+bool sharedNodes = false;
+
+// This function lets us use a '*' in our metaprogramming to indicate that we
+// want an owning pointer to a node.
 std::string fix_pointer(std::string_view field) {
   std::ostringstream out;
   std::string_view type = split(field, " ")[0];
@@ -62,7 +74,13 @@ std::string fix_pointer(std::string_view field) {
 
   if (type.back() == '*') {
     type.remove_suffix(1);
-    out << "std::shared_ptr<" << type << ">";
+    if (sharedNodes) {
+      out << "std::shared_ptr<" << type << ">";
+    } else if (type == "Expr" || type == "Stmt") {
+      out << type << "Ptr";
+    } else {
+      out << "std::unique_ptr<" << type << ">";
+    }
   } else {
     out << type;
   }
@@ -75,23 +93,56 @@ std::string fix_pointer(std::string_view field) {
 
 void defineVisitor(std::ofstream& writer, std::string_view baseName,
                    const std::vector<std::string_view>& types) {
-  writer << "struct " << baseName << "Visitor {\n";
+  if (sharedNodes) {
+    writer << "struct " << baseName << "Visitor {\n";
+
+    for (std::string_view type : types) {
+      std::string_view typeName = trim(split(type, ":")[0]);
+      writer << "  virtual std::any visit" << typeName << baseName
+             << "(std::shared_ptr<" << typeName << "> "
+             << toLowerCase(baseName) << ") = 0;\n";
+    }
+
+    writer << "  virtual ~" << baseName << "Visitor() = default;\n";
+    writer << "};\n";
+    return;
+  }
+
+  writer << "// A visitor derives from " << baseName
+         << "Visitor<Self, R> and implements\n"
+            "// R visit<Kind>"
+         << baseName << "(<Kind>&) for every node kind.\n"
+         << "template <class Visitor, class R>\n"
+         << "struct " << baseName << "Visitor {\n"
+         << "  R visit" << baseName << "(" << baseName << "& "
+         << toLowerCase(baseName) << ") {\n"
+         << "    auto& visitor = static_cast<Visitor&>(*this);\n"
+         << "    switch (" << toLowerCase(baseName) << ".kind) {\n";
 
   for (std::string_view type : types) {
     std::string_view typeName = trim(split(type, ":")[0]);
-    writer << "  virtual std::any visit" << typeName << baseName
-           << "(std::shared_ptr<" << typeName << "> " << toLowerCase(baseName)
-           << ") = 0;\n";
+    writer << "      case " << baseName << "Kind::" << typeName << ":\n"
+           << "        return visitor.visit" << typeName << baseName
+           << "(static_cast<" << typeName << "&>(" << toLowerCase(baseName)
+           << "));\n";
   }
 
-  writer << "  virtual ~" << baseName << "Visitor() = default;\n";
-  writer << "};\n";
+  writer << "    }\n"
+         << "    return R();\n"
+         << "  }\n"
+         << "};\n";
 }
 
 void defineType(std::ofstream& writer, std::string_view baseName,
-                std::string_view className, std::string_view fieldList) {
-  writer << "struct " << className << ": " << baseName
-         << ", public std::enable_shared_from_this<" << className << "> {\n";
+                std::string_view className, std::string_view fieldList,
+                std::string_view annotationList) {
+  if (sharedNodes) {
+    writer << "struct " << className << ": " << baseName
+           << ", public std::enable_shared_from_this<" << className
+           << "> {\n";
+  } else {
+    writer << "struct " << className << " : " << baseName << " {\n";
+  }
 
   // Constructor.
   writer << "  " << className << "(";
@@ -106,6 +157,10 @@ void defineType(std::ofstream& writer, std::string_view baseName,
   writer << ")\n"
          << "    : ";
 
+  if (!sharedNodes) {
+    writer << baseName << "{" << baseName << "Kind::" << className << "}, ";
+  }
+
   // Store parameters in fields.
   std::string_view name = split(fields[0], " ")[1];
   writer << name << "{std::move(" << name << ")}";
@@ -119,38 +174,59 @@ void defineType(std::ofstream& writer, std::string_view baseName,
          << "  {}\n";
 
   // Visitor pattern.
-  writer << "\n"
-            "  std::any accept("
-         << baseName
-         << "Visitor& visitor)"
-            " override {\n"
-            "    return visitor.visit"
-         << className << baseName
-         << "(shared_from_this());\n"
-            "  }\n";
-
-  // Fields.
+  if (sharedNodes) {
+    writer << "\n"
+              "  std::any accept("
+           << baseName
+           << "Visitor& visitor)"
+              " override {\n"
+              "    return visitor.visit"
+           << className << baseName
+           << "(shared_from_this());\n"
+              "  }\n";
+  }
+
+  // Fields. Child nodes are left mutable in the static form so that passes
+  // like the optimizer can rewrite subtrees in place.
   writer << "\n";
   for (std::string_view field : fields) {
-    writer << "  const " << fix_pointer(field) << ";\n";
+    std::string_view type = split(field, " ")[0];
+    bool child = !sharedNodes && type.find('*') != std::string_view::npos;
+    writer << "  " << (child ? "" : "const ") << fix_pointer(field) << ";\n";
+  }
+
+  // Annotations are mutable slots that later passes (e.g. the resolver)
+  // fill in. They are written as "type name = initial value".
+  if (!annotationList.empty()) {
+    writer << "\n";
+    for (std::string_view annotation : split(annotationList, ", ")) {
+      std::string_view declaration = trim(split(annotation, "=")[0]);
+      std::string_view init = trim(split(annotation, "=")[1]);
+      writer << "  " << declaration << "{" << init << "};\n";
+    }
   }
 
   writer << "};\n\n";
 }
 
 void defineAst(const std::string& outputDir, const std::string& baseName,
-               const std::vector<std::string_view>& types) {
-  std::string path = outputDir + "/" + baseName + ".h";
+               const std::vector<std::string_view>& types,
+               const std::vector<std::string_view>& includes) {
+  std::string path = outputDir + "/" + toLowerCase(baseName) + ".h";
   std::ofstream writer{path};
 
   writer << "#pragma once\n"
-            "\n"
-            "#include <any>\n"
-            "#include <memory>\n"
+            "\n";
+  if (sharedNodes) writer << "#include <any>\n";
+  writer << "#include <memory>\n"
             "#include <utility>  // std::move\n"
             "#include <vector>\n"
-            "#include \"../token/token.h\"\n"
-            "\n";
+            "\n"
+            "#include \"../token/token.h\"\n";
+  for (std::string_view include : includes) {
+    writer << "#include \"" << include << "\"\n";
+  }
+  writer << "\n";
 
   // Forward declare the AST classes.
   for (std::string_view type : types) {
@@ -158,58 +234,114 @@ void defineAst(const std::string& outputDir, const std::string& baseName,
     writer << "struct " << className << ";\n";
   }
 
-  // Visitor.
-  writer << "\n";
-  defineVisitor(writer, baseName, types);
-
-  // The base class.
-  // C++ does not allow virtual methods to be templated. That means
-  // multiple accept signatures are out -- at least if we don't want
-  // to overcomplicate things. An alternative is to use std::any,
-  // which holds values of any type in a type-safe way. Classes
-  // implementing the base class are then required to cast the return
-  // value to the expected type inside their member functions.
-  writer << "\n"
-            "struct "
-         << baseName
-         << " {\n"
-            "  virtual std::any accept("
-         << baseName
-         << "Visitor& visitor) = 0;\n"
-            "};\n\n";
+  if (sharedNodes) {
+    // Visitor.
+    writer << "\n";
+    defineVisitor(writer, baseName, types);
+
+    // The base class.
+    // C++ does not allow virtual methods to be templated. That means
+    // multiple accept signatures are out -- at least if we don't want
+    // to overcomplicate things. An alternative is to use std::any,
+    // which holds values of any type in a type-safe way. Classes
+    // implementing the base class are then required to cast the return
+    // value to the expected type inside their member functions.
+    writer << "\n"
+              "struct "
+           << baseName
+           << " {\n"
+              "  virtual std::any accept("
+           << baseName
+           << "Visitor& visitor) = 0;\n"
+              "};\n\n";
+  } else {
+    // The kind tag replaces the virtual accept(). The destructor is the only
+    // virtual function left, so owners can delete through the base.
+    writer << "\n"
+              "enum class "
+           << baseName << "Kind {\n";
+    for (std::string_view type : types) {
+      writer << "  " << trim(split(type, ": ")[0]) << ",\n";
+    }
+    writer << "};\n"
+              "\n"
+              "struct "
+           << baseName
+           << " {\n"
+              "  explicit "
+           << baseName << "(" << baseName
+           << "Kind kind) : kind{kind} {}\n"
+              "  virtual ~"
+           << baseName
+           << "() = default;\n"
+              "\n"
+              "  const "
+           << baseName
+           << "Kind kind;\n"
+              "};\n"
+              "\n"
+              "using "
+           << baseName << "Ptr = std::unique_ptr<" << baseName << ">;\n\n";
+  }
 
   // The AST classes.
   for (std::string_view type : types) {
-    std::string_view className = trim(split(type, ": ")[0]);
-    std::string_view fields = trim(split(type, ": ")[1]);
-    defineType(writer, baseName, className, fields);
+    std::vector<std::string_view> parts = split(type, "|");
+    std::string_view className = trim(split(parts[0], ": ")[0]);
+    std::string_view fields = trim(split(parts[0], ": ")[1]);
+    std::string_view annotations = parts.size() > 1 ? trim(parts[1]) : "";
+    defineType(writer, baseName, className, fields, annotations);
   }
+
+  // The visitor needs complete node types for its static_casts.
+  if (!sharedNodes) defineVisitor(writer, baseName, types);
 }
 
 int main(int argc, char* argv[]) {
-  //  if (argc != 2) {
-  //    std::cout << "Usage: generate_ast <output directory>\n";
-  //    std::exit(64);
-  //  }
   std::string outputDir = "./";
+  for (int i = 1; i < argc; ++i) {
+    if (std::string_view{argv[i]} == "--shared") {
+      sharedNodes = true;
+    } else if (i == argc - 1) {
+      outputDir = argv[i];
+    } else {
+      std::cout << "Usage: generate_ast [--shared] [output directory]\n";
+      std::exit(64);
+    }
+  }
 
   defineAst(outputDir, "Expr",
-            {"Assign   : Token name, Expr* value",
+            {"Assign   : Token name, Expr* value"
+             " | int depth = -1, int slot = -1",
              "Binary   : Expr* left, Token op, Expr* right",
              "Call     : Expr* callee, Token paren,"
-             " std::vector<Expr*> arguments",
-             "Grouping : Expr* expression", "Literal  : std::any value",
+             " std::vector<Expr*> arguments"
+             " | const void* checkedDeclaration = nullptr",
+             "Get      : Expr* object, Token name | PropertyCache cache = ",
+             "Grouping : Expr* expression", "Literal  : Value value",
              "Logical  : Expr* left, Token op, Expr* right",
-             "Unary    : Token op, Expr* right", "Variable : Token name"});
+             "Set      : Expr* object, Token name, Expr* value"
+             " | PropertyCache cache = ",
+             "Super    : Token keyword, Token method"
+             " | int depth = -1, int slot = -1",
+             "This     : Token keyword | int depth = -1, int slot = -1",
+             "Unary    : Token op, Expr* right",
+             "Variable : Token name | int depth = -1, int slot = -1"},
+            {"shape.h", "value.h"});
   defineAst(outputDir, "Stmt",
-            {"Block      : std::vector<Stmt*> statements",
+            {"Block      : std::vector<Stmt*> statements | bool flat = false",
+             "Class      : Token name, Variable* superclass,"
+             " std::vector<Function*> methods",
              "Expression : Expr* expression",
              "Function   : Token name, std::vector<Token> params,"
              " std::vector<Stmt*> body",
              "If         : Expr* condition, Stmt* thenBranch,"
              " Stmt* elseBranch",
+             "Import     : Token keyword, Token path"
+             " | const std::vector<StmtPtr>* program = nullptr",
              "Print      : Expr* expression",
-             "Return     : Token keyword, Expr* value",
+             "Return     : Token keyword, Expr* value | bool tailCall = false",
              "Var        : Token name, Expr* initializer",
-             "While      : Expr* condition, Stmt* body"});
+             "While      : Expr* condition, Stmt* body"},
+            {"expr.h"});
 }
\ No newline at end of file
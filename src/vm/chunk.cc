@@ -0,0 +1,32 @@
+#include "chunk.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace vm {
+
+void Chunk::write(uint8_t byte, int line) {
+  code.push_back(byte);
+  if (!lines_.empty() && lines_.back().line == line) return;
+  lines_.push_back({code.size() - 1, line});
+}
+
+size_t Chunk::addConstant(Value value) {
+  constants.push_back(value);
+  return constants.size() - 1;
+}
+
+size_t Chunk::addProperty(Symbol name) {
+  properties.push_back({name, {}});
+  return properties.size() - 1;
+}
+
+int Chunk::getLine(size_t offset) const {
+  auto it = std::upper_bound(
+      lines_.begin(), lines_.end(), offset,
+      [](size_t off, const LineStart& start) { return off < start.offset; });
+  if (it == lines_.begin()) return 0;
+  return std::prev(it)->line;
+}
+
+}  // namespace vm
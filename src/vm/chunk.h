@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "../token/symbol.h"
+#include "../treewalk/shape.h"
+#include "value.h"
+
+namespace vm {
+
+struct ObjClosure;
+
+enum OpCode : uint8_t {
+  OP_CONSTANT,       // [u16 constant]
+  OP_NIL,            //
+  OP_TRUE,           //
+  OP_FALSE,          //
+  OP_POP,            //
+  OP_GET_LOCAL,      // [u8 slot]
+  OP_SET_LOCAL,      // [u8 slot]
+  OP_GET_GLOBAL,     // [u16 global]
+  OP_DEFINE_GLOBAL,  // [u16 global]
+  OP_SET_GLOBAL,     // [u16 global]
+  OP_GET_UPVALUE,    // [u8 upvalue]
+  OP_SET_UPVALUE,    // [u8 upvalue]
+  OP_EQUAL,          //
+  OP_GREATER,        //
+  OP_GREATER_EQUAL,  //
+  OP_LESS,           //
+  OP_LESS_EQUAL,     //
+  OP_ADD,            //
+  OP_SUBTRACT,       //
+  OP_MULTIPLY,       //
+  OP_DIVIDE,         //
+  OP_NOT,            //
+  OP_NEGATE,         //
+  OP_PRINT,          //
+  OP_JUMP,           // [u16 offset]
+  OP_JUMP_IF_FALSE,  // [u16 offset]
+  OP_LOOP,           // [u16 offset]
+  OP_CALL,           // [u8 argCount]
+  OP_CLOSURE,        // [u16 function] then [u8 isLocal, u8 index] per upvalue
+  OP_CLOSE_UPVALUE,  //
+  OP_RETURN,         //
+  OP_CLASS,          // [u16 name constant]
+  OP_INHERIT,        //
+  OP_METHOD,         // [u16 property]
+  OP_GET_PROPERTY,   // [u16 property]
+  OP_SET_PROPERTY,   // [u16 property]
+  OP_INVOKE,         // [u16 property, u8 argCount]
+  OP_GET_SUPER,      // [u16 property]
+  OP_SUPER_INVOKE,   // [u16 property, u8 argCount]
+};
+
+// Every instruction that names a property gets a site of its own, so each
+// caches the receiver shapes seen at that point of the program.
+struct PropertySite {
+  Symbol name;
+  InlineCache<ObjClosure> cache;
+};
+
+// Bytecode for a single function. Source lines are kept in a run-length
+// encoded side table since consecutive instructions mostly share a line.
+class Chunk {
+ public:
+  void write(uint8_t byte, int line);
+  size_t addConstant(Value value);
+  size_t addProperty(Symbol name);
+  int getLine(size_t offset) const;
+
+  std::vector<uint8_t> code;
+  std::vector<Value> constants;
+  std::vector<PropertySite> properties;
+
+ private:
+  struct LineStart {
+    size_t offset;
+    int line;
+  };
+  std::vector<LineStart> lines_;
+};
+
+}  // namespace vm
@@ -0,0 +1,541 @@
+#include "compiler.h"
+
+#include <limits>
+#include <string>
+
+#include "../utils/error.h"
+#include "vm.h"
+
+namespace vm {
+
+namespace {
+
+const Symbol kThis = symbols().intern("this");
+const Symbol kSuper = symbols().intern("super");
+const Symbol kInit = symbols().intern("init");
+
+// Names `this` and `super` like the identifiers the compiler resolves.
+Token keywordName(const Token& keyword, Symbol symbol) {
+  return Token{IDENTIFIER, keyword.lexeme_, keyword.line_, symbol};
+}
+
+}  // namespace
+
+ObjFunction* Compiler::compile(const std::vector<StmtPtr>& statements) {
+  FunctionState script{nullptr, vm_.newFunction(), FunctionType::Script};
+  script.locals.push_back({kNoSymbol, 0, false});
+  current_ = &script;
+  for (const auto& statement : statements) {
+    compile(statement);
+  }
+  emitReturn();
+  current_ = nullptr;
+  return hadError_ ? nullptr : script.function;
+}
+
+void Compiler::compile(const ExprPtr& expr) { visitExpr(*expr); }
+
+void Compiler::compile(const StmtPtr& stmt) { visitStmt(*stmt); }
+
+void Compiler::visitAssignExpr(Assign& expr) {
+  compile(expr.value);
+  namedVariable(expr.name, true);
+}
+
+void Compiler::visitBinaryExpr(Binary& expr) {
+  compile(expr.left);
+  compile(expr.right);
+  line_ = expr.op.line_;
+  switch (expr.op.type_) {
+    case BANG_EQUAL:
+      emitBytes(OP_EQUAL, OP_NOT);
+      break;
+    case EQUAL_EQUAL:
+      emitByte(OP_EQUAL);
+      break;
+    case GREATER:
+      emitByte(OP_GREATER);
+      break;
+    case GREATER_EQUAL:
+      emitByte(OP_GREATER_EQUAL);
+      break;
+    case LESS:
+      emitByte(OP_LESS);
+      break;
+    case LESS_EQUAL:
+      emitByte(OP_LESS_EQUAL);
+      break;
+    case PLUS:
+      emitByte(OP_ADD);
+      break;
+    case MINUS:
+      emitByte(OP_SUBTRACT);
+      break;
+    case STAR:
+      emitByte(OP_MULTIPLY);
+      break;
+    case SLASH:
+      emitByte(OP_DIVIDE);
+      break;
+    default:
+      break;
+  }
+}
+
+void Compiler::visitCallExpr(Call& expr) {
+  // Method calls skip allocating the bound method.
+  if (expr.callee->kind == ExprKind::Get) {
+    auto& get = static_cast<Get&>(*expr.callee);
+    compile(get.object);
+    for (const auto& argument : expr.arguments) {
+      compile(argument);
+    }
+    line_ = expr.paren.line_;
+    emitShort(OP_INVOKE, makeProperty(get.name));
+    emitByte(static_cast<uint8_t>(expr.arguments.size()));
+    return;
+  }
+  if (expr.callee->kind == ExprKind::Super) {
+    auto& super = static_cast<Super&>(*expr.callee);
+    loadReceiver(super.keyword);
+    for (const auto& argument : expr.arguments) {
+      compile(argument);
+    }
+    loadSuperclass(super.keyword);
+    line_ = expr.paren.line_;
+    emitShort(OP_SUPER_INVOKE, makeProperty(super.method));
+    emitByte(static_cast<uint8_t>(expr.arguments.size()));
+    return;
+  }
+
+  compile(expr.callee);
+  for (const auto& argument : expr.arguments) {
+    compile(argument);
+  }
+  line_ = expr.paren.line_;
+  emitBytes(OP_CALL, static_cast<uint8_t>(expr.arguments.size()));
+}
+
+void Compiler::visitGetExpr(Get& expr) {
+  compile(expr.object);
+  line_ = expr.name.line_;
+  emitShort(OP_GET_PROPERTY, makeProperty(expr.name));
+}
+
+void Compiler::visitSetExpr(Set& expr) {
+  compile(expr.object);
+  compile(expr.value);
+  line_ = expr.name.line_;
+  emitShort(OP_SET_PROPERTY, makeProperty(expr.name));
+}
+
+void Compiler::visitSuperExpr(Super& expr) {
+  loadReceiver(expr.keyword);
+  loadSuperclass(expr.keyword);
+  emitShort(OP_GET_SUPER, makeProperty(expr.method));
+}
+
+void Compiler::visitThisExpr(This& expr) { loadReceiver(expr.keyword); }
+
+void Compiler::visitGroupingExpr(Grouping& expr) {
+  compile(expr.expression);
+}
+
+void Compiler::visitLiteralExpr(Literal& expr) {
+  // The tree-walker's value type, not ours.
+  const ::Value& value = expr.value;
+  if (value.isBool()) {
+    emitByte(value.asBool() ? OP_TRUE : OP_FALSE);
+  } else if (value.isNumber()) {
+    emitShort(OP_CONSTANT, makeConstant(Value::number(value.asNumber())));
+  } else if (value.isString()) {
+    ObjString* string = vm_.copyString(value.asString());
+    emitShort(OP_CONSTANT, makeConstant(Value::object(string)));
+  } else {
+    emitByte(OP_NIL);
+  }
+}
+
+void Compiler::visitLogicalExpr(Logical& expr) {
+  compile(expr.left);
+  line_ = expr.op.line_;
+  if (expr.op.type_ == OR) {
+    size_t elseJump = emitJump(OP_JUMP_IF_FALSE);
+    size_t endJump = emitJump(OP_JUMP);
+    patchJump(elseJump);
+    emitByte(OP_POP);
+    compile(expr.right);
+    patchJump(endJump);
+  } else {
+    size_t endJump = emitJump(OP_JUMP_IF_FALSE);
+    emitByte(OP_POP);
+    compile(expr.right);
+    patchJump(endJump);
+  }
+}
+
+void Compiler::visitUnaryExpr(Unary& expr) {
+  compile(expr.right);
+  line_ = expr.op.line_;
+  emitByte(expr.op.type_ == BANG ? OP_NOT : OP_NEGATE);
+}
+
+void Compiler::visitVariableExpr(Variable& expr) {
+  namedVariable(expr.name, false);
+}
+
+void Compiler::visitBlockStmt(Block& stmt) {
+  beginScope();
+  for (const auto& statement : stmt.statements) {
+    compile(statement);
+  }
+  endScope();
+}
+
+void Compiler::visitClassStmt(Class& stmt) {
+  line_ = stmt.name.line_;
+  declareVariable(stmt.name);
+  ObjString* name = vm_.copyString(stmt.name.lexeme_);
+  emitShort(OP_CLASS, makeConstant(Value::object(name)));
+  defineVariable(stmt.name);
+
+  ClassState state{currentClass_, false};
+  currentClass_ = &state;
+  if (stmt.superclass != nullptr) {
+    const Token& superclass = stmt.superclass->name;
+    if (superclass.symbol_ == stmt.name.symbol_) {
+      error(superclass, "A class can't inherit from itself!");
+    }
+    namedVariable(superclass, false);
+    // Methods capture the superclass as a local named `super`.
+    beginScope();
+    current_->locals.push_back({kSuper, current_->scopeDepth, false});
+    namedVariable(stmt.name, false);
+    emitByte(OP_INHERIT);
+    state.hasSuperclass = true;
+  }
+
+  namedVariable(stmt.name, false);
+  for (const auto& method : stmt.methods) {
+    function(*method, method->name.symbol_ == kInit
+                          ? FunctionType::Initializer
+                          : FunctionType::Method);
+    emitShort(OP_METHOD, makeProperty(method->name));
+  }
+  emitByte(OP_POP);
+
+  if (state.hasSuperclass) endScope();
+  currentClass_ = state.enclosing;
+}
+
+void Compiler::visitExpressionStmt(Expression& stmt) {
+  compile(stmt.expression);
+  emitByte(OP_POP);
+}
+
+void Compiler::visitFunctionStmt(Function& stmt) {
+  line_ = stmt.name.line_;
+  declareVariable(stmt.name);
+  // Locals are usable inside their own body so the function can recurse.
+  markInitialized();
+  function(stmt, FunctionType::Function);
+  defineVariable(stmt.name);
+}
+
+void Compiler::visitIfStmt(If& stmt) {
+  compile(stmt.condition);
+  size_t thenJump = emitJump(OP_JUMP_IF_FALSE);
+  emitByte(OP_POP);
+  compile(stmt.thenBranch);
+  size_t elseJump = emitJump(OP_JUMP);
+  patchJump(thenJump);
+  emitByte(OP_POP);
+  if (stmt.elseBranch != nullptr) {
+    compile(stmt.elseBranch);
+  }
+  patchJump(elseJump);
+}
+
+void Compiler::visitImportStmt(Import& stmt) {
+  line_ = stmt.keyword.line_;
+  if (stmt.program == nullptr) {
+    error(stmt.path,
+          "Module " + std::string{stmt.path.lexeme_} + " was not loaded!");
+    return;
+  }
+  // Imports are top-level statements, so the module's declarations define
+  // globals wherever its code is compiled in.
+  if (!vm_.markImported(stmt.program)) return;
+  for (const auto& statement : *stmt.program) {
+    compile(statement);
+  }
+}
+
+void Compiler::visitPrintStmt(Print& stmt) {
+  compile(stmt.expression);
+  emitByte(OP_PRINT);
+}
+
+void Compiler::visitReturnStmt(Return& stmt) {
+  line_ = stmt.keyword.line_;
+  if (current_->type == FunctionType::Script) {
+    error(stmt.keyword, "Can't return from top-level code!");
+  }
+  if (stmt.value == nullptr) {
+    emitReturn();
+    return;
+  }
+  if (current_->type == FunctionType::Initializer) {
+    error(stmt.keyword, "Can't return a value from an initializer!");
+  }
+  compile(stmt.value);
+  emitByte(OP_RETURN);
+}
+
+void Compiler::visitVarStmt(Var& stmt) {
+  line_ = stmt.name.line_;
+  declareVariable(stmt.name);
+  if (stmt.initializer != nullptr) {
+    compile(stmt.initializer);
+  } else {
+    emitByte(OP_NIL);
+  }
+  defineVariable(stmt.name);
+}
+
+void Compiler::visitWhileStmt(While& stmt) {
+  size_t loopStart = chunk().code.size();
+  compile(stmt.condition);
+  size_t exitJump = emitJump(OP_JUMP_IF_FALSE);
+  emitByte(OP_POP);
+  compile(stmt.body);
+  emitLoop(loopStart);
+  patchJump(exitJump);
+  emitByte(OP_POP);
+}
+
+void Compiler::function(const Function& stmt, FunctionType type) {
+  FunctionState state{current_, vm_.newFunction(), type};
+  state.function->name = vm_.copyString(stmt.name.lexeme_);
+  state.function->arity = static_cast<int>(stmt.params.size());
+  // Slot 0 holds the callee, or the receiver in methods.
+  bool isMethod = type == FunctionType::Method ||
+                  type == FunctionType::Initializer;
+  state.locals.push_back({isMethod ? kThis : kNoSymbol, 0, false});
+  current_ = &state;
+
+  // Parameters and the body share one scope, matching the tree-walker.
+  beginScope();
+  for (const Token& param : stmt.params) {
+    declareVariable(param);
+    markInitialized();
+  }
+  for (const auto& statement : stmt.body) {
+    compile(statement);
+  }
+  emitReturn();
+
+  current_ = state.enclosing;
+  ObjFunction* function = state.function;
+  function->upvalueCount = static_cast<int>(state.upvalues.size());
+  emitShort(OP_CLOSURE, makeConstant(Value::object(function)));
+  for (const Upvalue& upvalue : state.upvalues) {
+    emitBytes(upvalue.isLocal ? 1 : 0, upvalue.index);
+  }
+}
+
+void Compiler::loadReceiver(const Token& keyword) {
+  if (currentClass_ == nullptr) {
+    error(keyword, "Can't use '" + std::string{keyword.lexeme_} +
+                       "' outside of a class!");
+    return;
+  }
+  namedVariable(keywordName(keyword, kThis), false);
+}
+
+void Compiler::loadSuperclass(const Token& keyword) {
+  if (currentClass_ == nullptr) return;  // Reported by loadReceiver.
+  if (!currentClass_->hasSuperclass) {
+    error(keyword, "Can't use 'super' in a class with no superclass!");
+    return;
+  }
+  namedVariable(keywordName(keyword, kSuper), false);
+}
+
+void Compiler::emitByte(uint8_t byte) { chunk().write(byte, line_); }
+
+void Compiler::emitBytes(uint8_t byte1, uint8_t byte2) {
+  emitByte(byte1);
+  emitByte(byte2);
+}
+
+void Compiler::emitShort(uint8_t op, uint16_t operand) {
+  emitByte(op);
+  emitByte(static_cast<uint8_t>(operand >> 8));
+  emitByte(static_cast<uint8_t>(operand & 0xff));
+}
+
+size_t Compiler::emitJump(uint8_t op) {
+  emitShort(op, 0xffff);
+  return chunk().code.size() - 2;
+}
+
+void Compiler::patchJump(size_t offset) {
+  // -2 to adjust for the bytecode for the jump offset itself.
+  size_t jump = chunk().code.size() - offset - 2;
+  if (jump > std::numeric_limits<uint16_t>::max()) {
+    hadError_ = true;
+    ::error(line_, "Too much code to jump over!");
+  }
+  chunk().code[offset] = static_cast<uint8_t>((jump >> 8) & 0xff);
+  chunk().code[offset + 1] = static_cast<uint8_t>(jump & 0xff);
+}
+
+void Compiler::emitLoop(size_t loopStart) {
+  size_t offset = chunk().code.size() - loopStart + 3;
+  if (offset > std::numeric_limits<uint16_t>::max()) {
+    hadError_ = true;
+    ::error(line_, "Loop body too large!");
+  }
+  emitShort(OP_LOOP, static_cast<uint16_t>(offset));
+}
+
+void Compiler::emitReturn() {
+  // Initializers always return the instance.
+  if (current_->type == FunctionType::Initializer) {
+    emitBytes(OP_GET_LOCAL, 0);
+  } else {
+    emitByte(OP_NIL);
+  }
+  emitByte(OP_RETURN);
+}
+
+uint16_t Compiler::makeConstant(Value value) {
+  size_t constant = chunk().addConstant(value);
+  if (constant > std::numeric_limits<uint16_t>::max()) {
+    hadError_ = true;
+    ::error(line_, "Too many constants in one chunk!");
+    return 0;
+  }
+  return static_cast<uint16_t>(constant);
+}
+
+uint16_t Compiler::makeProperty(const Token& name) {
+  size_t property = chunk().addProperty(name.symbol_);
+  if (property > std::numeric_limits<uint16_t>::max()) {
+    error(name, "Too many property accesses in one chunk!");
+    return 0;
+  }
+  return static_cast<uint16_t>(property);
+}
+
+void Compiler::beginScope() { ++current_->scopeDepth; }
+
+void Compiler::endScope() {
+  --current_->scopeDepth;
+  auto& locals = current_->locals;
+  while (!locals.empty() && locals.back().depth > current_->scopeDepth) {
+    emitByte(locals.back().isCaptured ? OP_CLOSE_UPVALUE : OP_POP);
+    locals.pop_back();
+  }
+}
+
+void Compiler::declareVariable(const Token& name) {
+  if (current_->scopeDepth == 0) return;
+  auto& locals = current_->locals;
+  for (auto it = locals.rbegin(); it != locals.rend(); ++it) {
+    if (it->depth != -1 && it->depth < current_->scopeDepth) break;
+    if (it->name == name.symbol_) {
+      error(name, "Already a variable with this name in this scope!");
+    }
+  }
+  if (locals.size() > std::numeric_limits<uint8_t>::max()) {
+    error(name, "Too many local variables in function!");
+    return;
+  }
+  locals.push_back({name.symbol_, -1, false});
+}
+
+void Compiler::markInitialized() {
+  if (current_->scopeDepth == 0) return;
+  current_->locals.back().depth = current_->scopeDepth;
+}
+
+void Compiler::defineVariable(const Token& name) {
+  if (current_->scopeDepth > 0) {
+    markInitialized();
+    return;
+  }
+  emitShort(OP_DEFINE_GLOBAL, vm_.globalSlot(name.symbol_));
+}
+
+void Compiler::namedVariable(const Token& name, bool assign) {
+  line_ = name.line_;
+  int arg = resolveLocal(current_, name);
+  if (arg != -1) {
+    emitBytes(assign ? OP_SET_LOCAL : OP_GET_LOCAL, static_cast<uint8_t>(arg));
+    return;
+  }
+  arg = resolveUpvalue(current_, name);
+  if (arg != -1) {
+    emitBytes(assign ? OP_SET_UPVALUE : OP_GET_UPVALUE,
+              static_cast<uint8_t>(arg));
+    return;
+  }
+  if (vm_.globalCount() > std::numeric_limits<uint16_t>::max()) {
+    error(name, "Too many global variables!");
+    return;
+  }
+  emitShort(assign ? OP_SET_GLOBAL : OP_GET_GLOBAL,
+            vm_.globalSlot(name.symbol_));
+}
+
+int Compiler::resolveLocal(FunctionState* state, const Token& name) {
+  for (int i = static_cast<int>(state->locals.size()) - 1; i >= 0; --i) {
+    const Local& local = state->locals[i];
+    if (local.name == name.symbol_) {
+      if (local.depth == -1) {
+        error(name, "Can't read local variable in its own initializer!");
+      }
+      return i;
+    }
+  }
+  return -1;
+}
+
+int Compiler::resolveUpvalue(FunctionState* state, const Token& name) {
+  if (state->enclosing == nullptr) return -1;
+  int local = resolveLocal(state->enclosing, name);
+  if (local != -1) {
+    state->enclosing->locals[local].isCaptured = true;
+    return addUpvalue(state, static_cast<uint8_t>(local), true, name);
+  }
+  int upvalue = resolveUpvalue(state->enclosing, name);
+  if (upvalue != -1) {
+    return addUpvalue(state, static_cast<uint8_t>(upvalue), false, name);
+  }
+  return -1;
+}
+
+int Compiler::addUpvalue(FunctionState* state, uint8_t index, bool isLocal,
+                         const Token& name) {
+  auto& upvalues = state->upvalues;
+  for (size_t i = 0; i < upvalues.size(); ++i) {
+    if (upvalues[i].index == index && upvalues[i].isLocal == isLocal) {
+      return static_cast<int>(i);
+    }
+  }
+  if (upvalues.size() > std::numeric_limits<uint8_t>::max()) {
+    error(name, "Too many closure variables in function!");
+    return 0;
+  }
+  upvalues.push_back({index, isLocal});
+  return static_cast<int>(upvalues.size()) - 1;
+}
+
+void Compiler::error(const Token& token, const std::string& msg) {
+  hadError_ = true;
+  ::error(token, msg);
+}
+
+}  // namespace vm
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../token/symbol.h"
+#include "../token/token.h"
+#include "../treewalk/expr.h"
+#include "../treewalk/stmt.h"
+#include "chunk.h"
+#include "object.h"
+
+namespace vm {
+
+class VM;
+
+// Lowers the tree produced by Parser::parse() into bytecode. Locals live in
+// stack slots and captured variables become upvalues, so no name lookups are
+// left for runtime except the dense global slots handed out by the VM.
+class Compiler : public ExprVisitor<Compiler, void>,
+                 public StmtVisitor<Compiler, void> {
+ public:
+  explicit Compiler(VM& vm) : vm_{vm} {}
+
+  // Returns the top-level script function, or nullptr after a compile error.
+  ObjFunction* compile(const std::vector<StmtPtr>& statements);
+
+  void visitAssignExpr(Assign& expr);
+  void visitBinaryExpr(Binary& expr);
+  void visitCallExpr(Call& expr);
+  void visitGetExpr(Get& expr);
+  void visitSetExpr(Set& expr);
+  void visitSuperExpr(Super& expr);
+  void visitThisExpr(This& expr);
+  void visitGroupingExpr(Grouping& expr);
+  void visitLiteralExpr(Literal& expr);
+  void visitLogicalExpr(Logical& expr);
+  void visitUnaryExpr(Unary& expr);
+  void visitVariableExpr(Variable& expr);
+
+  void visitBlockStmt(Block& stmt);
+  void visitClassStmt(Class& stmt);
+  void visitExpressionStmt(Expression& stmt);
+  void visitFunctionStmt(Function& stmt);
+  void visitIfStmt(If& stmt);
+  void visitImportStmt(Import& stmt);
+  void visitPrintStmt(Print& stmt);
+  void visitReturnStmt(Return& stmt);
+  void visitVarStmt(Var& stmt);
+  void visitWhileStmt(While& stmt);
+
+ private:
+  enum class FunctionType { Script, Function, Method, Initializer };
+
+  struct Local {
+    Symbol name;
+    int depth;  // -1 while the initializer is being compiled.
+    bool isCaptured;
+  };
+
+  struct Upvalue {
+    uint8_t index;
+    bool isLocal;
+  };
+
+  struct FunctionState {
+    FunctionState* enclosing;
+    ObjFunction* function;
+    FunctionType type;
+    std::vector<Local> locals;
+    std::vector<Upvalue> upvalues;
+    int scopeDepth{0};
+  };
+
+  struct ClassState {
+    ClassState* enclosing;
+    bool hasSuperclass;
+  };
+
+  void compile(const ExprPtr& expr);
+  void compile(const StmtPtr& stmt);
+  void function(const Function& stmt, FunctionType type);
+  // Loads `this` or `super`, reporting uses outside of a (sub)class.
+  void loadReceiver(const Token& keyword);
+  void loadSuperclass(const Token& keyword);
+
+  Chunk& chunk() { return current_->function->chunk; }
+  void emitByte(uint8_t byte);
+  void emitBytes(uint8_t byte1, uint8_t byte2);
+  void emitShort(uint8_t op, uint16_t operand);
+  size_t emitJump(uint8_t op);
+  void patchJump(size_t offset);
+  void emitLoop(size_t loopStart);
+  void emitReturn();
+  uint16_t makeConstant(Value value);
+  uint16_t makeProperty(const Token& name);
+
+  void beginScope();
+  void endScope();
+  void declareVariable(const Token& name);
+  void markInitialized();
+  void defineVariable(const Token& name);
+  void namedVariable(const Token& name, bool assign);
+  int resolveLocal(FunctionState* state, const Token& name);
+  int resolveUpvalue(FunctionState* state, const Token& name);
+  int addUpvalue(FunctionState* state, uint8_t index, bool isLocal,
+                 const Token& name);
+
+  void error(const Token& token, const std::string& msg);
+
+  VM& vm_;
+  FunctionState* current_{nullptr};
+  ClassState* currentClass_{nullptr};
+  int line_{1};
+  bool hadError_{false};
+};
+
+}  // namespace vm
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../token/symbol.h"
+#include "../treewalk/shape.h"
+
+#include "chunk.h"
+#include "value.h"
+
+namespace vm {
+
+enum class ObjType : uint8_t {
+  String,
+  Function,
+  Native,
+  Closure,
+  Upvalue,
+  Class,
+  Instance,
+  BoundMethod,
+};
+
+struct Obj {
+  explicit Obj(ObjType type) : type{type} {}
+  virtual ~Obj() = default;
+
+  const ObjType type;
+  bool isMarked{false};
+  Obj* next{nullptr};
+};
+
+// Strings are interned by the VM, so two strings with the same characters are
+// always the same object and can be compared by pointer.
+struct ObjString : Obj {
+  ObjString(std::string chars, size_t hash)
+      : Obj{ObjType::String}, chars{std::move(chars)}, hash{hash} {}
+
+  const std::string chars;
+  const size_t hash;
+};
+
+struct ObjFunction : Obj {
+  ObjFunction() : Obj{ObjType::Function} {}
+
+  int arity{0};
+  int upvalueCount{0};
+  Chunk chunk;
+  ObjString* name{nullptr};
+};
+
+using NativeFn = Value (*)(int argCount, Value* args);
+
+struct ObjNative : Obj {
+  ObjNative(NativeFn function, int arity)
+      : Obj{ObjType::Native}, function{function}, arity{arity} {}
+
+  const NativeFn function;
+  const int arity;
+};
+
+// A captured variable. While the variable is still on the stack `location`
+// points at its stack slot; once closed it points at `closed`.
+struct ObjUpvalue : Obj {
+  explicit ObjUpvalue(Value* slot) : Obj{ObjType::Upvalue}, location{slot} {}
+
+  Value* location;
+  Value closed;
+  ObjUpvalue* nextOpen{nullptr};
+};
+
+struct ObjClosure : Obj {
+  explicit ObjClosure(ObjFunction* function)
+      : Obj{ObjType::Closure},
+        function{function},
+        upvalues(function->upvalueCount, nullptr) {}
+
+  ObjFunction* const function;
+  std::vector<ObjUpvalue*> upvalues;
+};
+
+struct ObjClass : Obj {
+  explicit ObjClass(ObjString* name) : Obj{ObjType::Class}, name{name} {}
+
+  ObjString* const name;
+  std::unordered_map<Symbol, ObjClosure*> methods;
+  ObjClosure* initializer{nullptr};
+  // Instances start out with this shape; see Shape.
+  Shape rootShape;
+};
+
+// Fields are stored densely in the order they were first assigned; `shape`
+// maps their names to indices.
+struct ObjInstance : Obj {
+  explicit ObjInstance(ObjClass* klass)
+      : Obj{ObjType::Instance}, klass{klass}, shape{&klass->rootShape} {}
+
+  ObjClass* const klass;
+  Shape* shape;
+  std::vector<Value> fields;
+};
+
+struct ObjBoundMethod : Obj {
+  ObjBoundMethod(Value receiver, ObjClosure* method)
+      : Obj{ObjType::BoundMethod}, receiver{receiver}, method{method} {}
+
+  const Value receiver;
+  ObjClosure* const method;
+};
+
+inline bool isObjType(Value value, ObjType type) {
+  return value.isObj() && value.asObj()->type == type;
+}
+
+inline bool isString(Value value) {
+  return isObjType(value, ObjType::String);
+}
+
+inline bool isClass(Value value) { return isObjType(value, ObjType::Class); }
+
+inline bool isInstance(Value value) {
+  return isObjType(value, ObjType::Instance);
+}
+
+inline ObjString* asString(Value value) {
+  return static_cast<ObjString*>(value.asObj());
+}
+
+inline ObjFunction* asFunction(Value value) {
+  return static_cast<ObjFunction*>(value.asObj());
+}
+
+inline ObjClosure* asClosure(Value value) {
+  return static_cast<ObjClosure*>(value.asObj());
+}
+
+inline ObjNative* asNative(Value value) {
+  return static_cast<ObjNative*>(value.asObj());
+}
+
+inline ObjClass* asClass(Value value) {
+  return static_cast<ObjClass*>(value.asObj());
+}
+
+inline ObjInstance* asInstance(Value value) {
+  return static_cast<ObjInstance*>(value.asObj());
+}
+
+inline ObjBoundMethod* asBoundMethod(Value value) {
+  return static_cast<ObjBoundMethod*>(value.asObj());
+}
+
+}  // namespace vm
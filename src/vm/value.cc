@@ -0,0 +1,66 @@
+#include "value.h"
+
+#include "object.h"
+
+namespace vm {
+
+bool valuesEqual(Value a, Value b) {
+  if (a.type != b.type) return false;
+  switch (a.type) {
+    case ValueType::Nil:
+      return true;
+    case ValueType::Bool:
+      return a.asBool() == b.asBool();
+    case ValueType::Number:
+      return a.asNumber() == b.asNumber();
+    case ValueType::Obj:
+      // Strings are interned, so identity is equality for every object.
+      return a.asObj() == b.asObj();
+  }
+  return false;
+}
+
+std::string stringify(Value value) {
+  switch (value.type) {
+    case ValueType::Nil:
+      return "nil";
+    case ValueType::Bool:
+      return value.asBool() ? "true" : "false";
+    case ValueType::Number: {
+      std::string text = std::to_string(value.asNumber());
+      int len = text.size();
+      if (text[len - 1] == '0' && text[len - 2] == '.') {
+        text = text.substr(0, len - 2);
+      }
+      return text;
+    }
+    case ValueType::Obj:
+      break;
+  }
+  switch (value.asObj()->type) {
+    case ObjType::String:
+      return asString(value)->chars;
+    case ObjType::Function: {
+      ObjString* name = asFunction(value)->name;
+      return name == nullptr ? "<script>" : "<fn " + name->chars + ">";
+    }
+    case ObjType::Native:
+      return "<native fn>";
+    case ObjType::Closure: {
+      ObjString* name = asClosure(value)->function->name;
+      return name == nullptr ? "<script>" : "<fn " + name->chars + ">";
+    }
+    case ObjType::Upvalue:
+      return "upvalue";
+    case ObjType::Class:
+      return asClass(value)->name->chars;
+    case ObjType::Instance:
+      return asInstance(value)->klass->name->chars + " instance";
+    case ObjType::BoundMethod:
+      return "<fn " + asBoundMethod(value)->method->function->name->chars +
+             ">";
+  }
+  return "";
+}
+
+}  // namespace vm
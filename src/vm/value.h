@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace vm {
+
+struct Obj;
+
+enum class ValueType : uint8_t { Nil, Bool, Number, Obj };
+
+// A tagged union small enough to be passed around by value. Heap values are
+// plain pointers; their lifetime is managed by the VM's garbage collector.
+struct Value {
+  ValueType type{ValueType::Nil};
+  union {
+    bool boolean;
+    double number;
+    Obj* obj;
+  } as{};
+
+  static Value nil() { return Value{}; }
+  static Value boolean(bool b) {
+    Value v;
+    v.type = ValueType::Bool;
+    v.as.boolean = b;
+    return v;
+  }
+  static Value number(double n) {
+    Value v;
+    v.type = ValueType::Number;
+    v.as.number = n;
+    return v;
+  }
+  static Value object(Obj* o) {
+    Value v;
+    v.type = ValueType::Obj;
+    v.as.obj = o;
+    return v;
+  }
+
+  bool isNil() const { return type == ValueType::Nil; }
+  bool isBool() const { return type == ValueType::Bool; }
+  bool isNumber() const { return type == ValueType::Number; }
+  bool isObj() const { return type == ValueType::Obj; }
+
+  bool asBool() const { return as.boolean; }
+  double asNumber() const { return as.number; }
+  Obj* asObj() const { return as.obj; }
+
+  bool isFalsey() const { return isNil() || (isBool() && !as.boolean); }
+};
+
+bool valuesEqual(Value a, Value b);
+std::string stringify(Value value);
+
+}  // namespace vm
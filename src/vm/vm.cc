@@ -0,0 +1,755 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <utility>
+
+#include "../treewalk/runtime_error.h"
+#include "compiler.h"
+
+namespace vm {
+
+static const Symbol kInit = symbols().intern("init");
+
+static Value clockNative(int argCount, Value* args) {
+  auto ticks = std::chrono::steady_clock::now().time_since_epoch();
+  return Value::number(std::chrono::duration<double>{ticks}.count());
+}
+
+static size_t sizeofObject(const Obj* object) {
+  switch (object->type) {
+    case ObjType::String:
+      return sizeof(ObjString);
+    case ObjType::Function:
+      return sizeof(ObjFunction);
+    case ObjType::Native:
+      return sizeof(ObjNative);
+    case ObjType::Closure:
+      return sizeof(ObjClosure);
+    case ObjType::Upvalue:
+      return sizeof(ObjUpvalue);
+    case ObjType::Class:
+      return sizeof(ObjClass);
+    case ObjType::Instance:
+      return sizeof(ObjInstance);
+    case ObjType::BoundMethod:
+      return sizeof(ObjBoundMethod);
+  }
+  return 0;
+}
+
+VM::VM() : stack_{new Value[kStackMax]} {
+  resetStack();
+  defineNative("clock", clockNative, 0);
+}
+
+VM::~VM() {
+  Obj* object = objects_;
+  while (object != nullptr) {
+    Obj* next = object->next;
+    freeObject(object);
+    object = next;
+  }
+}
+
+InterpretResult VM::interpret(
+    const std::vector<std::unique_ptr<Stmt>>& statements) {
+  // Everything the compiler allocates ends up reachable from the script
+  // function, so there is nothing to collect until it is on the stack.
+  ++gcPaused_;
+  imported_.insert(&statements);
+  Compiler compiler{*this};
+  ObjFunction* function = compiler.compile(statements);
+  if (function == nullptr) {
+    --gcPaused_;
+    return InterpretResult::CompileError;
+  }
+  push(Value::object(function));
+  --gcPaused_;
+
+  ObjClosure* closure = newClosure(function);
+  pop();
+  push(Value::object(closure));
+  call(closure, 0);
+  return run();
+}
+
+InterpretResult VM::run() {
+  CallFrame* frame = &frames_[frameCount_ - 1];
+  const uint8_t* ip = frame->ip;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() \
+  (frame->closure->function->chunk.constants[READ_SHORT()])
+#define READ_PROPERTY() \
+  (frame->closure->function->chunk.properties[READ_SHORT()])
+#define RUNTIME_ERROR(msg)                \
+  do {                                    \
+    frame->ip = ip;                       \
+    runtimeError(msg);                    \
+    return InterpretResult::RuntimeError; \
+  } while (false)
+#define BINARY_OP(valueType, op)                      \
+  do {                                                \
+    if (!peek(0).isNumber() || !peek(1).isNumber()) { \
+      RUNTIME_ERROR("Operand must be two numbers!");  \
+    }                                                 \
+    double b = pop().asNumber();                      \
+    double a = pop().asNumber();                      \
+    push(Value::valueType(a op b));                   \
+  } while (false)
+
+  for (;;) {
+    uint8_t instruction = READ_BYTE();
+    switch (instruction) {
+      case OP_CONSTANT:
+        push(READ_CONSTANT());
+        break;
+      case OP_NIL:
+        push(Value::nil());
+        break;
+      case OP_TRUE:
+        push(Value::boolean(true));
+        break;
+      case OP_FALSE:
+        push(Value::boolean(false));
+        break;
+      case OP_POP:
+        pop();
+        break;
+      case OP_GET_LOCAL:
+        push(frame->slots[READ_BYTE()]);
+        break;
+      case OP_SET_LOCAL:
+        frame->slots[READ_BYTE()] = peek(0);
+        break;
+      case OP_GET_GLOBAL: {
+        uint16_t slot = READ_SHORT();
+        if (!globals_[slot].defined) {
+          RUNTIME_ERROR("Undefined variable '" +
+                        symbols().name(globalNames_[slot]) + "'!");
+        }
+        push(globals_[slot].value);
+        break;
+      }
+      case OP_DEFINE_GLOBAL: {
+        Global& global = globals_[READ_SHORT()];
+        global.value = pop();
+        global.defined = true;
+        break;
+      }
+      case OP_SET_GLOBAL: {
+        uint16_t slot = READ_SHORT();
+        if (!globals_[slot].defined) {
+          RUNTIME_ERROR("Undefined variable '" +
+                        symbols().name(globalNames_[slot]) + "'!");
+        }
+        globals_[slot].value = peek(0);
+        break;
+      }
+      case OP_GET_UPVALUE:
+        push(*frame->closure->upvalues[READ_BYTE()]->location);
+        break;
+      case OP_SET_UPVALUE:
+        *frame->closure->upvalues[READ_BYTE()]->location = peek(0);
+        break;
+      case OP_EQUAL: {
+        Value b = pop();
+        Value a = pop();
+        push(Value::boolean(valuesEqual(a, b)));
+        break;
+      }
+      case OP_GREATER:
+        BINARY_OP(boolean, >);
+        break;
+      case OP_GREATER_EQUAL:
+        BINARY_OP(boolean, >=);
+        break;
+      case OP_LESS:
+        BINARY_OP(boolean, <);
+        break;
+      case OP_LESS_EQUAL:
+        BINARY_OP(boolean, <=);
+        break;
+      case OP_ADD:
+        if (peek(0).isNumber() && peek(1).isNumber()) {
+          double b = pop().asNumber();
+          double a = pop().asNumber();
+          push(Value::number(a + b));
+        } else if (isString(peek(0)) && isString(peek(1))) {
+          concatenate();
+        } else {
+          RUNTIME_ERROR("Operand must be two numbers or two strings!");
+        }
+        break;
+      case OP_SUBTRACT:
+        BINARY_OP(number, -);
+        break;
+      case OP_MULTIPLY:
+        BINARY_OP(number, *);
+        break;
+      case OP_DIVIDE:
+        BINARY_OP(number, /);
+        break;
+      case OP_NOT:
+        push(Value::boolean(pop().isFalsey()));
+        break;
+      case OP_NEGATE:
+        if (!peek(0).isNumber()) {
+          RUNTIME_ERROR("Operand must be a number");
+        }
+        push(Value::number(-pop().asNumber()));
+        break;
+      case OP_PRINT:
+        std::cout << stringify(pop()) << "\n";
+        break;
+      case OP_JUMP: {
+        uint16_t offset = READ_SHORT();
+        ip += offset;
+        break;
+      }
+      case OP_JUMP_IF_FALSE: {
+        uint16_t offset = READ_SHORT();
+        if (peek(0).isFalsey()) ip += offset;
+        break;
+      }
+      case OP_LOOP: {
+        uint16_t offset = READ_SHORT();
+        ip -= offset;
+        break;
+      }
+      case OP_CALL: {
+        int argCount = READ_BYTE();
+        frame->ip = ip;
+        if (!callValue(peek(argCount), argCount)) {
+          return InterpretResult::RuntimeError;
+        }
+        frame = &frames_[frameCount_ - 1];
+        ip = frame->ip;
+        break;
+      }
+      case OP_CLOSURE: {
+        ObjFunction* function = asFunction(READ_CONSTANT());
+        ObjClosure* closure = newClosure(function);
+        push(Value::object(closure));
+        for (ObjUpvalue*& upvalue : closure->upvalues) {
+          uint8_t isLocal = READ_BYTE();
+          uint8_t index = READ_BYTE();
+          if (isLocal) {
+            upvalue = captureUpvalue(frame->slots + index);
+          } else {
+            upvalue = frame->closure->upvalues[index];
+          }
+        }
+        break;
+      }
+      case OP_CLOSE_UPVALUE:
+        closeUpvalues(stackTop_ - 1);
+        pop();
+        break;
+      case OP_RETURN: {
+        Value result = pop();
+        closeUpvalues(frame->slots);
+        --frameCount_;
+        if (frameCount_ == 0) {
+          pop();
+          return InterpretResult::Ok;
+        }
+        stackTop_ = frame->slots;
+        push(result);
+        frame = &frames_[frameCount_ - 1];
+        ip = frame->ip;
+        break;
+      }
+      case OP_CLASS:
+        push(Value::object(
+            allocate<ObjClass>(0, asString(READ_CONSTANT()))));
+        break;
+      case OP_INHERIT: {
+        if (!isClass(peek(1))) {
+          RUNTIME_ERROR("Superclass must be a class!");
+        }
+        // Copied down before the subclass's own methods are added, which
+        // then override them; lookups never walk the class chain.
+        ObjClass* superclass = asClass(peek(1));
+        ObjClass* subclass = asClass(peek(0));
+        subclass->methods = superclass->methods;
+        subclass->initializer = superclass->initializer;
+        pop();
+        break;
+      }
+      case OP_METHOD: {
+        Symbol name = READ_PROPERTY().name;
+        ObjClass* klass = asClass(peek(1));
+        ObjClosure* method = asClosure(peek(0));
+        klass->methods[name] = method;
+        if (name == kInit) klass->initializer = method;
+        pop();
+        break;
+      }
+      case OP_GET_PROPERTY: {
+        PropertySite& site = READ_PROPERTY();
+        if (!isInstance(peek(0))) {
+          RUNTIME_ERROR("Only instances have properties!");
+        }
+        ObjInstance* instance = asInstance(peek(0));
+        const auto* property = findProperty(instance, site);
+        if (property == nullptr) {
+          RUNTIME_ERROR("Undefined property '" + symbols().name(site.name) +
+                        "'!");
+        }
+        if (property->slot >= 0) {
+          stackTop_[-1] = instance->fields[property->slot];
+        } else {
+          // The receiver stays on the stack while the bound method is
+          // allocated.
+          auto* bound =
+              allocate<ObjBoundMethod>(0, peek(0), property->method);
+          stackTop_[-1] = Value::object(bound);
+        }
+        break;
+      }
+      case OP_SET_PROPERTY: {
+        PropertySite& site = READ_PROPERTY();
+        if (!isInstance(peek(1))) {
+          RUNTIME_ERROR("Only instances have fields!");
+        }
+        ObjInstance* instance = asInstance(peek(1));
+        uint32_t shape = instance->shape->id();
+        const auto* entry = site.cache.find(shape);
+        if (entry == nullptr) {
+          // A new field is appended, moving the instance to a child shape.
+          int slot = instance->shape->indexOf(site.name);
+          Shape* transition = nullptr;
+          if (slot < 0) {
+            slot = static_cast<int>(instance->shape->size());
+            transition = instance->shape->withField(site.name);
+          }
+          site.cache.add({shape, slot, nullptr, transition});
+          entry = site.cache.find(shape);
+        }
+        if (entry->transition != nullptr) {
+          instance->shape = entry->transition;
+          instance->fields.push_back(peek(0));
+          bytesAllocated_ += sizeof(Value);
+        } else {
+          instance->fields[entry->slot] = peek(0);
+        }
+        Value value = pop();
+        pop();
+        push(value);
+        break;
+      }
+      case OP_INVOKE: {
+        PropertySite& site = READ_PROPERTY();
+        int argCount = READ_BYTE();
+        frame->ip = ip;
+        if (!invoke(site, argCount)) {
+          return InterpretResult::RuntimeError;
+        }
+        frame = &frames_[frameCount_ - 1];
+        ip = frame->ip;
+        break;
+      }
+      case OP_GET_SUPER: {
+        Symbol name = READ_PROPERTY().name;
+        ObjClass* superclass = asClass(pop());
+        frame->ip = ip;
+        if (!bindMethod(superclass, name)) {
+          return InterpretResult::RuntimeError;
+        }
+        break;
+      }
+      case OP_SUPER_INVOKE: {
+        Symbol name = READ_PROPERTY().name;
+        int argCount = READ_BYTE();
+        ObjClass* superclass = asClass(pop());
+        frame->ip = ip;
+        if (!invokeFromClass(superclass, name, argCount)) {
+          return InterpretResult::RuntimeError;
+        }
+        frame = &frames_[frameCount_ - 1];
+        ip = frame->ip;
+        break;
+      }
+    }
+  }
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef READ_PROPERTY
+#undef RUNTIME_ERROR
+#undef BINARY_OP
+}
+
+void VM::resetStack() {
+  stackTop_ = stack_.get();
+  frameCount_ = 0;
+  openUpvalues_ = nullptr;
+}
+
+void VM::runtimeError(const std::string& msg) {
+  const CallFrame& frame = frames_[frameCount_ - 1];
+  const Chunk& chunk = frame.closure->function->chunk;
+  size_t offset = frame.ip - chunk.code.data() - 1;
+  std::cerr << msg << "\n[line " << chunk.getLine(offset) << "]\n";
+  hadRuntimeError = true;
+  resetStack();
+}
+
+bool VM::callValue(Value callee, int argCount) {
+  if (callee.isObj()) {
+    switch (callee.asObj()->type) {
+      case ObjType::Closure:
+        return call(asClosure(callee), argCount);
+      case ObjType::BoundMethod: {
+        ObjBoundMethod* bound = asBoundMethod(callee);
+        stackTop_[-argCount - 1] = bound->receiver;
+        return call(bound->method, argCount);
+      }
+      case ObjType::Class: {
+        // The class stays in the receiver slot, and so reachable, until the
+        // instance replaces it.
+        ObjClass* klass = asClass(callee);
+        stackTop_[-argCount - 1] = Value::object(newInstance(klass));
+        if (klass->initializer != nullptr) {
+          return call(klass->initializer, argCount);
+        }
+        if (argCount != 0) {
+          runtimeError("Expected 0 arguments but got " +
+                       std::to_string(argCount) + "!");
+          return false;
+        }
+        return true;
+      }
+      case ObjType::Native: {
+        ObjNative* native = asNative(callee);
+        if (argCount != native->arity) {
+          runtimeError("Expected " + std::to_string(native->arity) +
+                       " arguments but got " + std::to_string(argCount) +
+                       "!");
+          return false;
+        }
+        Value result = native->function(argCount, stackTop_ - argCount);
+        stackTop_ -= argCount + 1;
+        push(result);
+        return true;
+      }
+      default:
+        break;
+    }
+  }
+  runtimeError("Can only call function and classes!");
+  return false;
+}
+
+bool VM::call(ObjClosure* closure, int argCount) {
+  if (argCount != closure->function->arity) {
+    runtimeError("Expected " + std::to_string(closure->function->arity) +
+                 " arguments but got " + std::to_string(argCount) + "!");
+    return false;
+  }
+  if (frameCount_ == kFramesMax) {
+    runtimeError("Stack overflow!");
+    return false;
+  }
+  CallFrame& frame = frames_[frameCount_++];
+  frame.closure = closure;
+  frame.ip = closure->function->chunk.code.data();
+  frame.slots = stackTop_ - argCount - 1;
+  return true;
+}
+
+bool VM::invoke(PropertySite& site, int argCount) {
+  Value receiver = peek(argCount);
+  if (!isInstance(receiver)) {
+    runtimeError("Only instances have properties!");
+    return false;
+  }
+  ObjInstance* instance = asInstance(receiver);
+  const auto* property = findProperty(instance, site);
+  if (property == nullptr) {
+    runtimeError("Undefined property '" + symbols().name(site.name) + "'!");
+    return false;
+  }
+  if (property->method != nullptr) return call(property->method, argCount);
+  // A field holding a function is called like any other value.
+  Value field = instance->fields[property->slot];
+  stackTop_[-argCount - 1] = field;
+  return callValue(field, argCount);
+}
+
+bool VM::invokeFromClass(ObjClass* klass, Symbol name, int argCount) {
+  auto method = klass->methods.find(name);
+  if (method == klass->methods.end()) {
+    runtimeError("Undefined property '" + symbols().name(name) + "'!");
+    return false;
+  }
+  return call(method->second, argCount);
+}
+
+const InlineCache<ObjClosure>::Entry* VM::findProperty(ObjInstance* instance,
+                                                       PropertySite& site) {
+  uint32_t shape = instance->shape->id();
+  if (const auto* entry = site.cache.find(shape)) return entry;
+
+  // Fields shadow methods.
+  InlineCache<ObjClosure>::Entry entry{
+      shape, instance->shape->indexOf(site.name), nullptr, nullptr};
+  if (entry.slot < 0) {
+    auto method = instance->klass->methods.find(site.name);
+    if (method == instance->klass->methods.end()) return nullptr;
+    entry.method = method->second;
+  }
+  site.cache.add(entry);
+  return site.cache.find(shape);
+}
+
+// Replaces the receiver on top of the stack with `name` bound to it.
+bool VM::bindMethod(ObjClass* klass, Symbol name) {
+  auto method = klass->methods.find(name);
+  if (method == klass->methods.end()) {
+    runtimeError("Undefined property '" + symbols().name(name) + "'!");
+    return false;
+  }
+  auto* bound = allocate<ObjBoundMethod>(0, peek(0), method->second);
+  stackTop_[-1] = Value::object(bound);
+  return true;
+}
+
+ObjUpvalue* VM::captureUpvalue(Value* local) {
+  ObjUpvalue* prevUpvalue = nullptr;
+  ObjUpvalue* upvalue = openUpvalues_;
+  while (upvalue != nullptr && upvalue->location > local) {
+    prevUpvalue = upvalue;
+    upvalue = upvalue->nextOpen;
+  }
+  if (upvalue != nullptr && upvalue->location == local) return upvalue;
+
+  ObjUpvalue* createdUpvalue = newUpvalue(local);
+  createdUpvalue->nextOpen = upvalue;
+  if (prevUpvalue == nullptr) {
+    openUpvalues_ = createdUpvalue;
+  } else {
+    prevUpvalue->nextOpen = createdUpvalue;
+  }
+  return createdUpvalue;
+}
+
+void VM::closeUpvalues(Value* last) {
+  while (openUpvalues_ != nullptr && openUpvalues_->location >= last) {
+    ObjUpvalue* upvalue = openUpvalues_;
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    openUpvalues_ = upvalue->nextOpen;
+  }
+}
+
+void VM::concatenate() {
+  // Operands stay on the stack until the result exists so a collection
+  // triggered by the allocation cannot free them.
+  const std::string& b = asString(peek(0))->chars;
+  const std::string& a = asString(peek(1))->chars;
+  ObjString* result = takeString(a + b);
+  pop();
+  pop();
+  push(Value::object(result));
+}
+
+void VM::defineNative(const std::string& name, NativeFn function, int arity) {
+  uint16_t slot = globalSlot(symbols().intern(name));
+  push(Value::object(copyString(name)));
+  ObjNative* native = allocate<ObjNative>(0, function, arity);
+  globals_[slot].value = Value::object(native);
+  globals_[slot].defined = true;
+  pop();
+}
+
+uint16_t VM::globalSlot(Symbol name) {
+  auto it = globalSlots_.find(name);
+  if (it != globalSlots_.end()) return it->second;
+  auto slot = static_cast<uint16_t>(globals_.size());
+  globals_.emplace_back();
+  globalNames_.push_back(name);
+  globalSlots_.emplace(name, slot);
+  return slot;
+}
+
+template <class T, class... Args>
+T* VM::allocate(size_t extra, Args&&... args) {
+  bytesAllocated_ += sizeof(T) + extra;
+  if (bytesAllocated_ > nextGC_ && gcPaused_ == 0) {
+    collectGarbage();
+  }
+  T* object = new T(std::forward<Args>(args)...);
+  object->next = objects_;
+  objects_ = object;
+  return object;
+}
+
+ObjString* VM::copyString(std::string_view chars) {
+  auto it = strings_.find(chars);
+  if (it != strings_.end()) return it->second;
+  return takeString(std::string{chars});
+}
+
+ObjString* VM::takeString(std::string chars) {
+  auto it = strings_.find(chars);
+  if (it != strings_.end()) return it->second;
+  size_t hash = std::hash<std::string>{}(chars);
+  size_t length = chars.size();
+  auto* string = allocate<ObjString>(length, std::move(chars), hash);
+  strings_.emplace(string->chars, string);
+  return string;
+}
+
+ObjFunction* VM::newFunction() { return allocate<ObjFunction>(0); }
+
+ObjClosure* VM::newClosure(ObjFunction* function) {
+  return allocate<ObjClosure>(
+      function->upvalueCount * sizeof(ObjUpvalue*), function);
+}
+
+ObjUpvalue* VM::newUpvalue(Value* slot) {
+  return allocate<ObjUpvalue>(0, slot);
+}
+
+ObjInstance* VM::newInstance(ObjClass* klass) {
+  return allocate<ObjInstance>(0, klass);
+}
+
+void VM::collectGarbage() {
+  for (Value* slot = stack_.get(); slot < stackTop_; ++slot) {
+    markValue(*slot);
+  }
+  for (int i = 0; i < frameCount_; ++i) {
+    markObject(frames_[i].closure);
+  }
+  for (ObjUpvalue* upvalue = openUpvalues_; upvalue != nullptr;
+       upvalue = upvalue->nextOpen) {
+    markObject(upvalue);
+  }
+  for (const Global& global : globals_) {
+    markValue(global.value);
+  }
+
+  while (!grayStack_.empty()) {
+    Obj* object = grayStack_.back();
+    grayStack_.pop_back();
+    blackenObject(object);
+  }
+
+  sweep();
+  nextGC_ = std::max<size_t>(bytesAllocated_ * 2, 1024 * 1024);
+}
+
+void VM::markValue(Value value) {
+  if (value.isObj()) markObject(value.asObj());
+}
+
+void VM::markObject(Obj* object) {
+  if (object == nullptr || object->isMarked) return;
+  object->isMarked = true;
+  grayStack_.push_back(object);
+}
+
+void VM::blackenObject(Obj* object) {
+  switch (object->type) {
+    case ObjType::Closure: {
+      auto* closure = static_cast<ObjClosure*>(object);
+      markObject(closure->function);
+      for (ObjUpvalue* upvalue : closure->upvalues) {
+        markObject(upvalue);
+      }
+      break;
+    }
+    case ObjType::Function: {
+      auto* function = static_cast<ObjFunction*>(object);
+      markObject(function->name);
+      for (Value constant : function->chunk.constants) {
+        markValue(constant);
+      }
+      break;
+    }
+    case ObjType::Upvalue:
+      markValue(static_cast<ObjUpvalue*>(object)->closed);
+      break;
+    case ObjType::Class: {
+      auto* klass = static_cast<ObjClass*>(object);
+      markObject(klass->name);
+      for (const auto& [name, method] : klass->methods) {
+        markObject(method);
+      }
+      markObject(klass->initializer);
+      break;
+    }
+    case ObjType::Instance: {
+      auto* instance = static_cast<ObjInstance*>(object);
+      markObject(instance->klass);
+      for (Value field : instance->fields) {
+        markValue(field);
+      }
+      break;
+    }
+    case ObjType::BoundMethod: {
+      auto* bound = static_cast<ObjBoundMethod*>(object);
+      markValue(bound->receiver);
+      markObject(bound->method);
+      break;
+    }
+    case ObjType::Native:
+    case ObjType::String:
+      break;
+  }
+}
+
+void VM::sweep() {
+  Obj* previous = nullptr;
+  Obj* object = objects_;
+  while (object != nullptr) {
+    if (object->isMarked) {
+      object->isMarked = false;
+      previous = object;
+      object = object->next;
+      continue;
+    }
+    Obj* unreached = object;
+    object = object->next;
+    if (previous != nullptr) {
+      previous->next = object;
+    } else {
+      objects_ = object;
+    }
+    freeObject(unreached);
+  }
+}
+
+void VM::freeObject(Obj* object) {
+  size_t extra = 0;
+  switch (object->type) {
+    case ObjType::String: {
+      auto* string = static_cast<ObjString*>(object);
+      extra = string->chars.size();
+      // The intern table is weak: drop the entry along with the string.
+      strings_.erase(string->chars);
+      break;
+    }
+    case ObjType::Closure:
+      extra = static_cast<ObjClosure*>(object)->upvalues.size() *
+              sizeof(ObjUpvalue*);
+      break;
+    case ObjType::Instance:
+      extra = static_cast<ObjInstance*>(object)->fields.size() * sizeof(Value);
+      break;
+    default:
+      break;
+  }
+  bytesAllocated_ -= std::min(bytesAllocated_, sizeofObject(object) + extra);
+  delete object;
+}
+
+}  // namespace vm
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../token/symbol.h"
+#include "object.h"
+#include "value.h"
+
+struct Stmt;
+
+namespace vm {
+
+enum class InterpretResult { Ok, CompileError, RuntimeError };
+
+class VM {
+ public:
+  VM();
+  ~VM();
+  VM(const VM&) = delete;
+  VM& operator=(const VM&) = delete;
+
+  // Compiles the parser output to bytecode and runs it. Globals persist
+  // between calls so the REPL can feed one line at a time.
+  InterpretResult interpret(
+      const std::vector<std::unique_ptr<Stmt>>& statements);
+
+  // Allocation entry points used by the compiler and the natives.
+  ObjString* copyString(std::string_view chars);
+  ObjFunction* newFunction();
+
+  // Globals are resolved to dense slots at compile time; this returns the slot
+  // for `name`, creating an undefined one on first use.
+  uint16_t globalSlot(Symbol name);
+  size_t globalCount() const { return globals_.size(); }
+  // Whether `program` is compiled in for the first time. Each module is
+  // compiled into the script at its first import only.
+  bool markImported(const void* program) {
+    return imported_.insert(program).second;
+  }
+
+ private:
+  static constexpr int kFramesMax = 1024;
+  static constexpr int kStackMax = kFramesMax * 256;
+
+  struct CallFrame {
+    ObjClosure* closure;
+    const uint8_t* ip;
+    Value* slots;
+  };
+
+  struct Global {
+    Value value;
+    bool defined{false};
+  };
+
+  InterpretResult run();
+  void resetStack();
+  void runtimeError(const std::string& msg);
+
+  void push(Value value) { *stackTop_++ = value; }
+  Value pop() { return *--stackTop_; }
+  Value peek(int distance) const { return stackTop_[-1 - distance]; }
+
+  bool callValue(Value callee, int argCount);
+  bool call(ObjClosure* closure, int argCount);
+  bool invoke(PropertySite& site, int argCount);
+  bool invokeFromClass(ObjClass* klass, Symbol name, int argCount);
+  // The field or method `site` names on `instance`, through the site's
+  // inline cache; nullptr if the instance has neither.
+  const InlineCache<ObjClosure>::Entry* findProperty(ObjInstance* instance,
+                                                     PropertySite& site);
+  bool bindMethod(ObjClass* klass, Symbol name);
+  ObjUpvalue* captureUpvalue(Value* local);
+  void closeUpvalues(Value* last);
+  void concatenate();
+  void defineNative(const std::string& name, NativeFn function, int arity);
+
+  template <class T, class... Args>
+  T* allocate(size_t extra, Args&&... args);
+  ObjClosure* newClosure(ObjFunction* function);
+  ObjUpvalue* newUpvalue(Value* slot);
+  ObjInstance* newInstance(ObjClass* klass);
+  ObjString* takeString(std::string chars);
+
+  void collectGarbage();
+  void markValue(Value value);
+  void markObject(Obj* object);
+  void blackenObject(Obj* object);
+  void sweep();
+  void freeObject(Obj* object);
+
+  std::unique_ptr<Value[]> stack_;
+  Value* stackTop_;
+  CallFrame frames_[kFramesMax];
+  int frameCount_{0};
+  ObjUpvalue* openUpvalues_{nullptr};
+
+  std::vector<Global> globals_;
+  std::vector<Symbol> globalNames_;
+  std::unordered_map<Symbol, uint16_t> globalSlots_;
+  std::unordered_map<std::string_view, ObjString*> strings_;
+  std::unordered_set<const void*> imported_;
+
+  Obj* objects_{nullptr};
+  std::vector<Obj*> grayStack_;
+  size_t bytesAllocated_{0};
+  size_t nextGC_{1024 * 1024};
+  int gcPaused_{0};
+};
+
+}  // namespace vm
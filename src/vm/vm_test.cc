@@ -0,0 +1,54 @@
+#include "vm.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../scanner/source.h"
+#include "../treewalk/parser.h"
+
+std::unique_ptr<SourceBuffer> load(std::string path) {
+  std::unique_ptr<SourceBuffer> source = SourceBuffer::fromFile(path);
+  if (source == nullptr) {
+    std::cerr << "Failed to open file " << path << ": " << std::strerror(errno)
+              << "\n";
+    std::exit(74);
+  }
+  return source;
+}
+
+std::string readFile(std::string path) {
+  return std::string{load(path)->text()};
+}
+
+std::string run(std::string path) {
+  std::unique_ptr<SourceBuffer> source = load(path);
+  Parser parser{source->text()};
+  auto statements = parser.parse();
+
+  std::ostringstream out;
+  std::streambuf* saved = std::cout.rdbuf(out.rdbuf());
+  vm::VM machine;
+  vm::InterpretResult result = machine.interpret(statements);
+  std::cout.rdbuf(saved);
+  EXPECT_EQ(result, vm::InterpretResult::Ok);
+  return out.str();
+}
+
+TEST(VMTests, Closures) {
+  EXPECT_EQ(run("./closures.lox"), readFile("./closures.lox.expected"));
+}
+
+TEST(VMTests, ControlFlow) {
+  EXPECT_EQ(run("./control-flow.lox"),
+            readFile("./control-flow.lox.expected"));
+}
+
+TEST(VMTests, Classes) {
+  EXPECT_EQ(run("./classes.lox"), readFile("./classes.lox.expected"));
+}